@@ -0,0 +1,507 @@
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/code_walker.h"
+#include "gb/cpu/jit.h"
+#include "gb/cpu/operation.h"
+#include "gb/save_state.h"
+#include "util/util.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+template <typename T>
+static void writeOptional(std::ostream &out, const std::optional<T> &value, std::string_view type);
+static void writeArgument(std::ostream &out, gb::cpu::ArgumentInfo arg);
+static void writeOpcode(std::ostream &out, const gb::cpu::CachedOpcode &opcode);
+// Writes a function running the instructions of run on JitRegisters and returns its name
+static std::string writeFunction(std::ostream &out, size_t index, const gb::cpu::CompiledRun &run);
+// Statements doing what the interpreter does for opcode, it must be one cpu::Jit compiles. leave is the statement
+// leaving the function before the instruction, not_taken the one leaving it if the condition of a branch doesn't
+// hold
+static void writeInstruction(std::ostream &out, const gb::cpu::CachedOpcode &opcode, std::string_view leave,
+                             std::string_view not_taken);
+// Statements declaring address and page, the page of the table it's in, leaving the function if it isn't in the
+// table. stack accesses two bytes starting at address, which must be in the same page
+static void writePageLookup(std::ostream &out, std::string_view address, bool write, bool stack,
+                            std::string_view leave);
+// return statement of the generated leave() helper
+static std::string getLeave(uint16_t pc, gb::cpu::JitExit exit);
+static void writeCompiledBlock(std::ostream &out, const gb::cpu::CompiledBlock &block, std::string_view function);
+// Index of the register in JitRegisters::bytes, as named in the generated code
+static std::string_view getRegisterName(gb::cpu::Registers reg);
+
+// Usage: aot_compiler <ROM> <output.cpp>
+// Decodes code reachable in the ROM and compiles every basic block cpu::Jit would compile to a C++ function.
+// Writes both as a translation unit defining gb::cpu::g_precompiled_rom, see aot_runner
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cout << "usage: " << argv[0] << " <ROM> <output.cpp>" << std::endl;
+        return 2;
+    }
+
+    std::filesystem::path rom_path = argv[1];
+    std::vector<uint8_t> rom = readFile(rom_path);
+    if (rom.empty()) {
+        std::cout << "failed to read " << rom_path << std::endl;
+        return 2;
+    }
+
+    std::vector<gb::cpu::CodeBlock> blocks = gb::cpu::findReachableCode(rom);
+    std::ofstream out(argv[2]);
+    if (!out.is_open()) {
+        std::cout << "failed to open " << argv[2] << std::endl;
+        return 2;
+    }
+
+    out << "// Generated by aot_compiler from " << rom_path.filename().string() << ", don't edit\n"
+        << "#include \"gb/cpu/block_cache.h\"\n"
+        << "#include \"gb/cpu/jit.h\"\n"
+        << "#include \"gb/cpu/operation.h\"\n"
+        << "#include \"gb/memory/basic_components.h\"\n\n"
+        << "#include <cstddef>\n"
+        << "#include <cstdint>\n"
+        << "#include <optional>\n\n"
+        << "namespace {\n"
+        << "    using namespace gb;\n"
+        << "    using namespace gb::cpu;\n\n"
+        << "    // indices in JitRegisters::bytes\n"
+        << "    enum : size_t { F, A, C, B, E, D, L, H };\n\n"
+        << "    // memory behind address, nullptr if the interpreter has to access it\n"
+        << "    [[maybe_unused]] const uint8_t *readPage(const JitRegisters *registers, uint16_t address) {\n"
+        << "        return registers->pages->read[address / g_memory_page_size];\n"
+        << "    }\n"
+        << "    [[maybe_unused]] uint8_t *writePage(const JitRegisters *registers, uint16_t address) {\n"
+        << "        return registers->pages->write[address / g_memory_page_size];\n"
+        << "    }\n"
+        << "    // the two bytes a push writes or a pop reads at address are in different pages\n"
+        << "    [[maybe_unused]] bool crossesPage(uint16_t address) {\n"
+        << "        return address % g_memory_page_size == g_memory_page_size - 1;\n"
+        << "    }\n"
+        << "    // the interpreter continues at pc\n"
+        << "    [[maybe_unused]] JitExit leave(JitRegisters *registers, uint16_t pc, uint16_t cycles, uint16_t "
+           "instructions) {\n"
+        << "        registers->pc = pc;\n"
+        << "        return {.cycles = cycles, .instructions = instructions};\n"
+        << "    }\n\n";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        out << "    // bank " << (blocks[i].key >> 16) << ", address 0x" << std::hex << (blocks[i].key & 0xffff)
+            << std::dec << "\n    const CachedOpcode g_block_" << i << "[] = {\n";
+        for (const gb::cpu::CachedOpcode &opcode : blocks[i].opcodes) {
+            out << "        ";
+            writeOpcode(out, opcode);
+            out << ",\n";
+        }
+        out << "    };\n";
+    }
+    out << "\n    const PrecompiledBlock g_blocks[] = {\n";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        out << "        {" << blocks[i].key << "u, g_block_" << i << "},\n";
+    }
+    out << "    };\n";
+
+    // every run is compiled once, where it starts in the middle of a block it's also the start of another one
+    std::set<uint32_t> compiled;
+    std::vector<std::pair<uint32_t, gb::cpu::CompiledRun>> runs;
+    for (const gb::cpu::CodeBlock &block : blocks) {
+        uint16_t bank = uint16_t(block.key >> 16);
+        gb::cpu::CodeReader read = [&rom, bank](uint16_t address) { return gb::cpu::readROM(rom, bank, address); };
+        for (size_t i = 0; i < block.opcodes.size(); ++i) {
+            uint32_t key = (uint32_t(bank) << 16) | block.opcodes[i].address;
+            if (!compiled.insert(key).second) {
+                continue;
+            }
+            gb::cpu::CompiledRun run = gb::cpu::getCompiledRun(block.opcodes[i].address, read);
+            if (!run.opcodes.empty()) {
+                i += run.opcodes.size() - 1;
+                runs.emplace_back(key, std::move(run));
+            }
+        }
+    }
+    std::vector<std::string> functions;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        out << "\n    // bank " << (runs[i].first >> 16) << ", address 0x" << std::hex << (runs[i].first & 0xffff)
+            << std::dec << "\n";
+        functions.push_back(writeFunction(out, i, runs[i].second));
+    }
+    out << "\n    const PrecompiledFunction g_functions[] = {\n";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        out << "        {.key = " << runs[i].first << "u, .block = ";
+        writeCompiledBlock(out, runs[i].second.block, functions[i]);
+        out << "},\n";
+    }
+    out << "    };\n"
+        << "} // namespace\n\n"
+        << "namespace gb::cpu {\n"
+        << "    extern const PrecompiledROM g_precompiled_rom{\n"
+        << "        .rom_hash = " << gb::hashBytes(rom) << "ull, .blocks = g_blocks, .functions = g_functions};\n"
+        << "} // namespace gb::cpu\n";
+
+    if (!out) {
+        std::cout << "failed to write " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << blocks.size() << " blocks and " << runs.size() << " compiled runs written to " << argv[2]
+              << std::endl;
+    return 0;
+}
+
+template <typename T>
+static void writeOptional(std::ostream &out, const std::optional<T> &value, std::string_view type) {
+    if (value) {
+        out << type << '(' << unsigned(*value) << ')';
+    } else {
+        out << "std::nullopt";
+    }
+}
+
+static void writeArgument(std::ostream &out, gb::cpu::ArgumentInfo arg) {
+    out << "{ArgumentSource(" << unsigned(arg.src) << "), Registers(" << unsigned(arg.reg) << ")}";
+}
+
+static void writeOpcode(std::ostream &out, const gb::cpu::CachedOpcode &opcode) {
+    const gb::cpu::DecodedInstruction &instr = opcode.decoded;
+    out << "{.decoded = {.reset_vector = ";
+    writeOptional(out, instr.reset_vector, "uint16_t");
+    out << ", .ld_subtype = ";
+    writeOptional(out, instr.ld_subtype, "LoadSubtype");
+    out << ", .condition = ";
+    writeOptional(out, instr.condition, "Conditions");
+    out << ", .src = ";
+    writeArgument(out, instr.src);
+    out << ", .dst = ";
+    writeArgument(out, instr.dst);
+    out << ", .type = InstructionType(" << unsigned(instr.type) << "), .bit = ";
+    writeOptional(out, instr.bit, "uint8_t");
+
+    const gb::cpu::IrOp &ir = opcode.ir;
+    out << "}, .ir = {.flags_read = " << unsigned(ir.flags_read) << ", .flags_written = " << unsigned(ir.flags_written)
+        << ", .flags_live = " << unsigned(ir.flags_live) << ", .constant_size = " << unsigned(ir.constant_size)
+        << ", .constant = " << ir.constant << "}, .address = " << opcode.address
+        << ", .code = " << unsigned(opcode.code) << ", .prefixed = " << std::boolalpha << opcode.prefixed
+        << std::noboolalpha << '}';
+}
+
+static std::string writeFunction(std::ostream &out, size_t index, const gb::cpu::CompiledRun &run) {
+    std::string name = "runBlock" + std::to_string(index);
+    const gb::cpu::CompiledBlock &block = run.block;
+    const gb::cpu::CachedOpcode &last = run.opcodes.back();
+    uint16_t last_start = uint16_t(block.cycles - gb::cpu::getCompiledCycles(last, true));
+    gb::cpu::JitExit not_taken_exit{.cycles = uint16_t(last_start + gb::cpu::getCompiledCycles(last, false)),
+                                    .instructions = block.instructions};
+    std::string not_taken = getLeave(block.end, not_taken_exit);
+
+    std::ostringstream body;
+    gb::cpu::JitExit before;
+    for (const gb::cpu::CachedOpcode &opcode : run.opcodes) {
+        body << "        // 0x" << std::hex << opcode.address << std::dec << ' '
+             << gb::cpu::to_string(opcode.decoded.type) << "\n";
+        writeInstruction(body, opcode, getLeave(opcode.address, before), not_taken);
+        before.cycles = uint16_t(before.cycles + gb::cpu::getCompiledCycles(opcode, true));
+        ++before.instructions;
+    }
+    // a branch sets PC itself
+    if (!gb::cpu::isBranch(last.decoded)) {
+        body << "        registers->pc = " << block.end << ";\n";
+    }
+    out << "    JitExit " << name << "(JitRegisters *registers) {\n";
+    // runs of NOPs and SP updates don't touch the 8-bit registers
+    if (body.str().find("r[") != std::string::npos) {
+        out << "        uint8_t *r = registers->bytes.data();\n";
+    }
+    out << body.str() << "        return {.cycles = " << block.cycles << ", .instructions = " << block.instructions
+        << "};\n"
+        << "    }\n";
+    return name;
+}
+
+static void writeInstruction(std::ostream &out, const gb::cpu::CachedOpcode &opcode, std::string_view leave,
+                             std::string_view not_taken) {
+    using namespace gb::cpu;
+    using enum InstructionType;
+    const DecodedInstruction &instr = opcode.decoded;
+    bool flags_live = (opcode.ir.flags_written & opcode.ir.flags_live) != 0;
+    auto low = [](Registers reg) {
+        return getRegisterName(Registers(uint8_t(reg) & uint8_t(Registers::LOW_REG_MASK)));
+    };
+    auto high = [](Registers reg) {
+        return getRegisterName(Registers((uint8_t(reg) & uint8_t(Registers::HIGH_REG_MASK)) >> 4));
+    };
+    auto pair = [&low, &high](Registers reg) {
+        return "uint16_t((r[" + std::string(high(reg)) + "] << 8) | r[" + std::string(low(reg)) + "])";
+    };
+    const std::string memory = "page[address % g_memory_page_size]";
+    // the byte operand of loads and ALU instructions
+    std::string source = "r[" + std::string(getRegisterName(instr.src.reg)) + "]";
+    if (instr.src.src == ArgumentSource::IMMEDIATE_U8) {
+        source = std::to_string(opcode.ir.constant & 0xff);
+    } else if (instr.src.src == ArgumentSource::INDIRECT) {
+        source = memory;
+    }
+
+    const std::string_view indent = "        ";
+    // INC or DEC of target, flags are computed from its old value. C is kept
+    auto writeIncrement = [&](std::string_view target, std::string_view inner) {
+        char op = instr.type == INC ? '+' : '-';
+        out << inner << "unsigned value = " << target << ";\n"
+            << inner << target << " = uint8_t(value " << op << " 1);\n";
+        if (flags_live) {
+            out << inner << "r[F] = uint8_t((r[F] & 0x10) | (" << target << " == 0 ? 0x80 : 0) | "
+                << (instr.type == INC ? "((value & 0x0f) == 0x0f ? 0x20 : 0));\n"
+                                      : "0x40 | ((value & 0x0f) == 0 ? 0x20 : 0));\n");
+        }
+    };
+    // the condition of a conditional branch, leaving the function if it doesn't hold
+    auto writeCondition = [&]() {
+        if (!instr.condition) {
+            return;
+        }
+        std::string_view test;
+        switch (*instr.condition) {
+        case Conditions::NOT_ZERO: test = "(r[F] & 0x80) != 0"; break;
+        case Conditions::ZERO: test = "(r[F] & 0x80) == 0"; break;
+        case Conditions::NOT_CARRY: test = "(r[F] & 0x10) != 0"; break;
+        case Conditions::CARRY: test = "(r[F] & 0x10) == 0"; break;
+        }
+        out << indent << "if (" << test << ") {\n" << indent << "    " << not_taken << "\n" << indent << "}\n";
+    };
+    // pushes value, a 16-bit expression
+    auto writePush = [&](std::string_view value) {
+        out << indent << "{\n";
+        writePageLookup(out, "uint16_t(registers->sp - 2)", true, true, leave);
+        out << indent << "    " << memory << " = uint8_t(" << value << ");\n"
+            << indent << "    page[address % g_memory_page_size + 1] = uint8_t(" << value << " >> 8);\n"
+            << indent << "    registers->sp = address;\n"
+            << indent << "}\n";
+    };
+
+    using src = ArgumentSource;
+    switch (instr.type) {
+    case LD: {
+        if (instr.dst.reg == Registers::SP) {
+            out << indent << "registers->sp = " << opcode.ir.constant << ";\n";
+            break;
+        }
+        if (instr.dst.src == src::DOUBLE_REGISTER) {
+            out << indent << "r[" << low(instr.dst.reg) << "] = " << (opcode.ir.constant & 0xff) << ";\n"
+                << indent << "r[" << high(instr.dst.reg) << "] = " << (opcode.ir.constant >> 8) << ";\n";
+            break;
+        }
+        if (instr.dst.src == src::REGISTER && instr.src.src != src::INDIRECT &&
+            instr.src.src != src::IMMEDIATE_U16) {
+            out << indent << "r[" << getRegisterName(instr.dst.reg) << "] = " << source << ";\n";
+            break;
+        }
+        // one side in memory: (rr), (HL+), (HL-) or (nn)
+        bool to_memory = instr.dst.src != src::REGISTER;
+        ArgumentInfo side = to_memory ? instr.dst : instr.src;
+        std::string address = side.src == src::INDIRECT ? pair(side.reg) : std::to_string(opcode.ir.constant);
+        out << indent << "{\n";
+        writePageLookup(out, address, to_memory, false, leave);
+        if (to_memory) {
+            std::string value = instr.src.src == src::IMMEDIATE_U8
+                                    ? std::to_string(opcode.ir.constant & 0xff)
+                                    : "r[" + std::string(getRegisterName(instr.src.reg)) + "]";
+            out << indent << "    " << memory << " = " << value << ";\n";
+        } else {
+            out << indent << "    r[" << getRegisterName(instr.dst.reg) << "] = " << memory << ";\n";
+        }
+        if (instr.ld_subtype == LoadSubtype::LD_INC || instr.ld_subtype == LoadSubtype::LD_DEC) {
+            char op = instr.ld_subtype == LoadSubtype::LD_INC ? '+' : '-';
+            out << indent << "    uint16_t hl = uint16_t(address " << op << " 1);\n"
+                << indent << "    r[L] = uint8_t(hl);\n"
+                << indent << "    r[H] = uint8_t(hl >> 8);\n";
+        }
+        out << indent << "}\n";
+        break;
+    }
+    case INC:
+    case DEC: {
+        char op = instr.type == INC ? '+' : '-';
+        if (instr.src.reg == Registers::SP) {
+            out << indent << "registers->sp = uint16_t(registers->sp " << op << " 1);\n";
+        } else if (instr.src.src == src::DOUBLE_REGISTER) {
+            out << indent << "{\n"
+                << indent << "    unsigned value = ((r[" << high(instr.src.reg) << "] << 8) | r[" << low(instr.src.reg)
+                << "]) " << op << " 1;\n"
+                << indent << "    r[" << low(instr.src.reg) << "] = uint8_t(value);\n"
+                << indent << "    r[" << high(instr.src.reg) << "] = uint8_t(value >> 8);\n"
+                << indent << "}\n";
+        } else if (instr.src.src == src::INDIRECT) {
+            out << indent << "{\n";
+            writePageLookup(out, pair(Registers::HL), true, false, leave);
+            writeIncrement(memory, "            ");
+            out << indent << "}\n";
+        } else {
+            out << indent << "{\n";
+            writeIncrement("r[" + std::string(getRegisterName(instr.src.reg)) + "]", "            ");
+            out << indent << "}\n";
+        }
+        break;
+    }
+    case ADD:
+        if (instr.dst.reg == Registers::HL) {
+            out << indent << "{\n"
+                << indent << "    unsigned lhs = (r[H] << 8) | r[L];\n"
+                << indent << "    unsigned rhs = (r[" << high(instr.src.reg) << "] << 8) | r[" << low(instr.src.reg)
+                << "];\n"
+                << indent << "    unsigned result = lhs + rhs;\n"
+                << indent << "    r[L] = uint8_t(result);\n"
+                << indent << "    r[H] = uint8_t(result >> 8);\n";
+            if (flags_live) {
+                // Z is kept
+                out << indent
+                    << "    r[F] = uint8_t((r[F] & 0x80) | ((lhs & 0x0fff) + (rhs & 0x0fff) > 0x0fff ? 0x20 : 0) | "
+                       "(result > 0xffff ? 0x10 : 0));\n";
+            }
+            out << indent << "}\n";
+            break;
+        }
+        [[fallthrough]];
+    case ADC:
+    case SUB:
+    case SBC:
+    case AND:
+    case OR:
+    case XOR:
+    case CP: {
+        // CP only writes flags
+        if (instr.type == CP && !flags_live) {
+            break;
+        }
+        bool carry = instr.type == ADC || instr.type == SBC;
+        bool adds = instr.type == ADD || instr.type == ADC;
+        bool subtracts = instr.type == SUB || instr.type == SBC || instr.type == CP;
+        out << indent << "{\n";
+        if (instr.src.src == src::INDIRECT) {
+            writePageLookup(out, pair(Registers::HL), false, false, leave);
+        }
+        out << indent << "    unsigned lhs = r[A];\n"
+            << indent << "    unsigned rhs = " << source << ";\n";
+        if (carry) {
+            out << indent << "    unsigned carry = (r[F] >> 4) & 1;\n";
+        }
+        std::string_view with_carry = carry ? " + carry" : "";
+        out << indent << "    unsigned result = ";
+        if (adds) {
+            out << "lhs + rhs" << with_carry << ";\n";
+        } else if (subtracts) {
+            out << "lhs - rhs" << (carry ? " - carry" : "") << ";\n";
+        } else {
+            out << "lhs " << (instr.type == AND ? '&' : instr.type == OR ? '|' : '^') << " rhs;\n";
+        }
+        if (instr.type != CP) {
+            out << indent << "    r[A] = uint8_t(result);\n";
+        }
+        if (flags_live) {
+            out << indent << "    r[F] = uint8_t((uint8_t(result) == 0 ? 0x80 : 0)";
+            if (adds) {
+                out << " | ((lhs & 0x0f) + (rhs & 0x0f)" << with_carry
+                    << " > 0x0f ? 0x20 : 0) | (result > 0xff ? 0x10 : 0)";
+            } else if (subtracts) {
+                out << " | 0x40 | ((lhs & 0x0f) < (rhs & 0x0f)" << with_carry << " ? 0x20 : 0) | (lhs < rhs"
+                    << with_carry << " ? 0x10 : 0)";
+            } else if (instr.type == AND) {
+                out << " | 0x20";
+            }
+            out << ");\n";
+        }
+        out << indent << "}\n";
+        break;
+    }
+    case CPL:
+        out << indent << "r[A] = uint8_t(~r[A]);\n";
+        if (flags_live) {
+            out << indent << "r[F] = uint8_t(r[F] | 0x60);\n";
+        }
+        break;
+    case SCF:
+        if (flags_live) {
+            out << indent << "r[F] = uint8_t((r[F] & 0x80) | 0x10);\n";
+        }
+        break;
+    case CCF:
+        if (flags_live) {
+            out << indent << "r[F] = uint8_t((r[F] & 0x90) ^ 0x10);\n";
+        }
+        break;
+    case PUSH: writePush(pair(instr.src.reg)); break;
+    case POP:
+        out << indent << "{\n";
+        writePageLookup(out, "registers->sp", false, true, leave);
+        out << indent << "    r[" << low(instr.dst.reg) << "] = " << memory << ";\n"
+            << indent << "    r[" << high(instr.dst.reg) << "] = page[address % g_memory_page_size + 1];\n";
+        if (instr.dst.reg == Registers::AF) {
+            // the low bits of F always read as 0
+            out << indent << "    r[F] = uint8_t(r[F] & 0xf0);\n";
+        }
+        out << indent << "    registers->sp = uint16_t(address + 2);\n" << indent << "}\n";
+        break;
+    case JP:
+        if (instr.src.src == src::DOUBLE_REGISTER) {
+            // JP HL, the interpreter takes over if nothing is compiled at HL
+            out << indent << "registers->pc = " << pair(Registers::HL) << ";\n";
+            break;
+        }
+        [[fallthrough]];
+    case JR:
+        writeCondition();
+        out << indent << "registers->pc = " << *getBranchTarget(opcode) << ";\n";
+        break;
+    case CALL:
+    case RST: {
+        writeCondition();
+        uint16_t return_address = uint16_t(opcode.address + (instr.type == CALL ? 3 : 1));
+        writePush(std::to_string(return_address));
+        out << indent << "registers->pc = " << *getBranchTarget(opcode) << ";\n";
+        break;
+    }
+    case RET:
+        writeCondition();
+        out << indent << "{\n";
+        writePageLookup(out, "registers->sp", false, true, leave);
+        out << indent << "    registers->pc = uint16_t(" << memory
+            << " | (page[address % g_memory_page_size + 1] << 8));\n"
+            << indent << "    registers->sp = uint16_t(address + 2);\n"
+            << indent << "}\n";
+        break;
+    default: break;
+    }
+}
+
+static void writePageLookup(std::ostream &out, std::string_view address, bool write, bool stack,
+                            std::string_view leave) {
+    const std::string_view indent = "            ";
+    out << indent << "uint16_t address = " << address << ";\n"
+        << indent << (write ? "uint8_t *page = " : "const uint8_t *page = ");
+    if (stack) {
+        out << "crossesPage(address) ? nullptr : ";
+    }
+    out << (write ? "writePage" : "readPage") << "(registers, address);\n"
+        << indent << "if (!page) {\n"
+        << indent << "    " << leave << "\n"
+        << indent << "}\n";
+}
+
+static std::string getLeave(uint16_t pc, gb::cpu::JitExit exit) {
+    return "return leave(registers, " + std::to_string(pc) + ", " + std::to_string(exit.cycles) + ", " +
+           std::to_string(exit.instructions) + ");";
+}
+
+static void writeCompiledBlock(std::ostream &out, const gb::cpu::CompiledBlock &block, std::string_view function) {
+    out << "{.function = " << function << ", .end = " << block.end << ", .cycles = " << block.cycles
+        << ", .instructions = " << block.instructions << ", .dead_flag_writes = " << block.dead_flag_writes << '}';
+}
+
+static std::string_view getRegisterName(gb::cpu::Registers reg) {
+    constexpr std::string_view names[] = {"F", "A", "C", "B", "E", "D", "L", "H"};
+    return names[uint8_t(reg) & 7];
+}
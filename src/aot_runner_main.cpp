@@ -0,0 +1,67 @@
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/jit.h"
+#include "gb/emulator.h"
+#include "gb/fault.h"
+#include "gb/save_state.h"
+#include "util/util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace gb::cpu {
+    // defined in the translation unit generated by aot_compiler
+    extern const PrecompiledROM g_precompiled_rom;
+}
+
+// Usage: aot_runner <ROM> [frames]
+// Runs the ROM aot_runner was built for headless, with its code decoded and compiled to C++ at build time. Prints
+// the hash of the final state, which is the same as without precompiled code
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        std::cout << "usage: " << argv[0] << " <ROM> [frames]" << std::endl;
+        return 2;
+    }
+    uint64_t frames = argc == 3 ? std::stoull(argv[2]) : 3600;
+
+    std::vector<uint8_t> rom = readFile(argv[1]);
+    if (gb::hashBytes(rom) != gb::cpu::g_precompiled_rom.rom_hash) {
+        std::cout << argv[1] << " is not the ROM aot_runner was built for" << std::endl;
+        return 2;
+    }
+
+    gb::HeadlessEmulator emulator;
+    if (!emulator.getCartridge().setROM(std::move(rom))) {
+        std::cout << "failed to load " << argv[1] << std::endl;
+        return 2;
+    }
+    emulator.getCPU().getBlockCache().setPrecompiled(gb::cpu::g_precompiled_rom.blocks);
+    emulator.getCPU().getJit().setPrecompiled(gb::cpu::g_precompiled_rom.functions);
+    emulator.reset();
+    emulator.start();
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < frames && !emulator.terminated(); ++i) {
+        if (emulator.runFrame() == gb::StopReason::FAULT) {
+            std::cout << "emulation failed: " << gb::getFaultName(emulator.getFault().fault) << " at 0x" << std::hex
+                      << emulator.getFault().address << std::dec << " in frame " << i << std::endl;
+            return 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const gb::cpu::BlockCacheStats &stats = emulator.getCPU().getBlockCache().getStats();
+    const gb::cpu::JitStats &jit_stats = emulator.getJitStats();
+    std::vector<uint8_t> state;
+    emulator.saveState(state);
+    std::cout << frames << " frames in " << seconds << " s, " << stats.blocks_built
+              << " blocks decoded at run time, " << gb::cpu::g_precompiled_rom.blocks.size() << " precompiled\n"
+              << jit_stats.instructions_run << " instructions in " << jit_stats.blocks_run << " compiled blocks, "
+              << jit_stats.blocks_compiled << " compiled at run time, "
+              << gb::cpu::g_precompiled_rom.functions.size() << " precompiled\n"
+              << "state hash " << gb::hashBytes(state) << std::endl;
+    return 0;
+}
@@ -2,11 +2,13 @@
 #include "breakpoint.h"
 #include "disassembler.h"
 #include "gb/address_bus.h"
+#include "gb/condition.h"
 #include "gb/cpu/cpu.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/decoder.h"
 #include "gb/cpu/operation.h"
 #include "gb/emulator.h"
+#include "gb/fault.h"
 #include "gb/memory/basic_components.h"
 #include "gb/ppu/ppu.h"
 #include "gb/timer.h"
@@ -31,9 +33,21 @@
 #include <ios>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 namespace emulator {
+    constexpr std::array g_joypad_bindings = {
+        std::pair{ImGuiKey_Z, gb::Button::A},
+        std::pair{ImGuiKey_X, gb::Button::B},
+        std::pair{ImGuiKey_RightShift, gb::Button::SELECT},
+        std::pair{ImGuiKey_Enter, gb::Button::START},
+        std::pair{ImGuiKey_UpArrow, gb::Button::UP},
+        std::pair{ImGuiKey_DownArrow, gb::Button::DOWN},
+        std::pair{ImGuiKey_LeftArrow, gb::Button::LEFT},
+        std::pair{ImGuiKey_RightArrow, gb::Button::RIGHT},
+    };
+
     void Application::draw() {
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -71,7 +85,6 @@ namespace emulator {
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwSwapBuffers(window_);
-        glfwPollEvents();
     }
 
     void Application::drawMainMenu() {
@@ -126,8 +139,55 @@ namespace emulator {
             }
 
             if (ImGui::Selectable("Reset")) {
+                stopMovie();
                 recent_instructions_.clear();
                 emulator_.reset();
+                rewind_.clear();
+            }
+
+            if (ImGui::BeginMenu("Movie", emulator_.getCartridge().hasROM())) {
+                bool active = movie_recorder_ || movie_player_;
+                if (ImGui::MenuItem("Record from reset", nullptr, false, !active)) {
+                    startRecording(gb::MovieStart::RESET);
+                }
+                if (ImGui::MenuItem("Record from current state", nullptr, false, !active)) {
+                    startRecording(gb::MovieStart::STATE);
+                }
+                if (ImGui::MenuItem("Play", nullptr, false, !active)) {
+                    startPlayback();
+                }
+                if (ImGui::MenuItem("Stop", nullptr, false, active)) {
+                    stopMovie();
+                }
+
+                ImGui::Separator();
+                ImGui::TextUnformatted("Keyframe every:");
+                for (int interval : g_movie_keyframe_intervals) {
+                    StaticStringBuffer<sizeof("100000 frames")> label;
+                    if (interval == 0) {
+                        std::snprintf(label.data(), label.capacityWithNullChar(), "Never");
+                    } else {
+                        std::snprintf(label.data(), label.capacityWithNullChar(), "%d frames", interval);
+                    }
+                    if (ImGui::Selectable(label.data(), movie_keyframe_interval_ == uint64_t(interval))) {
+                        movie_keyframe_interval_ = uint64_t(interval);
+                    }
+                }
+
+                if (movie_player_) {
+                    ImGui::Separator();
+                    ImGui::InputScalar("Frame", ImGuiDataType_U64, &movie_seek_frame_);
+                    if (ImGui::Button("Seek")) {
+                        try {
+                            movie_player_->seek(emulator_, movie_seek_frame_);
+                        } catch (const std::exception &e) {
+                            std::cout << "failed to seek: " << e.what() << std::endl;
+                        }
+                        rewind_.clear();
+                        recent_instructions_.clear();
+                    }
+                }
+                ImGui::EndMenu();
             }
 
             if (ImGui::Selectable("Quit")) {
@@ -137,6 +197,71 @@ namespace emulator {
             ImGui::EndMenu();
         }
 
+        if (ImGui::BeginMenu("Speed")) {
+            for (double speed : g_speed_multipliers) {
+                StaticStringBuffer<sizeof("100.00x")> label;
+                std::snprintf(label.data(), label.capacityWithNullChar(), "%.2fx", speed);
+                if (ImGui::Selectable(label.data(), frame_limiter_.getSpeed() == speed)) {
+                    frame_limiter_.setSpeed(speed);
+                }
+            }
+
+            ImGui::Separator();
+            if (ImGui::MenuItem("Turbo", "Tab", turbo_)) {
+                turbo_ = !turbo_;
+                frame_limiter_.reset();
+            }
+            if (ImGui::MenuItem("Skip idle loops", nullptr, emulator_.isIdleLoopSkipping())) {
+                emulator_.setIdleLoopSkipping(!emulator_.isIdleLoopSkipping());
+            }
+            gb::cpu::BlockCache &block_cache = emulator_.getCPU().getBlockCache();
+            if (ImGui::MenuItem("Cache decoded blocks", nullptr, block_cache.isEnabled())) {
+                block_cache.setEnabled(!block_cache.isEnabled());
+            }
+
+            if (ImGui::BeginMenu("Run-ahead")) {
+                if (ImGui::Selectable("Off", run_ahead_frames_ == 0)) {
+                    run_ahead_frames_ = 0;
+                }
+                for (int frames = 1; frames <= g_max_run_ahead_frames; ++frames) {
+                    StaticStringBuffer<sizeof("10 frames")> label;
+                    std::snprintf(label.data(), label.capacityWithNullChar(), "%d frame%s", frames,
+                                  frames == 1 ? "" : "s");
+                    if (ImGui::Selectable(label.data(), run_ahead_frames_ == frames)) {
+                        run_ahead_frames_ = frames;
+                        run_ahead_time_ = 0;
+                    }
+                }
+                ImGui::EndMenu();
+            }
+
+            ImGui::EndMenu();
+        }
+
+        if (ImGui::BeginMenu("Rewind")) {
+            ImGui::TextUnformatted("Memory budget:");
+            for (int budget : g_rewind_budgets_mb) {
+                StaticStringBuffer<sizeof("1000 MB")> label;
+                std::snprintf(label.data(), label.capacityWithNullChar(), "%d MB", budget);
+                size_t bytes = size_t(budget) * 1024 * 1024;
+                if (ImGui::Selectable(label.data(), rewind_.getMemoryBudget() == bytes)) {
+                    rewind_.setMemoryBudget(bytes);
+                }
+            }
+
+            ImGui::Separator();
+            ImGui::TextUnformatted("Snapshot every:");
+            for (int interval : g_rewind_intervals) {
+                StaticStringBuffer<sizeof("100 frames")> label;
+                std::snprintf(label.data(), label.capacityWithNullChar(), "%d frames", interval);
+                if (ImGui::Selectable(label.data(), rewind_.getCaptureInterval() == uint32_t(interval))) {
+                    rewind_.setCaptureInterval(uint32_t(interval));
+                }
+            }
+
+            ImGui::EndMenu();
+        }
+
         ImGui::EndMenuBar();
     }
 
@@ -147,14 +272,13 @@ namespace emulator {
             buffer_.clear();
             printInstruction(buffer_, recent_instructions_[i], i);
             if (ImGui::Selectable(buffer_.data())) {
-                registers_to_print_ = std::pair<gb::cpu::RegisterFile, bool>{recent_instructions_[i].registers,
-                                                                             recent_instructions_[i].ime};
+                registers_to_print_ = recent_instructions_[i];
             }
         }
 
         if (registers_to_print_) {
             ImGui::NewLine();
-            auto [regs, ime] = *registers_to_print_;
+            gb::cpu::RegisterFile regs = gb::cpu::getRegisters(*registers_to_print_);
             buffer_.clear();
             buffer_.reserve(g_registers_buffer_size);
             buffer_.putString("Carry: ")
@@ -187,12 +311,10 @@ namespace emulator {
                 .putU8(regs.l())
                 .putString(", HL: ")
                 .putU16(regs.hl())
-                .putString("\nSP: ")
-                .putU16(regs.sp)
-                .putString(", PC: ")
+                .putString("\nPC: ")
                 .putU16(regs.pc())
                 .putString("\nIME: ")
-                .putBool(ime);
+                .putBool(registers_to_print_->ime());
             buffer_.finish();
             ImGui::TextUnformatted(buffer_.data(), buffer_.data() + buffer_.size());
         }
@@ -202,11 +324,14 @@ namespace emulator {
         ImGui::TextUnformatted("Fast forward (in number of instructions):");
         if (ImGui::InputScalar("##run_instr", ImGuiDataType_U64, &instr, nullptr, nullptr, "%d",
                                ImGuiInputTextFlags_EnterReturnsTrue)) {
-            for (uint64_t i = 0; i < instr; ++i) {
-                update();
-                while (!emulator_.terminated() && !emulator_.getCPU().isFinished()) {
-                    update();
-                }
+            // instructions are run by the main loop a slice at a time so the UI stays responsive
+            fast_forward_instructions_ = instr;
+        }
+        if (fast_forward_instructions_ != 0) {
+            ImGui::Text("Fast forwarding, %llu instructions left", (unsigned long long)fast_forward_instructions_);
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) {
+                fast_forward_instructions_ = 0;
             }
         }
 
@@ -252,7 +377,7 @@ namespace emulator {
                 disasm_buffer_.putString("    ");
                 printInstruction(disasm_buffer_, instr.second);
                 disasm_buffer_.put('\n');
-                next_addr = InstructionAddress{uint16_t(instr.first.address + instr.second.width), instr.first.bank};
+                next_addr = InstructionAddress{uint16_t(instr.first.address + instr.second.width()), instr.first.bank};
                 last_address = instr.first;
             }
             disassembly_line_count_ += offset;
@@ -312,15 +437,31 @@ namespace emulator {
         ImGui::TextUnformatted("Add PC breakpoint:");
         if (ImGui::InputScalar("##Add PC breakpoint input", ImGuiDataType_U16, &pc_break, nullptr, nullptr, "%.4x",
                                ImGuiInputTextFlags_CharsHexadecimal | ImGuiInputTextFlags_EnterReturnsTrue)) {
-            addPCBreakpoint(pc_break);
+            std::optional<uint16_t> bank;
+            if (pc_breakpoint_bank_ >= 0) {
+                bank = uint16_t(pc_breakpoint_bank_);
+            }
+            std::optional<gb::BreakpointCondition> condition;
+            if (compileCondition(pc_breakpoint_condition_, condition)) {
+                addPCBreakpoint(gb::PCBreakpoint{.address = pc_break, .bank = bank, .condition = std::move(condition)});
+                pc_breakpoint_condition_.clear();
+            }
         }
+        ImGui::InputInt("Bank (-1 for any)##PC breakpoint bank", &pc_breakpoint_bank_);
+        ImGui::InputText("Condition##PC breakpoint condition", &pc_breakpoint_condition_);
         {
             ImGui::Text("PC breakpoints: ");
-            std::optional<uint16_t> delete_br;
-            for (uint16_t br : pc_breakpoints_) {
+            std::optional<gb::PCBreakpoint> delete_br;
+            for (const gb::PCBreakpoint &br : pc_breakpoints_.getBreakpoints()) {
                 buffer_.clear();
-                buffer_.reserve(6);
-                buffer_.putString("0x").putU16(br);
+                buffer_.reserve(sizeof("0xffff, bank 0xffff"));
+                buffer_.putString("0x").putU16(br.address);
+                if (br.bank) {
+                    buffer_.putString(", bank 0x").putU16(*br.bank);
+                }
+                if (br.condition) {
+                    buffer_.putString(", if ").putString(br.condition->getExpression());
+                }
                 buffer_.finish();
                 ImGui::Selectable(buffer_.data());
                 if (ImGui::IsItemHovered() && ImGui::IsKeyPressed(ImGuiKey_Backspace)) {
@@ -328,7 +469,7 @@ namespace emulator {
                 }
             }
             if (delete_br) {
-                pc_breakpoints_.erase(*delete_br);
+                pc_breakpoints_.remove(*delete_br);
             }
         }
 
@@ -343,10 +484,18 @@ namespace emulator {
                 memory_breakpoint_data_.break_on = MemoryBreakpointData::BreakOn::READ;
             } else if (ImGui::Selectable(to_string(MemoryBreakpointData::BreakOn::WRITE).data())) {
                 memory_breakpoint_data_.break_on = MemoryBreakpointData::BreakOn::WRITE;
+            } else if (ImGui::Selectable(to_string(MemoryBreakpointData::BreakOn::CHANGE).data())) {
+                memory_breakpoint_data_.break_on = MemoryBreakpointData::BreakOn::CHANGE;
             }
             ImGui::EndCombo();
         }
 
+        uint16_t temp_end = memory_breakpoint_data_.getEndAddress();
+        if (ImGui::InputScalar("end address", ImGuiDataType_U16, &temp_end, nullptr, nullptr, "%.4x",
+                               ImGuiInputTextFlags_CharsHexadecimal)) {
+            memory_breakpoint_data_.end_address = temp_end;
+        }
+
         uint8_t temp_value = memory_breakpoint_data_.value ? *memory_breakpoint_data_.value : 0;
 
         // ImGui issue: InputScalar won't return true if the value is unchanged
@@ -356,6 +505,11 @@ namespace emulator {
                                ImGuiInputTextFlags_CharsHexadecimal)) {
             memory_breakpoint_data_.value = temp_value;
         }
+        ImGui::InputScalar("mask", ImGuiDataType_U8, &memory_breakpoint_data_.mask, nullptr, nullptr, "%.2x",
+                           ImGuiInputTextFlags_CharsHexadecimal);
+
+        ImGui::InputText("Condition##memory breakpoint condition", &memory_breakpoint_condition_);
+        ImGui::Checkbox("Stop emulation (hits are logged either way)", &memory_breakpoint_data_.stop);
 
         if (ImGui::Button("Add")) {
             addMemoryBreakpoint();
@@ -363,16 +517,26 @@ namespace emulator {
         {
             ImGui::Text("Memory breakpoints: ");
             std::optional<MemoryBreakpointData> delete_val;
-            for (auto br : memory_breakpoints_.getBreakpoints()) {
+            for (const MemoryBreakpointData &br : memory_breakpoints_.getBreakpoints()) {
                 buffer_.clear();
-                buffer_.reserve(sizeof("Address: 0xffff\nBreak on: ALWAYS, value: 0xff"));
-                buffer_.putString("Address: 0x")
-                    .putU16(br.address)
-                    .putString("\nbreak on: ")
-                    .putString(to_string(br.break_on));
+                buffer_.reserve(sizeof("Address: 0xffff-0xffff\nBreak on: ALWAYS, value: 0xff, mask: 0xff, log only"));
+                buffer_.putString("Address: 0x").putU16(br.address);
+                if (br.end_address) {
+                    buffer_.putString("-0x").putU16(*br.end_address);
+                }
+                buffer_.putString("\nbreak on: ").putString(to_string(br.break_on));
                 if (br.value) {
                     buffer_.putString(", value: 0x").putU8(*br.value);
                 }
+                if (br.mask != 0xff) {
+                    buffer_.putString(", mask: 0x").putU8(br.mask);
+                }
+                if (!br.stop) {
+                    buffer_.putString(", log only");
+                }
+                if (br.condition) {
+                    buffer_.putString("\nif ").putString(br.condition->getExpression());
+                }
                 buffer_.finish();
                 ImGui::Selectable(buffer_.data());
                 if (ImGui::IsItemHovered() && ImGui::IsKeyPressed(ImGuiKey_Backspace)) {
@@ -381,6 +545,20 @@ namespace emulator {
             }
             if (delete_val) {
                 memory_breakpoints_.removeBreakpoint(*delete_val);
+                emulator_.getBus().updateWatchedAddresses();
+            }
+        }
+        {
+            auto &hits = memory_breakpoints_.getHits();
+            ImGui::Text("Memory breakpoint hits: ");
+            ImGui::SameLine();
+            if (ImGui::Button("Clear##memory breakpoint hits")) {
+                hits.clear();
+            }
+            for (size_t i = 0; i < hits.size(); ++i) {
+                const MemoryBreakpointHit &hit = hits[i];
+                ImGui::Text("cycle %llu, PC 0x%.4x: %s 0x%.4x, 0x%.2x -> 0x%.2x", (unsigned long long)hit.cycle,
+                            hit.pc, hit.write ? "write" : "read", hit.address, hit.old_value, hit.new_value);
             }
         }
     }
@@ -495,6 +673,59 @@ namespace emulator {
     }
 
     void Application::drawEmulatorView() {
+        const JitterStats &jitter = frame_limiter_.getJitter();
+        if (turbo_) {
+            ImGui::Text("Turbo: %.2fx, frames presented: %llu, skipped: %llu", turbo_stats_.emulated_speed,
+                        (unsigned long long)turbo_stats_.frames_presented,
+                        (unsigned long long)turbo_stats_.frames_skipped);
+        } else {
+            ImGui::Text("Speed: %.2fx (measured: %.2fx), frame pacing jitter: average %.0f us, max %.0f us",
+                        frame_limiter_.getSpeed(), jitter.measured_speed, jitter.average_us, jitter.max_us);
+        }
+        if (movie_recorder_) {
+            ImGui::Text("Recording movie: %llu frames", (unsigned long long)movie_recorder_->getFrameCount());
+        } else if (movie_player_) {
+            ImGui::Text("Playing movie: frame %llu of %llu, keyframes indexed: %zu%s",
+                        (unsigned long long)movie_player_->getCurrentFrame(),
+                        (unsigned long long)movie_player_->getFrameCount(), movie_player_->getKeyframes().size(),
+                        movie_player_->isIndexComplete() ? "" : " (incomplete)");
+        }
+        if (emulator_.getCycleCount() != 0) {
+            const gb::IdleLoopStats &idle = emulator_.getIdleLoopStats();
+            double cycles = double(emulator_.getCycleCount());
+            ImGui::Text("Skipped: %.1f%% of cycles in HALT, %.1f%% in %llu idle loops",
+                        double(emulator_.getSkippedHaltCycles()) * 100 / cycles,
+                        double(idle.skipped_cycles) * 100 / cycles, (unsigned long long)idle.loops_detected);
+        }
+        const gb::cpu::BlockCacheStats &cache = emulator_.getCPU().getBlockCache().getStats();
+        if (uint64_t fetches = cache.hits + cache.misses + cache.uncached; fetches != 0) {
+            ImGui::Text("Block cache: %.1f%% of fetches hit, %zu blocks, %llu invalidated",
+                        double(cache.hits) * 100 / double(fetches), emulator_.getCPU().getBlockCache().getBlockCount(),
+                        (unsigned long long)cache.invalidations);
+        }
+        if (cache.translation.flag_writes != 0) {
+            ImGui::Text("Translated blocks: %.1f%% of flag writes dead, %llu constant operands",
+                        double(cache.translation.dead_flag_writes) * 100 / double(cache.translation.flag_writes),
+                        (unsigned long long)cache.translation.constant_operands);
+        }
+        if (const gb::cpu::FlagStats &flags = emulator_.getCPU().getFlagStats(); flags.deferred != 0) {
+            ImGui::Text("Lazy flags: %.1f%% of deferred flag updates computed",
+                        double(flags.materialized) * 100 / double(flags.deferred));
+        }
+        if (run_ahead_frames_ != 0 && frame_time_ > 0) {
+            ImGui::Text("Run-ahead: %d frame%s, %.0f us per frame (+%.0f%% emulation time)", run_ahead_frames_,
+                        run_ahead_frames_ == 1 ? "" : "s", run_ahead_time_ * 1e6, run_ahead_time_ * 100 / frame_time_);
+        }
+
+        RewindStats rewind_stats = rewind_.getStats(emulator_);
+        double frame_us = double(gb::g_cycles_per_frame) * 1e6 / double(gb::g_cpu_frequency);
+        ImGui::Text("Rewind (hold F9): %.1f s buffered, %.1f of %.0f MB used, snapshot: %.0f bytes, %.0f us "
+                    "(%.2f%% of emulated time)",
+                    rewind_stats.buffered_seconds, double(rewind_stats.used_bytes) / (1024 * 1024),
+                    double(rewind_stats.budget_bytes) / (1024 * 1024), rewind_stats.average_snapshot_bytes,
+                    rewind_stats.capture_us,
+                    rewind_stats.capture_us * 100 / (frame_us * rewind_.getCaptureInterval()));
+
         emulator_renderer_->flush();
         ImVec2 position = ImGui::GetCursorScreenPos();
         ImVec2 img_size = ImGui::GetContentRegionAvail();
@@ -516,36 +747,87 @@ namespace emulator {
         }
     }
 
-    Application::Application() : memory_breakpoints_([this]() { single_step_ = true; }) {
+    Application::Application()
+        : memory_breakpoints_([this]() { single_step_ = true; },
+                              [this](uint16_t address, uint8_t value) {
+                                  return emulator_.getConditionContext(address, value);
+                              }) {
         initGUI();
-        emulator_.getBus().setObserver(memory_breakpoints_);
+        emulator_.getBus().addObserver(memory_breakpoints_);
+        emulator_.setPCBreakpoints(pc_breakpoints_);
+        // instruction history, disassembly and PC breakpoints are built from the trace
+        emulator_.getCPU().setTraceEnabled(true);
     }
 
     void Application::run() {
         while (is_running_) {
 
             double start = glfwGetTime();
+            bool was_paused = isPaused();
 
             if (ImGui::IsKeyPressed(ImGuiKey_Space, false)) {
                 single_step_ = !single_step_;
             }
+            if (ImGui::IsKeyPressed(ImGuiKey_Tab, false)) {
+                turbo_ = !turbo_;
+                frame_limiter_.reset();
+            }
 
-            if (single_step_) {
+            updateInput();
+
+            if (ImGui::IsKeyDown(ImGuiKey_F9)) {
+                stopMovie();
+                rewind();
+            } else if (fast_forward_instructions_ != 0) {
+                stopMovie();
+                runFastForward();
+            } else if (single_step_) {
                 if (ImGui::IsKeyPressed(ImGuiKey_F11)) {
+                    stopMovie();
                     update();
                     while (!(emulator_.getCPU().isFinished() || emulator_.terminated())) {
                         update();
                     }
+                    recordFrame();
+                    requestRedraw();
                 } else if (ImGui::IsKeyPressed(ImGuiKey_F12)) {
-                    advanceFrame();
+                    emulateFrame();
+                    requestRedraw();
                 }
+            } else if (turbo_) {
+                runTurbo();
             } else {
-                advanceFrame();
+                if (was_paused) {
+                    frame_limiter_.reset();
+                }
+                uint64_t cycles = emulator_.getCycleCount();
+                double frame_start = glfwGetTime();
+                // with run-ahead the displayed frame is the last speculative one
+                emulator_.getPPU().skipRendering(run_ahead_frames_ != 0);
+                emulateFrame();
+                emulator_.getPPU().skipRendering(false);
+                frame_time_ = frame_time_ * 0.9 + (glfwGetTime() - frame_start) * 0.1;
+                if (run_ahead_frames_ != 0 && !isPaused()) {
+                    runAhead();
+                }
+                frame_limiter_.wait(emulator_.getCycleCount() - cycles);
             }
 
-            glfwSetWindowTitle(window_, ("emulator [" + std::to_string(glfwGetTime() - start) + "]").c_str());
+            // pausing (including hitting a breakpoint) changes what the debugger shows
+            if (isPaused() != was_paused) {
+                requestRedraw();
+            }
+
+            if (!isIdle()) {
+                glfwSetWindowTitle(window_, ("emulator [" + std::to_string(glfwGetTime() - start) + "]").c_str());
+
+                draw();
+                if (redraw_frames_ > 0) {
+                    --redraw_frames_;
+                }
+            }
 
-            draw();
+            waitEvents();
 
             if (window_ && glfwWindowShouldClose(window_)) {
                 is_running_ = false;
@@ -553,6 +835,22 @@ namespace emulator {
         }
     }
 
+    void Application::waitEvents() {
+        if (!isIdle()) {
+            glfwPollEvents();
+            return;
+        }
+
+        // Nothing changes while emulation is paused until the user does something,
+        // so block instead of redrawing the whole UI in a loop
+        glfwWaitEventsTimeout(g_idle_wait_timeout);
+
+        // input is queued by the ImGui backend and processed on the next ImGui::NewFrame()
+        if (ImGui::GetCurrentContext()->InputEventsQueue.Size > 0) {
+            requestRedraw();
+        }
+    }
+
     void Application::initGUI() {
         if (gui_init_) {
             return;
@@ -570,8 +868,19 @@ namespace emulator {
         ImGui::CreateContext();
         ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
 
+        // window contents have to be redrawn after resizing or being exposed even if emulation is paused
+        glfwSetWindowUserPointer(window_, this);
+        glfwSetWindowRefreshCallback(window_, [](GLFWwindow *window) {
+            static_cast<Application *>(glfwGetWindowUserPointer(window))->requestRedraw();
+        });
+        glfwSetFramebufferSizeCallback(window_, [](GLFWwindow *window, int, int) {
+            static_cast<Application *>(glfwGetWindowUserPointer(window))->requestRedraw();
+        });
+
         ImGui_ImplGlfw_InitForOpenGL(window_, true);
         ImGui_ImplOpenGL3_Init();
+        // frames are paced by FrameLimiter, waiting for vsync on top of that would tie emulation speed to the monitor
+        glfwSwapInterval(0);
         refresh_rate_ = glfwGetVideoMode(glfwGetPrimaryMonitor())->refreshRate;
         emulator_renderer_ = std::make_unique<renderer::Renderer>();
         emulator_.getPPU().setRenderer(*emulator_renderer_);
@@ -579,6 +888,7 @@ namespace emulator {
     }
 
     Application::~Application() {
+        stopMovie();
         if (gui_init_) {
             ImGui_ImplOpenGL3_Shutdown();
             ImGui_ImplGlfw_Shutdown();
@@ -588,61 +898,244 @@ namespace emulator {
     }
 
     void Application::update() {
-        try {
-            emulator_.tick();
-            if (emulator_.getCPU().isFinished()) {
-                gb::cpu::Instruction instr = emulator_.getCPU().getLastInstruction();
-                recent_instructions_.push_back(instr);
-                if (instr.registers.pc() <= gb::g_rom_bank0_max_address) {
-                    disassembler_.addInstruction(instr, current_rom_banks_.first);
-                } else if (instr.registers.pc() <= gb::g_memory_rom.max_address) {
-                    disassembler_.addInstruction(instr, current_rom_banks_.second);
-                } else if (gb::g_memory_cartridge_ram.isInRange(instr.registers.pc())) {
-                    disassembler_.addInstruction(instr, current_ram_bank_);
-                } else {
-                    disassembler_.addInstruction(instr);
-                }
-                current_ram_bank_ = emulator_.getCartridge().getCurrentRAMBank();
-                current_rom_banks_ = emulator_.getCartridge().getCurrentROMBanks();
-                // StaticStringBuffer<g_instruction_string_buf_size> buf;
-                // printInstruction(buf, recent_instructions_.size() - 1);
-                // std::cout << buf.data() << '\n';
-                if (!single_step_ && pc_breakpoints_.contains(instr.registers.pc())) {
-                    single_step_ = true;
-                }
-            }
-        } catch (const std::exception &e) {
-            std::cout << "exception occured during emulator update: " << e.what() << std::endl;
-            emulator_.stop();
+        bool was_running = !emulator_.terminated();
+        emulator_.tick();
+        if (emulator_.getCPU().isTraceEnabled() && emulator_.getCPU().isFinished()) {
+            const gb::cpu::TraceRecord &record = emulator_.getCPU().getLastTrace();
+            recent_instructions_.push_back(record);
+            disassembler_.addInstruction(record);
+        }
+        // the debugger ticks the emulator itself, so it checks breakpoints the same way runFrame() does
+        if (!single_step_ && emulator_.atBreakpoint()) {
+            single_step_ = true;
+        }
+        if (const gb::FaultState &fault = emulator_.getFault(); was_running && fault.isSet()) {
+            std::cout << "emulation stopped: " << gb::getFaultName(fault.fault) << " at 0x" << std::hex
+                      << std::setfill('0') << std::setw(4) << fault.address << std::dec << std::endl;
             single_step_ = true;
         }
     }
 
-    void Application::advanceFrame() {
+    bool Application::advanceFrame() {
         if (emulator_.terminated()) {
-            return;
+            return false;
         }
         bool old_single_step = single_step_;
         single_step_ = false;
-        constexpr size_t clock_frequency = 1 << 20;
-        size_t max_updates = (clock_frequency / refresh_rate_) * 2;
+        // no frame is ever finished while the LCD is off, so run at most a frame worth of cycles
+        uint64_t frame_end = emulator_.getCycleCount() + gb::g_cycles_per_frame;
 
+        bool finished = true;
         update();
-        while (!emulator_.getPPU().frameFinished() && max_updates > 0) {
+        while (!emulator_.getPPU().frameFinished() && !emulator_.terminated() &&
+               emulator_.getCycleCount() < frame_end) {
             if (single_step_) {
                 // run current instruction until completion
-                while (!emulator_.getCPU().isFinished()) {
+                while (!emulator_.getCPU().isFinished() && !emulator_.terminated()) {
                     update();
                 }
+                finished = false;
                 break;
             }
             update();
-            --max_updates;
+            emulator_.skipIdleLoop(frame_end);
+            emulator_.skipHalt(frame_end);
         }
         emulator_.getPPU().resetFrameFinistedFlag();
         if (!single_step_) {
             single_step_ = old_single_step;
         }
+        return finished && !emulator_.terminated();
+    }
+
+    void Application::emulateFrame() {
+        if (movie_player_) {
+            if (std::optional<uint8_t> input = movie_player_->nextFrame()) {
+                emulator_.getInput().setState(*input);
+            } else {
+                std::cout << "movie playback finished" << std::endl;
+                stopMovie();
+            }
+        }
+        if (movie_recorder_) {
+            movie_recorder_->addFrame(emulator_.getInput().getState());
+        }
+
+        bool finished = advanceFrame();
+        recordFrame();
+
+        // movies only consist of whole frames
+        if (!finished && (movie_recorder_ || movie_player_)) {
+            std::cout << "frame was interrupted, stopping the movie" << std::endl;
+            stopMovie();
+        }
+    }
+
+    void Application::startRecording(gb::MovieStart start) {
+        stopMovie();
+        movie_recorder_.emplace(emulator_, start, movie_keyframe_interval_);
+        rewind_.clear();
+        recent_instructions_.clear();
+    }
+
+    void Application::startPlayback() {
+        stopMovie();
+        std::filesystem::path path = current_rom_;
+        path.replace_extension(g_movie_extension);
+        try {
+            movie_player_.emplace(readFile(path));
+            movie_player_->start(emulator_);
+            path.replace_extension(g_movie_index_extension);
+            // a stale or missing index is rebuilt as the movie is played
+            movie_index_loaded_ = movie_player_->loadIndex(readFile(path));
+        } catch (const std::exception &e) {
+            std::cout << "failed to play movie " << path << ": " << e.what() << std::endl;
+            movie_player_.reset();
+            return;
+        }
+        rewind_.clear();
+        recent_instructions_.clear();
+    }
+
+    void Application::stopMovie() {
+        if (movie_player_ && !movie_index_loaded_) {
+            if (std::optional<std::vector<uint8_t>> index = movie_player_->saveIndex()) {
+                std::filesystem::path path = current_rom_;
+                path.replace_extension(g_movie_index_extension);
+                if (!writeFile(path, *index)) {
+                    std::cout << "failed to save movie index to " << path << std::endl;
+                }
+            }
+        }
+        movie_player_.reset();
+        if (!movie_recorder_) {
+            return;
+        }
+
+        std::filesystem::path path = current_rom_;
+        path.replace_extension(g_movie_extension);
+        if (!writeFile(path, movie_recorder_->finish())) {
+            std::cout << "failed to save movie to " << path << std::endl;
+        }
+        movie_recorder_.reset();
+    }
+
+    void Application::runTurbo() {
+        double slice_end = glfwGetTime() + 1.0 / refresh_rate_;
+        uint64_t start_cycles = emulator_.getCycleCount();
+        if (turbo_window_start_ == 0) {
+            turbo_window_start_ = glfwGetTime();
+        }
+
+        // the display can't show more than one frame per refresh, so rendering of all frames
+        // except the last one in this slice is skipped
+        emulator_.getPPU().skipRendering(true);
+        double frame_start = glfwGetTime();
+        while (!isPaused() && frame_start + 2 * skipped_frame_time_ < slice_end) {
+            emulateFrame();
+            ++turbo_window_.frames_skipped;
+            double now = glfwGetTime();
+            skipped_frame_time_ = now - frame_start;
+            frame_start = now;
+        }
+        emulator_.getPPU().skipRendering(false);
+        if (!isPaused()) {
+            emulateFrame();
+            ++turbo_window_.frames_presented;
+        }
+
+        turbo_window_cycles_ += emulator_.getCycleCount() - start_cycles;
+        double now = glfwGetTime();
+        if (now - turbo_window_start_ >= g_turbo_stats_interval) {
+            turbo_window_.emulated_speed =
+                double(turbo_window_cycles_) / double(gb::g_cpu_frequency) / (now - turbo_window_start_);
+            turbo_stats_ = turbo_window_;
+            turbo_window_ = TurboStats{};
+            turbo_window_start_ = now;
+            turbo_window_cycles_ = 0;
+        }
+    }
+
+    void Application::rewind() {
+        // re-simulated frames shouldn't trigger breakpoints
+        emulator_.getBus().setObserversMuted(true);
+        try {
+            rewind_.rewind(emulator_, g_rewind_frames_per_step);
+        } catch (const std::exception &e) {
+            std::cout << "exception occured during rewinding: " << e.what() << std::endl;
+            emulator_.stop();
+            single_step_ = true;
+        }
+        emulator_.getBus().setObserversMuted(false);
+        frame_limiter_.wait(gb::g_cycles_per_frame);
+        requestRedraw();
+    }
+
+    void Application::runAhead() {
+        double start = glfwGetTime();
+        emulator_.saveState(run_ahead_state_);
+        // speculative frames are discarded, they shouldn't trigger breakpoints
+        emulator_.getBus().setObserversMuted(true);
+        emulator_.removePCBreakpoints();
+        // a fault is reported once emulation actually gets there
+        for (int i = 0; i < run_ahead_frames_; ++i) {
+            emulator_.getPPU().skipRendering(i + 1 < run_ahead_frames_);
+            emulator_.runFrame();
+        }
+        emulator_.getPPU().skipRendering(false);
+        emulator_.getBus().setObserversMuted(false);
+        emulator_.setPCBreakpoints(pc_breakpoints_);
+
+        emulator_.loadState(run_ahead_state_);
+        emulator_.start();
+        run_ahead_time_ = run_ahead_time_ * 0.9 + (glfwGetTime() - start) * 0.1;
+    }
+
+    void Application::updateInput() {
+        if (movie_player_ || ImGui::GetIO().WantTextInput) {
+            return;
+        }
+
+        uint8_t state = 0;
+        for (auto [key, button] : g_joypad_bindings) {
+            if (ImGui::IsKeyDown(key)) {
+                state |= uint8_t(button);
+            }
+        }
+        emulator_.getInput().setState(state);
+    }
+
+    void Application::recordFrame() {
+        if (!emulator_.terminated()) {
+            rewind_.onFrame(emulator_);
+        }
+    }
+
+    void Application::runFastForward() {
+        double slice_end = glfwGetTime() + 1.0 / refresh_rate_;
+        bool old_single_step = single_step_;
+        single_step_ = false;
+        // glfwGetTime() is not free, so time is checked once per batch of instructions
+        constexpr uint64_t g_time_check_interval = 1024;
+        uint64_t executed = 0;
+        while (fast_forward_instructions_ != 0 && !isPaused() &&
+               (executed % g_time_check_interval != 0 || glfwGetTime() < slice_end)) {
+            update();
+            while (!emulator_.terminated() && !emulator_.getCPU().isFinished()) {
+                update();
+            }
+            --fast_forward_instructions_;
+            ++executed;
+        }
+        recordFrame();
+        if (isPaused()) {
+            // stopped by a breakpoint or emulator termination
+            fast_forward_instructions_ = 0;
+        }
+        if (!single_step_) {
+            single_step_ = old_single_step;
+        }
+        requestRedraw();
     }
 
     bool Application::setROMDirectory() {
@@ -672,26 +1165,55 @@ namespace emulator {
         }
 
         pushRecent(recent_roms_, path);
+        stopMovie();
+        current_rom_ = path;
 
         emulator_.getCartridge().setROM(std::move(data));
         emulator_.reset();
         emulator_.start();
         disassembler_.clear();
+        rewind_.clear();
 
         return true;
     }
 
-    void Application::addPCBreakpoint(uint16_t address) { pc_breakpoints_.insert(address); }
+    void Application::addPCBreakpoint(gb::PCBreakpoint breakpoint) { pc_breakpoints_.add(breakpoint); }
 
     void Application::addMemoryBreakpoint() {
-        memory_breakpoints_.addBreakpoint(memory_breakpoint_data_);
+        if (!compileCondition(memory_breakpoint_condition_, memory_breakpoint_data_.condition)) {
+            return;
+        }
+        try {
+            memory_breakpoints_.addBreakpoint(memory_breakpoint_data_);
+        } catch (const std::invalid_argument &e) {
+            std::cout << "invalid memory breakpoint: " << e.what() << std::endl;
+            return;
+        }
+        emulator_.getBus().updateWatchedAddresses();
         memory_breakpoint_data_ = MemoryBreakpointData{};
+        memory_breakpoint_condition_.clear();
+    }
+
+    bool Application::compileCondition(const std::string &text, std::optional<gb::BreakpointCondition> &condition) {
+        if (text.find_first_not_of(" \t") == std::string::npos) {
+            condition = std::nullopt;
+            return true;
+        }
+        try {
+            condition = gb::BreakpointCondition::compile(text);
+            return true;
+        } catch (const std::invalid_argument &e) {
+            std::cout << "invalid breakpoint condition: " << e.what() << std::endl;
+            return false;
+        }
     }
 
-    void Application::printInstruction(StringBuffer &buf, gb::cpu::Instruction instr, std::optional<size_t> idx) {
+    void Application::printInstruction(StringBuffer &buf, const gb::cpu::TraceRecord &record,
+                                       std::optional<size_t> idx) {
         using namespace gb::cpu;
+        Instruction instr = disassemble(record);
         buf.reserve(sizeof("ffff CALL nz, ffff##125"));
-        buf.putU16(instr.registers.pc()).put(' ').putString(to_string(instr.type));
+        buf.putU16(instr.address).put(' ').putString(to_string(instr.type));
         if (instr.condition) {
             buf.put(' ').putString(to_string(*instr.condition));
         }
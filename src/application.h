@@ -3,15 +3,20 @@
 
 #include "breakpoint.h"
 #include "disassembler.h"
+#include "frame_limiter.h"
 #include "gb/address_bus.h"
+#include "gb/condition.h"
 #include "gb/cpu/cpu.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/decoder.h"
 #include "gb/emulator.h"
 #include "gb/interrupt_register.h"
 #include "gb/memory/basic_components.h"
+#include "gb/movie.h"
+#include "gb/pc_breakpoints.h"
 #include "gb/timer.h"
 #include "renderer.h"
+#include "rewind.h"
 #include "util/util.h"
 
 // clang-format off
@@ -19,15 +24,17 @@
 #include "GLFW/glfw3.h"
 // clang-format on
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <filesystem>
 #include <list>
 #include <memory>
+#include <optional>
 #include <queue>
+#include <string>
 #include <string_view>
-#include <unordered_set>
 
 namespace emulator {
 
@@ -37,16 +44,46 @@ namespace emulator {
                                                       "C: ff, B: ff, BC: ffff\n"
                                                       "E: ff, D: ff, DE: ffff\n"
                                                       "H: ff, L: ff, HL: ffff\n"
-                                                      "SP: ffff, PC: fff\n"
+                                                      "PC: ffff\n"
                                                       "IME: 1");
 
     constexpr size_t g_instruction_string_buf_size = sizeof("ffff CALL nz, ffff##111"); // ##111 is needed to accomodate
                                                                                         // for Dear ImGui ids
 
     constexpr std::string_view g_rom_extension = ".gb";
+    // movies are stored next to the ROM
+    constexpr std::string_view g_movie_extension = ".gbm";
+    // keyframe index, written once a movie was played through
+    constexpr std::string_view g_movie_index_extension = ".gbmi";
+    // in frames, 0 means no keyframes
+    constexpr std::array g_movie_keyframe_intervals = {0, 600, 3600, 18000};
 
     constexpr size_t g_recent_cache_size = 10;
 
+    // While emulation is paused the window is redrawn only after input or state changes.
+    // Dear ImGui needs a few frames to settle after an event (hover state, popups, etc.)
+    constexpr int g_idle_redraw_frames = 3;
+    constexpr double g_idle_wait_timeout = 0.25; // in seconds
+
+    constexpr std::array g_speed_multipliers = {0.25, 0.5, 1.0, 2.0, 4.0};
+
+    constexpr std::array g_rewind_budgets_mb = {8, 32, 128};
+    constexpr std::array g_rewind_intervals = {1, 2, 4, 8};
+    // rewinding goes back this many frames per emulated frame of host time, i.e. runs at 2x speed
+    constexpr uint32_t g_rewind_frames_per_step = 2;
+
+    constexpr int g_max_run_ahead_frames = 4;
+
+    // how often turbo mode and instruction fast forwarding statistics are refreshed, in seconds
+    constexpr double g_turbo_stats_interval = 0.5;
+
+    struct TurboStats {
+        // emulated time / host time
+        double emulated_speed = 0;
+        uint64_t frames_presented = 0;
+        uint64_t frames_skipped = 0;
+    };
+
     class Application {
       public:
         Application();
@@ -65,7 +102,31 @@ namespace emulator {
         void initGUI();
         void update();
 
-        void advanceFrame();
+        // Returns false if the frame was interrupted (e.g. by a breakpoint)
+        bool advanceFrame();
+        // Runs a frame with movie input/recording and records it for rewinding
+        void emulateFrame();
+        // Runs as many frames as fit into one display refresh, only the last one is rendered
+        void runTurbo();
+        // Runs pending fast forward instructions for at most one display refresh
+        void runFastForward();
+        // Goes back g_rewind_frames_per_step frames
+        void rewind();
+        // Must be called after any advancement of emulation
+        void recordFrame();
+        // Runs run_ahead_frames_ frames with current input, so they are displayed, and restores state afterwards
+        void runAhead();
+        void updateInput();
+
+        void startRecording(gb::MovieStart start);
+        void startPlayback();
+        // Saves the movie if one is being recorded and the keyframe index if it was just built
+        void stopMovie();
+
+        void requestRedraw() { redraw_frames_ = g_idle_redraw_frames; }
+        bool isPaused() const { return single_step_ || emulator_.terminated(); }
+        bool isIdle() const { return isPaused() && fast_forward_instructions_ == 0 && redraw_frames_ == 0; }
+        void waitEvents();
 
         bool setROMDirectory();
         bool runROM(const std::filesystem::path path);
@@ -86,26 +147,37 @@ namespace emulator {
             }
         }
 
-        void addPCBreakpoint(uint16_t address);
+        void addPCBreakpoint(gb::PCBreakpoint breakpoint);
         void addMemoryBreakpoint();
+        // Empty text is no condition. Returns false and prints the error if text can't be compiled
+        bool compileCondition(const std::string &text, std::optional<gb::BreakpointCondition> &condition);
 
-        void printInstruction(StringBuffer &buf, gb::cpu::Instruction instr, std::optional<size_t> idx = {});
+        void printInstruction(StringBuffer &buf, const gb::cpu::TraceRecord &record, std::optional<size_t> idx = {});
 
       private:
         gb::Emulator emulator_;
 
         std::vector<std::filesystem::path> roms_;
         std::list<std::filesystem::path> recent_roms_;
-        RingBuffer<gb::cpu::Instruction, g_recent_cache_size> recent_instructions_;
+        RingBuffer<gb::cpu::TraceRecord, g_recent_cache_size> recent_instructions_;
 
         GLFWwindow *window_ = nullptr;
 
-        std::unordered_set<uint16_t> pc_breakpoints_;
-        MemoryBreakpoints memory_breakpoints_{[this]() { single_step_ = true; }};
+        gb::PCBreakpoints pc_breakpoints_;
+        MemoryBreakpoints memory_breakpoints_{
+            [this]() { single_step_ = true; },
+            [this](uint16_t address, uint8_t value) { return emulator_.getConditionContext(address, value); }};
         std::unique_ptr<renderer::Renderer> emulator_renderer_;
-
-        std::pair<uint16_t, uint16_t> current_rom_banks_{0, 1};
-        uint16_t current_ram_bank_ = 0;
+        FrameLimiter frame_limiter_;
+        RewindBuffer rewind_;
+        // reused between frames, so saving state for run-ahead doesn't allocate
+        std::vector<uint8_t> run_ahead_state_;
+        std::optional<gb::MovieRecorder> movie_recorder_;
+        std::optional<gb::MoviePlayer> movie_player_;
+        bool movie_index_loaded_ = false;
+        uint64_t movie_keyframe_interval_ = 3600;
+        uint64_t movie_seek_frame_ = 0;
+        std::filesystem::path current_rom_;
 
         Disassembler disassembler_;
         std::map<InstructionAddress, size_t> instruction_line_offsets_;
@@ -116,8 +188,12 @@ namespace emulator {
 
         // buffers for GUI
         MemoryBreakpointData memory_breakpoint_data_;
+        // negative for breakpoints in any bank
+        int pc_breakpoint_bank_ = -1;
+        std::string pc_breakpoint_condition_;
+        std::string memory_breakpoint_condition_;
         std::string new_romdir_;
-        std::optional<std::pair<gb::cpu::RegisterFile, bool>> registers_to_print_;
+        std::optional<gb::cpu::TraceRecord> registers_to_print_;
         StringBuffer buffer_;
         StringBuffer disasm_buffer_;
 
@@ -126,7 +202,23 @@ namespace emulator {
         bool single_step_ = true;
         bool frame_finished_ = false;
 
+        bool turbo_ = false;
+        int run_ahead_frames_ = 0;
+        // moving averages of host time spent on a frame and on running ahead after it, in seconds
+        double frame_time_ = 0;
+        double run_ahead_time_ = 0;
+
         int refresh_rate_ = 60;
+        int redraw_frames_ = g_idle_redraw_frames;
+
+        uint64_t fast_forward_instructions_ = 0;
+        // host time spent on the last frame with rendering skipped, in seconds
+        double skipped_frame_time_ = 0;
+        TurboStats turbo_stats_;
+        // statistics accumulated since turbo_stats_ was last updated
+        TurboStats turbo_window_;
+        double turbo_window_start_ = 0;
+        uint64_t turbo_window_cycles_ = 0;
     };
 } // namespace emulator
 
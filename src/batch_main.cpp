@@ -0,0 +1,67 @@
+#include "batch_runner.h"
+
+#include <charconv>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Usage: batch_runner <job list> [-j threads] [-o report.csv]
+// Exits with 0 only if every job passed
+int main(int argc, char **argv) {
+    std::filesystem::path job_list;
+    std::filesystem::path report_path;
+    size_t threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            std::string_view count = argv[++i];
+            auto [end, error] = std::from_chars(count.data(), count.data() + count.size(), threads);
+            if (error != std::errc{} || end != count.data() + count.size()) {
+                job_list.clear();
+                break;
+            }
+        } else if (arg == "-o" && i + 1 < argc) {
+            report_path = argv[++i];
+        } else if (job_list.empty()) {
+            job_list = arg;
+        } else {
+            job_list.clear();
+            break;
+        }
+    }
+    if (job_list.empty()) {
+        std::cout << "usage: " << argv[0] << " <job list> [-j threads] [-o report.csv]" << std::endl;
+        return 2;
+    }
+
+    std::vector<emulator::BatchJob> jobs;
+    try {
+        std::ifstream input(job_list);
+        if (!input.is_open()) {
+            std::cout << "failed to open " << job_list << std::endl;
+            return 2;
+        }
+        jobs = emulator::parseJobList(input, job_list.parent_path());
+    } catch (const std::exception &e) {
+        std::cout << job_list.string() << ": " << e.what() << std::endl;
+        return 2;
+    }
+
+    std::vector<emulator::BatchResult> results;
+    emulator::BatchSummary summary = emulator::runBatch(jobs, results, threads);
+    if (report_path.empty()) {
+        emulator::writeReport(std::cout, jobs, results, summary);
+    } else {
+        std::ofstream report(report_path);
+        emulator::writeReport(report, jobs, results, summary);
+        std::cout << summary.passed << " passed, " << summary.failed << " failed, " << summary.faults << " faults, "
+                  << summary.errors << " errors" << std::endl;
+    }
+
+    return summary.passed == jobs.size() ? 0 : 1;
+}
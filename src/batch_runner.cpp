@@ -0,0 +1,255 @@
+#include "batch_runner.h"
+#include "gb/emulator.h"
+#include "gb/movie.h"
+#include "gb/save_state.h"
+#include "util/util.h"
+#include "work_stealing_pool.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace emulator {
+
+    // Emulator instances and buffers are kept between jobs, so a thread doesn't allocate them again for every job
+    struct BatchWorker {
+        std::unique_ptr<gb::HeadlessEmulator> emulator = std::make_unique<gb::HeadlessEmulator>();
+        std::filesystem::path rom_path;
+        std::vector<uint8_t> rom;
+        std::vector<uint8_t> state;
+    };
+
+    static std::vector<std::string> splitFields(const std::string &line);
+    static std::optional<uint64_t> parseInteger(std::string_view text, int base);
+    // Writes field quoted as in RFC 4180 if it contains a comma, a quote or a line break
+    static void writeField(std::ostream &output, std::string_view field);
+    static void runJob(const BatchJob &job, BatchWorker &worker, BatchResult &result);
+    static std::string describeFault(const gb::FaultState &fault, uint64_t frame);
+    static std::string_view toString(BatchStatus status);
+
+    std::vector<BatchJob> parseJobList(std::istream &input, const std::filesystem::path &base_directory) {
+        std::vector<BatchJob> jobs;
+        std::string line;
+        for (size_t line_number = 1; std::getline(input, line); ++line_number) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line.front() == '#') {
+                continue;
+            }
+
+            std::vector<std::string> fields = splitFields(line);
+            if (fields.size() < 2 || fields.size() > 4) {
+                throw std::invalid_argument("line " + std::to_string(line_number) +
+                                            ": expected 2 to 4 tab-separated fields");
+            }
+
+            BatchJob &job = jobs.emplace_back();
+            job.rom = base_directory / fields[0];
+            if (fields[1].starts_with(g_frames_prefix)) {
+                std::optional<uint64_t> frames =
+                    parseInteger(std::string_view(fields[1]).substr(g_frames_prefix.size()), 10);
+                if (!frames) {
+                    throw std::invalid_argument("line " + std::to_string(line_number) + ": invalid frame count");
+                }
+                job.frames = *frames;
+            } else {
+                job.movie = base_directory / fields[1];
+            }
+            if (fields.size() > 2 && !fields[2].empty()) {
+                job.state_output = base_directory / fields[2];
+            }
+            if (fields.size() > 3 && !fields[3].empty()) {
+                job.expected_hash = parseInteger(fields[3], 16);
+                if (!job.expected_hash) {
+                    throw std::invalid_argument("line " + std::to_string(line_number) + ": invalid state hash");
+                }
+            }
+        }
+        return jobs;
+    }
+
+    BatchSummary runBatch(const std::vector<BatchJob> &jobs, std::vector<BatchResult> &results, size_t threads) {
+        auto start = std::chrono::steady_clock::now();
+        results.assign(jobs.size(), BatchResult{});
+
+        WorkStealingPool pool(threads);
+        std::vector<BatchWorker> workers(pool.getThreadCount());
+        pool.run(jobs.size(),
+                 [&](size_t worker, size_t index) { runJob(jobs[index], workers[worker], results[index]); });
+
+        BatchSummary summary{.threads = pool.getThreadCount(), .stolen_jobs = pool.getStolenCount()};
+        for (const BatchResult &result : results) {
+            switch (result.status) {
+            case BatchStatus::PASSED: ++summary.passed; break;
+            case BatchStatus::FAILED: ++summary.failed; break;
+            case BatchStatus::FAULT: ++summary.faults; break;
+            case BatchStatus::ERROR: ++summary.errors; break;
+            }
+            summary.frames += result.frames;
+            summary.cycles += result.cycles;
+        }
+        summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return summary;
+    }
+
+    void writeReport(std::ostream &output, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                     const BatchSummary &summary) {
+        std::ios_base::fmtflags flags = output.flags();
+        char fill = output.fill();
+        output << "job,rom,input,status,frames,cycles,state_hash,seconds,fault,fault_address,error\n";
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            const BatchJob &job = jobs[i];
+            const BatchResult &result = results[i];
+            output << i << ',';
+            writeField(output, job.rom.string());
+            output << ',';
+            if (job.movie.empty()) {
+                output << job.frames << " frames";
+            } else {
+                writeField(output, job.movie.string());
+            }
+            output << ',' << toString(result.status) << ',' << result.frames << ',' << result.cycles << ','
+                   << std::hex << std::setfill('0') << std::setw(16) << result.state_hash << std::dec << ','
+                   << result.seconds << ',' << gb::getFaultName(result.fault.fault) << ",0x" << std::hex
+                   << std::setw(4) << result.fault.address << std::dec << ',';
+            writeField(output, result.error);
+            output << '\n';
+        }
+        output.flags(flags);
+        output.fill(fill);
+
+        double emulated_seconds = double(summary.cycles) / double(gb::g_cpu_frequency);
+        output << "# " << summary.passed << " passed, " << summary.failed << " failed, " << summary.faults
+               << " faults, " << summary.errors << " errors\n";
+        output << "# " << summary.frames << " frames in " << summary.seconds << " s on " << summary.threads
+               << " threads (" << summary.stolen_jobs << " jobs stolen), "
+               << (summary.seconds > 0 ? emulated_seconds / summary.seconds : 0) << "x realtime\n";
+    }
+
+    static std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t')) {
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    static std::optional<uint64_t> parseInteger(std::string_view text, int base) {
+        uint64_t value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+        if (text.empty() || error != std::errc{} || end != text.data() + text.size()) {
+            return {};
+        }
+        return value;
+    }
+
+    static void writeField(std::ostream &output, std::string_view field) {
+        if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+            output << field;
+            return;
+        }
+        output << '"';
+        for (char c : field) {
+            if (c == '"') {
+                output << '"';
+            }
+            output << c;
+        }
+        output << '"';
+    }
+
+    static void runJob(const BatchJob &job, BatchWorker &worker, BatchResult &result) {
+        auto start = std::chrono::steady_clock::now();
+        // runJob must not throw, every error is reported in the result instead
+        try {
+            gb::HeadlessEmulator &emulator = *worker.emulator;
+            if (worker.rom_path != job.rom) {
+                worker.rom = readFile(job.rom);
+                worker.rom_path = job.rom;
+            }
+            // setting the ROM again also clears cartridge RAM left by the previous job
+            if (!emulator.getCartridge().setROM(worker.rom)) {
+                throw std::invalid_argument("failed to load ROM " + job.rom.string());
+            }
+
+            if (job.movie.empty()) {
+                emulator.reset();
+                emulator.start();
+                while (result.frames < job.frames && !emulator.terminated()) {
+                    emulator.runFrame();
+                    ++result.frames;
+                }
+            } else {
+                std::vector<uint8_t> movie = readFile(job.movie);
+                if (movie.empty()) {
+                    throw std::invalid_argument("failed to read movie " + job.movie.string());
+                }
+                result.frames = gb::playMovie(emulator, std::move(movie));
+            }
+            result.cycles = emulator.getCycleCount();
+            result.fault = emulator.getFault();
+            if (result.fault.isSet()) {
+                // the emulator is left in a consistent state, the next job resets it
+                result.status = BatchStatus::FAULT;
+                result.error = describeFault(result.fault, result.frames);
+            } else if (emulator.terminated()) {
+                throw std::runtime_error("emulation terminated at frame " + std::to_string(result.frames));
+            } else {
+                emulator.saveState(worker.state);
+                result.state_hash = gb::hashBytes(worker.state);
+                if (!job.state_output.empty() && !writeFile(job.state_output, worker.state)) {
+                    throw std::runtime_error("failed to write state to " + job.state_output.string());
+                }
+
+                if (job.expected_hash && *job.expected_hash != result.state_hash) {
+                    result.status = BatchStatus::FAILED;
+                    result.error = "state hash mismatch";
+                } else {
+                    result.status = BatchStatus::PASSED;
+                }
+            }
+        } catch (const std::exception &e) {
+            result.status = BatchStatus::ERROR;
+            result.error = e.what();
+            // a failed job can leave the emulator in any state, the next one starts from scratch
+            worker.emulator = std::make_unique<gb::HeadlessEmulator>();
+            worker.rom_path.clear();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static std::string describeFault(const gb::FaultState &fault, uint64_t frame) {
+        std::stringstream description;
+        description << gb::getFaultName(fault.fault) << " at ";
+        toHexOutput(description, fault.address);
+        description << " in frame " << frame;
+        return description.str();
+    }
+
+    static std::string_view toString(BatchStatus status) {
+        switch (status) {
+        case BatchStatus::PASSED: return "passed";
+        case BatchStatus::FAILED: return "failed";
+        case BatchStatus::FAULT: return "fault";
+        case BatchStatus::ERROR: return "error";
+        }
+        return "";
+    }
+} // namespace emulator
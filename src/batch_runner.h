@@ -0,0 +1,74 @@
+#ifndef GB_EMULATOR_SRC_BATCH_RUNNER_HDR_
+#define GB_EMULATOR_SRC_BATCH_RUNNER_HDR_
+
+#include "gb/fault.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emulator {
+
+    struct BatchJob {
+        std::filesystem::path rom;
+        // if empty, frames frames are run without input
+        std::filesystem::path movie;
+        uint64_t frames = 0;
+        // if not empty, the final save state is written there
+        std::filesystem::path state_output;
+        // FNV-1a hash of the final save state, the job fails if it doesn't match
+        std::optional<uint64_t> expected_hash;
+    };
+
+    // FAULT: emulation stopped on a fault, e.g. the ROM crashed into an illegal instruction
+    enum class BatchStatus : uint8_t { PASSED, FAILED, FAULT, ERROR };
+
+    struct BatchResult {
+        BatchStatus status = BatchStatus::ERROR;
+        std::string error;
+        gb::FaultState fault;
+        uint64_t frames = 0;
+        uint64_t cycles = 0;
+        uint64_t state_hash = 0;
+        // host time spent on the job, in seconds
+        double seconds = 0;
+    };
+
+    struct BatchSummary {
+        size_t passed = 0;
+        size_t failed = 0;
+        size_t faults = 0;
+        size_t errors = 0;
+        uint64_t frames = 0;
+        uint64_t cycles = 0;
+        // wall clock time of the whole batch, in seconds
+        double seconds = 0;
+        size_t threads = 0;
+        uint64_t stolen_jobs = 0;
+    };
+
+    // Marks a frame count in the input field of a job list, e.g. "frames:600"
+    constexpr std::string_view g_frames_prefix = "frames:";
+
+    // Job list format: one job per line, fields are separated by tabs:
+    // ROM, movie path or g_frames_prefix followed by a frame count, [state output], [expected state hash in hex].
+    // Empty fields are skipped, so are empty lines and lines starting with '#'.
+    // Relative paths are resolved against base_directory. Throws std::invalid_argument on malformed lines
+    std::vector<BatchJob> parseJobList(std::istream &input, const std::filesystem::path &base_directory);
+
+    // Runs jobs on a work-stealing pool of threads (0 means one per hardware thread). Each thread reuses
+    // one emulator instance for all of its jobs. results[i] is the result of jobs[i]
+    BatchSummary runBatch(const std::vector<BatchJob> &jobs, std::vector<BatchResult> &results, size_t threads = 0);
+
+    // CSV with a line per job followed by the summary
+    void writeReport(std::ostream &output, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                     const BatchSummary &summary);
+} // namespace emulator
+
+#endif
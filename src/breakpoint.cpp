@@ -2,11 +2,23 @@
 #include <algorithm>
 #include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <utility>
 
 namespace emulator {
 
-    void MemoryBreakpoints::removeBreakpoint(MemoryBreakpointData breakpoint) {
+    // Mode, mask and value of the breakpoint match the access, the condition is checked separately
+    static bool matchesAccess(const MemoryBreakpointData &breakpoint, uint8_t data, uint8_t old_data, bool write);
+
+    void MemoryBreakpoints::addBreakpoint(const MemoryBreakpointData &breakpoint) {
+        if (breakpoint.getEndAddress() < breakpoint.address) {
+            throw std::invalid_argument("memory breakpoint ends before it starts");
+        }
+        breakpoints_.insert(std::lower_bound(breakpoints_.begin(), breakpoints_.end(), breakpoint), breakpoint);
+        updateIndex();
+    }
+
+    void MemoryBreakpoints::removeBreakpoint(const MemoryBreakpointData &breakpoint) {
         bool found = false;
         auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), breakpoint);
         for (; !(it == breakpoints_.end() || breakpoint < *it); ++it) {
@@ -17,48 +29,137 @@ namespace emulator {
         }
         if (found) {
             breakpoints_.erase(it);
+            updateIndex();
         }
     }
 
-    void MemoryBreakpoints::onRead(uint16_t address, uint8_t data) noexcept {
-        if (breakpoints_.empty()) {
-            return;
+    void MemoryBreakpoints::updateIndex() {
+        segments_.clear();
+        covering_.clear();
+        ranges_.clear();
+        // the set of breakpoints covering an address only changes at these
+        std::vector<uint32_t> bounds;
+        for (const MemoryBreakpointData &breakpoint : breakpoints_) {
+            bounds.push_back(breakpoint.address);
+            bounds.push_back(uint32_t(breakpoint.getEndAddress()) + 1);
         }
-        bool found = false;
-        auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(),
-                                   MemoryBreakpointData{.address = address,
-                                                        .break_on = MemoryBreakpointData::BreakOn::READ});
-        for (;
-             it != breakpoints_.end() && address == it->address && it->break_on != MemoryBreakpointData::BreakOn::WRITE;
-             ++it) {
-            if (!it->value || *it->value == data) {
-                found = true;
-                break;
+        std::ranges::sort(bounds);
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+            uint16_t min_address = bounds[i];
+            uint16_t max_address = bounds[i + 1] - 1;
+            uint32_t begin = covering_.size();
+            for (size_t j = 0; j < breakpoints_.size(); ++j) {
+                if (breakpoints_[j].address <= min_address && breakpoints_[j].getEndAddress() >= max_address) {
+                    covering_.push_back(uint32_t(j));
+                }
             }
-        }
+            if (covering_.size() == begin) {
+                continue;
+            }
+            segments_.push_back(Segment{.min_address = min_address,
+                                        .max_address = max_address,
+                                        .begin = begin,
+                                        .end = uint32_t(covering_.size())});
 
-        if (found) {
-            callback_();
+            if (!ranges_.empty() && uint32_t(ranges_.back().max_address) + 1 >= min_address) {
+                // size is computed on construction
+                ranges_.back() =
+                    gb::MemoryObjectInfo{.min_address = ranges_.back().min_address, .max_address = max_address};
+            } else {
+                ranges_.push_back(gb::MemoryObjectInfo{.min_address = min_address, .max_address = max_address});
+            }
         }
     }
 
-    void MemoryBreakpoints::onWrite(uint16_t address, uint8_t data) noexcept {
-        if (breakpoints_.empty()) {
+    void MemoryBreakpoints::onRead(uint16_t address, uint8_t data) noexcept { onAccess(address, data, data, false); }
+
+    void MemoryBreakpoints::onWrite(uint16_t address, uint8_t data, uint8_t old_data) noexcept {
+        onAccess(address, data, old_data, true);
+    }
+
+    void MemoryBreakpoints::onAccess(uint16_t address, uint8_t data, uint8_t old_data, bool write) noexcept {
+        auto segment = std::upper_bound(segments_.begin(), segments_.end(), address,
+                                        [](uint16_t value, const Segment &other) { return value < other.min_address; });
+        if (segment == segments_.begin() || (--segment)->max_address < address) {
             return;
         }
-        bool found = false;
-        auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(),
-                                   MemoryBreakpointData{.address = address,
-                                                        .break_on = MemoryBreakpointData::BreakOn::ALWAYS});
-        for (; it != breakpoints_.end() && address == it->address; ++it) {
-            if (!it->value || *it->value == data) {
-                found = true;
-                break;
+
+        // only built once a breakpoint needs it
+        std::optional<gb::ConditionContext> context;
+        bool hit = false;
+        bool stop = false;
+        for (uint32_t i = segment->begin; i < segment->end && !stop; ++i) {
+            const MemoryBreakpointData &breakpoint = breakpoints_[covering_[i]];
+            if (!matchesAccess(breakpoint, data, old_data, write)) {
+                continue;
             }
+            if (breakpoint.condition) {
+                if (!context) {
+                    context = getContext(address, data);
+                }
+                if (!breakpoint.condition->evaluate(*context)) {
+                    continue;
+                }
+            }
+            hit = true;
+            stop = breakpoint.stop;
+        }
+        if (!hit) {
+            return;
         }
 
-        if (found) {
+        if (!context) {
+            context = getContext(address, data);
+        }
+        hits_.push_back(MemoryBreakpointHit{.cycle = context->cycles,
+                                            .pc = context->instruction_address,
+                                            .address = address,
+                                            .old_value = old_data,
+                                            .new_value = data,
+                                            .write = write});
+        if (stop) {
             callback_();
         }
     }
+
+    gb::ConditionContext MemoryBreakpoints::getContext(uint16_t address, uint8_t data) const noexcept {
+        if (get_context_) {
+            return get_context_(address, data);
+        }
+        // without a context only the access itself is known
+        return gb::ConditionContext{.registers = {},
+                                    .cycles = 0,
+                                    .bank = 0,
+                                    .rom_bank = 0,
+                                    .ram_bank = 0,
+                                    .instruction_address = 0,
+                                    .address = address,
+                                    .value = data,
+                                    .peek = {}};
+    }
+
+    static bool matchesAccess(const MemoryBreakpointData &breakpoint, uint8_t data, uint8_t old_data, bool write) {
+        using enum MemoryBreakpointData::BreakOn;
+        switch (breakpoint.break_on) {
+        case READ:
+            if (write) {
+                return false;
+            }
+            break;
+        case WRITE:
+            if (!write) {
+                return false;
+            }
+            break;
+        case CHANGE:
+            if (!write || ((data ^ old_data) & breakpoint.mask) == 0) {
+                return false;
+            }
+            break;
+        case ALWAYS: break;
+        }
+        return !breakpoint.value || (data & breakpoint.mask) == *breakpoint.value;
+    }
 } // namespace emulator
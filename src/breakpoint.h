@@ -2,33 +2,55 @@
 #define GB_EMULATOR_SRC_BREAKPOINT_HDR_
 
 #include "gb/address_bus.h"
+#include "gb/condition.h"
+#include "util/util.h"
 
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <span>
+#include <string_view>
+#include <vector>
 
 namespace emulator {
 
     struct MemoryBreakpointData {
-        enum class BreakOn : uint8_t { ALWAYS = 1, READ = 0, WRITE = 2 };
+        // CHANGE is a write which changes the masked value
+        enum class BreakOn : uint8_t { ALWAYS = 1, READ = 0, WRITE = 2, CHANGE = 3 };
 
+        // first watched address
         uint16_t address = 0;
 
         BreakOn break_on = BreakOn::ALWAYS;
 
-        std::optional<uint8_t> value;
+        // compared to the accessed value with mask applied
+        std::optional<uint8_t> value = std::nullopt;
 
-        bool operator<(MemoryBreakpointData other) const {
+        // checked after the address, the mode and the value match
+        std::optional<gb::BreakpointCondition> condition = std::nullopt;
+
+        // last watched address, only address itself if empty
+        std::optional<uint16_t> end_address = std::nullopt;
+
+        uint8_t mask = 0xff;
+
+        // a hit is always logged, but only stops emulation if this is set
+        bool stop = true;
+
+        uint16_t getEndAddress() const { return end_address.value_or(address); }
+
+        bool operator<(const MemoryBreakpointData &other) const {
             if (address == other.address) {
                 return break_on < other.break_on;
             }
             return address < other.address;
         }
 
-        bool operator==(MemoryBreakpointData other) const {
-            return address == other.address && break_on == other.break_on && value == other.value;
+        bool operator==(const MemoryBreakpointData &other) const {
+            return address == other.address && break_on == other.break_on && value == other.value &&
+                   condition == other.condition && getEndAddress() == other.getEndAddress() && mask == other.mask &&
+                   stop == other.stop;
         }
     };
 
@@ -38,31 +60,74 @@ namespace emulator {
         case ALWAYS: return "Always";
         case READ: return "Read";
         case WRITE: return "Write";
+        case CHANGE: return "Change";
         default: return "";
         }
     }
 
+    // An access matched by at least one memory breakpoint
+    struct MemoryBreakpointHit {
+        uint64_t cycle = 0;
+        // address of the instruction which made the access
+        uint16_t pc = 0;
+        uint16_t address = 0;
+        // the same as new_value for reads
+        uint8_t old_value = 0;
+        uint8_t new_value = 0;
+        bool write = false;
+    };
+
+    constexpr size_t g_memory_hit_log_size = 256;
+
     class MemoryBreakpoints final : public gb::IMemoryObserver {
       public:
-        MemoryBreakpoints(std::function<void()> &&callback) : callback_(std::move(callback)) {}
+        // Gives conditions the state of the emulator at an access, like BasicEmulator::getConditionContext()
+        using ContextGetter = std::function<gb::ConditionContext(uint16_t address, uint8_t value)>;
 
-        void addBreakpoint(MemoryBreakpointData breakpoint) {
-            breakpoints_.insert(std::lower_bound(breakpoints_.begin(), breakpoints_.end(), breakpoint), breakpoint);
-        }
+        // Without get_context conditions only see the accessed address and value, and hits have no PC or cycle
+        MemoryBreakpoints(std::function<void()> &&callback, ContextGetter &&get_context = {})
+            : callback_(std::move(callback)), get_context_(std::move(get_context)) {}
 
-        void removeBreakpoint(MemoryBreakpointData breakpoint);
+        // The bus has to be told about added and removed breakpoints with AddressBus::updateWatchedAddresses().
+        // Throws std::invalid_argument if the end address is before the start
+        void addBreakpoint(const MemoryBreakpointData &breakpoint);
+
+        void removeBreakpoint(const MemoryBreakpointData &breakpoint);
 
         const std::vector<MemoryBreakpointData> &getBreakpoints() const { return breakpoints_; }
 
+        // The most recent hits, oldest first
+        RingBuffer<MemoryBreakpointHit, g_memory_hit_log_size> &getHits() { return hits_; }
+
         void onRead(uint16_t address, uint8_t data) noexcept override;
-        void onWrite(uint16_t address, uint8_t data) noexcept override;
+        void onWrite(uint16_t address, uint8_t data, uint8_t old_data) noexcept override;
 
-        uint16_t minAddress() const noexcept override { return 0; }
-        uint16_t maxAddress() const noexcept override { return uint16_t(-1); }
+        std::span<const gb::MemoryObjectInfo> getWatchedRanges() const noexcept override { return ranges_; }
 
       private:
+        // Addresses covered by the same breakpoints
+        struct Segment {
+            uint16_t min_address = 0;
+            uint16_t max_address = 0;
+            // indices into covering_
+            uint32_t begin = 0;
+            uint32_t end = 0;
+        };
+
+        // Splits the watched addresses into segments at the ends of every breakpoint and merges them into ranges
+        void updateIndex();
+        void onAccess(uint16_t address, uint8_t data, uint8_t old_data, bool write) noexcept;
+        gb::ConditionContext getContext(uint16_t address, uint8_t data) const noexcept;
+
         std::function<void()> callback_;
+        ContextGetter get_context_;
         std::vector<MemoryBreakpointData> breakpoints_;
+        // sorted and disjoint, an access finds its breakpoints with a single binary search
+        std::vector<Segment> segments_;
+        // indices into breakpoints_ of the breakpoints covering each segment
+        std::vector<uint32_t> covering_;
+        std::vector<gb::MemoryObjectInfo> ranges_;
+        RingBuffer<MemoryBreakpointHit, g_memory_hit_log_size> hits_;
     };
 } // namespace emulator
 #endif
@@ -1,12 +1,12 @@
 #ifndef GB_EMULATOR_SRC_DISASSEMBLER_HDR_
 #define GB_EMULATOR_SRC_DISASSEMBLER_HDR_
 
-#include "gb/cpu/cpu.h"
+#include "gb/cpu/trace.h"
 #include <cstdint>
 #include <map>
 namespace emulator {
     struct InstructionAddress {
-        static constexpr uint16_t g_none_bank = uint16_t(-1);
+        static constexpr uint16_t g_none_bank = gb::cpu::g_no_trace_bank;
 
         uint16_t address = 0;
 
@@ -33,20 +33,21 @@ namespace emulator {
     // TODO: this doesn't support self-modifyng code
     class Disassembler {
       public:
-        using Iterator = std::map<InstructionAddress, gb::cpu::Instruction>::iterator;
-        using ConstInerator = std::map<InstructionAddress, gb::cpu::Instruction>::const_iterator;
+        using Iterator = std::map<InstructionAddress, gb::cpu::TraceRecord>::iterator;
+        using ConstInerator = std::map<InstructionAddress, gb::cpu::TraceRecord>::const_iterator;
 
         Disassembler() = default;
 
-        void addInstruction(gb::cpu::Instruction instr, uint16_t bank = InstructionAddress::g_none_bank) {
-            gb::cpu::Instruction &value = disassembly_[InstructionAddress{
-                .address = instr.registers.pc(),
-                .bank = bank,
+        void addInstruction(const gb::cpu::TraceRecord &record) {
+            gb::cpu::TraceRecord &value = disassembly_[InstructionAddress{
+                .address = record.pc,
+                .bank = record.bank,
             }];
-            if (value != instr) {
+            // registers are different every time the instruction is executed
+            if (value.bytes != record.bytes || value.width() != record.width()) {
                 dirty_ = true;
             }
-            value = instr;
+            value = record;
         }
 
         Iterator begin() { return disassembly_.begin(); }
@@ -68,7 +69,7 @@ namespace emulator {
         void clearDirtyFlag() { dirty_ = false; }
 
       private:
-        std::map<InstructionAddress, gb::cpu::Instruction> disassembly_;
+        std::map<InstructionAddress, gb::cpu::TraceRecord> disassembly_;
         bool dirty_ = true;
     };
 } // namespace emulator
@@ -0,0 +1,75 @@
+#include "frame_limiter.h"
+#include "gb/emulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+namespace emulator {
+
+    void FrameLimiter::setSpeed(double multiplier) {
+        if (multiplier <= 0) {
+            return;
+        }
+        speed_ = multiplier;
+        reset();
+    }
+
+    void FrameLimiter::reset() {
+        deadline_ = Clock::now();
+        last_wakeup_ = deadline_;
+        fraction_ns_ = 0;
+        lateness_ns_.clear();
+        speed_samples_.clear();
+        jitter_ = JitterStats{};
+    }
+
+    void FrameLimiter::wait(uint64_t emulated_cycles) {
+        double ns = double(emulated_cycles) * 1e9 / (double(gb::g_cpu_frequency) * speed_) + fraction_ns_;
+        double whole_ns = std::floor(ns);
+        fraction_ns_ = ns - whole_ns;
+        deadline_ += std::chrono::nanoseconds(int64_t(whole_ns));
+
+        Clock::time_point now = Clock::now();
+        if (now - deadline_ > g_max_lag) {
+            // the host can't keep up (or emulation was stopped), don't try to run faster to catch up
+            deadline_ = now;
+            fraction_ns_ = 0;
+        }
+
+        if (deadline_ - now > g_spin_threshold) {
+            std::this_thread::sleep_for(deadline_ - now - g_spin_threshold);
+        }
+        // sleep_for is too coarse on most systems, so the last bit is spent spinning
+        while ((now = Clock::now()) < deadline_) {
+        }
+
+        updateJitter(now - deadline_, emulated_cycles, now);
+    }
+
+    void FrameLimiter::updateJitter(Clock::duration lateness, uint64_t emulated_cycles, Clock::time_point now) {
+        lateness_ns_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(lateness).count());
+        double host_seconds = std::chrono::duration<double>(now - last_wakeup_).count();
+        last_wakeup_ = now;
+        if (host_seconds > 0) {
+            speed_samples_.push_back(double(emulated_cycles) / double(gb::g_cpu_frequency) / host_seconds);
+        }
+
+        int64_t total = 0;
+        int64_t max = 0;
+        for (int64_t sample : lateness_ns_) {
+            total += sample;
+            max = std::max(max, sample);
+        }
+        double speed_total = 0;
+        for (double sample : speed_samples_) {
+            speed_total += sample;
+        }
+
+        jitter_.average_us = double(total) / double(lateness_ns_.size()) / 1000.0;
+        jitter_.max_us = double(max) / 1000.0;
+        jitter_.measured_speed = speed_samples_.size() == 0 ? 0 : speed_total / double(speed_samples_.size());
+    }
+} // namespace emulator
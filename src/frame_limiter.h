@@ -0,0 +1,60 @@
+#ifndef GB_EMULATOR_SRC_FRAME_LIMITER_HDR_
+#define GB_EMULATOR_SRC_FRAME_LIMITER_HDR_
+
+#include "util/util.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace emulator {
+
+    // sleeping is only trusted up to this much before the deadline, the rest is spent spinning
+    constexpr std::chrono::microseconds g_spin_threshold{2000};
+    // if the host falls behind by more than this, pacing restarts from the current time instead of catching up
+    constexpr std::chrono::milliseconds g_max_lag{100};
+    constexpr size_t g_jitter_window = 120;
+
+    struct JitterStats {
+        // how late the limiter woke up relative to the deadline, in microseconds
+        double average_us = 0;
+        double max_us = 0;
+        // emulated time / host time over the jitter window
+        double measured_speed = 0;
+    };
+
+    // Paces emulation by emulated time: every emulated cycle advances a host-time deadline
+    // by 1 / (g_cpu_frequency * speed) seconds, and wait() blocks until that deadline
+    class FrameLimiter {
+      public:
+        using Clock = std::chrono::steady_clock;
+
+        FrameLimiter() { reset(); }
+
+        void setSpeed(double multiplier);
+        double getSpeed() const { return speed_; }
+
+        // blocks until host time catches up with emulated time after emulated_cycles more cycles
+        void wait(uint64_t emulated_cycles);
+
+        // forget accumulated time, e.g. after emulation was paused
+        void reset();
+
+        const JitterStats &getJitter() const { return jitter_; }
+
+      private:
+        void updateJitter(Clock::duration lateness, uint64_t emulated_cycles, Clock::time_point now);
+
+        Clock::time_point deadline_;
+        Clock::time_point last_wakeup_;
+        // part of a nanosecond which was not added to deadline_ yet
+        double fraction_ns_ = 0;
+        double speed_ = 1.0;
+
+        RingBuffer<int64_t, g_jitter_window> lateness_ns_;
+        RingBuffer<double, g_jitter_window> speed_samples_;
+        JitterStats jitter_;
+    };
+} // namespace emulator
+
+#endif
@@ -1,4 +1,7 @@
 #include "gb/address_bus.h"
+#include "gb/config.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/fault.h"
 #include "gb/gb_input.h"
 #include "gb/interrupt_register.h"
 #include "gb/memory/basic_components.h"
@@ -10,40 +13,54 @@
 #include <cstring>
 #include <exception>
 #include <iostream>
-#include <sstream>
-#include <stdexcept>
-#include <string>
 
 namespace gb {
 
-    bool less(const IMemoryObserver *mem, uint16_t address) { return mem->maxAddress() < address; }
-
-    uint8_t AddressBus::read(uint16_t address) const {
+    template <EmulatorConfig CONFIG>
+    uint8_t AddressBus<CONFIG>::readDecoded(uint16_t address) const noexcept {
+        if (sync_ && isPeripheralAddress(address)) {
+            sync_->syncPeripherals();
+        }
         std::optional<uint8_t> data = peek(address);
 
-        if (!data) {
-            throw std::invalid_argument("trying to read from invalid address");
+        if (!data) [[unlikely]] {
+            fault_.raise(Fault::UNMAPPED_MEMORY, address);
+            return 0xff;
         }
 
-        if (observer_) {
-            observer_->onRead(address, *data);
+        if (isWatched(address)) [[unlikely]] {
+            notifyRead(address, *data);
         }
 
         return *data;
     }
 
-    void AddressBus::write(uint16_t address, uint8_t data) {
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::writeDecoded(uint16_t address, uint8_t data) noexcept {
+        if (sync_ && isPeripheralAddress(address)) {
+            sync_->syncPeripherals();
+        }
+        // observers are told which value the write replaced
+        uint8_t old_data = 0;
+        if (isWatched(address)) [[unlikely]] {
+            old_data = peek(address).value_or(0xff);
+        }
         if (address <= g_memory_rom.max_address) {
             cartridge_.writeROM(address, data);
+            if (block_cache_) {
+                block_cache_->resetCursor();
+            }
         } else if (address <= g_memory_vram.max_address) {
             ppu_.writeVRAM(address, data);
         } else if (address <= g_memory_cartridge_ram.max_address) {
             cartridge_.writeRAM(address, data);
         } else if (address <= g_memory_wram.max_address) {
             wram_[address - g_memory_wram.min_address] = data;
+            invalidateCode(address);
         } else if (address <= g_memory_mirror.max_address) {
             // only lower 13 bits of the address are used
             wram_[address & 0x1fff] = data;
+            invalidateCode(g_memory_wram.min_address + (address & 0x1fff));
         } else if (address <= g_memory_oam.max_address) {
             ppu_.writeOAM(address, data);
         } else if (address <= g_memory_forbidden.max_address) {
@@ -63,40 +80,142 @@ namespace gb {
             unused_io_[address - g_memory_io_unused.min_address] = data;
         } else if (address <= g_memory_hram.max_address) {
             hram_[address - g_memory_hram.min_address] = data;
+            invalidateCode(address);
         } else {
-            throw std::invalid_argument("trying to access invalid memory");
+            fault_.raise(Fault::UNMAPPED_MEMORY, address);
+            return;
         }
 
-        if (observer_) {
-            observer_->onWrite(address, data);
+        if (isWatched(address)) [[unlikely]] {
+            notifyWrite(address, data, old_data);
         }
     }
 
-    void AddressBus::reset() {
-        // values set according to mooneye test suite, see accepnance/boot_hwio_dmg0.gb
-        // initial values for all implemented hardware are reset by corresponding class
-        std::memcpy(unused_io_.data(), g_io_initail_values.data(), g_io_initail_values.size());
-        uint8_t *ptr = unused_io_.data() + g_io_initail_values.size();
-        memset(ptr, 0xff, unused_io_.data() + unused_io_.size() - ptr);
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::addObserver(IMemoryObserver &observer)
+        requires(CONFIG.observers)
+    {
+        // the ranges are copied by updateWatchedAddresses()
+        observers_.push_back(ObserverEntry{.observer = &observer, .ranges = {}});
+        updateWatchedAddresses();
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::removeObserver(IMemoryObserver &observer) {
+        std::erase_if(observers_, [&observer](const ObserverEntry &entry) { return entry.observer == &observer; });
+        updateWatchedAddresses();
     }
 
-    std::string AddressBus::getErrorDescription(uint16_t address, int value) const {
-        std::stringstream err;
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::updateWatchedAddresses() {
+        if (!observers_.empty() && !watched_) {
+            watched_ = std::make_unique<WatchedAddresses>();
+        }
+        if (watched_) {
+            watched_->reset();
+        }
+        watched_pages_.reset();
+        for (ObserverEntry &entry : observers_) {
+            // assign() reuses the capacity of the ranges copied before
+            std::span<const MemoryObjectInfo> ranges = entry.observer->getWatchedRanges();
+            entry.ranges.assign(ranges.begin(), ranges.end());
+            for (MemoryObjectInfo range : ranges) {
+                for (uint32_t address = range.min_address; address <= range.max_address; ++address) {
+                    watched_->set(address);
+                    watched_pages_.set(address / g_memory_page_size);
+                }
+            }
+        }
+        setObserversMuted(muted_);
+    }
 
-        if (value == -1) {
-            err << "Attempting to read from invalid memory address: ";
-            toHexOutput(err, address);
-        } else {
-            err << "Attempting to write to invalid memory address: ";
-            toHexOutput(err, address);
-            err << ". Data: ";
-            toHexOutput(err, value);
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::markCode(size_t page) noexcept {
+        code_pages_.set(page);
+        pages_->write[page] = nullptr;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::unmarkCode(size_t page) noexcept {
+        code_pages_.reset(page);
+        if (g_memory_wram.isInRange(uint16_t(page * g_memory_page_size))) {
+            updateWRAMPage(page - g_memory_wram.min_address / g_memory_page_size);
         }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::unmarkAllCode() noexcept {
+        code_pages_.reset();
+        updatePages();
+    }
 
-        return err.str();
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::updatePages() noexcept {
+        for (size_t i = 0; i < g_memory_wram.size / g_memory_page_size; ++i) {
+            updateWRAMPage(i);
+        }
+        updateCartridgePages();
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::updateWRAMPage(size_t index) noexcept {
+        constexpr size_t wram_first_page = g_memory_wram.min_address / g_memory_page_size;
+        constexpr size_t mirror_first_page = g_memory_mirror.min_address / g_memory_page_size;
+        constexpr size_t mirror_pages = g_memory_mirror.size / g_memory_page_size;
+        uint8_t *memory = wram_.data() + index * g_memory_page_size;
+        size_t page = wram_first_page + index;
+        pages_->read[page] = isPageWatched(page) ? nullptr : memory;
+        pages_->write[page] = isPageWatched(page) || code_pages_.test(page) ? nullptr : memory;
+        if (index < mirror_pages) {
+            pages_->read[mirror_first_page + index] = isPageWatched(mirror_first_page + index) ? nullptr : memory;
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::updateCartridgePages() noexcept {
+        for (size_t page = g_memory_rom.min_address / g_memory_page_size;
+             page <= g_memory_rom.max_address / g_memory_page_size; ++page) {
+            uint16_t address = uint16_t(page * g_memory_page_size);
+            pages_->read[page] = isPageWatched(page) ? nullptr : cartridge_.getROMPage(address);
+        }
+        for (size_t page = g_memory_cartridge_ram.min_address / g_memory_page_size;
+             page <= g_memory_cartridge_ram.max_address / g_memory_page_size; ++page) {
+            uint16_t address = uint16_t(page * g_memory_page_size);
+            uint8_t *memory = isPageWatched(page) ? nullptr : cartridge_.getRAMPage(address);
+            pages_->read[page] = memory;
+            pages_->write[page] = memory;
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::notifyRead(uint16_t address, uint8_t data) const noexcept {
+        for (const ObserverEntry &entry : observers_) {
+            if (entry.watches(address)) {
+                entry.observer->onRead(address, data);
+            }
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::notifyWrite(uint16_t address, uint8_t data, uint8_t old_data) const noexcept {
+        for (const ObserverEntry &entry : observers_) {
+            if (entry.watches(address)) {
+                entry.observer->onWrite(address, data, old_data);
+            }
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void AddressBus<CONFIG>::reset() {
+        // values set according to mooneye test suite, see accepnance/boot_hwio_dmg0.gb
+        // initial values for all implemented hardware are reset by corresponding class
+        std::memcpy(unused_io_.data(), g_io_initail_values.data(), g_io_initail_values.size());
+        uint8_t *ptr = unused_io_.data() + g_io_initail_values.size();
+        memset(ptr, 0xff, unused_io_.data() + unused_io_.size() - ptr);
     }
 
-    std::optional<uint8_t> AddressBus::peek(uint16_t address) const {
+    template <EmulatorConfig CONFIG>
+    std::optional<uint8_t> AddressBus<CONFIG>::peek(uint16_t address) const noexcept {
         if (address <= g_memory_rom.max_address) {
             return cartridge_.readROM(address);
         } else if (address <= g_memory_vram.max_address) {
@@ -133,4 +252,6 @@ namespace gb {
         return {};
     }
 
+    template class AddressBus<g_full_config>;
+    template class AddressBus<g_headless_config>;
 } // namespace gb
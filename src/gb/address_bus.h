@@ -1,6 +1,9 @@
 #ifndef GB_EMULATOR_SRC_GB_ADDRESS_BUS_HDR_
 #define GB_EMULATOR_SRC_GB_ADDRESS_BUS_HDR_
 
+#include "gb/config.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/fault.h"
 #include "gb/gb_input.h"
 #include "gb/interrupt_register.h"
 #include "gb/memory/basic_components.h"
@@ -8,25 +11,41 @@
 #include "gb/ppu/ppu.h"
 #include "gb/timer.h"
 
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <cstdint>
-#include <string>
+#include <memory>
+#include <span>
 #include <vector>
 
 namespace gb {
+    // Notified about accesses to the addresses it watches, other accesses don't cost a virtual call
     class IMemoryObserver {
       public:
         virtual void onRead(uint16_t address, uint8_t data) noexcept {};
-        virtual void onWrite(uint16_t address, uint8_t data) noexcept {};
-        virtual uint16_t minAddress() const noexcept = 0;
-        virtual uint16_t maxAddress() const noexcept = 0;
-
-        bool isInRange(uint16_t address) const { return address >= minAddress() && address <= maxAddress(); }
+        // old_data is what a read returned right before the write
+        virtual void onWrite(uint16_t address, uint8_t data, uint8_t old_data) noexcept {};
+        // Read by the bus when the observer is added and by AddressBus::updateWatchedAddresses()
+        virtual std::span<const MemoryObjectInfo> getWatchedRanges() const noexcept = 0;
 
       protected:
         ~IMemoryObserver() = default;
     };
 
+    // A bit per address, set if any observer watches it
+    using WatchedAddresses = std::bitset<0x10000>;
+
+    // Notified before the CPU accesses memory owned by the PPU or the timer, so updates deferred by the emulator can
+    // be applied first
+    class IPeripheralSync {
+      public:
+        virtual void syncPeripherals() noexcept = 0;
+
+      protected:
+        ~IPeripheralSync() = default;
+    };
+
     constexpr std::array<uint8_t, 77> g_io_initail_values = {0xcf, 0,    0x7e, 0xff, 0x19, 0,    0,    0xf8, 0xff, 0xff,
                                                              0xff, 0xff, 0xff, 0xff, 0xff, 0xe1, 0x80, 0xbf, 0xf3, 0xff,
                                                              0xbf, 0xff, 0x3f, 0,    0xff, 0xbf, 0x7f, 0xff, 0x9f, 0xff,
@@ -36,28 +55,132 @@ namespace gb {
                                                              0,    0,    0,    0,    0,    0x91, 0x83, 0,    0,    1,
                                                              0,    0xff, 0xfc, 0xff, 0xff, 0,    0};
 
-    class AddressBus {
+    static_assert(cpu::g_code_page_size == g_memory_page_size, "code pages are taken out of the page table");
+
+    template <EmulatorConfig CONFIG>
+    class AddressBus final : ICartridgeMappingListener, cpu::ICodePages {
       public:
-        AddressBus(WRAM wram, UnusedIO unused_io, HRAM hram, Cartridge &cartridge, PPU &ppu, Timer &timer, Input &input,
-                   InterruptRegister &interrupt_enable, InterruptRegister &interrupt_flags)
+        // Accesses to unmapped memory are recorded in fault, reads from it give 0xff
+        AddressBus(WRAM wram, UnusedIO unused_io, HRAM hram, Cartridge &cartridge, PPU<CONFIG> &ppu, Timer &timer,
+                   Input &input, InterruptRegister &interrupt_enable, InterruptRegister &interrupt_flags,
+                   FaultState &fault)
             : wram_(wram), unused_io_(unused_io), hram_(hram), cartridge_(cartridge),
               interrupt_enable_(interrupt_enable), interrupt_flags_(interrupt_flags), timer_(timer), ppu_(ppu),
-              input_(input) {}
-
-        void setObserver(IMemoryObserver &observer) { observer_ = &observer; }
-        void removeObserver() { observer_ = nullptr; }
-
-        uint8_t read(uint16_t address) const;
-        void write(uint16_t address, uint8_t data);
+              input_(input), fault_(fault) {
+            cartridge_.setMappingListener(this);
+            updatePages();
+        }
+        AddressBus(const AddressBus &) = delete;
+        AddressBus &operator=(const AddressBus &) = delete;
+        ~AddressBus() { cartridge_.setMappingListener(nullptr); }
+
+        // Observers are notified in the order they were added
+        void addObserver(IMemoryObserver &observer)
+            requires(CONFIG.observers);
+        void removeObserver(IMemoryObserver &observer);
+        // Must be called after an observer changes its watched ranges
+        void updateWatchedAddresses();
+        // Muted observers aren't notified, e.g. during speculative runs which are discarded. Unlike removing and
+        // adding them again, this doesn't touch the watched addresses
+        void setObserversMuted(bool muted) {
+            muted_ = muted;
+            active_watched_ = muted_ || observers_.empty() ? nullptr : watched_.get();
+            updatePages();
+        }
+        bool hasObserver() const { return CONFIG.observers && active_watched_; }
+        bool isWatched(uint16_t address) const {
+            return CONFIG.observers && active_watched_ && (*active_watched_)[address];
+        }
+
+        void setPeripheralSync(IPeripheralSync *sync) { sync_ = sync; }
+
+        // The cache is notified about writes to pages it marked as containing code and about ROM bank switches
+        void setBlockCache(cpu::BlockCache *cache) { block_cache_ = cache; }
+        cpu::ICodePages &getCodePages() { return *this; }
+
+        const Cartridge &getCartridge() const { return cartridge_; }
+
+        // Pages of plain memory are accessed through the page table, everything else is decoded by address
+        uint8_t read(uint16_t address) const noexcept {
+            if (const uint8_t *page = pages_->read[address / g_memory_page_size]) [[likely]] {
+                return page[address % g_memory_page_size];
+            }
+            return readDecoded(address);
+        }
+        void write(uint16_t address, uint8_t data) noexcept {
+            if (uint8_t *page = pages_->write[address / g_memory_page_size]) [[likely]] {
+                page[address % g_memory_page_size] = data;
+                return;
+            }
+            writeDecoded(address, data);
+        }
+
+        const MemoryPages &getPages() const { return *pages_; }
 
         void reset();
 
-        std::optional<uint8_t> peek(uint16_t address) const;
+        // memory is not included, it is saved by its owner
+        void saveState(StateWriter &writer) const { writer.write(data_); }
+        void loadState(StateReader &reader) { reader.read(data_); }
+        void checkState(StateReader &reader) const { reader.skip(sizeof(data_)); }
 
-      private:
-        std::string getErrorDescription(uint16_t address, int value = -1) const;
+        // Empty for unmapped memory, doesn't record a fault
+        std::optional<uint8_t> peek(uint16_t address) const noexcept;
 
-        IMemoryObserver *observer_ = nullptr;
+      private:
+        uint8_t readDecoded(uint16_t address) const noexcept;
+        void writeDecoded(uint16_t address, uint8_t data) noexcept;
+
+        void onMappingChanged() noexcept override { updateCartridgePages(); }
+        // pages holding cached code are only written through writeDecoded(), which invalidates the code
+        void markCode(size_t page) noexcept override;
+        void unmarkCode(size_t page) noexcept override;
+        void unmarkAllCode() noexcept override;
+        void updatePages() noexcept;
+        // index is the WRAM page, its mirror is only read through the table
+        void updateWRAMPage(size_t index) noexcept;
+        void updateCartridgePages() noexcept;
+        bool isPageWatched(size_t page) const { return active_watched_ && watched_pages_.test(page); }
+
+        // VRAM, OAM and IO registers, IE is owned by the emulator itself
+        static bool isPeripheralAddress(uint16_t address) {
+            return g_memory_vram.isInRange(address) ||
+                   (address >= g_memory_oam.min_address && address < g_memory_hram.min_address);
+        }
+
+        void invalidateCode(uint16_t address) {
+            if (code_pages_.test(address / cpu::g_code_page_size)) [[unlikely]] {
+                block_cache_->invalidatePage(address);
+            }
+        }
+
+        struct ObserverEntry {
+            IMemoryObserver *observer = nullptr;
+            // copied from the observer, so dispatch doesn't need a virtual call per observer
+            std::vector<MemoryObjectInfo> ranges;
+
+            bool watches(uint16_t address) const {
+                return std::ranges::any_of(ranges,
+                                           [address](MemoryObjectInfo range) { return range.isInRange(address); });
+            }
+        };
+
+        void notifyRead(uint16_t address, uint8_t data) const noexcept;
+        void notifyWrite(uint16_t address, uint8_t data, uint8_t old_data) const noexcept;
+
+        // allocated separately, it would take up 4 KiB inside the emulator
+        std::unique_ptr<MemoryPages> pages_ = std::make_unique<MemoryPages>();
+        IPeripheralSync *sync_ = nullptr;
+        cpu::BlockCache *block_cache_ = nullptr;
+        std::bitset<cpu::g_code_page_count> code_pages_;
+        // allocated with the first observer and kept, so a bus which never had one doesn't carry 8 KiB of zeroes
+        std::unique_ptr<WatchedAddresses> watched_;
+        // watched_ while there are observers and they aren't muted, null otherwise
+        const WatchedAddresses *active_watched_ = nullptr;
+        // pages of watched_ holding any watched address, they are left out of the page table
+        std::bitset<g_memory_page_count> watched_pages_;
+        bool muted_ = false;
+        std::vector<ObserverEntry> observers_;
 
         WRAM wram_;
         UnusedIO unused_io_;
@@ -67,12 +190,16 @@ namespace gb {
         InterruptRegister &interrupt_enable_;
         InterruptRegister &interrupt_flags_;
         Timer &timer_;
-        PPU &ppu_;
+        PPU<CONFIG> &ppu_;
         Input &input_;
+        FaultState &fault_;
 
         uint8_t data_ = 0;
     };
 
+    extern template class AddressBus<g_full_config>;
+    extern template class AddressBus<g_headless_config>;
+
 } // namespace gb
 
 #endif
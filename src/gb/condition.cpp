@@ -0,0 +1,403 @@
+#include "gb/condition.h"
+#include "gb/cpu/cpu_utils.h"
+#include "gb/emulator.h"
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace gb {
+
+    // Recursive descent parser which emits the bytecode of each subexpression as soon as it's parsed
+    class ConditionCompiler {
+        using Opcode = BreakpointCondition::Opcode;
+        using Variable = BreakpointCondition::Variable;
+
+      public:
+        explicit ConditionCompiler(std::string_view expression) : expression_(expression) {}
+
+        BreakpointCondition compile() {
+            skipSpaces();
+            if (position_ == expression_.size()) {
+                fail("empty condition");
+            }
+            parseOr();
+            if (position_ != expression_.size()) {
+                fail("unexpected character");
+            }
+            result_.expression_ = expression_;
+            return std::move(result_);
+        }
+
+      private:
+        // || and && leave 0 or 1 on the stack and skip their right side if the left one decides the result
+        void parseOr() {
+            parseAnd();
+            while (accept("||")) {
+                emitShortCircuit(Opcode::JUMP_IF_TRUE, &ConditionCompiler::parseAnd);
+            }
+        }
+
+        void parseAnd() {
+            parseComparison();
+            while (accept("&&")) {
+                emitShortCircuit(Opcode::JUMP_IF_FALSE, &ConditionCompiler::parseComparison);
+            }
+        }
+
+        void emitShortCircuit(Opcode jump, void (ConditionCompiler::*parse_right)()) {
+            emit(Opcode::BOOL);
+            size_t jump_index = result_.code_.size();
+            emit(jump);
+            emit(Opcode::POP);
+            (this->*parse_right)();
+            emit(Opcode::BOOL);
+            result_.code_[jump_index].operand = uint16_t(result_.code_.size());
+        }
+
+        // Comparisons don't chain, "a < b < c" is rejected
+        void parseComparison() {
+            parseBitOr();
+            static constexpr std::array<std::pair<std::string_view, Opcode>, 6> g_comparisons{{
+                {"==", Opcode::EQUAL},
+                {"!=", Opcode::NOT_EQUAL},
+                {"<=", Opcode::LESS_EQUAL},
+                {">=", Opcode::GREATER_EQUAL},
+                {"<", Opcode::LESS},
+                {">", Opcode::GREATER},
+            }};
+            for (auto [token, opcode] : g_comparisons) {
+                if (accept(token)) {
+                    parseBitOr();
+                    emit(opcode);
+                    return;
+                }
+            }
+        }
+
+        void parseBitOr() {
+            parseBitXor();
+            while (peek() == '|' && peek(1) != '|') {
+                accept("|");
+                parseBitXor();
+                emit(Opcode::OR);
+            }
+        }
+
+        void parseBitXor() {
+            parseBitAnd();
+            while (accept("^")) {
+                parseBitAnd();
+                emit(Opcode::XOR);
+            }
+        }
+
+        void parseBitAnd() {
+            parseSum();
+            while (peek() == '&' && peek(1) != '&') {
+                accept("&");
+                parseSum();
+                emit(Opcode::AND);
+            }
+        }
+
+        void parseSum() {
+            parseUnary();
+            while (true) {
+                if (accept("+")) {
+                    parseUnary();
+                    emit(Opcode::ADD);
+                } else if (accept("-")) {
+                    parseUnary();
+                    emit(Opcode::SUB);
+                } else {
+                    return;
+                }
+            }
+        }
+
+        void parseUnary() {
+            enterNesting();
+            if (peek() == '!' && peek(1) != '=') {
+                accept("!");
+                parseUnary();
+                emit(Opcode::NOT);
+            } else if (accept("~")) {
+                parseUnary();
+                emit(Opcode::COMPLEMENT);
+            } else {
+                parsePrimary();
+            }
+            --nesting_;
+        }
+
+        void parsePrimary() {
+            if (accept("(")) {
+                parseOr();
+                expect(")");
+            } else if (accept("[")) {
+                parseOr();
+                expect("]");
+                emit(Opcode::READ);
+            } else if (std::isdigit(static_cast<unsigned char>(peek())) || peek() == '$') {
+                emitConstant(parseNumber());
+            } else if (std::isalpha(static_cast<unsigned char>(peek())) || peek() == '_') {
+                emit(Opcode::LOAD, uint16_t(parseVariable()));
+            } else {
+                fail(position_ == expression_.size() ? "unexpected end of condition" : "unexpected character");
+            }
+        }
+
+        uint64_t parseNumber() {
+            unsigned base = 10;
+            if (peek() == '$') {
+                base = 16;
+                ++position_;
+            } else if (peek() == '0' && (peek(1) == 'x' || peek(1) == 'X')) {
+                base = 16;
+                position_ += 2;
+            }
+            size_t start = position_;
+            uint64_t value = 0;
+            while (std::isxdigit(static_cast<unsigned char>(peek()))) {
+                unsigned digit = std::isdigit(static_cast<unsigned char>(peek()))
+                                     ? unsigned(peek() - '0')
+                                     : unsigned(std::tolower(static_cast<unsigned char>(peek())) - 'a' + 10);
+                if (digit >= base) {
+                    break;
+                }
+                if (value > (std::numeric_limits<uint64_t>::max() - digit) / base) {
+                    fail("number is too large");
+                }
+                value = value * base + digit;
+                ++position_;
+            }
+            if (position_ == start || std::isalnum(static_cast<unsigned char>(peek()))) {
+                fail("malformed number");
+            }
+            skipSpaces();
+            return value;
+        }
+
+        Variable parseVariable() {
+            static constexpr std::array<std::pair<std::string_view, Variable>, 25> g_variables{{
+                {"a", Variable::A},
+                {"f", Variable::F},
+                {"b", Variable::B},
+                {"c", Variable::C},
+                {"d", Variable::D},
+                {"e", Variable::E},
+                {"h", Variable::H},
+                {"l", Variable::L},
+                {"af", Variable::AF},
+                {"bc", Variable::BC},
+                {"de", Variable::DE},
+                {"hl", Variable::HL},
+                {"sp", Variable::SP},
+                {"pc", Variable::PC},
+                {"zf", Variable::ZF},
+                {"nf", Variable::NF},
+                {"hf", Variable::HF},
+                {"cf", Variable::CF},
+                {"cycles", Variable::CYCLES},
+                {"frame", Variable::FRAME},
+                {"bank", Variable::BANK},
+                {"rom_bank", Variable::ROM_BANK},
+                {"ram_bank", Variable::RAM_BANK},
+                {"address", Variable::ADDRESS},
+                {"value", Variable::VALUE},
+            }};
+            size_t start = position_;
+            std::string name;
+            while (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_') {
+                name += char(std::tolower(static_cast<unsigned char>(peek())));
+                ++position_;
+            }
+            for (auto [variable_name, variable] : g_variables) {
+                if (name == variable_name) {
+                    skipSpaces();
+                    return variable;
+                }
+            }
+            position_ = start;
+            fail("unknown name");
+        }
+
+        void emitConstant(uint64_t value) {
+            if (value <= std::numeric_limits<uint16_t>::max()) {
+                emit(Opcode::PUSH, uint16_t(value));
+                return;
+            }
+            emit(Opcode::PUSH_WIDE, uint16_t(result_.constants_.size()));
+            result_.constants_.push_back(value);
+        }
+
+        // Keeps track of the stack depth, so evaluation can use a fixed-size stack without checks
+        void emit(Opcode opcode, uint16_t operand = 0) {
+            switch (opcode) {
+            case Opcode::PUSH:
+            case Opcode::PUSH_WIDE:
+            case Opcode::LOAD: ++depth_; break;
+            case Opcode::READ:
+            case Opcode::NOT:
+            case Opcode::COMPLEMENT:
+            case Opcode::BOOL:
+            case Opcode::JUMP_IF_FALSE:
+            case Opcode::JUMP_IF_TRUE: break;
+            default: --depth_; break;
+            }
+            if (depth_ > BreakpointCondition::g_max_stack_depth) {
+                fail("condition is too complex");
+            }
+            // jump targets and constant indices have to fit in an operand
+            if (result_.code_.size() == std::numeric_limits<uint16_t>::max()) {
+                fail("condition is too long");
+            }
+            result_.code_.push_back(BreakpointCondition::Instruction{.opcode = opcode, .operand = operand});
+        }
+
+        // Parentheses and unary operators don't use the stack, but still recurse
+        void enterNesting() {
+            if (++nesting_ > g_max_nesting) {
+                fail("condition is too complex");
+            }
+        }
+
+        char peek(size_t offset = 0) const {
+            return position_ + offset < expression_.size() ? expression_[position_ + offset] : '\0';
+        }
+
+        bool accept(std::string_view token) {
+            if (expression_.substr(position_, token.size()) != token) {
+                return false;
+            }
+            position_ += token.size();
+            skipSpaces();
+            return true;
+        }
+
+        void expect(std::string_view token) {
+            if (!accept(token)) {
+                fail("expected '" + std::string(token) + "'");
+            }
+        }
+
+        void skipSpaces() {
+            while (std::isspace(static_cast<unsigned char>(peek()))) {
+                ++position_;
+            }
+        }
+
+        [[noreturn]] void fail(const std::string &message) const {
+            throw std::invalid_argument(message + " at position " + std::to_string(position_));
+        }
+
+        static constexpr size_t g_max_nesting = 64;
+
+        std::string_view expression_;
+        size_t position_ = 0;
+        size_t depth_ = 0;
+        size_t nesting_ = 0;
+        BreakpointCondition result_;
+    };
+
+    BreakpointCondition BreakpointCondition::compile(std::string_view expression) {
+        return ConditionCompiler(expression).compile();
+    }
+
+    bool BreakpointCondition::evaluate(const ConditionContext &context) const noexcept {
+        if (code_.empty()) {
+            return true;
+        }
+        // compile() guarantees the depth, and that every operator has its operands
+        std::array<uint64_t, g_max_stack_depth> stack;
+        size_t size = 0;
+        size_t ip = 0;
+        while (ip < code_.size()) {
+            Instruction instruction = code_[ip++];
+            switch (instruction.opcode) {
+            case Opcode::PUSH: stack[size++] = instruction.operand; break;
+            case Opcode::PUSH_WIDE: stack[size++] = constants_[instruction.operand]; break;
+            case Opcode::LOAD: stack[size++] = load(Variable(instruction.operand), context); break;
+            case Opcode::READ: {
+                uint64_t &top = stack[size - 1];
+                std::optional<uint8_t> value = context.peek ? context.peek(uint16_t(top)) : std::nullopt;
+                top = value ? *value : 0xff;
+                break;
+            }
+            case Opcode::NOT: stack[size - 1] = stack[size - 1] == 0; break;
+            case Opcode::COMPLEMENT: stack[size - 1] = ~stack[size - 1]; break;
+            case Opcode::BOOL: stack[size - 1] = stack[size - 1] != 0; break;
+            case Opcode::JUMP_IF_FALSE:
+                if (stack[size - 1] == 0) {
+                    ip = instruction.operand;
+                }
+                break;
+            case Opcode::JUMP_IF_TRUE:
+                if (stack[size - 1] != 0) {
+                    ip = instruction.operand;
+                }
+                break;
+            case Opcode::POP: --size; break;
+            default: {
+                uint64_t rhs = stack[--size];
+                uint64_t &lhs = stack[size - 1];
+                switch (instruction.opcode) {
+                case Opcode::ADD: lhs += rhs; break;
+                case Opcode::SUB: lhs -= rhs; break;
+                case Opcode::AND: lhs &= rhs; break;
+                case Opcode::OR: lhs |= rhs; break;
+                case Opcode::XOR: lhs ^= rhs; break;
+                case Opcode::EQUAL: lhs = lhs == rhs; break;
+                case Opcode::NOT_EQUAL: lhs = lhs != rhs; break;
+                case Opcode::LESS: lhs = lhs < rhs; break;
+                case Opcode::LESS_EQUAL: lhs = lhs <= rhs; break;
+                case Opcode::GREATER: lhs = lhs > rhs; break;
+                case Opcode::GREATER_EQUAL: lhs = lhs >= rhs; break;
+                default: break;
+                }
+                break;
+            }
+            }
+        }
+        return stack[0] != 0;
+    }
+
+    uint64_t BreakpointCondition::load(Variable variable, const ConditionContext &context) noexcept {
+        const cpu::RegisterFile &registers = context.registers;
+        switch (variable) {
+        case Variable::A: return registers.a();
+        case Variable::F: return registers.f();
+        case Variable::B: return registers.b();
+        case Variable::C: return registers.c();
+        case Variable::D: return registers.d();
+        case Variable::E: return registers.e();
+        case Variable::H: return registers.h();
+        case Variable::L: return registers.l();
+        case Variable::AF: return registers.af();
+        case Variable::BC: return registers.bc();
+        case Variable::DE: return registers.de();
+        case Variable::HL: return registers.hl();
+        case Variable::SP: return registers.sp;
+        case Variable::PC: return registers.pc();
+        case Variable::ZF: return registers.getFlag(cpu::Flags::ZERO);
+        case Variable::NF: return registers.getFlag(cpu::Flags::NEGATIVE);
+        case Variable::HF: return registers.getFlag(cpu::Flags::HALF_CARRY);
+        case Variable::CF: return registers.getFlag(cpu::Flags::CARRY);
+        case Variable::CYCLES: return context.cycles;
+        case Variable::FRAME: return context.cycles / g_cycles_per_frame;
+        case Variable::BANK: return context.bank;
+        case Variable::ROM_BANK: return context.rom_bank;
+        case Variable::RAM_BANK: return context.ram_bank;
+        case Variable::ADDRESS: return context.address;
+        case Variable::VALUE: return context.value;
+        }
+        return 0;
+    }
+} // namespace gb
@@ -0,0 +1,140 @@
+#ifndef GB_EMULATOR_SRC_GB_CONDITION_HDR_
+#define GB_EMULATOR_SRC_GB_CONDITION_HDR_
+
+#include "gb/cpu/cpu_utils.h"
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gb {
+
+    // Reads memory without side effects, empty for unmapped memory
+    using MemoryPeeker = std::function<std::optional<uint8_t>(uint16_t address)>;
+
+    // Emulator state a BreakpointCondition is evaluated against, see BasicEmulator::getConditionContext()
+    struct ConditionContext {
+        // with the flags applied
+        cpu::RegisterFile registers;
+        uint64_t cycles = 0;
+        // bank mapped at address the way cpu::TraceRecord reports it
+        uint16_t bank = 0;
+        // banks mapped at 0x4000-0x7fff and 0xa000-0xbfff
+        uint16_t rom_bank = 0;
+        uint16_t ram_bank = 0;
+        // address of the instruction being executed
+        uint16_t instruction_address = 0;
+        // the accessed address and value for memory breakpoints, the PC and 0 for PC breakpoints
+        uint16_t address = 0;
+        uint8_t value = 0;
+        // memory reads as 0xff without it
+        MemoryPeeker peek;
+    };
+
+    // Boolean expression over registers, memory, the cycle count and banks, like
+    // "A == 0x3f && [HL] > 0x10 && frame > 1000". It's parsed once and compiled to a short stack bytecode, so a
+    // breakpoint only pays for evaluating it when its address matches.
+    //
+    // Values are unsigned 64-bit, literals are decimal, 0x or $ hexadecimal. Operators from the loosest:
+    // ||, &&, comparisons (== != < <= > >=), |, ^, &, + -, unary ! and ~. [expr] reads a byte of memory.
+    // Names are case-insensitive: registers (a, f, b, c, d, e, h, l, af, bc, de, hl, sp, pc), flags (zf, nf, hf,
+    // cf), cycles, frame (cycles / g_cycles_per_frame), bank, rom_bank, ram_bank, address and value
+    class BreakpointCondition {
+      public:
+        // Always true
+        BreakpointCondition() = default;
+
+        // Throws std::invalid_argument if the expression is malformed or too complex
+        static BreakpointCondition compile(std::string_view expression);
+
+        bool evaluate(const ConditionContext &context) const noexcept;
+
+        const std::string &getExpression() const { return expression_; }
+
+        // Conditions compiled from the same text are the same
+        bool operator==(const BreakpointCondition &other) const { return expression_ == other.expression_; }
+        std::strong_ordering operator<=>(const BreakpointCondition &other) const {
+            return expression_ <=> other.expression_;
+        }
+
+        // Deepest stack an expression can use, deeper ones are rejected by compile()
+        static constexpr size_t g_max_stack_depth = 16;
+
+      private:
+        friend class ConditionCompiler;
+
+        enum class Opcode : uint8_t {
+            // operand is the value
+            PUSH,
+            // operand indexes constants_, for values which don't fit in the operand
+            PUSH_WIDE,
+            // operand is a Variable
+            LOAD,
+            READ,
+            NOT,
+            COMPLEMENT,
+            // replaces the top value with 0 or 1
+            BOOL,
+            ADD,
+            SUB,
+            AND,
+            OR,
+            XOR,
+            EQUAL,
+            NOT_EQUAL,
+            LESS,
+            LESS_EQUAL,
+            GREATER,
+            GREATER_EQUAL,
+            // jump to the operand keeping the top value, && and || skip their right side with them
+            JUMP_IF_FALSE,
+            JUMP_IF_TRUE,
+            POP,
+        };
+
+        enum class Variable : uint8_t {
+            A,
+            F,
+            B,
+            C,
+            D,
+            E,
+            H,
+            L,
+            AF,
+            BC,
+            DE,
+            HL,
+            SP,
+            PC,
+            ZF,
+            NF,
+            HF,
+            CF,
+            CYCLES,
+            FRAME,
+            BANK,
+            ROM_BANK,
+            RAM_BANK,
+            ADDRESS,
+            VALUE,
+        };
+
+        struct Instruction {
+            Opcode opcode = Opcode::PUSH;
+            uint16_t operand = 0;
+        };
+
+        static uint64_t load(Variable variable, const ConditionContext &context) noexcept;
+
+        std::string expression_;
+        std::vector<Instruction> code_;
+        std::vector<uint64_t> constants_;
+    };
+} // namespace gb
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef GB_EMULATOR_SRC_GB_CONFIG_HDR_
+#define GB_EMULATOR_SRC_GB_CONFIG_HDR_
+
+#include <cstddef>
+
+namespace gb {
+
+    // State the emulator uses on every cycle is grouped and aligned to cache lines of this size
+    constexpr size_t g_cache_line_size = 64;
+
+    // Features of the emulator core which are decided at compile time. A disabled feature costs nothing at run time:
+    // its checks are compiled out and the functions enabling it can't be called
+    struct EmulatorConfig {
+        // IMemoryObserver notified about every memory access
+        bool observers = true;
+        // instruction trace records, also compiled out of every configuration by GB_TRACE=OFF
+        bool tracing = true;
+        // the PPU draws pixels to an IRenderer
+        bool renderer = true;
+        // runFrame() and runUntil() run hot ROM code compiled to x86-64 or ahead of time by aot_compiler, see
+        // cpu::Jit. Hosts where cpu::isNativeJitAvailable() is false run them as threaded code
+        bool jit = true;
+        // runFrame() and runUntil() stop at PCBreakpoints
+        bool breakpoints = true;
+
+        constexpr bool operator==(const EmulatorConfig &) const = default;
+    };
+
+    // Used by the debugger and tests
+    constexpr EmulatorConfig g_full_config{};
+    // Used by headless runners which only need the emulated state
+    constexpr EmulatorConfig g_headless_config{
+        .observers = false, .tracing = false, .renderer = false, .breakpoints = false};
+} // namespace gb
+
+#endif
@@ -0,0 +1,180 @@
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/block_ir.h"
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/micro_program.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/basic_components.h"
+#include "gb/memory/memory_map.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace gb::cpu {
+
+    static bool endsBlock(InstructionType type);
+
+    const CachedOpcode *BlockCache::lookup(uint16_t address, bool prefixed) {
+        if (!enabled_) {
+            return nullptr;
+        }
+        if (next_ < block_.size()) {
+            const CachedOpcode &opcode = block_[next_];
+            if (opcode.address == address && opcode.prefixed == prefixed) [[likely]] {
+                ++next_;
+                ++stats_.hits;
+                return &opcode;
+            }
+        }
+
+        block_ = {};
+        std::optional<uint32_t> key = getKey(address);
+        // a block can't start in the middle of a prefixed instruction
+        if (!key || prefixed) {
+            ++stats_.uncached;
+            return nullptr;
+        }
+
+        if (auto it = blocks_.find(*key); it != blocks_.end()) {
+            ++stats_.hits;
+            block_ = it->second;
+        } else if (auto precompiled = precompiled_.find(*key); precompiled != precompiled_.end()) {
+            ++stats_.hits;
+            block_ = precompiled->second;
+        } else {
+            block_ = build(address, *key);
+            if (block_.empty()) {
+                ++stats_.uncached;
+                return nullptr;
+            }
+            ++stats_.misses;
+        }
+        next_ = 1;
+        return &block_.front();
+    }
+
+    void BlockCache::invalidatePage(uint16_t address) {
+        std::vector<uint32_t> &keys = page_blocks_[address / g_code_page_size];
+        for (uint32_t key : keys) {
+            stats_.invalidations += blocks_.erase(key);
+        }
+        keys.clear();
+        code_pages_.unmarkCode(address / g_code_page_size);
+        block_ = {};
+    }
+
+    void BlockCache::clear() {
+        blocks_.clear();
+        for (std::vector<uint32_t> &keys : page_blocks_) {
+            keys.clear();
+        }
+        code_pages_.unmarkAllCode();
+        block_ = {};
+    }
+
+    void BlockCache::setPrecompiled(std::span<const PrecompiledBlock> blocks) {
+        precompiled_.clear();
+        for (const PrecompiledBlock &block : blocks) {
+            if (!block.opcodes.empty()) {
+                precompiled_.emplace(block.key, block.opcodes);
+            }
+        }
+        block_ = {};
+    }
+
+    std::optional<uint32_t> BlockCache::getKey(uint16_t address) const {
+        if (address <= g_rom_bank0_max_address) {
+            return (uint32_t(cartridge_.getCurrentROMBanks().first) << 16) | address;
+        } else if (address <= g_memory_rom.max_address) {
+            return (uint32_t(cartridge_.getCurrentROMBanks().second) << 16) | address;
+        } else if (g_memory_wram.isInRange(address) || g_memory_hram.isInRange(address)) {
+            return address;
+        }
+        return {};
+    }
+
+    std::span<const CachedOpcode> BlockCache::build(uint16_t address, uint32_t key) {
+        Block block = decodeBlock(address, read_);
+        if (block.empty()) {
+            return {};
+        }
+        // ROM operands can't change, bank switching is handled by the key
+        bool is_rom = address <= g_memory_rom.max_address;
+        translateBlock(block, read_, is_rom ? std::optional(getCodeRegionEnd(address)) : std::nullopt,
+                       stats_.translation);
+
+        if (!is_rom) {
+            size_t last_page = g_code_page_count;
+            for (const CachedOpcode &opcode : block) {
+                size_t page = opcode.address / g_code_page_size;
+                if (page != last_page) {
+                    page_blocks_[page].push_back(key);
+                    code_pages_.markCode(page);
+                    last_page = page;
+                }
+            }
+        }
+        ++stats_.blocks_built;
+        return blocks_.insert_or_assign(key, std::move(block)).first->second;
+    }
+
+    std::vector<CachedOpcode> decodeBlock(uint16_t address, const CodeReader &read) {
+        std::vector<CachedOpcode> block;
+        uint32_t current = address;
+        uint16_t end = getCodeRegionEnd(address);
+        bool prefixed = false;
+        while (current <= end && block.size() < g_max_block_length) {
+            uint16_t opcode_address = uint16_t(current);
+            CachedOpcode opcode{
+                .decoded = {}, .ir = {}, .address = opcode_address, .code = read(opcode_address), .prefixed = prefixed};
+            ++current;
+            if (prefixed) {
+                opcode.decoded = decodePrefixed(opcode.code);
+            } else if (isPrefix(opcode.code)) {
+                block.push_back(opcode);
+                prefixed = true;
+                continue;
+            } else {
+                opcode.decoded = decodeUnprefixed(opcode.code);
+                if (opcode.decoded.type == InstructionType::NONE) {
+                    // the illegal opcode is reported when it is actually executed
+                    break;
+                }
+            }
+            block.push_back(opcode);
+            prefixed = false;
+            if (endsBlock(opcode.decoded.type)) {
+                break;
+            }
+            current += getImmediateSize(opcode.decoded);
+        }
+        return block;
+    }
+
+    uint16_t getCodeRegionEnd(uint16_t address) {
+        if (address <= g_rom_bank0_max_address) {
+            return g_rom_bank0_max_address;
+        } else if (address <= g_memory_rom.max_address) {
+            return g_memory_rom.max_address;
+        } else if (address <= g_memory_wram.max_address) {
+            return g_memory_wram.max_address;
+        }
+        return g_memory_hram.max_address;
+    }
+
+    static bool endsBlock(InstructionType type) {
+        using enum InstructionType;
+        switch (type) {
+        case JP:
+        case JR:
+        case CALL:
+        case RET:
+        case RETI:
+        case RST:
+        case HALT:
+        case STOP: return true;
+        default: return false;
+        }
+    }
+} // namespace gb::cpu
@@ -0,0 +1,128 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_BLOCK_CACHE_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_BLOCK_CACHE_HDR_
+
+#include "gb/cpu/block_ir.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/basic_components.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gb::cpu {
+
+    // blocks are also split at this length, so a long run of straight-line code isn't decoded in one go
+    constexpr size_t g_max_block_length = 64;
+    // granularity of code invalidation
+    constexpr uint16_t g_code_page_size = 256;
+    constexpr size_t g_code_page_count = 0x10000 / g_code_page_size;
+
+    // Pages holding cached code, kept by the bus. Writes to marked pages must reach BlockCache::invalidatePage(),
+    // which unmarks them, so the bus can't let anything write to them directly
+    class ICodePages {
+      public:
+        virtual void markCode(size_t page) noexcept = 0;
+        virtual void unmarkCode(size_t page) noexcept = 0;
+        virtual void unmarkAllCode() noexcept = 0;
+
+      protected:
+        ~ICodePages() = default;
+    };
+
+    // A fetched byte decoded ahead of time. Immediate operands are not cached, they are read when the instruction
+    // is executed
+    struct CachedOpcode {
+        // not used for the 0xCB prefix itself
+        DecodedInstruction decoded;
+        IrOp ir;
+        uint16_t address = 0;
+        uint8_t code = 0;
+        // decoded as the second byte of a 0xCB-prefixed instruction
+        bool prefixed = false;
+    };
+
+    // Block decoded ahead of time, key is (ROM bank << 16) | address
+    struct PrecompiledBlock {
+        uint32_t key = 0;
+        std::span<const CachedOpcode> opcodes;
+    };
+
+    // Last address of the memory region containing address, blocks never cross regions
+    uint16_t getCodeRegionEnd(uint16_t address);
+
+    // Decodes instructions starting at address up to the end of the block, which is empty if the first opcode is
+    // illegal. IrOp isn't filled in
+    std::vector<CachedOpcode> decodeBlock(uint16_t address, const CodeReader &read);
+
+    struct BlockCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        // fetches from memory which isn't cached: VRAM, cartridge RAM, echo RAM, OAM and IO
+        uint64_t uncached = 0;
+        uint64_t blocks_built = 0;
+        uint64_t invalidations = 0;
+        TranslationStats translation;
+    };
+
+    // Straight-line runs of instructions up to the next branch, decoded and translated once and keyed on
+    // (ROM bank, address).
+    // ROM, WRAM and HRAM are cached. Writes to WRAM or HRAM pages holding cached code drop every block decoded from
+    // them, the cache marks such pages in the bus, which takes them out of its page table, so other writes cost
+    // nothing. Code is read with read, which must not have side effects
+    class BlockCache {
+      public:
+        BlockCache(const Cartridge &cartridge, ICodePages &code_pages, CodeReader read)
+            : cartridge_(cartridge), code_pages_(code_pages), read_(std::move(read)) {}
+
+        // Decoded opcode at address, nullptr if it can't be cached. prefixed must be true if the previous fetch was
+        // the 0xCB prefix
+        const CachedOpcode *lookup(uint16_t address, bool prefixed);
+
+        // Drops blocks decoded from the page containing address
+        void invalidatePage(uint16_t address);
+        // Must be called when ROM banks are switched, the current block might continue in a different bank
+        void resetCursor() { block_ = {}; }
+        void clear();
+
+        // Precompiled blocks are looked up if a block isn't cached yet, they are kept by clear(). They must be
+        // for the current ROM and outlive the cache
+        void setPrecompiled(std::span<const PrecompiledBlock> blocks);
+
+        bool isEnabled() const { return enabled_; }
+        void setEnabled(bool enabled) {
+            enabled_ = enabled;
+            clear();
+        }
+
+        const BlockCacheStats &getStats() const { return stats_; }
+        size_t getBlockCount() const { return blocks_.size(); }
+
+      private:
+        using Block = std::vector<CachedOpcode>;
+
+        std::optional<uint32_t> getKey(uint16_t address) const;
+        std::span<const CachedOpcode> build(uint16_t address, uint32_t key);
+
+        // the block being executed and the index of the opcode expected to be fetched next. They and the hit
+        // counter are used on every fetch, so they go first
+        std::span<const CachedOpcode> block_;
+        size_t next_ = 0;
+        bool enabled_ = true;
+        BlockCacheStats stats_;
+
+        const Cartridge &cartridge_;
+        ICodePages &code_pages_;
+        CodeReader read_;
+        std::unordered_map<uint32_t, Block> blocks_;
+        std::unordered_map<uint32_t, std::span<const CachedOpcode>> precompiled_;
+        // keys of blocks decoded from each writable page, some of them might already be gone. Allocated separately,
+        // it's only used when blocks are built or invalidated and would take up 6 KiB inside the CPU
+        std::vector<std::vector<uint32_t>> page_blocks_ = std::vector<std::vector<uint32_t>>(g_code_page_count);
+    };
+} // namespace gb::cpu
+
+#endif
@@ -0,0 +1,124 @@
+#include "gb/cpu/block_ir.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/micro_program.h"
+#include "gb/cpu/operation.h"
+
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace gb::cpu {
+
+    constexpr uint8_t g_all_flags = uint8_t(Flags::ALL);
+
+    static uint8_t getConditionFlag(std::optional<Conditions> condition);
+
+    void translateBlock(std::span<CachedOpcode> block, const CodeReader &read, std::optional<uint16_t> constant_end,
+                        TranslationStats &stats) {
+        for (CachedOpcode &opcode : block) {
+            opcode.ir = IrOp{};
+            // the 0xCB prefix itself does nothing
+            if (!opcode.prefixed && isPrefix(opcode.code)) {
+                continue;
+            }
+            FlagUsage usage = getFlagUsage(opcode.decoded);
+            opcode.ir.flags_read = usage.read;
+            opcode.ir.flags_written = usage.written;
+
+            uint16_t size = opcode.prefixed ? 0 : getImmediateSize(opcode.decoded);
+            if (size != 0 && constant_end && uint32_t(opcode.address) + size <= *constant_end) {
+                opcode.ir.constant_size = uint8_t(size);
+                for (uint16_t i = 0; i < size; ++i) {
+                    opcode.ir.constant |= uint16_t(read(uint16_t(opcode.address + 1 + i))) << (i * 8);
+                }
+                ++stats.constant_operands;
+            }
+        }
+
+        // code after the block, or an interrupt handler, might read anything
+        uint8_t live = g_all_flags;
+        for (auto it = block.rbegin(); it != block.rend(); ++it) {
+            IrOp &ir = it->ir;
+            ir.flags_live = live;
+            stats.flag_writes += std::popcount(ir.flags_written);
+            stats.dead_flag_writes += std::popcount(uint8_t(ir.flags_written & ~live));
+            live = uint8_t((live & ~ir.flags_written) | ir.flags_read);
+        }
+    }
+
+    FlagUsage getFlagUsage(const DecodedInstruction &instr) {
+        using enum InstructionType;
+        FlagUsage usage;
+        constexpr uint8_t z = uint8_t(Flags::Z);
+        constexpr uint8_t n = uint8_t(Flags::N);
+        constexpr uint8_t h = uint8_t(Flags::H);
+        constexpr uint8_t c = uint8_t(Flags::C);
+        switch (instr.type) {
+        case ADD: usage.written = instr.dst.reg == Registers::HL ? n | h | c : g_all_flags; break;
+        case ADC:
+        case SBC:
+        case RLA:
+        case RRA:
+        case RL:
+        case RR:
+            usage.read = c;
+            usage.written = g_all_flags;
+            break;
+        case SUB:
+        case AND:
+        case OR:
+        case XOR:
+        case CP:
+        case RLCA:
+        case RRCA:
+        case RLC:
+        case RRC:
+        case SLA:
+        case SRA:
+        case SRL:
+        case SWAP: usage.written = g_all_flags; break;
+        case INC:
+        case DEC: usage.written = instr.src.src == ArgumentSource::DOUBLE_REGISTER ? 0 : z | n | h; break;
+        case BIT: usage.written = z | n | h; break;
+        case DAA:
+            usage.read = n | h | c;
+            usage.written = z | h | c;
+            break;
+        case CPL: usage.written = n | h; break;
+        case SCF: usage.written = n | h | c; break;
+        case CCF:
+            usage.read = c;
+            usage.written = n | h | c;
+            break;
+        case LD:
+            if (instr.ld_subtype == LoadSubtype::LD_OFFSET_SP) {
+                usage.written = g_all_flags;
+            }
+            break;
+        case PUSH: usage.read = instr.src.reg == Registers::AF ? g_all_flags : 0; break;
+        case POP: usage.written = instr.dst.reg == Registers::AF ? g_all_flags : 0; break;
+        case JR:
+        case JP:
+        case CALL:
+        case RET: usage.read = getConditionFlag(instr.condition); break;
+        default: break;
+        }
+        return usage;
+    }
+
+    static uint8_t getConditionFlag(std::optional<Conditions> condition) {
+        if (!condition) {
+            return 0;
+        }
+        switch (*condition) {
+        case Conditions::NOT_ZERO:
+        case Conditions::ZERO: return uint8_t(Flags::Z);
+        case Conditions::NOT_CARRY:
+        case Conditions::CARRY: return uint8_t(Flags::C);
+        }
+        return 0;
+    }
+} // namespace gb::cpu
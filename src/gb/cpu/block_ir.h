@@ -0,0 +1,55 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_BLOCK_IR_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_BLOCK_IR_HDR_
+
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/operation.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+
+namespace gb::cpu {
+
+    struct CachedOpcode;
+
+    // Reads code bytes while blocks are decoded and translated
+    using CodeReader = std::function<uint8_t(uint16_t address)>;
+
+    // What the translation passes know about a cached instruction
+    struct IrOp {
+        // F bit masks: flags the instruction reads, flags it writes and flags a later instruction in the block
+        // (or code after the block) might read before they are written again. Only compiled code leaves dead flags
+        // out, see cpu::Jit: the interpreter can service an interrupt or save state between any two instructions,
+        // and both see F
+        uint8_t flags_read = 0;
+        uint8_t flags_written = 0;
+        uint8_t flags_live = uint8_t(Flags::ALL);
+        // immediate operand bytes known at translation time, the CPU still spends an M-cycle on each of them,
+        // but doesn't read them from the bus
+        uint8_t constant_size = 0;
+        uint16_t constant = 0;
+    };
+
+    struct TranslationStats {
+        uint64_t flag_writes = 0;
+        // flag writes overwritten in the same block before anything reads them
+        uint64_t dead_flag_writes = 0;
+        uint64_t constant_operands = 0;
+    };
+
+    // F bit masks
+    struct FlagUsage {
+        uint8_t read = 0;
+        uint8_t written = 0;
+    };
+
+    FlagUsage getFlagUsage(const DecodedInstruction &instruction);
+
+    // Fills in IrOp of every instruction in the block. Operands up to constant_end are read with read and
+    // treated as constants, it must only be set for memory which can't change while the block is cached
+    void translateBlock(std::span<CachedOpcode> block, const CodeReader &read, std::optional<uint16_t> constant_end,
+                        TranslationStats &stats);
+} // namespace gb::cpu
+
+#endif
@@ -0,0 +1,119 @@
+#include "gb/cpu/code_walker.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/block_ir.h"
+#include "gb/cpu/micro_program.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/memory_map.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace gb::cpu {
+
+    constexpr size_t g_rom_bank_size = 0x4000;
+
+    // Addresses execution can continue at after the last instruction of a block
+    static std::vector<uint16_t> getSuccessors(std::span<const uint8_t> rom, uint16_t bank,
+                                               const CachedOpcode &opcode);
+
+    std::vector<CodeBlock> findReachableCode(std::span<const uint8_t> rom) {
+        uint16_t bank_count = uint16_t(rom.size() / g_rom_bank_size);
+        std::map<uint32_t, CodeBlock> blocks;
+        std::vector<uint32_t> pending;
+        auto addTarget = [&](uint16_t from_bank, uint16_t address) {
+            if (address <= g_rom_bank0_max_address) {
+                pending.push_back(address);
+            } else if (address <= g_memory_rom.max_address && from_bank != 0) {
+                pending.push_back((uint32_t(from_bank) << 16) | address);
+            } else if (address <= g_memory_rom.max_address) {
+                for (uint16_t bank = 1; bank < bank_count; ++bank) {
+                    pending.push_back((uint32_t(bank) << 16) | address);
+                }
+            }
+        };
+
+        addTarget(0, 0x100);
+        for (uint16_t vector = 0; vector <= 0x60; vector += 8) {
+            addTarget(0, vector);
+        }
+
+        TranslationStats stats;
+        while (!pending.empty()) {
+            uint32_t key = pending.back();
+            pending.pop_back();
+            if (blocks.contains(key)) {
+                continue;
+            }
+            uint16_t bank = uint16_t(key >> 16);
+            uint16_t address = uint16_t(key);
+            CodeReader read = [rom, bank](uint16_t address) { return readROM(rom, bank, address); };
+
+            CodeBlock &block = blocks[key];
+            block.key = key;
+            block.opcodes = decodeBlock(address, read);
+            if (block.opcodes.empty()) {
+                continue;
+            }
+            translateBlock(block.opcodes, read, getCodeRegionEnd(address), stats);
+            for (uint16_t target : getSuccessors(rom, bank, block.opcodes.back())) {
+                addTarget(bank, target);
+            }
+        }
+
+        std::vector<CodeBlock> result;
+        for (auto &[key, block] : blocks) {
+            if (!block.opcodes.empty()) {
+                result.push_back(std::move(block));
+            }
+        }
+        return result;
+    }
+
+    std::vector<PrecompiledBlock> getPrecompiledBlocks(std::span<const CodeBlock> blocks) {
+        std::vector<PrecompiledBlock> result;
+        result.reserve(blocks.size());
+        for (const CodeBlock &block : blocks) {
+            result.push_back(PrecompiledBlock{.key = block.key, .opcodes = block.opcodes});
+        }
+        return result;
+    }
+
+    uint8_t readROM(std::span<const uint8_t> rom, uint16_t bank, uint16_t address) {
+        size_t offset = address;
+        if (address > g_rom_bank0_max_address) {
+            offset = bank * g_rom_bank_size + (address - g_rom_bank0_max_address - 1);
+        }
+        // the same as the bus returns for missing ROM
+        return offset < rom.size() ? rom[offset] : 0xff;
+    }
+
+    static std::vector<uint16_t> getSuccessors(std::span<const uint8_t> rom, uint16_t bank,
+                                               const CachedOpcode &opcode) {
+        // the 0xCB prefix and prefixed instructions don't have operands and fall through
+        const DecodedInstruction &instr = opcode.decoded;
+        uint16_t next = uint16_t(opcode.address + 1 + (opcode.prefixed ? 0 : getImmediateSize(instr)));
+        uint16_t word = uint16_t(readROM(rom, bank, uint16_t(opcode.address + 1)) |
+                                 (readROM(rom, bank, uint16_t(opcode.address + 2)) << 8));
+        bool conditional = instr.condition.has_value();
+        switch (instr.type) {
+        case InstructionType::JP:
+            if (instr.src.src == ArgumentSource::DOUBLE_REGISTER) {
+                return {};
+            }
+            return conditional ? std::vector<uint16_t>{word, next} : std::vector<uint16_t>{word};
+        case InstructionType::JR: {
+            uint16_t target = uint16_t(next + int8_t(word));
+            return conditional ? std::vector<uint16_t>{target, next} : std::vector<uint16_t>{target};
+        }
+        case InstructionType::CALL: return {word, next};
+        case InstructionType::RST: return {*instr.reset_vector, next};
+        case InstructionType::RET: return conditional ? std::vector<uint16_t>{next} : std::vector<uint16_t>{};
+        case InstructionType::RETI: return {};
+        default: return {next};
+        }
+    }
+} // namespace gb::cpu
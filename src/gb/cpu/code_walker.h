@@ -0,0 +1,31 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_CODE_WALKER_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_CODE_WALKER_HDR_
+
+#include "gb/cpu/block_cache.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace gb::cpu {
+
+    struct CodeBlock {
+        // (ROM bank << 16) | address, the same as the block cache key
+        uint32_t key = 0;
+        std::vector<CachedOpcode> opcodes;
+    };
+
+    // Finds ROM code reachable from the entry point, RST and interrupt vectors by following static branch targets.
+    // The bank of a switchable bank target is only known for jumps from the same bank, jumps from bank 0 are
+    // followed into every bank. Indirect jumps (JP HL, RET) aren't followed. Blocks are the same as the ones the
+    // block cache builds, sorted by key
+    std::vector<CodeBlock> findReachableCode(std::span<const uint8_t> rom);
+
+    // Byte at address with bank mapped at 0x4000-0x7fff, 0xff past the end of the ROM like the bus returns
+    uint8_t readROM(std::span<const uint8_t> rom, uint16_t bank, uint16_t address);
+
+    // Blocks of the result of findReachableCode() to be passed to BlockCache::setPrecompiled()
+    std::vector<PrecompiledBlock> getPrecompiledBlocks(std::span<const CodeBlock> blocks);
+} // namespace gb::cpu
+
+#endif
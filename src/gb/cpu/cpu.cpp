@@ -1,21 +1,32 @@
 #include "gb/cpu/cpu.h"
+#include "gb/config.h"
 #include "gb/address_bus.h"
+#include "gb/cpu/block_ir.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/decoder.h"
 #include "gb/cpu/operation.h"
+#include "gb/cpu/trace.h"
+#include "gb/fault.h"
 #include "gb/interrupt_register.h"
+#include "gb/memory/basic_components.h"
 #include "util/util.h"
 
+#include <array>
 #include <cstdint>
 #include <exception>
-#include <iostream>
 #include <optional>
 #include <stdexcept>
 
 namespace gb::cpu {
 
-    SharpSM83::SharpSM83(AddressBus &bus, InterruptRegister &interrupt_enable, InterruptRegister &interrupt_flags)
-        : bus_(bus), ie_(interrupt_enable), if_(interrupt_flags) {
+    // true for instructions which overwrite flags through deferFlags()
+    static bool defersFlags(const DecodedInstruction &instruction);
+
+    template <EmulatorConfig CONFIG>
+    SharpSM83<CONFIG>::SharpSM83(AddressBus<CONFIG> &bus, InterruptRegister &interrupt_enable,
+                                 InterruptRegister &interrupt_flags, FaultState &fault)
+        : bus_(bus), ie_(interrupt_enable), if_(interrupt_flags), fault_(fault) {
+        bus_.setBlockCache(&block_cache_);
         reg_.af(0x01B0);
         reg_.bc(0x0013);
         reg_.de(0x00D8);
@@ -25,12 +36,12 @@ namespace gb::cpu {
         reg_.pc(0x0100);
     }
 
-    void SharpSM83::tick() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::tick() noexcept {
         if (stopped_) {
             return;
         }
 
-        memory_op_executed_ = false;
         finished_ = false;
 
         if (halt_mode_ && getPendingInterrupt()) {
@@ -43,26 +54,34 @@ namespace gb::cpu {
             IME_ = true;
             enable_IME_ = false;
         }
-        if (!halt_mode_ && memory_op_queue_.empty()) {
-            if (!current_instruction_) {
+        if (!halt_mode_ && step_ == sequence_->size) {
+            if (!current_instruction_) [[unlikely]] {
+                // no instruction available after its operands are read
+                fault_.raise(Fault::INTERNAL_ERROR, instruction_address_);
                 stopped_ = true;
-                throw std::runtime_error(
-                    "CPU's memory operation invariant failed: no instruction available after queue exhaustion");
+                return;
             }
 
             if (auto interrupt = getPendingInterrupt(); IME_ && interrupt) {
                 handleInterrupt(*interrupt);
             } else {
+                if constexpr (g_tracing) {
+                    if (trace_enabled_) {
+                        finishTrace();
+                    }
+                }
+                branch_taken_ = true;
                 dispatch();
-                last_instruction_ = instruction_;
+                startSequence(branch_taken_ ? program_->execute : program_->not_taken);
                 jumping_to_interrupt_ = false;
-                sheduleFetchInstruction();
             }
+            current_instruction_ = std::nullopt;
         }
         executeMemoryOp();
     }
 
-    std::optional<InterruptFlags> SharpSM83::getPendingInterrupt() const {
+    template <EmulatorConfig CONFIG>
+    std::optional<InterruptFlags> SharpSM83<CONFIG>::getPendingInterrupt() const {
         uint8_t pending_interrupts = ie_.getFlags() & if_.getFlags();
         if (pending_interrupts != 0) {
             return static_cast<InterruptFlags>(pending_interrupts & -pending_interrupts);
@@ -71,52 +90,45 @@ namespace gb::cpu {
         }
     }
 
-    void SharpSM83::handleInterrupt(InterruptFlags interrupt) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::handleInterrupt(InterruptFlags interrupt) {
         jumping_to_interrupt_ = true;
         IME_ = false;
         if_.clearFlag(interrupt);
-        // with this no-op added the emulator fails mooneye's intr_timing test.
-        // it looks like interrupts are checked before new instruction is fetched
-        // so in case of this emulator the FETCH_INSTRUCTION takes place of the first no-op.
-        // TODO: probably should call it from executeMemoryOp() then.
-        // sheduleMemoryNoOp();
-        sheduleMemoryNoOp();
-        // instruction_.registers.PC() contains address of the fetched instruction
-        // reg_.PC() contains address of the byte after the instruction
-        shedulePushStack(instruction_.registers.pc());
-        sheduleMemoryNoOp();
+        startProgram(g_interrupt_program);
+        startSequence(program_->execute);
+        // reg_.PC() contains address of the byte after the fetched instruction
+        pushStack(instruction_address_);
         reg_.pc(getInterruptVector(interrupt));
-        sheduleFetchInstruction();
     }
 
-    void SharpSM83::decode(Opcode code) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::decode(Opcode code, const DecodedInstruction *cached) {
         if (!prefixed_next_) {
-            instruction_ = Instruction{.registers = reg_, .ime = IME_};
+            instruction_address_ = reg_.pc();
             if (isPrefix(code)) {
-                ++instruction_.width;
                 prefixed_next_ = true;
-                sheduleFetchInstruction();
                 return;
             }
         }
 
         if (prefixed_next_) {
-            current_instruction_ = decodePrefixed(code);
-            instruction_.type = current_instruction_->type;
-            instruction_.arg() = current_instruction_->arg().reg;
-            if (current_instruction_->bit) {
-                instruction_.bit() = *current_instruction_->bit;
-            }
+            current_instruction_ = cached ? *cached : decodePrefixed(code);
         } else {
-            current_instruction_ = decodeUnprefixed(code);
-            instruction_.type = current_instruction_->type;
-            instruction_.load_subtype = current_instruction_->ld_subtype;
-            instruction_.condition = current_instruction_->condition;
+            current_instruction_ = cached ? *cached : decodeUnprefixed(code);
         }
         prefixed_next_ = false;
     }
 
-    void SharpSM83::dispatch() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::dispatch() {
+        if (lazy_flags_.op != LazyFlags::Op::NONE) {
+            FlagUsage usage = getFlagUsage(*current_instruction_);
+            if (usage.read != 0 || (usage.written != 0 && !defersFlags(*current_instruction_))) {
+                materializeFlags();
+            }
+        }
+
         using type = InstructionType;
         switch (current_instruction_->type) {
         case type::NOP: return NOP();
@@ -162,11 +174,75 @@ namespace gb::cpu {
         case type::BIT: return BIT(current_instruction_->arg().reg, *current_instruction_->bit);
         case type::RES: return RES(current_instruction_->arg().reg, *current_instruction_->bit);
         case type::SET: return SET(current_instruction_->arg().reg, *current_instruction_->bit);
-        default: throw std::runtime_error("unknown instruction");
+        case type::NONE: return fault_.raise(Fault::ILLEGAL_INSTRUCTION, instruction_address_);
+        default: return fault_.raise(Fault::INTERNAL_ERROR, instruction_address_);
         }
     }
 
-    void SharpSM83::reset() {
+    template <EmulatorConfig CONFIG>
+    uint32_t SharpSM83<CONFIG>::runCompiled(uint64_t max_cycles) noexcept {
+        if constexpr (!g_jit) {
+            return 0;
+        }
+        // none of the operands of the fetched opcode are read yet, and with the HALT bug PC wasn't advanced past it
+        if (!isFinished() || stopped_ || halt_mode_ || enable_IME_ || access_log_ || isTraceEnabled() ||
+            !current_instruction_ || sequence_ != &program_->operands || step_ != 0 ||
+            reg_.pc() != uint16_t(instruction_address_ + 1 + program_->immediate_size) || getPendingInterrupt()) {
+            return 0;
+        }
+        // Blocks are chained while the next one is compiled too. The interpreter fetches the opcode each block
+        // stopped at, so the state between blocks is the same as after tick()
+        uint32_t cycles = 0;
+        while (const CompiledBlock *block = jit_.lookup(instruction_address_)) {
+            if (cycles + block->cycles > max_cycles) {
+                break;
+            }
+            if constexpr (CONFIG.observers) {
+                // observers are told about fetches at the addresses they watch, fetch() reads the opcode after the
+                // block from the bus itself
+                bool watched = false;
+                for (uint32_t address = instruction_address_; address < block->end && !watched; ++address) {
+                    watched = bus_.isWatched(uint16_t(address));
+                }
+                if (watched) {
+                    break;
+                }
+            }
+
+            // compiled code computes flags itself
+            if (lazy_flags_.op != LazyFlags::Op::NONE) {
+                materializeFlags();
+            }
+            JitRegisters registers{.sp = reg_.sp, .pc = instruction_address_, .pages = &bus_.getPages()};
+            for (size_t i = 0; i < registers.bytes.size(); ++i) {
+                registers.bytes[i] = reg_.getByteRegister(Registers(i));
+            }
+            JitExit exit = jit_.run(*block, registers);
+            if (exit.cycles == 0) {
+                // the first instruction accesses memory outside the page table
+                break;
+            }
+            for (size_t i = 0; i < registers.bytes.size(); ++i) {
+                reg_.setLow(Registers(i), registers.bytes[i]);
+            }
+            reg_.sp = registers.sp;
+            reg_.pc(registers.pc);
+            // as after dispatch()
+            jumping_to_interrupt_ = false;
+            current_instruction_ = std::nullopt;
+            fetch();
+            jit_.onRun(*block, exit);
+            cycles += exit.cycles;
+            if (!current_instruction_) {
+                // the opcode is a prefix, its second byte is fetched by the interpreter
+                break;
+            }
+        }
+        return cycles;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::reset() {
         reg_.setWordRegister(Registers::AF, 0x01b0);
         reg_.setWordRegister(Registers::BC, 0x0013);
         reg_.setWordRegister(Registers::DE, 0x00d8);
@@ -176,27 +252,130 @@ namespace gb::cpu {
         reg_.pc(0x100);
 
         IME_ = false;
-        instruction_ = Instruction{};
+        instruction_address_ = 0;
+        current_instruction_.reset();
+        data_buffer_ = DataBuffer{};
         stopped_ = false;
         finished_ = false;
         jumping_to_interrupt_ = false;
         halt_bug_ = false;
         halt_mode_ = false;
         enable_IME_ = false;
-        memory_op_executed_ = false;
         prefixed_next_ = false;
-        memory_op_queue_.clear();
-        sheduleFetchInstruction();
+        block_cache_.clear();
+        jit_.clear();
+        constant_bytes_ = 0;
+        lazy_flags_ = LazyFlags{};
+        trace_ = TraceRecord{};
+        // as if a NOP was just executed, the first opcode is fetched right away
+        startProgram(0);
+        startSequence(program_->execute);
+        executeMemoryOp();
     }
 
-    uint8_t SharpSM83::getByteRegister(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::saveState(StateWriter &writer) const {
+        // deferred flags are applied, so the state doesn't depend on which flags were computed
+        writer.write(withFlags(reg_, lazy_flags_));
+        writer.write(IME_);
+        writer.write(enable_IME_);
+        writer.write(halt_mode_);
+        writer.write(halt_bug_);
+        writer.write(prefixed_next_);
+        writer.write(stopped_);
+        writer.write(finished_);
+        writer.write(jumping_to_interrupt_);
+        writer.write(program_index_);
+        writer.write(getSequenceKind());
+        writer.write(step_);
+        writer.write(op_address_);
+        writer.write(op_data_);
+        writer.write(op_register_);
+        writer.write(instruction_address_);
+        writer.write(data_buffer_);
+        // written field by field, the padding of the optional itself is never initialized
+        writer.write(current_instruction_.has_value());
+        writer.write(current_instruction_.value_or(DecodedInstruction{}));
+    }
+
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::loadState(StateReader &reader) {
+        reader.read(reg_);
+        reader.read(IME_);
+        reader.read(enable_IME_);
+        reader.read(halt_mode_);
+        reader.read(halt_bug_);
+        reader.read(prefixed_next_);
+        reader.read(stopped_);
+        reader.read(finished_);
+        reader.read(jumping_to_interrupt_);
+        uint16_t program = reader.read<uint16_t>();
+        SequenceKind kind = reader.read<SequenceKind>();
+        uint8_t step = reader.read<uint8_t>();
+        const MicroSequence *sequence = findSequence(program, kind, step);
+        if (!sequence) {
+            throw std::runtime_error("invalid CPU state");
+        }
+        startProgram(program);
+        startSequence(*sequence);
+        step_ = step;
+        reader.read(op_address_);
+        reader.read(op_data_);
+        reader.read(op_register_);
+        reader.read(instruction_address_);
+        reader.read(data_buffer_);
+        bool has_instruction = reader.read<bool>();
+        DecodedInstruction instruction = reader.read<DecodedInstruction>();
+        current_instruction_ = has_instruction ? std::optional(instruction) : std::nullopt;
+        // memory was replaced without going through the bus
+        block_cache_.clear();
+        constant_bytes_ = 0;
+        lazy_flags_ = LazyFlags{};
+        if (isTraceEnabled()) {
+            restartTrace();
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::checkState(StateReader &reader) const {
+        reader.skip(sizeof(reg_) + sizeof(IME_) + sizeof(enable_IME_) + sizeof(halt_mode_) + sizeof(halt_bug_) +
+                    sizeof(prefixed_next_) + sizeof(stopped_) + sizeof(finished_) + sizeof(jumping_to_interrupt_));
+        uint16_t program = reader.read<uint16_t>();
+        SequenceKind kind = reader.read<SequenceKind>();
+        uint8_t step = reader.read<uint8_t>();
+        if (!findSequence(program, kind, step)) {
+            throw std::runtime_error("invalid CPU state");
+        }
+        reader.skip(sizeof(op_address_) + sizeof(op_data_) + sizeof(op_register_) + sizeof(instruction_address_) +
+                    sizeof(data_buffer_) + sizeof(bool) + sizeof(DecodedInstruction));
+    }
+
+    template <EmulatorConfig CONFIG>
+    const MicroSequence *SharpSM83<CONFIG>::findSequence(uint16_t program, SequenceKind kind, uint8_t step) {
+        if (program >= g_micro_program_count) {
+            return nullptr;
+        }
+        const MicroProgram &micro_program = getMicroProgram(program);
+        const MicroSequence *sequence = nullptr;
+        switch (kind) {
+        case SequenceKind::OPERANDS: sequence = &micro_program.operands; break;
+        case SequenceKind::EXECUTE: sequence = &micro_program.execute; break;
+        case SequenceKind::NOT_TAKEN: sequence = &micro_program.not_taken; break;
+        default: return nullptr;
+        }
+        return step <= sequence->size ? sequence : nullptr;
+    }
+
+    template <EmulatorConfig CONFIG>
+    uint8_t SharpSM83<CONFIG>::getByteRegister(Registers reg) {
         if (isByteRegister(reg)) {
             return reg_.getByteRegister(reg);
         }
         return data_buffer_.get();
     }
 
-    uint16_t SharpSM83::getWordRegister(Registers reg) const {
+    template <EmulatorConfig CONFIG>
+    uint16_t SharpSM83<CONFIG>::getWordRegister(Registers reg) const {
         if (reg == Registers::SP) {
             return reg_.sp;
         }
@@ -204,15 +383,17 @@ namespace gb::cpu {
         return reg_.getWordRegister(reg);
     }
 
-    void SharpSM83::setByteRegister(Registers reg, uint8_t data) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::setByteRegister(Registers reg, uint8_t data) {
         if (isByteRegister(reg)) {
             reg_.setLow(reg, data);
         } else {
-            sheduleWriteByte(reg_.getWordRegister(reg), data);
+            writeByte(reg_.getWordRegister(reg), data);
         }
     }
 
-    void SharpSM83::setWordRegister(Registers reg, uint16_t data) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::setWordRegister(Registers reg, uint16_t data) {
         if (reg == Registers::SP) {
             reg_.sp = data;
         } else {
@@ -221,7 +402,25 @@ namespace gb::cpu {
         }
     }
 
-    bool SharpSM83::checkCondition(Conditions condition) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::deferFlags(LazyFlags flags) {
+        // INC and DEC keep the carry flag, which might still be deferred
+        if ((lazy_flags_.getMask() & ~flags.getMask()) != 0) {
+            materializeFlags();
+        }
+        lazy_flags_ = flags;
+        ++flag_stats_.deferred;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::materializeFlags() {
+        reg_.f(lazy_flags_.apply(reg_.f()));
+        lazy_flags_ = LazyFlags{};
+        ++flag_stats_.materialized;
+    }
+
+    template <EmulatorConfig CONFIG>
+    bool SharpSM83<CONFIG>::checkCondition(Conditions condition) {
         switch (condition) {
         case Conditions::CARRY: return reg_.getFlag(Flags::CARRY);
         case Conditions::NOT_CARRY: return !reg_.getFlag(Flags::CARRY);
@@ -233,172 +432,222 @@ namespace gb::cpu {
         }
     }
 
-    void SharpSM83::setArgData(Instruction::Argument &arg, ArgumentInfo info, uint8_t data) {
-        if (info.src == ArgumentSource::REGISTER || info.src == ArgumentSource::INDIRECT) {
-            arg = info.reg;
-        } else {
-            arg = data;
-        }
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::writeByte(uint16_t address, uint8_t data) {
+        op_address_ = address;
+        op_data_ = data;
     }
 
-    void SharpSM83::pushMemoryOp(MemoryOp op) {
-        memory_op_queue_.push_back(op);
-        // Only one operation per CPU cycle is run, check memory_op_executed_
-        // flag
-        executeMemoryOp();
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::writeWord(uint16_t address, uint16_t data) {
+        op_address_ = address;
+        op_data_ = data;
     }
 
-    void SharpSM83::sheduleMemoryNoOp() { pushMemoryOp(MemoryOp{}); }
-
-    void SharpSM83::sheduleReadByte(uint16_t address) {
-        pushMemoryOp(MemoryOp{.address = address, .type = MemoryOp::Type::READ, .data = uint8_t(Registers::NONE)});
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::pushStack(uint16_t data) {
+        op_address_ = reg_.sp;
+        op_data_ = data;
+        reg_.sp -= 2;
     }
 
-    void SharpSM83::sheduleReadWord(uint16_t address) {
-        pushMemoryOp(MemoryOp{.address = address, .type = MemoryOp::Type::READ, .data = uint8_t(Registers::NONE)});
-        pushMemoryOp(MemoryOp{.address = ++address, .type = MemoryOp::Type::READ, .data = uint8_t(Registers::NONE)});
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::popStack(Registers reg) {
+        readToRegister(reg_.sp, reg);
+        reg_.sp += 2;
     }
 
-    void SharpSM83::sheduleWriteByte(uint16_t address, uint8_t data) {
-        pushMemoryOp(MemoryOp{.address = address, .type = MemoryOp::Type::WRITE, .data = data});
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::readToRegister(uint16_t address, Registers reg) {
+        op_address_ = address;
+        op_register_ = reg;
     }
 
-    void SharpSM83::sheduleWriteWord(uint16_t address, uint16_t data) {
-        pushMemoryOp(MemoryOp{.address = address, .type = MemoryOp::Type::WRITE, .data = uint8_t(data)});
-        pushMemoryOp(MemoryOp{.address = ++address, .type = MemoryOp::Type::WRITE, .data = uint8_t(data >> 8)});
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::startProgram(uint16_t index) {
+        program_index_ = index;
+        program_ = &getMicroProgram(index);
+        startSequence(program_->operands);
     }
 
-    void SharpSM83::shedulePushStack(uint16_t data) {
-        --reg_.sp;
-        pushMemoryOp(MemoryOp{.address = uint16_t(reg_.sp), .type = MemoryOp::Type::WRITE, .data = uint8_t(data >> 8)});
-        --reg_.sp;
-        pushMemoryOp(MemoryOp{.address = uint16_t(reg_.sp), .type = MemoryOp::Type::WRITE, .data = uint8_t(data)});
+    template <EmulatorConfig CONFIG>
+    typename SharpSM83<CONFIG>::SequenceKind SharpSM83<CONFIG>::getSequenceKind() const {
+        if (sequence_ == &program_->operands) {
+            return SequenceKind::OPERANDS;
+        }
+        return sequence_ == &program_->execute ? SequenceKind::EXECUTE : SequenceKind::NOT_TAKEN;
     }
 
-    void SharpSM83::shedulePopStack(Registers reg) {
-        sheduleReadToReg(reg_.sp, reg);
-        reg_.sp += 2;
-    }
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::executeMemoryOp() {
+        if (step_ == sequence_->size) {
+            return;
+        }
 
-    void SharpSM83::sheduleReadToReg(uint16_t address, Registers reg) {
-        if (isByteRegister(reg)) {
-            pushMemoryOp(MemoryOp{.address = address, .type = MemoryOp::Type::READ, .data = uint8_t(reg)});
-        } else {
-            pushMemoryOp(
-                MemoryOp{.address = address, .type = MemoryOp::Type::READ, .data = reg & Registers::LOW_REG_MASK});
-            pushMemoryOp(MemoryOp{.address = ++address,
-                                  .type = MemoryOp::Type::READ,
-                                  .data = uint8_t((reg & Registers::HIGH_REG_MASK) >> 4)});
+        MicroOp op = sequence_->ops[step_++];
+        if (access_log_) [[unlikely]] {
+            if (op == MicroOp::WRITE || op == MicroOp::PUSH) {
+                access_log_->has_writes = true;
+            } else if (op == MicroOp::READ || op == MicroOp::READ_LOW || op == MicroOp::READ_HIGH) {
+                access_log_->addRead(op_address_);
+            } else if (op == MicroOp::FETCH) {
+                access_log_->addRead(reg_.pc());
+            }
+        }
+        using enum MicroOp;
+        switch (op) {
+        case IDLE: break;
+        case READ:
+            if (constant_bytes_ != 0) {
+                // immediate operands are read right after the fetch, before anything else
+                data_buffer_.put(uint8_t(constant_operand_));
+                constant_operand_ >>= 8;
+                --constant_bytes_;
+            } else {
+                data_buffer_.put(bus_.read(op_address_));
+            }
+            ++op_address_;
+            break;
+        case READ_LOW: reg_.setLow(op_register_, bus_.read(op_address_++)); break;
+        case READ_HIGH: reg_.setHigh(op_register_, bus_.read(op_address_++)); break;
+        case WRITE:
+            bus_.write(op_address_++, uint8_t(op_data_));
+            op_data_ >>= 8;
+            break;
+        case PUSH:
+            bus_.write(--op_address_, uint8_t(op_data_ >> 8));
+            op_data_ <<= 8;
+            break;
+        case FETCH: fetch(); break;
         }
     }
 
-    void SharpSM83::sheduleFetchInstruction() {
-        current_instruction_ = std::nullopt;
-        pushMemoryOp(MemoryOp{.type = MemoryOp::Type::FETCH_INSTRUCTION});
-    }
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::fetch() {
+        finished_ = true;
+        uint16_t index = prefixed_next_ ? g_prefixed_programs : 0;
+        uint16_t pc = reg_.pc();
+        // opcodes and operands at watched addresses are read from the bus, so observers see them
+        bool watched = bus_.isWatched(pc) || bus_.isWatched(uint16_t(pc + 1)) || bus_.isWatched(uint16_t(pc + 2));
+        const CachedOpcode *cached = watched ? nullptr : block_cache_.lookup(pc, prefixed_next_);
+        uint8_t code = cached ? cached->code : bus_.read(pc);
+        index |= code;
+        if constexpr (g_tracing) {
+            if (trace_enabled_) {
+                traceOpcode(code);
+            }
+        }
+        decode(code, cached ? &cached->decoded : nullptr);
+        // with the HALT bug operands are read starting from the opcode itself
+        constant_bytes_ = cached && !halt_bug_ ? cached->ir.constant_size : 0;
+        constant_operand_ = cached ? cached->ir.constant : 0;
+        if (halt_bug_) {
+            halt_bug_ = false;
+        } else {
+            reg_.pc(reg_.pc() + 1);
+        }
 
-    void SharpSM83::sheduleMemoryAcceses(DecodedInstruction instr) {
-        if (!memory_op_executed_) [[unlikely]] {
-            throw std::runtime_error(
-                "sheduleMemoryAccess must be called only during FETCH_INSTRUCTION memory operation");
+        startProgram(index);
+        // nothing is left of the previous instruction, so the state doesn't depend on how it was run
+        op_address_ = 0;
+        op_data_ = 0;
+        op_register_ = Registers::NONE;
+        data_buffer_ = DataBuffer{};
+        if (program_->immediate_size != 0) {
+            op_address_ = reg_.pc();
+            reg_.pc(reg_.pc() + program_->immediate_size);
+        } else if (program_->indirect_operand != Registers::NONE) {
+            op_address_ = getWordRegister(program_->indirect_operand);
         }
+    }
 
-        // manually inline all neseccary sheduleXXX method to avoid calling executeMemoryOp()
-        // as it will never actually execute anything
-        switch (instr.src.src) {
-        case ArgumentSource::IMMEDIATE_S8:
-        case ArgumentSource::IMMEDIATE_U8:
-            memory_op_queue_.push_back(MemoryOp{
-                .address = reg_.pc(),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            ++instruction_.width;
-            reg_.pc(reg_.pc() + 1);
-            return;
-        case ArgumentSource::IMMEDIATE_U16:
-            memory_op_queue_.push_back(MemoryOp{
-                .address = reg_.pc(),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            memory_op_queue_.push_back(MemoryOp{
-                .address = uint16_t(reg_.pc() + 1),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            instruction_.width += 2;
-            reg_.pc(reg_.pc() + 2);
-            return;
-        case ArgumentSource::INDIRECT:
-            if (instr.src.reg == Registers::C) {
-                return;
-            }
-            memory_op_queue_.push_back(MemoryOp{
-                .address = getWordRegister(instr.src.reg),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::traceOpcode(uint8_t code) {
+        if (prefixed_next_) {
+            trace_.bytes[1] = code;
+            ++trace_.info;
             return;
         }
+        // the record shows flags the way the instruction sees them
+        RegisterFile registers = withFlags(reg_, lazy_flags_);
+        trace_ = TraceRecord{
+            .pc = reg_.pc(),
+            .bank = getTraceBank(bus_.getCartridge(), reg_.pc()),
+            .bytes = {code},
+            .info = uint8_t(1 | (IME_ ? TraceRecord::g_ime_bit : 0)),
+            .af = registers.af(),
+            .bc = registers.bc(),
+            .de = registers.de(),
+            .hl = registers.hl(),
+        };
+    }
 
-        if (instr.dst.src == ArgumentSource::IMMEDIATE_U8) {
-            memory_op_queue_.push_back(MemoryOp{
-                .address = reg_.pc(),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            ++instruction_.width;
-            reg_.pc(reg_.pc() + 1);
-
-        } else if (instr.dst.src == ArgumentSource::IMMEDIATE_U16) {
-            memory_op_queue_.push_back(MemoryOp{
-                .address = reg_.pc(),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            memory_op_queue_.push_back(MemoryOp{
-                .address = uint16_t(reg_.pc() + 1),
-                .type = MemoryOp::Type::READ,
-                .data = uint8_t(Registers::NONE),
-            });
-            instruction_.width += 2;
-            reg_.pc(reg_.pc() + 2);
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::setTraceEnabled(bool enabled)
+        requires(CONFIG.tracing)
+    {
+        if (g_tracing && enabled && !trace_enabled_) {
+            restartTrace();
         }
+        trace_enabled_ = g_tracing && enabled;
     }
 
-    void SharpSM83::executeMemoryOp() {
-        if (memory_op_queue_.empty() || memory_op_executed_) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::restartTrace() {
+        if (program_index_ == g_interrupt_program) {
             return;
         }
-        memory_op_executed_ = true;
+        uint8_t code = uint8_t(program_index_);
+        bool prefixed = program_index_ >= g_prefixed_programs;
+        RegisterFile registers = withFlags(reg_, lazy_flags_);
+        trace_ = TraceRecord{
+            .pc = instruction_address_,
+            .bank = getTraceBank(bus_.getCartridge(), instruction_address_),
+            .bytes = prefixed ? std::array<uint8_t, 3>{0xcb, code} : std::array<uint8_t, 3>{code},
+            .info = uint8_t((prefixed ? 2 : 1) | (IME_ ? TraceRecord::g_ime_bit : 0)),
+            .af = registers.af(),
+            .bc = registers.bc(),
+            .de = registers.de(),
+            .hl = registers.hl(),
+        };
+        // registers change only after operands are read, an instruction which is already executed is recorded with
+        // the registers it left
+        if (getSequenceKind() != SequenceKind::OPERANDS) {
+            finishTrace();
+        }
+    }
 
-        MemoryOp op = memory_op_queue_.pop_front();
-        using enum MemoryOp::Type;
-        switch (op.type) {
-        case NONE: break;
-        case READ:
-            if (op.data != uint8_t(Registers::NONE)) {
-                reg_.setLow(Registers(op.data), bus_.read(op.address));
-            } else {
-                data_buffer_.put(bus_.read(op.address));
-            }
-            break;
-        case FETCH_INSTRUCTION:
-            finished_ = true;
-            decode(bus_.read(reg_.pc()));
-            if (halt_bug_) {
-                halt_bug_ = false;
-            } else {
-                reg_.pc(reg_.pc() + 1);
-            }
-            // false if fetched 0xCB
-            if (current_instruction_) {
-                sheduleMemoryAcceses(*current_instruction_);
-            }
-            break;
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::finishTrace() {
+        // immediate operands are the last bytes read into the data buffer
+        if (program_->immediate_size == 1) {
+            trace_.bytes[1] = data_buffer_.get();
+        } else if (program_->immediate_size == 2) {
+            uint16_t word = data_buffer_.getWord();
+            trace_.bytes[1] = uint8_t(word);
+            trace_.bytes[2] = uint8_t(word >> 8);
+        }
+        trace_.info += program_->immediate_size;
+        last_trace_ = trace_;
+    }
 
-        case WRITE: bus_.write(op.address, op.data); break;
+    static bool defersFlags(const DecodedInstruction &instruction) {
+        using enum InstructionType;
+        switch (instruction.type) {
+        case ADD: return instruction.dst.reg == Registers::A;
+        case ADC:
+        case SUB:
+        case SBC:
+        case AND:
+        case OR:
+        case XOR:
+        case CP: return true;
+        case INC:
+        case DEC: return instruction.src.src != ArgumentSource::DOUBLE_REGISTER;
+        default: return false;
         }
     }
+
+    template class SharpSM83<g_full_config>;
+    template class SharpSM83<g_headless_config>;
 } // namespace gb::cpu
@@ -2,12 +2,21 @@
 #define GB_EMULATOR_SRC_GB_CPU_CPU_HDR_
 
 #include "gb/address_bus.h"
+#include "gb/config.h"
+#include "gb/cpu/block_cache.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/decoder.h"
+#include "gb/cpu/jit.h"
+#include "gb/cpu/micro_program.h"
 #include "gb/cpu/operation.h"
+#include "gb/cpu/trace.h"
+#include "gb/fault.h"
 #include "gb/interrupt_register.h"
+#include "gb/save_state.h"
 #include "util/util.h"
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 
@@ -23,37 +32,36 @@ namespace gb::cpu {
         }
     }
 
-    struct Instruction {
-        using Argument = Variant<std::monostate, Registers, int8_t, uint8_t, uint16_t>;
-
-        InstructionType type = InstructionType::NONE;
-        std::optional<LoadSubtype> load_subtype;
-        std::optional<Conditions> condition;
-
-        Argument src;
-        Argument dst;
-
-        RegisterFile registers;
-        bool ime = false;
-        uint8_t width = 1;
-
-        Argument &arg() { return src; }
-        Argument &arg1() { return src; }
-        Argument &arg2() { return dst; }
-        Argument &bit() { return dst; }
+    struct FlagStats {
+        // arithmetic instructions which only recorded their operands
+        uint64_t deferred = 0;
+        // times deferred flags were computed because an instruction needed F
+        uint64_t materialized = 0;
     };
 
-    constexpr inline bool operator==(Instruction lhs, Instruction rhs) {
-        return lhs.type == rhs.type && lhs.load_subtype == rhs.load_subtype && lhs.condition == rhs.condition &&
-               lhs.src == rhs.src;
-    }
+    constexpr size_t g_access_log_capacity = 32;
+
+    // Memory accesses made by the CPU while the log is attached, used to verify idle loops
+    struct MemoryAccessLog {
+        std::array<uint16_t, g_access_log_capacity> reads{};
+        size_t read_count = 0;
+        bool has_writes = false;
+        // more reads than fit into the log
+        bool overflow = false;
 
-    struct MemoryOp {
-        enum class Type : uint8_t { NONE, READ, FETCH_INSTRUCTION, WRITE };
+        void clear() {
+            read_count = 0;
+            has_writes = false;
+            overflow = false;
+        }
 
-        uint16_t address = 0;
-        Type type = Type::NONE;
-        uint8_t data;
+        void addRead(uint16_t address) {
+            if (read_count == reads.size()) {
+                overflow = true;
+                return;
+            }
+            reads[read_count++] = address;
+        }
     };
 
     class DataBuffer {
@@ -78,30 +86,73 @@ namespace gb::cpu {
       private:
         uint8_t lsb_ = 0;
         uint8_t msb_ = 0;
-        bool empty_ = true;
     };
 
+    template <EmulatorConfig CONFIG>
     class SharpSM83 {
       public:
-        SharpSM83(AddressBus &bus, InterruptRegister &interrupt_enable, InterruptRegister &interrupt_flags);
+        // Faults are recorded in fault, the CPU never throws while it runs
+        SharpSM83(AddressBus<CONFIG> &bus, InterruptRegister &interrupt_enable, InterruptRegister &interrupt_flags,
+                  FaultState &fault);
 
-        void tick();
+        void tick() noexcept;
 
-        RegisterFile getRegisters() const { return reg_; }
+        RegisterFile getRegisters() const { return withFlags(reg_, lazy_flags_); }
 
         uint16_t getProgramCounter() const { return reg_.pc(); }
+        // Address of the last fetched opcode, or of the 0xCB prefix before it. Once isFinished() it is the address of
+        // the instruction executed next, unless an interrupt is serviced first
+        uint16_t getInstructionAddress() const { return instruction_address_; }
 
         bool isFinished() const { return stopped_ || (!jumping_to_interrupt_ && !prefixed_next_ && finished_); }
 
         bool isHalted() const { return halt_mode_; }
 
+        // Halted with nothing left to execute, until an interrupt is pending ticks don't change CPU state
+        bool isWaitingForInterrupt() const {
+            return halt_mode_ && step_ == sequence_->size && !enable_IME_ && !finished_ && !stopped_;
+        }
+
         bool isStopped() const { return stopped_; }
 
-        Instruction getLastInstruction() const { return last_instruction_; }
+        // Records every executed instruction while enabled, does nothing in builds without tracing.
+        // Records aren't a part of CPU state, they are neither saved nor reset
+        void setTraceEnabled(bool enabled)
+            requires(CONFIG.tracing);
+        bool isTraceEnabled() const { return g_tracing && trace_enabled_; }
+        // Record of the last executed instruction
+        const TraceRecord &getLastTrace() const { return last_trace_; }
+
+        // Not a part of CPU state, it is neither saved nor reset
+        const FlagStats &getFlagStats() const { return flag_stats_; }
+
+        // The log isn't a part of CPU state, it is neither saved nor reset
+        void setAccessLog(MemoryAccessLog *log) { access_log_ = log; }
+
+        // Cleared on reset and when state is loaded. Instructions at addresses watched by a bus observer are read
+        // from the bus instead, so those fetches are still reported
+        BlockCache &getBlockCache() { return block_cache_; }
+
+        // If an opcode has just been fetched and a compiled block starts at it, runs the block and fetches the opcode
+        // it stopped at, then the block starting there and so on. Leaves the CPU exactly as the interpreter would
+        // after the returned number of M-cycles. A block doesn't run if that would take more than max_cycles, if an
+        // interrupt is pending or if the instructions could be observed one by one: while tracing, with an access
+        // log or if the bus observer watches the code
+        uint32_t runCompiled(uint64_t max_cycles) noexcept;
+        // Not a part of CPU state, blocks compiled at run time are dropped on reset
+        Jit &getJit() { return jit_; }
+        const Jit &getJit() const { return jit_; }
 
         void reset();
 
+        void saveState(StateWriter &writer) const;
+        void loadState(StateReader &reader);
+        void checkState(StateReader &reader) const;
+
       private:
+        static constexpr bool g_tracing = g_trace_enabled && CONFIG.tracing;
+        static constexpr bool g_jit = g_jit_enabled && CONFIG.jit;
+
         void dispatch();
 
         std::optional<InterruptFlags> getPendingInterrupt() const;
@@ -117,22 +168,45 @@ namespace gb::cpu {
 
         bool checkCondition(Conditions condition);
 
-        void setArgData(Instruction::Argument &arg, ArgumentInfo info, uint8_t data);
-
-        void sheduleMemoryNoOp();
-        void sheduleReadByte(uint16_t address);
-        void sheduleReadWord(uint16_t address);
-        void sheduleWriteByte(uint16_t address, uint8_t data);
-        void sheduleWriteWord(uint16_t address, uint16_t data);
-        void shedulePushStack(uint16_t data);
-        void shedulePopStack(Registers reg);
-        void sheduleMemoryAcceses(DecodedInstruction instr);
-        void sheduleReadToReg(uint16_t address, Registers reg);
-        void sheduleFetchInstruction();
+        // Records the flags of an arithmetic instruction instead of computing them
+        void deferFlags(LazyFlags flags);
+        void materializeFlags();
+        static RegisterFile withFlags(RegisterFile registers, LazyFlags flags) {
+            registers.f(flags.apply(registers.f()));
+            return registers;
+        }
+
+        // Memory accesses of the cycles which follow, their order is fixed by the micro-op program
+        void writeByte(uint16_t address, uint8_t data);
+        void writeWord(uint16_t address, uint16_t data);
+        void pushStack(uint16_t data);
+        void popStack(Registers reg);
+        void readToRegister(uint16_t address, Registers reg);
+        // Used by conditional instructions to run MicroProgram::not_taken
+        void skipBranch() { branch_taken_ = false; }
+
+        // Saved instead of the sequence pointer
+        enum class SequenceKind : uint8_t { OPERANDS, EXECUTE, NOT_TAKEN };
+
+        void startProgram(uint16_t index);
+        SequenceKind getSequenceKind() const;
+        // null if a saved state can't be in that sequence at that step
+        static const MicroSequence *findSequence(uint16_t program, SequenceKind kind, uint8_t step);
+        void startSequence(const MicroSequence &sequence) {
+            sequence_ = &sequence;
+            step_ = 0;
+        }
         void executeMemoryOp();
+        void fetch();
+        // Starts the record of a fetched opcode or adds a prefixed opcode to it
+        void traceOpcode(uint8_t code);
+        // Adds operands to the record of the current instruction, which becomes the last one
+        void finishTrace();
+        // Records the instruction in flight when its opcode wasn't seen by traceOpcode()
+        void restartTrace();
 
-        void decode(Opcode code);
-        void pushMemoryOp(MemoryOp op);
+        // cached is the result of decoding code, if it is already known
+        void decode(Opcode code, const DecodedInstruction *cached = nullptr);
 
         void NOP() {}
         void RLA();
@@ -185,9 +259,10 @@ namespace gb::cpu {
         void SET(Registers reg, uint8_t bit);
 
       private:
-        AddressBus &bus_;
+        AddressBus<CONFIG> &bus_;
         InterruptRegister &ie_;
         InterruptRegister &if_;
+        FaultState &fault_;
 
         RegisterFile reg_;
 
@@ -195,18 +270,49 @@ namespace gb::cpu {
         bool enable_IME_ = false;
         bool halt_mode_ = false;
         bool halt_bug_ = false;
-        bool memory_op_executed_ = false;
         bool prefixed_next_ = false;
         bool stopped_ = false;
         bool finished_ = false;
         bool jumping_to_interrupt_ = false;
 
-        Queue<MemoryOp, 8> memory_op_queue_;
-        Instruction last_instruction_;
-        Instruction instruction_;
+        // M-cycles of the current instruction: its program, the part of the program being run and the next cycle
+        const MicroProgram *program_ = &getMicroProgram(0);
+        const MicroSequence *sequence_ = &program_->operands;
+        uint16_t program_index_ = 0;
+        uint8_t step_ = 0;
+        // address, data and target register of the memory accesses of the sequence
+        uint16_t op_address_ = 0;
+        uint16_t op_data_ = 0;
+        Registers op_register_ = Registers::NONE;
+        bool branch_taken_ = true;
+        // address of the last fetched opcode, or of the 0xCB prefix before it
+        uint16_t instruction_address_ = 0;
         DataBuffer data_buffer_;
         std::optional<DecodedInstruction> current_instruction_;
+        // F in reg_ doesn't include these yet. Flags are computed only when an instruction reads or partially
+        // overwrites them, or state is saved
+        LazyFlags lazy_flags_;
+        FlagStats flag_stats_;
+        // immediate operand bytes of the current instruction which are known from the block cache and don't have to
+        // be read from the bus, lowest byte first. Not a part of CPU state, the bus gives the same bytes
+        uint16_t constant_operand_ = 0;
+        uint8_t constant_bytes_ = 0;
+        bool trace_enabled_ = false;
+        MemoryAccessLog *access_log_ = nullptr;
+        // code in memory which can't be peeked, e.g. missing cartridge RAM, reads as 0xff like on the bus
+        BlockCache block_cache_{bus_.getCartridge(), bus_.getCodePages(),
+                                [this](uint16_t address) { return bus_.peek(address).value_or(0xff); }};
+        Jit jit_{bus_.getCartridge(), [this](uint16_t address) { return bus_.peek(address).value_or(0xff); }};
+
+        // Everything above is used every M-cycle, the trace is only written while tracing is enabled, so it goes last
+        // and doesn't take up cache lines between the hot fields.
+        // Records of the instruction being executed and of the last executed one
+        TraceRecord trace_;
+        TraceRecord last_trace_;
     };
+
+    extern template class SharpSM83<g_full_config>;
+    extern template class SharpSM83<g_headless_config>;
 } // namespace gb::cpu
 
 #endif
@@ -5,10 +5,8 @@
 #include "util/util.h"
 
 #include <array>
-#include <bit>
 #include <cstddef>
 #include <cstdint>
-#include <stdexcept>
 
 namespace gb::cpu {
 
@@ -40,47 +38,28 @@ namespace gb::cpu {
         uint8_t h() const { return registers_[size_t(Registers::H)]; }
         uint8_t l() const { return registers_[size_t(Registers::L)]; }
 
-        void setLow(Registers reg, uint8_t data) {
-            size_t idx = uint8_t(reg) & uint8_t(Registers::LOW_REG_MASK);
-            if (idx >= registers_.size()) [[unlikely]] {
-                throw std::invalid_argument("register index out of bounds");
-            }
-            registers_[idx] = data;
+        // Registers come from the decoder's tables, so they aren't checked. Every index a nibble of a Registers value
+        // can hold is in the file, a wrong register can't access anything outside of it
+        void setLow(Registers reg, uint8_t data) noexcept {
+            registers_[getLowIndex(reg)] = data;
             registers_[g_flags] &= uint8_t(Flags::ALL);
         }
 
-        void setHigh(Registers reg, uint8_t data) {
-            size_t idx = (uint8_t(reg) & uint8_t(Registers::HIGH_REG_MASK)) >> 4;
-            if (idx == 0) [[unlikely]] {
-                throw std::invalid_argument("attempting to setHigh() of byte register");
-            }
-            if (idx >= registers_.size()) [[unlikely]] {
-                throw std::invalid_argument("register index out of bounds");
-            }
-            registers_[idx] = data;
-        }
-
-        uint8_t getByteRegister(Registers reg) const {
-            size_t idx = reg & Registers::LOW_REG_MASK;
-            if (idx >= registers_.size()) [[unlikely]] {
-                throw std::invalid_argument("invalid byte register");
-            }
-            return registers_[idx];
-        }
-        uint16_t getWordRegister(Registers reg) const {
-            size_t idx = reg & Registers::LOW_REG_MASK;
-            if (isByteRegister(reg) || idx >= registers_.size()) [[unlikely]] {
-                throw std::invalid_argument("invalid word register");
-            }
+        void setHigh(Registers reg, uint8_t data) noexcept { registers_[getHighIndex(reg)] = data; }
 
-            return *std::bit_cast<uint16_t *>(&registers_[idx]);
+        uint8_t getByteRegister(Registers reg) const noexcept { return registers_[getLowIndex(reg)]; }
+        uint16_t getWordRegister(Registers reg) const noexcept {
+            return uint16_t(registers_[getLowIndex(reg)]) | (uint16_t(registers_[getHighIndex(reg)]) << 8);
         }
 
-        void setWordRegister(Registers reg, uint16_t data) {
+        void setWordRegister(Registers reg, uint16_t data) noexcept {
             setLow(reg, uint8_t(data));
             setHigh(reg, uint8_t(data >> 8));
         }
 
+        uint8_t f() const { return registers_[g_flags]; }
+        void f(uint8_t value) { registers_[g_flags] = value & uint8_t(Flags::ALL); }
+
         uint16_t af() const { return uint16_t(registers_[g_flags]) | (uint16_t(a()) << 8); }
         uint16_t bc() const { return uint16_t(c()) | (uint16_t(b()) << 8); }
         uint16_t de() const { return uint16_t(e()) | (uint16_t(d()) << 8); }
@@ -126,7 +105,30 @@ namespace gb::cpu {
         uint16_t sp;
 
       private:
-        std::array<uint8_t, 10> registers_; // 7 registers + flags + PC
+        static constexpr size_t getLowIndex(Registers reg) { return uint8_t(reg) & uint8_t(Registers::LOW_REG_MASK); }
+        static constexpr size_t getHighIndex(Registers reg) {
+            return (uint8_t(reg) & uint8_t(Registers::HIGH_REG_MASK)) >> 4;
+        }
+
+        // 7 registers + flags + PC, the rest is never used
+        std::array<uint8_t, 16> registers_{};
+    };
+
+    // Flags of an 8-bit arithmetic instruction, kept as its operands until something reads them
+    struct LazyFlags {
+        enum class Op : uint8_t { NONE, ADD, ADC, SUB, SBC, AND, OR, XOR, INC, DEC };
+
+        Op op = Op::NONE;
+        uint8_t lhs = 0;
+        uint8_t rhs = 0;
+        // carry flag before ADC and SBC
+        uint8_t carry = 0;
+
+        // flags set by op, INC and DEC leave the carry flag alone
+        uint8_t getMask() const;
+        uint8_t getFlags() const;
+        // flags with the deferred ones applied
+        uint8_t apply(uint8_t flags) const { return uint8_t((flags & ~getMask()) | getFlags()); }
     };
 
     inline bool carried(uint8_t lhs, uint8_t rhs) { return (std::numeric_limits<uint8_t>::max() - rhs) < lhs; }
@@ -136,6 +138,42 @@ namespace gb::cpu {
     inline bool halfCarried(uint8_t lhs, uint8_t rhs) { return ((lhs & 0x0F) + (rhs & 0x0F)) > 0x0F; }
     inline bool halfBorrowed(uint8_t lhs, uint8_t rhs) { return (lhs & 0x0F) < (rhs & 0x0F); }
     inline bool halfCarried(uint16_t rhs, uint16_t lhs) { return ((lhs & 0x0FFF) + (rhs & 0x0FFF)) > 0x0FFF; }
+
+    inline uint8_t LazyFlags::getMask() const {
+        switch (op) {
+        case Op::NONE: return 0;
+        case Op::INC:
+        case Op::DEC: return uint8_t(Flags::Z) | uint8_t(Flags::N) | uint8_t(Flags::H);
+        default: return uint8_t(Flags::ALL);
+        }
+    }
+
+    inline uint8_t LazyFlags::getFlags() const {
+        auto flag = [](Flags flag, bool value) { return value ? uint8_t(flag) : uint8_t(0); };
+        switch (op) {
+        case Op::NONE: return 0;
+        case Op::ADD:
+            return flag(Flags::Z, uint8_t(lhs + rhs) == 0) | flag(Flags::H, halfCarried(lhs, rhs)) |
+                   flag(Flags::C, carried(lhs, rhs));
+        case Op::ADC:
+            return flag(Flags::Z, uint8_t(lhs + rhs + carry) == 0) |
+                   flag(Flags::H, (lhs & 0x0F) + (rhs & 0x0F) + carry > 0x0F) |
+                   flag(Flags::C, uint16_t(lhs) + rhs + carry > 0xFF);
+        case Op::SUB:
+            return uint8_t(Flags::N) | flag(Flags::Z, lhs == rhs) | flag(Flags::H, halfBorrowed(lhs, rhs)) |
+                   flag(Flags::C, borrowed(lhs, rhs));
+        case Op::SBC:
+            return uint8_t(Flags::N) | flag(Flags::Z, uint8_t(lhs - rhs - carry) == 0) |
+                   flag(Flags::H, (lhs & 0x0F) < (rhs & 0x0F) + carry) | flag(Flags::C, lhs < uint16_t(rhs) + carry);
+        case Op::AND: return uint8_t(Flags::H) | flag(Flags::Z, (lhs & rhs) == 0);
+        case Op::OR: return flag(Flags::Z, (lhs | rhs) == 0);
+        case Op::XOR: return flag(Flags::Z, (lhs ^ rhs) == 0);
+        case Op::INC: return flag(Flags::Z, uint8_t(lhs + 1) == 0) | flag(Flags::H, halfCarried(lhs, uint8_t(1)));
+        case Op::DEC:
+            return uint8_t(Flags::N) | flag(Flags::Z, lhs == 1) | flag(Flags::H, halfBorrowed(lhs, uint8_t(1)));
+        }
+        return 0;
+    }
 } // namespace gb::cpu
 
 #endif
@@ -1,10 +1,10 @@
 #include "gb/cpu/decoder.h"
 #include "gb/cpu/cpu.h"
+#include "gb/cpu/micro_program.h"
 #include "gb/cpu/operation.h"
 
 #include <array>
 #include <cstdint>
-#include <stdexcept>
 #include <utility>
 
 // TODO: this is a mess
@@ -17,6 +17,11 @@ namespace gb::cpu {
 
     static constexpr void setRegisterInfo(uint8_t register_index, ArgumentInfo &register_info);
     static constexpr void setALUInfo(Opcode code, DecodedInstruction &instruction, bool has_immediate);
+    // Type is NONE for illegal opcodes
+    static constexpr DecodedInstruction decodeOpcode(Opcode code);
+    static constexpr DecodedInstruction decodePrefixedOpcode(Opcode code);
+    static constexpr MicroProgram makeMicroProgram(const DecodedInstruction &instr);
+    static constexpr void addLoadCycles(const DecodedInstruction &instr, MicroSequence &cycles);
 
     consteval DecodedInstruction dec(Registers reg, bool double_reg = false) {
         DecodedInstruction instr{.type = Type::DEC};
@@ -334,7 +339,11 @@ namespace gb::cpu {
 
     consteval uint8_t getColumnID(uint8_t quarter, uint8_t column) { return (quarter << 6) | column; }
 
-    DecodedInstruction decodeUnprefixed(Opcode code) {
+    DecodedInstruction decodeUnprefixed(Opcode code) { return decodeOpcode(code); }
+
+    DecodedInstruction decodePrefixed(Opcode code) { return decodePrefixedOpcode(code); }
+
+    constexpr DecodedInstruction decodeOpcode(Opcode code) {
         DecodedInstruction result;
 
         switch (code.getX()) {
@@ -359,14 +368,10 @@ namespace gb::cpu {
             break;
         }
 
-        if (result.type == Type::NONE) {
-            throw std::invalid_argument("illegal instruction");
-        }
-
         return result;
     }
 
-    DecodedInstruction decodePrefixed(Opcode code) {
+    constexpr DecodedInstruction decodePrefixedOpcode(Opcode code) {
         DecodedInstruction result;
 
         switch (code.getX()) {
@@ -407,4 +412,146 @@ namespace gb::cpu {
         }
     }
 
+    // Cycles must match how SharpSM83 executes the instruction: the memory accesses it sets up and the conditions
+    // it checks
+    constexpr MicroProgram makeMicroProgram(const DecodedInstruction &instr) {
+        using enum MicroOp;
+        MicroProgram program;
+        program.immediate_size = uint8_t(getImmediateSize(instr));
+        for (uint8_t i = 0; i < program.immediate_size; ++i) {
+            program.operands.add(READ);
+        }
+        if (instr.src.src == ArgSrc::INDIRECT && instr.src.reg != Reg::C) {
+            program.indirect_operand = instr.src.reg;
+            program.operands.add(READ);
+        }
+
+        MicroSequence &cycles = program.execute;
+        switch (instr.type) {
+        case Type::LD: addLoadCycles(instr, cycles); break;
+        case Type::INC:
+        case Type::DEC:
+            if (instr.src.src == ArgSrc::DOUBLE_REGISTER) {
+                cycles.add(IDLE);
+            } else if (instr.src.src == ArgSrc::INDIRECT) {
+                cycles.add(WRITE);
+            }
+            break;
+        case Type::ADD:
+            if (instr.dst.reg == Reg::HL) {
+                cycles.add(IDLE);
+            } else if (instr.dst.reg == Reg::SP) {
+                cycles.add(IDLE);
+                cycles.add(IDLE);
+            }
+            break;
+        case Type::JP:
+            if (instr.src.src != ArgSrc::DOUBLE_REGISTER) {
+                cycles.add(IDLE);
+            }
+            break;
+        case Type::JR: cycles.add(IDLE); break;
+        case Type::CALL:
+        case Type::RST:
+        case Type::PUSH:
+            cycles.add(IDLE);
+            cycles.add(PUSH);
+            cycles.add(PUSH);
+            break;
+        case Type::POP:
+            cycles.add(READ_LOW);
+            cycles.add(READ_HIGH);
+            break;
+        case Type::RET:
+            // the condition is checked in a cycle of its own
+            if (instr.condition) {
+                cycles.add(IDLE);
+                program.not_taken = cycles;
+            }
+            [[fallthrough]];
+        case Type::RETI:
+            cycles.add(READ_LOW);
+            cycles.add(READ_HIGH);
+            cycles.add(IDLE);
+            break;
+        case Type::RLC:
+        case Type::RRC:
+        case Type::RL:
+        case Type::RR:
+        case Type::SLA:
+        case Type::SRA:
+        case Type::SWAP:
+        case Type::SRL:
+        case Type::RES:
+        case Type::SET:
+            if (instr.src.src == ArgSrc::INDIRECT) {
+                cycles.add(WRITE);
+            }
+            break;
+        default: break;
+        }
+
+        if (!instr.condition) {
+            program.not_taken = cycles;
+        }
+        program.execute.add(FETCH);
+        program.not_taken.add(FETCH);
+        return program;
+    }
+
+    constexpr void addLoadCycles(const DecodedInstruction &instr, MicroSequence &cycles) {
+        switch (*instr.ld_subtype) {
+        case LoadSubtype::TYPICAL:
+            if (instr.dst.src == ArgSrc::DOUBLE_REGISTER) {
+                // LD SP, HL
+                if (instr.src.src != ArgSrc::IMMEDIATE_U16) {
+                    cycles.add(MicroOp::IDLE);
+                }
+                break;
+            }
+            [[fallthrough]];
+        case LoadSubtype::LD_INC:
+        case LoadSubtype::LD_DEC:
+            if (instr.src.src == ArgSrc::IMMEDIATE_U16) { // LD A, [nn]
+                cycles.add(MicroOp::READ_LOW);
+            } else if (!isByteRegister(instr.dst.reg)) { // LD [HL], r, LD [rr], A, LD [nn], A
+                cycles.add(MicroOp::WRITE);
+            }
+            break;
+        case LoadSubtype::LD_IO: cycles.add(instr.src.reg == Reg::A ? MicroOp::WRITE : MicroOp::READ_LOW); break;
+        case LoadSubtype::LD_OFFSET_SP: cycles.add(MicroOp::IDLE); break;
+        case LoadSubtype::LD_SP:
+            cycles.add(MicroOp::WRITE);
+            cycles.add(MicroOp::WRITE);
+            break;
+        }
+    }
+
+    static constexpr std::array<MicroProgram, g_micro_program_count> makeMicroPrograms() {
+        std::array<MicroProgram, g_micro_program_count> result{};
+        for (uint16_t code = 0; code < 0x100; ++code) {
+            if (isPrefix(uint8_t(code))) {
+                // the prefixed opcode is fetched right after the prefix
+                result[code].operands.add(MicroOp::FETCH);
+            } else if (DecodedInstruction instr = decodeOpcode(uint8_t(code)); instr.type != Type::NONE) {
+                result[code] = makeMicroProgram(instr);
+            }
+            result[g_prefixed_programs + code] = makeMicroProgram(decodePrefixedOpcode(uint8_t(code)));
+        }
+
+        // with another idle cycle before pushing PC the emulator fails mooneye's intr_timing test.
+        // It looks like interrupts are checked before the next opcode is fetched,
+        // so in case of this emulator the FETCH takes place of the first idle cycle
+        MicroSequence &interrupt = result[g_interrupt_program].execute;
+        interrupt.add(MicroOp::IDLE);
+        interrupt.add(MicroOp::PUSH);
+        interrupt.add(MicroOp::PUSH);
+        interrupt.add(MicroOp::IDLE);
+        interrupt.add(MicroOp::FETCH);
+        return result;
+    }
+
+    constexpr std::array<MicroProgram, g_micro_program_count> g_micro_programs = makeMicroPrograms();
+
+    const MicroProgram &getMicroProgram(uint16_t index) { return g_micro_programs[index]; }
 } // namespace gb::cpu
@@ -1,6 +1,7 @@
 #ifndef GB_EMULATOR_SRC_GB_CPU_DECODER_HDR_
 #define GB_EMULATOR_SRC_GB_CPU_DECODER_HDR_
 
+#include "gb/cpu/micro_program.h"
 #include "gb/cpu/operation.h"
 
 #include <array>
@@ -14,10 +15,15 @@ https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20
 */
 namespace gb::cpu {
 
+    // Type of illegal opcodes is InstructionType::NONE
     DecodedInstruction decodeUnprefixed(Opcode code);
     DecodedInstruction decodePrefixed(Opcode code);
 
-    inline bool isPrefix(Opcode code) { return code.code == 0xCB; }
+    constexpr inline bool isPrefix(Opcode code) { return code.code == 0xCB; }
+
+    // M-cycles of an opcode, index is the opcode, the opcode + g_prefixed_programs or g_interrupt_program.
+    // The programs are built at compile time
+    const MicroProgram &getMicroProgram(uint16_t index);
 } // namespace gb::cpu
 
 #endif
@@ -1,61 +1,50 @@
 #include "gb/cpu/cpu.h"
+#include "gb/config.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/operation.h"
+#include "gb/fault.h"
 #include "util/util.h"
 
 #include <climits>
 #include <cstdint>
-#include <stdexcept>
 
 namespace gb::cpu {
     using enum Flags;
 
-    void SharpSM83::loadByte(ArgumentInfo dst, ArgumentInfo src) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::loadByte(ArgumentInfo dst, ArgumentInfo src) {
         switch (src.src) {
         case ArgumentSource::IMMEDIATE_U16: // LD A, [nn]
-            sheduleReadToReg(data_buffer_.getWord(), dst.reg);
-            instruction_.src = data_buffer_.getWord();
-            instruction_.dst = dst.reg;
+            readToRegister(data_buffer_.getWord(), dst.reg);
             break;
         case ArgumentSource::INDIRECT: // LD r, [HL], LD A, [rr]
             setByteRegister(dst.reg, data_buffer_.get());
-            instruction_.src = src.reg;
-            instruction_.dst = dst.reg;
             break;
         case ArgumentSource::IMMEDIATE_U8: // LD r, n, LD [HL], n
             setByteRegister(dst.reg, data_buffer_.get());
-            instruction_.src = data_buffer_.get();
-            instruction_.dst = dst.reg;
             break;
         case ArgumentSource::REGISTER:
             if (dst.src == ArgumentSource::IMMEDIATE_U16) { // LD [nn], A
-                sheduleWriteByte(data_buffer_.getWord(), getByteRegister(src.reg));
-                instruction_.dst = data_buffer_.getWord();
-                instruction_.src = src.reg;
+                writeByte(data_buffer_.getWord(), getByteRegister(src.reg));
                 break;
             } else { // LD r, r, LD [HL], r, LD [rr], A
                 setByteRegister(dst.reg, getByteRegister(src.reg));
-                instruction_.src = src.reg;
-                instruction_.dst = dst.reg;
                 break;
             }
-        default: throw std::runtime_error("unreachable"); break;
+        default: fault_.raise(Fault::INTERNAL_ERROR, instruction_address_); break;
         }
     }
 
-    void SharpSM83::LD(DecodedInstruction instr) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::LD(DecodedInstruction instr) {
         switch (*instr.ld_subtype) {
         case LoadSubtype::TYPICAL:
             if (instr.dst.src == ArgumentSource::DOUBLE_REGISTER) {
-                instruction_.dst = instr.dst.reg;
                 uint16_t value = 0;
                 if (instr.src.src == ArgumentSource::IMMEDIATE_U16) {
                     value = data_buffer_.getWord();
-                    instruction_.src = value;
                 } else { // LD SP, HL
                     value = reg_.hl();
-                    instruction_.src = Registers::HL;
-                    sheduleMemoryNoOp();
                 }
                 setWordRegister(instr.dst.reg, value);
             } else {
@@ -82,92 +71,71 @@ namespace gb::cpu {
             }
             uint16_t address = 0xFF00 + uint16_t(byte);
             if (direction) {
-                setArgData(instruction_.dst, instr.dst, byte);
-                instruction_.src = Registers::A;
-                sheduleWriteByte(address, reg_.a());
+                writeByte(address, reg_.a());
             } else {
-                setArgData(instruction_.src, instr.src, byte);
-                instruction_.dst = Registers::A;
-                sheduleReadToReg(address, Registers::A);
+                readToRegister(address, Registers::A);
             }
             break;
         }
         case LoadSubtype::LD_OFFSET_SP: {
             int8_t offset = data_buffer_.getSigned();
-            instruction_.dst = Registers::SP;
-            instruction_.src = offset;
             reg_.setFlag(H, halfCarried(uint8_t(reg_.sp), offset));
             reg_.setFlag(C, carried(uint8_t(reg_.sp), uint8_t(offset)));
             reg_.setFlag(Z, 0);
             reg_.setFlag(N, 0);
             reg_.hl(reg_.sp + offset);
-            sheduleMemoryNoOp();
             break;
         }
         case LoadSubtype::LD_SP: {
             uint16_t address = data_buffer_.getWord();
-            instruction_.dst = Registers::SP;
-            instruction_.src = address;
-            sheduleWriteWord(address, reg_.sp);
+            writeWord(address, reg_.sp);
             break;
         }
-        default: throw std::invalid_argument("Unknown LD instruction"); break;
+        default: fault_.raise(Fault::INTERNAL_ERROR, instruction_address_); break;
         }
     }
 
-    void SharpSM83::INC(ArgumentInfo target) {
-        instruction_.arg() = target.reg;
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::INC(ArgumentInfo target) {
         if (target.src == ArgumentSource::DOUBLE_REGISTER) {
             uint16_t value = getWordRegister(target.reg);
             ++value;
             setWordRegister(target.reg, value);
-            sheduleMemoryNoOp();
         } else {
             uint8_t value = getByteRegister(target.reg);
-            reg_.setFlag(H, halfCarried(value, 1));
-            reg_.setFlag(N, 0);
-            ++value;
-            reg_.setFlag(Z, value == 0);
-            setByteRegister(target.reg, value);
+            deferFlags(LazyFlags{.op = LazyFlags::Op::INC, .lhs = value});
+            setByteRegister(target.reg, value + 1);
         }
     }
 
-    void SharpSM83::DEC(ArgumentInfo target) {
-        instruction_.arg() = target.reg;
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::DEC(ArgumentInfo target) {
         if (target.src == ArgumentSource::DOUBLE_REGISTER) {
             uint16_t value = getWordRegister(target.reg);
             --value;
             setWordRegister(target.reg, value);
-            sheduleMemoryNoOp();
         } else {
             uint8_t value = getByteRegister(target.reg);
-            reg_.setFlag(H, halfBorrowed(value, 1));
-            reg_.setFlag(N, 1);
-            --value;
-            reg_.setFlag(Z, value == 0);
-            setByteRegister(target.reg, value);
+            deferFlags(LazyFlags{.op = LazyFlags::Op::DEC, .lhs = value});
+            setByteRegister(target.reg, value - 1);
         }
     }
 
-    void SharpSM83::ADD(DecodedInstruction instr) {
-        reg_.setFlag(N, false);
-
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::ADD(DecodedInstruction instr) {
         switch (instr.dst.reg) {
         case Registers::HL: {
-            instruction_.dst = Registers::HL;
-            instruction_.src = instr.src.reg;
+            reg_.setFlag(N, false);
             uint16_t value = getWordRegister(instr.src.reg);
             reg_.setFlag(H, halfCarried(reg_.hl(), value));
             reg_.setFlag(C, carried(reg_.hl(), value));
             reg_.hl(reg_.hl() + value);
-            sheduleMemoryNoOp();
             break;
         }
         case Registers::SP: {
-            instruction_.dst = Registers::SP;
+            reg_.setFlag(N, false);
             reg_.setFlag(Z, false);
             int8_t value = data_buffer_.getSigned();
-            instruction_.src = value;
             reg_.setFlag(H, halfCarried(uint8_t(reg_.sp),
                                         value)); // According to specification H flag
                                                  // should be set if overflow from bit 3
@@ -175,8 +143,6 @@ namespace gb::cpu {
                                     uint8_t(value))); // Carry flag should be set
                                                       // if overflow from bit 7
             reg_.sp += value;
-            sheduleMemoryNoOp();
-            sheduleMemoryNoOp();
             break;
         }
         case Registers::A: {
@@ -186,214 +152,183 @@ namespace gb::cpu {
             } else { // ADD r, ADD [HL]
                 value = getByteRegister(instr.src.reg);
             }
-            setArgData(instruction_.arg(), instr.src, value);
-            reg_.setFlag(H, halfCarried(reg_.a(), value));
-            reg_.setFlag(C, carried(reg_.a(), value));
+            deferFlags(LazyFlags{.op = LazyFlags::Op::ADD, .lhs = reg_.a(), .rhs = value});
             reg_.a() += value;
-            reg_.setFlag(Z, reg_.a() == 0);
             break;
         }
-        default: throw std::invalid_argument("Unknown ADD instruction"); break;
+        default: fault_.raise(Fault::INTERNAL_ERROR, instruction_address_); break;
         }
     }
 
-    void SharpSM83::ADC(ArgumentInfo argument) {
-        reg_.setFlag(N, false);
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::ADC(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // ADC n
             value = data_buffer_.get();
         } else { // ADC r, ADC [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
-        uint8_t old_a = reg_.a();
-
-        reg_.a() += value + uint8_t(reg_.getFlag(C));
-        reg_.setFlag(Z, reg_.a() == 0);
-        reg_.setFlag(H, ((old_a & 0x0F) + (value & 0x0F) + reg_.getFlag(C)) > 0x0F);
-        reg_.setFlag(C, uint16_t(old_a) + value + reg_.getFlag(C) > 0xFF);
+        uint8_t carry = uint8_t(reg_.getFlag(C));
+        deferFlags(LazyFlags{.op = LazyFlags::Op::ADC, .lhs = reg_.a(), .rhs = value, .carry = carry});
+        reg_.a() += value + carry;
     }
 
-    void SharpSM83::SUB(ArgumentInfo argument) {
-        reg_.setFlag(N, true);
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SUB(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // SUB n
             value = data_buffer_.get();
         } else { // SUB r, SUB [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
-
-        reg_.setFlag(H, halfBorrowed(reg_.a(), value));
-        reg_.setFlag(C, borrowed(reg_.a(), value));
+        deferFlags(LazyFlags{.op = LazyFlags::Op::SUB, .lhs = reg_.a(), .rhs = value});
         reg_.a() -= value;
-        reg_.setFlag(Z, reg_.a() == 0);
     }
 
-    void SharpSM83::SBC(ArgumentInfo argument) {
-        reg_.setFlag(N, true);
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SBC(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // SBC n
             value = data_buffer_.get();
         } else { // SBC r, SBC [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
-
-        uint8_t old_a = reg_.a();
-
-        reg_.a() -= value + reg_.getFlag(C);
-        reg_.setFlag(Z, reg_.a() == 0);
-        reg_.setFlag(H, (old_a & 0x0F) < ((value & 0x0F) + reg_.getFlag(C)));
-        reg_.setFlag(C, old_a < (static_cast<uint16_t>(value) + reg_.getFlag(C)));
+        uint8_t carry = uint8_t(reg_.getFlag(C));
+        deferFlags(LazyFlags{.op = LazyFlags::Op::SBC, .lhs = reg_.a(), .rhs = value, .carry = carry});
+        reg_.a() -= value + carry;
     }
 
-    void SharpSM83::OR(ArgumentInfo argument) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::OR(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // OR n
             value = data_buffer_.get();
         } else { // OR r, OR [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
-
-        reg_.clearFlags(); // Only Z flag can be non-zero as a result of OR
 
+        deferFlags(LazyFlags{.op = LazyFlags::Op::OR, .lhs = reg_.a(), .rhs = value});
         reg_.a() |= value;
-        reg_.setFlag(Z, reg_.a() == 0);
     }
 
-    void SharpSM83::AND(ArgumentInfo argument) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::AND(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // AND n
             value = data_buffer_.get();
         } else { // AND r, AND [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
 
-        reg_.clearFlags();
-        reg_.setFlag(H, true);
+        deferFlags(LazyFlags{.op = LazyFlags::Op::AND, .lhs = reg_.a(), .rhs = value});
         reg_.a() &= value;
-        reg_.setFlag(Z, reg_.a() == 0);
     }
 
-    void SharpSM83::XOR(ArgumentInfo argument) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::XOR(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // XOR n
             value = data_buffer_.get();
         } else { // XOR r, XOR [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
 
-        reg_.clearFlags(); // Only Z flag can be non-zero as a result of XOR
+        deferFlags(LazyFlags{.op = LazyFlags::Op::XOR, .lhs = reg_.a(), .rhs = value});
         reg_.a() ^= value;
-        reg_.setFlag(Z, reg_.a() == 0);
     }
 
-    void SharpSM83::CP(ArgumentInfo argument) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::CP(ArgumentInfo argument) {
         uint8_t value = 0;
         if (argument.src == ArgumentSource::IMMEDIATE_U8) { // CP n
             value = data_buffer_.get();
         } else { // CP r, CP [HL]
             value = getByteRegister(argument.reg);
         }
-        setArgData(instruction_.arg(), argument, value);
 
-        reg_.setFlag(N, true);
-        reg_.setFlag(H, halfBorrowed(reg_.a(), value));
-        reg_.setFlag(C, borrowed(reg_.a(), value));
-        reg_.setFlag(Z, (reg_.a() - value) == 0);
+        deferFlags(LazyFlags{.op = LazyFlags::Op::SUB, .lhs = reg_.a(), .rhs = value});
     }
 
-    void SharpSM83::JP(DecodedInstruction instr) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::JP(DecodedInstruction instr) {
         if (instr.src.src == ArgumentSource::DOUBLE_REGISTER) { // JP HL
-            instruction_.arg() = Registers::HL;
             reg_.pc(reg_.hl());
             return;
         }
         uint16_t address = data_buffer_.getWord();
-        instruction_.arg() = address;
 
         if (instr.condition.has_value() && !checkCondition(*instr.condition)) {
-            return;
+            return skipBranch();
         }
         reg_.pc(address);
-        sheduleMemoryNoOp();
     }
 
-    void SharpSM83::JR(std::optional<Conditions> condition) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::JR(std::optional<Conditions> condition) {
         int8_t rel_address = data_buffer_.getSigned();
-        instruction_.arg() = rel_address;
 
         if (condition.has_value() && (!checkCondition(*condition))) {
-            return;
+            return skipBranch();
         }
 
         reg_.pc(reg_.pc() + rel_address);
-        sheduleMemoryNoOp();
     }
 
-    void SharpSM83::PUSH(Registers reg) {
-        instruction_.arg() = reg;
-        sheduleMemoryNoOp();
-        shedulePushStack(getWordRegister(reg));
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::PUSH(Registers reg) {
+        pushStack(getWordRegister(reg));
     }
 
-    void SharpSM83::POP(Registers reg) {
-        instruction_.arg() = reg;
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::POP(Registers reg) {
         // TODO: verify that reg is double register
-        shedulePopStack(reg);
+        popStack(reg);
     }
 
-    void SharpSM83::RST(uint16_t reset_vector) {
-        instruction_.arg() = reset_vector;
-        sheduleMemoryNoOp();
-        shedulePushStack(reg_.pc());
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RST(uint16_t reset_vector) {
+        pushStack(reg_.pc());
         reg_.pc(reset_vector);
     }
 
-    void SharpSM83::CALL(std::optional<Conditions> condition) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::CALL(std::optional<Conditions> condition) {
         uint16_t address = data_buffer_.getWord();
-        instruction_.arg() = address;
 
         if (condition.has_value() && (!checkCondition(*condition))) {
-            return;
+            return skipBranch();
         }
 
-        sheduleMemoryNoOp();
-        shedulePushStack(reg_.pc());
+        pushStack(reg_.pc());
         reg_.pc(address);
     }
 
-    void SharpSM83::RET(std::optional<Conditions> condition) {
-        bool conditional = condition.has_value();
-        if (conditional) {
-            sheduleMemoryNoOp();
-            if (!checkCondition(*condition)) {
-                return;
-            }
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RET(std::optional<Conditions> condition) {
+        if (condition.has_value() && !checkCondition(*condition)) {
+            return skipBranch();
         }
 
-        shedulePopStack(Registers::PC);
-        sheduleMemoryNoOp();
+        popStack(Registers::PC);
     }
 
-    void SharpSM83::RETI() {
-        shedulePopStack(Registers::PC);
-        sheduleMemoryNoOp();
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RETI() {
+        popStack(Registers::PC);
         IME_ = true;
     }
 
-    void SharpSM83::DI() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::DI() {
         IME_ = false;
         enable_IME_ = false;
     }
 
-    void SharpSM83::EI() { enable_IME_ = true; }
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::EI() { enable_IME_ = true; }
 
-    void SharpSM83::HALT() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::HALT() {
         if (getPendingInterrupt() && !IME_) {
             halt_bug_ = true;
         } else {
@@ -401,12 +336,14 @@ namespace gb::cpu {
         }
     }
 
-    void SharpSM83::STOP() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::STOP() {
         // TODO: check for corrupted STOP
         stopped_ = true;
     }
 
-    void SharpSM83::DAA() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::DAA() {
         uint8_t correction = 0;
 
         if (reg_.getFlag(C) || (!reg_.getFlag(N) && reg_.a() > 0x99)) {
@@ -427,51 +364,59 @@ namespace gb::cpu {
         reg_.setFlag(Z, reg_.a() == 0);
     }
 
-    void SharpSM83::CPL() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::CPL() {
         reg_.setFlag(N, true);
         reg_.setFlag(H, true);
         reg_.a() = ~reg_.a();
     }
 
-    void SharpSM83::CCF() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::CCF() {
         reg_.setFlag(N, false);
         reg_.setFlag(H, false);
         reg_.setFlag(C, !reg_.getFlag(C));
     }
 
-    void SharpSM83::SCF() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SCF() {
         reg_.setFlag(N, false);
         reg_.setFlag(H, false);
         reg_.setFlag(C, true);
     }
 
-    void SharpSM83::RLA() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RLA() {
         uint8_t first_bit = uint8_t(reg_.getFlag(C));
         reg_.clearFlags();
         reg_.setFlag(C, (reg_.a() & 0x80) != 0);
         reg_.a() = (reg_.a() << 1) | first_bit;
     }
 
-    void SharpSM83::RRA() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RRA() {
         uint8_t last_bit = uint8_t(reg_.getFlag(C)) << 7;
         reg_.clearFlags();
         reg_.setFlag(C, (reg_.a() & 0x01) != 0);
         reg_.a() = (reg_.a() >> 1) | last_bit;
     }
 
-    void SharpSM83::RLCA() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RLCA() {
         reg_.clearFlags();
         reg_.setFlag(C, (reg_.a() & 0b10000000) != 0);
         reg_.a() = (reg_.a() << 1) | (reg_.a() >> (sizeof(uint8_t) * CHAR_BIT - 1));
     }
 
-    void SharpSM83::RRCA() {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RRCA() {
         reg_.clearFlags();
         reg_.setFlag(C, (reg_.a() & 0b00000001) != 0);
         reg_.a() = (reg_.a() >> 1) | (reg_.a() << (sizeof(uint8_t) * CHAR_BIT - 1));
     }
 
-    void SharpSM83::RLC(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RLC(Registers reg) {
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
 
@@ -481,7 +426,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::RRC(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RRC(Registers reg) {
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
 
@@ -491,7 +437,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::RL(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RL(Registers reg) {
         uint8_t first_bit = uint8_t(reg_.getFlag(C));
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
@@ -502,7 +449,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::RR(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RR(Registers reg) {
         uint8_t last_bit = uint8_t(reg_.getFlag(C)) << 7;
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
@@ -513,7 +461,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::SLA(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SLA(Registers reg) {
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
 
@@ -523,7 +472,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::SRA(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SRA(Registers reg) {
         reg_.clearFlags();
         uint8_t first_bit = 0;
         uint8_t value = getByteRegister(reg);
@@ -536,7 +486,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::SWAP(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SWAP(Registers reg) {
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
         uint8_t temp = value & 0xF0;
@@ -548,7 +499,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::SRL(Registers reg) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SRL(Registers reg) {
         reg_.clearFlags();
         uint8_t value = getByteRegister(reg);
 
@@ -558,7 +510,8 @@ namespace gb::cpu {
         setByteRegister(reg, value);
     }
 
-    void SharpSM83::BIT(Registers reg, uint8_t bit) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::BIT(Registers reg, uint8_t bit) {
         reg_.setFlag(N, false);
         reg_.setFlag(H, true);
         uint8_t value = getByteRegister(reg);
@@ -567,13 +520,18 @@ namespace gb::cpu {
         reg_.setFlag(Z, value == 0);
     }
 
-    void SharpSM83::RES(Registers reg, uint8_t bit) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::RES(Registers reg, uint8_t bit) {
         uint8_t mask = ~(1 << bit);
         setByteRegister(reg, getByteRegister(reg) & mask);
     }
 
-    void SharpSM83::SET(Registers reg, uint8_t bit) {
+    template <EmulatorConfig CONFIG>
+    void SharpSM83<CONFIG>::SET(Registers reg, uint8_t bit) {
         uint8_t mask = 1 << bit;
         setByteRegister(reg, getByteRegister(reg) | mask);
     }
+
+    template class SharpSM83<g_full_config>;
+    template class SharpSM83<g_headless_config>;
 } // namespace gb::cpu
@@ -0,0 +1,945 @@
+#include "gb/cpu/jit.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/block_ir.h"
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/micro_program.h"
+#include "gb/cpu/operation.h"
+#include "gb/cpu/threaded_code.h"
+#include "gb/memory/basic_components.h"
+#include "gb/memory/memory_map.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#endif
+
+namespace gb::cpu {
+
+    // x86-64 registers by their encoding. SM83 register r is kept in r8 + r while a block runs, rdi points to
+    // JitRegisters, rsi to g_flag_table and rcx to MemoryPages. Memory is accessed at [rax + rdx], with the page in
+    // rax and the offset in it in rdx
+    constexpr uint8_t g_rax = 0;
+    constexpr uint8_t g_rdx = 2;
+    constexpr uint8_t g_r8 = 8;
+
+    // extensions of x86's 8-bit arithmetic opcodes, 0x80 /op ib and (op << 3) /r
+    enum class AluOp : uint8_t { ADD = 0, OR = 1, ADC = 2, SBB = 3, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+    // second bytes of x86's Jcc rel32 opcodes
+    enum class Jump : uint8_t { CARRY = 0x82, NOT_CARRY = 0x83, ZERO = 0x84 };
+
+    // the function returns JitExit in eax, cycles in the low half
+    static_assert(sizeof(JitExit) == 4 && offsetof(JitExit, instructions) == 2);
+
+    constexpr uint8_t g_flag_z = uint8_t(Flags::Z);
+    constexpr uint8_t g_flag_n = uint8_t(Flags::N);
+    constexpr uint8_t g_flag_h = uint8_t(Flags::H);
+    constexpr uint8_t g_flag_c = uint8_t(Flags::C);
+
+    // SM83 Z, H and C for each value LAHF can load into AH, x86 keeps them in bits 6, 4 and 0
+    constexpr std::array<uint8_t, 256> g_flag_table = [] {
+        std::array<uint8_t, 256> table{};
+        for (size_t i = 0; i < table.size(); ++i) {
+            table[i] = uint8_t(((i & 0x40) != 0 ? g_flag_z : 0) | ((i & 0x10) != 0 ? g_flag_h : 0) |
+                               ((i & 0x01) != 0 ? g_flag_c : 0));
+        }
+        return table;
+    }();
+
+    // Encodes the few instructions compiled blocks are made of. Byte registers are always r8b-r15b or al
+    class X86Emitter {
+      public:
+        const std::vector<uint8_t> &getCode() const { return code_; }
+        void append(const X86Emitter &other) { code_.insert(code_.end(), other.code_.begin(), other.code_.end()); }
+
+        // op dst, src
+        void alu(AluOp op, uint8_t dst, uint8_t src) { registerOp(uint8_t(uint8_t(op) << 3), src, dst); }
+        // op dst, value
+        void aluImmediate(AluOp op, uint8_t dst, uint8_t value) {
+            registerOp(0x80, uint8_t(op), dst);
+            byte(value);
+        }
+        void move(uint8_t dst, uint8_t src) { registerOp(0x88, src, dst); }
+        void moveImmediate(uint8_t dst, uint8_t value) {
+            rex(0, dst);
+            byte(uint8_t(0xb0 | (dst & 7)));
+            byte(value);
+        }
+        void increment(uint8_t reg) { registerOp(0xfe, 0, reg); }
+        void decrement(uint8_t reg) { registerOp(0xfe, 1, reg); }
+        void complement(uint8_t reg) { registerOp(0xf6, 2, reg); }
+        // BT reg, bit: the x86 carry flag becomes the bit
+        void testBit(uint8_t reg, uint8_t bit) {
+            rex(0, reg);
+            byte(0x0f);
+            registerOp(0xba, 4, reg, false);
+            byte(bit);
+        }
+
+        // al = the SM83 flags of the last x86 arithmetic instruction, see g_flag_table
+        void loadFlags() {
+            // LAHF, MOVZX eax, ah, MOVZX eax, byte [rsi + rax]
+            bytes({0x9f, 0x0f, 0xb6, 0xc4, 0x0f, 0xb6, 0x04, 0x06});
+        }
+
+        // MOVZX reg, byte [rdi + offset]
+        void load(uint8_t reg, uint8_t offset) {
+            rex(reg, 0);
+            bytes({0x0f, 0xb6, uint8_t(0x47 | ((reg & 7) << 3)), offset});
+        }
+        // MOV byte [rdi + offset], reg
+        void store(uint8_t offset, uint8_t reg) {
+            rex(reg, 0);
+            bytes({0x88, uint8_t(0x47 | ((reg & 7) << 3)), offset});
+        }
+        // MOV word [rdi + offset], value
+        void storeWord(uint8_t offset, uint16_t value) {
+            bytes({0x66, 0xc7, 0x47, offset, uint8_t(value), uint8_t(value >> 8)});
+        }
+        // INC or DEC word [rdi + offset]
+        void incrementWord(uint8_t offset) { bytes({0x66, 0xff, 0x47, offset}); }
+        void decrementWord(uint8_t offset) { bytes({0x66, 0xff, 0x4f, offset}); }
+        // MOV rsi, pointer
+        void loadTable(const void *pointer) {
+            bytes({0x48, 0xbe});
+            uint64_t value = reinterpret_cast<uintptr_t>(pointer);
+            for (int i = 0; i < 8; ++i) {
+                byte(uint8_t(value >> (i * 8)));
+            }
+        }
+        // MOV word [rdi + offset], reg
+        void storeWordRegister(uint8_t offset, uint8_t reg) { bytes({0x66, 0x89, uint8_t(0x47 | (reg << 3)), offset}); }
+        // ADD word [rdi + offset], value
+        void addWord(uint8_t offset, int8_t value) { bytes({0x66, 0x83, 0x47, offset, uint8_t(value)}); }
+        // MOVZX reg, word [rdi + offset], rax or rdx only
+        void loadWord(uint8_t reg, uint8_t offset) { bytes({0x0f, 0xb7, uint8_t(0x47 | (reg << 3)), offset}); }
+        // MOV rcx, [rdi + offset]
+        void loadPointer(uint8_t offset) { bytes({0x48, 0x8b, 0x4f, offset}); }
+
+        // MOVZX dst, src: the 32-bit register dst = the byte register src
+        void zeroExtend(uint8_t dst, uint8_t src) {
+            rex(dst, src);
+            bytes({0x0f, 0xb6, uint8_t(0xc0 | ((dst & 7) << 3) | (src & 7))});
+        }
+        // MOV eax, edx
+        void moveDword() { bytes({0x89, 0xd0}); }
+        // MOV reg, value, rax or rdx only
+        void moveDwordImmediate(uint8_t reg, uint32_t value) {
+            byte(uint8_t(0xb8 | reg));
+            dword(value);
+        }
+        // SHR or SHL reg, count, rax or rdx only
+        void shiftRight(uint8_t reg, uint8_t count) { bytes({0xc1, uint8_t(0xe8 | reg), count}); }
+        void shiftLeft(uint8_t reg, uint8_t count) { bytes({0xc1, uint8_t(0xe0 | reg), count}); }
+        // SUB dx, value: 16-bit arithmetic wraps like SM83 addresses, the upper half is left alone
+        void subtractFromWord(uint8_t value) { bytes({0x66, 0x83, 0xea, value}); }
+
+        // MOV rax, [rcx + index * 8 + table]: the read or write entry of the page number in the 32-bit register index
+        void loadPage(uint8_t index, bool write) {
+            bytes({uint8_t(0x48 | ((index >> 3) << 1)), 0x8b, 0x84, uint8_t(0xc1 | ((index & 7) << 3))});
+            dword(write ? uint32_t(offsetof(MemoryPages, write)) : 0);
+        }
+        // MOV rax, [rcx + offset]
+        void loadPageAt(uint32_t offset) {
+            bytes({0x48, 0x8b, 0x81});
+            dword(offset);
+        }
+        // MOV reg, byte [rax + rdx + offset]
+        void loadMemory(uint8_t reg, uint8_t offset) { memoryOp({0x8a}, reg, offset); }
+        // MOVZX eax, word [rax + rdx]
+        void loadMemoryWord() { memoryOp({0x0f, 0xb7}, g_rax, 0); }
+        // MOV byte [rax + rdx + offset], reg
+        void storeMemory(uint8_t offset, uint8_t reg) { memoryOp({0x88}, reg, offset); }
+        // MOV byte [rax + rdx + offset], value
+        void storeMemoryImmediate(uint8_t offset, uint8_t value) {
+            memoryOp({0xc6}, 0, offset);
+            byte(value);
+        }
+        // op reg, byte [rax + rdx]
+        void aluMemory(AluOp op, uint8_t reg) { memoryOp({uint8_t((uint8_t(op) << 3) | 2)}, reg, 0); }
+        // INC or DEC byte [rax + rdx]
+        void incrementMemory() { memoryOp({0xfe}, 0, 0); }
+        void decrementMemory() { memoryOp({0xfe}, 1, 0); }
+
+        // Jcc rel32 to a label bound later, returns the label
+        size_t jump(Jump condition) {
+            bytes({0x0f, uint8_t(condition)});
+            size_t label = code_.size();
+            dword(0);
+            return label;
+        }
+        // TEST rax, rax and JZ to a label bound later
+        size_t jumpIfNull() {
+            bytes({0x48, 0x85, 0xc0});
+            return jump(Jump::ZERO);
+        }
+        // jumps to label go to the current end of the code, which must be in the same emitter
+        void bind(size_t label) {
+            uint32_t offset = uint32_t(code_.size() - (label + 4));
+            for (int i = 0; i < 4; ++i) {
+                code_[label + i] = uint8_t(offset >> (i * 8));
+            }
+        }
+
+        // r8-r15 only
+        void push(uint8_t reg) { bytes({0x41, uint8_t(0x50 | (reg & 7))}); }
+        void pop(uint8_t reg) { bytes({0x41, uint8_t(0x58 | (reg & 7))}); }
+        void ret() { byte(0xc3); }
+
+      private:
+        void byte(uint8_t value) { code_.push_back(value); }
+        void bytes(std::initializer_list<uint8_t> values) { code_.insert(code_.end(), values); }
+        void dword(uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                byte(uint8_t(value >> (i * 8)));
+            }
+        }
+
+        // opcode with a [rax + rdx + offset] operand, reg is a register or an opcode extension
+        void memoryOp(std::initializer_list<uint8_t> opcode, uint8_t reg, uint8_t offset) {
+            rex(reg, 0);
+            bytes(opcode);
+            byte(uint8_t((offset != 0 ? 0x44 : 0x04) | ((reg & 7) << 3)));
+            // SIB: base rax, index rdx
+            byte(0x10);
+            if (offset != 0) {
+                byte(offset);
+            }
+        }
+
+        // always emitted for byte registers, so encodings 4-7 mean spl-dil and r8b-r15b are reachable
+        void rex(uint8_t reg, uint8_t rm) { byte(uint8_t(0x40 | ((reg >> 3) << 2) | (rm >> 3))); }
+
+        // opcode with a register-direct ModRM byte, reg is a register or an opcode extension
+        void registerOp(uint8_t opcode, uint8_t reg, uint8_t rm, bool prefix = true) {
+            if (prefix) {
+                rex(reg, rm);
+            }
+            byte(opcode);
+            byte(uint8_t(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+        }
+
+        std::vector<uint8_t> code_;
+    };
+
+    // Host registers a block touches, bit r8 + r stands for SM83 register r
+    struct RegisterUse {
+        uint32_t used = 0;
+        uint32_t written = 0;
+
+        uint8_t read(Registers reg) {
+            uint8_t host = uint8_t(g_r8 + uint8_t(reg));
+            used |= 1u << host;
+            return host;
+        }
+        uint8_t write(Registers reg) {
+            uint8_t host = read(reg);
+            written |= 1u << host;
+            return host;
+        }
+    };
+
+    // Jumps to the exits of a block's function, bound once all of its instructions are emitted
+    struct ExitLabels {
+        // leaving before the instruction, the interpreter runs it
+        std::vector<size_t> before;
+        // the condition of the last instruction doesn't hold
+        std::vector<size_t> not_taken;
+    };
+
+    static bool isCompiled(const DecodedInstruction &instr);
+    // Emits the instruction, flags it writes are only computed if some of them are live
+    static void emitInstruction(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits);
+    static void emitLoad(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits);
+    static void emitBranch(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits);
+    // rax = the page holding the address in the register pair, rdx = the offset in it. The block is left if the page
+    // isn't in the table
+    static void emitPairAddress(X86Emitter &x86, RegisterUse &use, Registers pair, bool write, ExitLabels &exits);
+    static void emitConstantAddress(X86Emitter &x86, uint16_t address, bool write, ExitLabels &exits);
+    // Like emitPairAddress() for the two bytes a push writes below SP or a pop reads at SP, the block is also left if
+    // they are in different pages
+    static void emitStackAddress(X86Emitter &x86, bool push, ExitLabels &exits);
+    // Stores the registers and returns result. pc is stored unless the block already did it
+    static void emitExit(X86Emitter &x86, const RegisterUse &use, std::optional<uint16_t> pc, JitExit result);
+    // F = computed flags of the last x86 instruction | set, with the kept flags of F left alone
+    static void emitFlags(X86Emitter &x86, RegisterUse &use, uint8_t computed, uint8_t set, uint8_t kept);
+    static AluOp getAluOp(InstructionType type);
+    static Registers getLowRegister(Registers pair) { return Registers(pair & Registers::LOW_REG_MASK); }
+    static Registers getHighRegister(Registers pair) { return Registers((pair & Registers::HIGH_REG_MASK) >> 4); }
+
+    static void *mapArena(size_t size);
+    // The arena is either writable or executable, never both
+    static bool protectArena(void *memory, size_t size, bool writable);
+    static void unmapArena(void *memory, size_t size);
+
+    bool isNativeJitAvailable() {
+        static const bool available = [] {
+            if (!g_jit_supported) {
+                return false;
+            }
+#if defined(__unix__)
+            utsname host{};
+            return uname(&host) == 0 && std::string_view(host.machine) == "x86_64";
+#else
+            return false;
+#endif
+        }();
+        return available;
+    }
+
+    Jit::Jit(const Cartridge &cartridge, CodeReader read) : cartridge_(cartridge), read_(std::move(read)) {}
+
+    Jit::~Jit() {
+        if (arena_) {
+            unmapArena(arena_, g_jit_arena_size);
+        }
+    }
+
+    const CompiledBlock *Jit::lookup(uint16_t address) {
+        if (!g_jit_enabled || address > g_memory_rom.max_address) {
+            return nullptr;
+        }
+        auto [low_bank, high_bank] = cartridge_.getCurrentROMBanks();
+        uint16_t bank = address <= g_rom_bank0_max_address ? low_bank : high_bank;
+        uint32_t key = (uint32_t(bank) << 16) | address;
+        Slot &slot = slots_[(address + bank * 0x9e5u) % g_jit_slot_count];
+        if (slot.key != key) {
+            slot = Slot{.key = key};
+            if (auto it = blocks_.find(key); it != blocks_.end()) {
+                slot.block = &it->second;
+            } else if (auto precompiled = precompiled_.find(key); precompiled != precompiled_.end()) {
+                slot.block = precompiled->second;
+            }
+        }
+        if (!slot.block && ++slot.hits >= g_jit_threshold) {
+            slot.block = &compile(address, key);
+        }
+        return slot.block && (slot.block->function || slot.block->threaded) ? slot.block : nullptr;
+    }
+
+    JitExit Jit::run(const CompiledBlock &block, JitRegisters &registers) const {
+        return block.function ? block.function(&registers) : runThreaded(*block.threaded, registers);
+    }
+
+    void Jit::setPrecompiled(std::span<const PrecompiledFunction> functions) {
+        precompiled_.clear();
+        for (const PrecompiledFunction &function : functions) {
+            precompiled_[function.key] = &function.block;
+        }
+        std::fill(slots_.begin(), slots_.end(), Slot{});
+    }
+
+    void Jit::clear() {
+        blocks_.clear();
+        threaded_.clear();
+        std::fill(slots_.begin(), slots_.end(), Slot{});
+        arena_used_ = 0;
+    }
+
+    CompiledRun getCompiledRun(uint16_t address, const CodeReader &read) {
+        CompiledRun run{.opcodes = {}, .block = CompiledBlock{.end = address}};
+        // the run stays in its bank and the opcode fetched after it is still in ROM, bank 0 is followed by the
+        // switchable bank
+        uint32_t region_end =
+            address <= g_rom_bank0_max_address ? g_rom_bank0_max_address + 1 : g_memory_rom.max_address;
+        uint32_t current = address;
+        while (current < region_end && run.opcodes.size() < g_max_block_length) {
+            CachedOpcode opcode{
+                .decoded = {}, .ir = {}, .address = uint16_t(current), .code = read(uint16_t(current))};
+            if (isPrefix(opcode.code)) {
+                break;
+            }
+            // illegal opcodes decode to InstructionType::NONE, which isn't compiled
+            opcode.decoded = decodeUnprefixed(opcode.code);
+            uint16_t size = getImmediateSize(opcode.decoded);
+            if (!isCompiled(opcode.decoded) || current + 1 + size > region_end) {
+                break;
+            }
+            run.opcodes.push_back(opcode);
+            current += 1 + size;
+            if (isBranch(opcode.decoded)) {
+                break;
+            }
+        }
+        if (run.opcodes.size() < 2) {
+            run.opcodes.clear();
+            return run;
+        }
+
+        // operands are compiled in
+        TranslationStats translation;
+        translateBlock(run.opcodes, read, g_memory_rom.max_address, translation);
+        // flags are live where the interpreter takes over: after the block and before instructions which might
+        // leave it
+        uint8_t live = uint8_t(Flags::ALL);
+        for (auto it = run.opcodes.rbegin(); it != run.opcodes.rend(); ++it) {
+            it->ir.flags_live = live;
+            live = uint8_t((live & ~it->ir.flags_written) | it->ir.flags_read);
+            if (accessesMemory(it->decoded)) {
+                live = uint8_t(Flags::ALL);
+            }
+        }
+
+        CompiledBlock &block = run.block;
+        for (const CachedOpcode &opcode : run.opcodes) {
+            if (opcode.ir.flags_written != 0 && (opcode.ir.flags_written & opcode.ir.flags_live) == 0) {
+                ++block.dead_flag_writes;
+            }
+            block.cycles += getCompiledCycles(opcode, true);
+        }
+        block.end = uint16_t(current);
+        block.instructions = uint16_t(run.opcodes.size());
+        return run;
+    }
+
+    uint16_t getCompiledCycles(const CachedOpcode &opcode, bool taken) {
+        const MicroProgram &program = getMicroProgram(opcode.code);
+        return program.operands.size + (taken ? program.execute.size : program.not_taken.size);
+    }
+
+    bool accessesMemory(const DecodedInstruction &instr) {
+        using enum InstructionType;
+        using source = ArgumentSource;
+        switch (instr.type) {
+        case LD:
+            // LD A, (nn) and LD (nn), A
+            return instr.src.src == source::INDIRECT || instr.dst.src == source::INDIRECT ||
+                   (instr.dst.src == source::REGISTER && instr.src.src == source::IMMEDIATE_U16) ||
+                   instr.dst.src == source::IMMEDIATE_U16;
+        case INC:
+        case DEC:
+        case ADD:
+        case ADC:
+        case SUB:
+        case SBC:
+        case AND:
+        case OR:
+        case XOR:
+        case CP: return instr.src.src == source::INDIRECT;
+        case PUSH:
+        case POP:
+        case CALL:
+        case RST:
+        case RET:
+        case RETI: return true;
+        default: return false;
+        }
+    }
+
+    bool isBranch(const DecodedInstruction &instr) {
+        using enum InstructionType;
+        switch (instr.type) {
+        case JP:
+        case JR:
+        case CALL:
+        case RET:
+        case RETI:
+        case RST: return true;
+        default: return false;
+        }
+    }
+
+    std::optional<uint16_t> getBranchTarget(const CachedOpcode &opcode) {
+        const DecodedInstruction &instr = opcode.decoded;
+        using enum InstructionType;
+        switch (instr.type) {
+        case JP:
+            if (instr.src.src == ArgumentSource::DOUBLE_REGISTER) {
+                return std::nullopt;
+            }
+            [[fallthrough]];
+        case CALL: return opcode.ir.constant;
+        case JR: return uint16_t(opcode.address + 2 + int8_t(opcode.ir.constant));
+        case RST: return *instr.reset_vector;
+        default: return std::nullopt;
+        }
+    }
+
+    const CompiledBlock &Jit::compile(uint16_t address, uint32_t key) {
+        CompiledRun run = getCompiledRun(address, read_);
+        CompiledBlock block = run.block;
+        if (run.opcodes.empty()) {
+            return blocks_.insert_or_assign(key, block).first->second;
+        }
+        if (native_ && !arena_failed_) {
+            block.function = compileNative(run);
+        }
+        if (!block.function) {
+            std::unique_ptr<ThreadedBlock> &threaded = threaded_[key];
+            threaded = std::make_unique<ThreadedBlock>(translateThreaded(run));
+            block.threaded = threaded.get();
+            ++stats_.blocks_threaded;
+            stats_.fused_moves += threaded->fused_moves;
+        }
+        ++stats_.blocks_compiled;
+        return blocks_.insert_or_assign(key, block).first->second;
+    }
+
+    JitFunction Jit::compileNative(const CompiledRun &run) {
+        const CompiledBlock &block = run.block;
+        X86Emitter body;
+        RegisterUse use;
+        std::vector<ExitLabels> exits(run.opcodes.size());
+        for (size_t i = 0; i < run.opcodes.size(); ++i) {
+            emitInstruction(body, use, run.opcodes[i], exits[i]);
+        }
+
+        // the last instruction falls through to its exit, a branch has stored PC unless it's known. Exits
+        // before an instruction report the cycles of the instructions before it
+        const CachedOpcode &last = run.opcodes.back();
+        uint16_t last_start = uint16_t(block.cycles - getCompiledCycles(last, true));
+        emitExit(body, use, isBranch(last.decoded) ? getBranchTarget(last) : std::optional(block.end),
+                 JitExit{.cycles = block.cycles, .instructions = block.instructions});
+        if (!exits.back().not_taken.empty()) {
+            for (size_t label : exits.back().not_taken) {
+                body.bind(label);
+            }
+            emitExit(body, use, block.end,
+                     JitExit{.cycles = uint16_t(last_start + getCompiledCycles(last, false)),
+                             .instructions = block.instructions});
+        }
+        uint16_t cycles = 0;
+        for (size_t i = 0; i < run.opcodes.size(); ++i) {
+            if (!exits[i].before.empty()) {
+                for (size_t label : exits[i].before) {
+                    body.bind(label);
+                }
+                emitExit(body, use, run.opcodes[i].address,
+                         JitExit{.cycles = cycles, .instructions = uint16_t(i)});
+            }
+            cycles = uint16_t(cycles + getCompiledCycles(run.opcodes[i], true));
+        }
+
+        // r12-r15 are callee-saved, the rest is free to use
+        X86Emitter x86;
+        for (uint8_t reg = 12; reg < 16; ++reg) {
+            if ((use.used & (1u << reg)) != 0) {
+                x86.push(reg);
+            }
+        }
+        for (uint8_t reg = g_r8; reg < 16; ++reg) {
+            if ((use.used & (1u << reg)) != 0) {
+                x86.load(reg, uint8_t(reg - g_r8));
+            }
+        }
+        x86.loadTable(g_flag_table.data());
+        x86.loadPointer(offsetof(JitRegisters, pages));
+        // labels are relative to the body, which is copied as a whole
+        x86.append(body);
+
+        JitFunction function = install(x86.getCode());
+        if (!function && !arena_failed_) {
+            // the arena is full, everything compiled so far goes
+            ++stats_.flushes;
+            clear();
+            function = install(x86.getCode());
+        }
+        return function;
+    }
+
+    JitFunction Jit::install(const std::vector<uint8_t> &code) {
+        if (!arena_) {
+            arena_ = static_cast<uint8_t *>(mapArena(g_jit_arena_size));
+            if (!arena_) {
+                arena_failed_ = true;
+                return nullptr;
+            }
+        } else if (code.size() <= g_jit_arena_size - arena_used_ &&
+                   !protectArena(arena_, g_jit_arena_size, true)) {
+            arena_failed_ = true;
+            return nullptr;
+        }
+        if (code.size() > g_jit_arena_size - arena_used_) {
+            return nullptr;
+        }
+        uint8_t *start = arena_ + arena_used_;
+        std::memcpy(start, code.data(), code.size());
+        if (!protectArena(arena_, g_jit_arena_size, false)) {
+            // blocks compiled before can't run either
+            arena_failed_ = true;
+            clear();
+            return nullptr;
+        }
+        // blocks start at 16 bytes, like functions the host compiler emits
+        arena_used_ = std::min(g_jit_arena_size, (arena_used_ + code.size() + 15) & ~size_t(15));
+        return reinterpret_cast<JitFunction>(start);
+    }
+
+    static bool isCompiled(const DecodedInstruction &instr) {
+        using enum InstructionType;
+        using source = ArgumentSource;
+        switch (instr.type) {
+        case NOP:
+        case CPL:
+        case SCF:
+        case CCF:
+        case PUSH:
+        case POP:
+        case JP:
+        case JR:
+        case CALL:
+        case RET:
+        case RST:
+        case INC:
+        case DEC: return true;
+        case LD:
+            if (instr.ld_subtype == LoadSubtype::LD_INC || instr.ld_subtype == LoadSubtype::LD_DEC) {
+                return true;
+            }
+            if (instr.ld_subtype != LoadSubtype::TYPICAL) {
+                return false;
+            }
+            if (instr.dst.src == source::DOUBLE_REGISTER) {
+                // LD SP, HL isn't
+                return instr.src.src == source::IMMEDIATE_U16;
+            }
+            return instr.dst.src == source::REGISTER || instr.dst.src == source::INDIRECT ||
+                   instr.dst.src == source::IMMEDIATE_U16;
+        case ADD:
+            if (instr.dst.reg == Registers::HL) {
+                // SP has no host register of its own
+                return instr.src.reg != Registers::SP;
+            }
+            // ADD SP, e isn't
+            return instr.dst.reg == Registers::A;
+        case ADC:
+        case SUB:
+        case SBC:
+        case AND:
+        case OR:
+        case XOR:
+        case CP: return true;
+        default: return false;
+        }
+    }
+
+    static void emitInstruction(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits) {
+        const DecodedInstruction &instr = opcode.decoded;
+        bool flags_live = (opcode.ir.flags_written & opcode.ir.flags_live) != 0;
+        uint16_t constant = opcode.ir.constant;
+
+        using enum InstructionType;
+        switch (instr.type) {
+        case NOP: break;
+        case LD: emitLoad(x86, use, opcode, exits); break;
+        case INC:
+        case DEC:
+            if (instr.src.src == ArgumentSource::REGISTER || instr.src.src == ArgumentSource::INDIRECT) {
+                if (instr.src.src == ArgumentSource::INDIRECT) {
+                    emitPairAddress(x86, use, Registers::HL, true, exits);
+                    if (instr.type == INC) {
+                        x86.incrementMemory();
+                    } else {
+                        x86.decrementMemory();
+                    }
+                } else if (instr.type == INC) {
+                    x86.increment(use.write(instr.src.reg));
+                } else {
+                    x86.decrement(use.write(instr.src.reg));
+                }
+                if (flags_live) {
+                    emitFlags(x86, use, g_flag_z | g_flag_h, instr.type == DEC ? g_flag_n : 0, g_flag_c);
+                }
+            } else if (instr.src.reg == Registers::SP) {
+                if (instr.type == INC) {
+                    x86.incrementWord(offsetof(JitRegisters, sp));
+                } else {
+                    x86.decrementWord(offsetof(JitRegisters, sp));
+                }
+            } else {
+                // the carry of the low byte goes into the high one
+                uint8_t low = use.write(getLowRegister(instr.src.reg));
+                uint8_t high = use.write(getHighRegister(instr.src.reg));
+                x86.aluImmediate(instr.type == INC ? AluOp::ADD : AluOp::SUB, low, 1);
+                x86.aluImmediate(instr.type == INC ? AluOp::ADC : AluOp::SBB, high, 0);
+            }
+            break;
+        case ADD:
+            if (instr.dst.reg == Registers::HL) {
+                // H is the carry out of bit 3 of the high byte, which x86 reports as the auxiliary carry
+                uint8_t low = use.read(getLowRegister(instr.src.reg));
+                uint8_t high = use.read(getHighRegister(instr.src.reg));
+                x86.alu(AluOp::ADD, use.write(Registers::L), low);
+                x86.alu(AluOp::ADC, use.write(Registers::H), high);
+                if (flags_live) {
+                    emitFlags(x86, use, g_flag_h | g_flag_c, 0, g_flag_z);
+                }
+                break;
+            }
+            [[fallthrough]];
+        case ADC:
+        case SUB:
+        case SBC:
+        case AND:
+        case OR:
+        case XOR:
+        case CP: {
+            // the page check changes the x86 flags, so it goes before the carry is loaded
+            if (instr.src.src == ArgumentSource::INDIRECT) {
+                emitPairAddress(x86, use, Registers::HL, false, exits);
+            }
+            AluOp op = getAluOp(instr.type);
+            if (op == AluOp::ADC || op == AluOp::SBB) {
+                x86.testBit(use.read(Registers::FLAGS), 4);
+            }
+            uint8_t a = instr.type == CP ? use.read(Registers::A) : use.write(Registers::A);
+            if (instr.src.src == ArgumentSource::IMMEDIATE_U8) {
+                x86.aluImmediate(op, a, uint8_t(constant));
+            } else if (instr.src.src == ArgumentSource::INDIRECT) {
+                x86.aluMemory(op, a);
+            } else {
+                x86.alu(op, a, use.read(instr.src.reg));
+            }
+            if (!flags_live) {
+                break;
+            }
+            if (op == AluOp::AND) {
+                emitFlags(x86, use, g_flag_z, g_flag_h, 0);
+            } else if (op == AluOp::OR || op == AluOp::XOR) {
+                emitFlags(x86, use, g_flag_z, 0, 0);
+            } else {
+                bool subtracts = op == AluOp::SUB || op == AluOp::SBB || op == AluOp::CMP;
+                emitFlags(x86, use, g_flag_z | g_flag_h | g_flag_c, subtracts ? g_flag_n : 0, 0);
+            }
+            break;
+        }
+        case CPL:
+            x86.complement(use.write(Registers::A));
+            if (flags_live) {
+                x86.aluImmediate(AluOp::OR, use.write(Registers::FLAGS), g_flag_n | g_flag_h);
+            }
+            break;
+        case SCF:
+            if (flags_live) {
+                uint8_t flags = use.write(Registers::FLAGS);
+                x86.aluImmediate(AluOp::AND, flags, g_flag_z);
+                x86.aluImmediate(AluOp::OR, flags, g_flag_c);
+            }
+            break;
+        case CCF:
+            if (flags_live) {
+                uint8_t flags = use.write(Registers::FLAGS);
+                x86.aluImmediate(AluOp::AND, flags, g_flag_z | g_flag_c);
+                x86.aluImmediate(AluOp::XOR, flags, g_flag_c);
+            }
+            break;
+        case PUSH:
+            emitStackAddress(x86, true, exits);
+            x86.storeMemory(0, use.read(getLowRegister(instr.src.reg)));
+            x86.storeMemory(1, use.read(getHighRegister(instr.src.reg)));
+            x86.addWord(offsetof(JitRegisters, sp), -2);
+            break;
+        case POP:
+            emitStackAddress(x86, false, exits);
+            x86.loadMemory(use.write(getLowRegister(instr.dst.reg)), 0);
+            x86.loadMemory(use.write(getHighRegister(instr.dst.reg)), 1);
+            if (instr.dst.reg == Registers::AF) {
+                // the low bits of F always read as 0
+                x86.aluImmediate(AluOp::AND, use.write(Registers::FLAGS), uint8_t(Flags::ALL));
+            }
+            x86.addWord(offsetof(JitRegisters, sp), 2);
+            break;
+        case JP:
+        case JR:
+        case CALL:
+        case RET:
+        case RST: emitBranch(x86, use, opcode, exits); break;
+        default: break;
+        }
+    }
+
+    static void emitLoad(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits) {
+        const DecodedInstruction &instr = opcode.decoded;
+        uint16_t constant = opcode.ir.constant;
+        using source = ArgumentSource;
+        if (instr.dst.src == source::DOUBLE_REGISTER) {
+            if (instr.dst.reg == Registers::SP) {
+                x86.storeWord(offsetof(JitRegisters, sp), constant);
+            } else {
+                x86.moveImmediate(use.write(getLowRegister(instr.dst.reg)), uint8_t(constant));
+                x86.moveImmediate(use.write(getHighRegister(instr.dst.reg)), uint8_t(constant >> 8));
+            }
+            return;
+        }
+
+        // register to register, or one side in memory: (rr), (HL+), (HL-) or (nn)
+        bool to_memory = instr.dst.src != source::REGISTER;
+        ArgumentInfo memory = to_memory ? instr.dst : instr.src;
+        if (memory.src == source::INDIRECT) {
+            emitPairAddress(x86, use, memory.reg, to_memory, exits);
+        } else if (memory.src == source::IMMEDIATE_U16) {
+            emitConstantAddress(x86, constant, to_memory, exits);
+        }
+        if (!to_memory) {
+            uint8_t dst = use.write(instr.dst.reg);
+            if (instr.src.src == source::IMMEDIATE_U8) {
+                x86.moveImmediate(dst, uint8_t(constant));
+            } else if (instr.src.src == source::REGISTER) {
+                x86.move(dst, use.read(instr.src.reg));
+            } else {
+                x86.loadMemory(dst, 0);
+            }
+        } else if (instr.src.src == source::IMMEDIATE_U8) {
+            x86.storeMemoryImmediate(0, uint8_t(constant));
+        } else {
+            x86.storeMemory(0, use.read(instr.src.reg));
+        }
+
+        if (instr.ld_subtype == LoadSubtype::LD_INC || instr.ld_subtype == LoadSubtype::LD_DEC) {
+            bool increments = instr.ld_subtype == LoadSubtype::LD_INC;
+            x86.aluImmediate(increments ? AluOp::ADD : AluOp::SUB, use.write(Registers::L), 1);
+            x86.aluImmediate(increments ? AluOp::ADC : AluOp::SBB, use.write(Registers::H), 0);
+        }
+    }
+
+    static void emitBranch(X86Emitter &x86, RegisterUse &use, const CachedOpcode &opcode, ExitLabels &exits) {
+        const DecodedInstruction &instr = opcode.decoded;
+        if (instr.condition) {
+            // BT F, bit: the x86 carry flag is the SM83 flag the condition tests
+            Conditions condition = *instr.condition;
+            bool zero = condition == Conditions::ZERO || condition == Conditions::NOT_ZERO;
+            x86.testBit(use.read(Registers::FLAGS), zero ? 7 : 4);
+            bool set = condition == Conditions::ZERO || condition == Conditions::CARRY;
+            exits.not_taken.push_back(x86.jump(set ? Jump::NOT_CARRY : Jump::CARRY));
+        }
+
+        using enum InstructionType;
+        switch (instr.type) {
+        case CALL:
+        case RST: {
+            uint16_t return_address = uint16_t(opcode.address + (instr.type == CALL ? 3 : 1));
+            emitStackAddress(x86, true, exits);
+            x86.storeMemoryImmediate(0, uint8_t(return_address));
+            x86.storeMemoryImmediate(1, uint8_t(return_address >> 8));
+            x86.addWord(offsetof(JitRegisters, sp), -2);
+            break;
+        }
+        case RET:
+            emitStackAddress(x86, false, exits);
+            x86.loadMemoryWord();
+            x86.addWord(offsetof(JitRegisters, sp), 2);
+            x86.storeWordRegister(offsetof(JitRegisters, pc), g_rax);
+            break;
+        case JP:
+            // JP HL, other jumps go to a constant address
+            if (instr.src.src == ArgumentSource::DOUBLE_REGISTER) {
+                x86.zeroExtend(g_rax, use.read(Registers::H));
+                x86.shiftLeft(g_rax, 8);
+                x86.move(g_rax, use.read(Registers::L));
+                x86.storeWordRegister(offsetof(JitRegisters, pc), g_rax);
+            }
+            break;
+        default: break;
+        }
+    }
+
+    static void emitPairAddress(X86Emitter &x86, RegisterUse &use, Registers pair, bool write, ExitLabels &exits) {
+        x86.zeroExtend(g_rax, use.read(getHighRegister(pair)));
+        x86.loadPage(g_rax, write);
+        exits.before.push_back(x86.jumpIfNull());
+        x86.zeroExtend(g_rdx, use.read(getLowRegister(pair)));
+    }
+
+    static void emitConstantAddress(X86Emitter &x86, uint16_t address, bool write, ExitLabels &exits) {
+        size_t table = write ? offsetof(MemoryPages, write) : offsetof(MemoryPages, read);
+        x86.loadPageAt(uint32_t(table + address / g_memory_page_size * sizeof(uint8_t *)));
+        exits.before.push_back(x86.jumpIfNull());
+        x86.moveDwordImmediate(g_rdx, address % g_memory_page_size);
+    }
+
+    static void emitStackAddress(X86Emitter &x86, bool push, ExitLabels &exits) {
+        x86.loadWord(g_rdx, offsetof(JitRegisters, sp));
+        if (push) {
+            x86.subtractFromWord(2);
+        }
+        x86.aluImmediate(AluOp::CMP, g_rdx, 0xff);
+        exits.before.push_back(x86.jump(Jump::ZERO));
+        x86.moveDword();
+        x86.shiftRight(g_rax, 8);
+        x86.loadPage(g_rax, push);
+        exits.before.push_back(x86.jumpIfNull());
+        x86.zeroExtend(g_rdx, g_rdx);
+    }
+
+    static void emitExit(X86Emitter &x86, const RegisterUse &use, std::optional<uint16_t> pc, JitExit result) {
+        if (pc) {
+            x86.storeWord(offsetof(JitRegisters, pc), *pc);
+        }
+        x86.moveDwordImmediate(g_rax, uint32_t(result.cycles) | (uint32_t(result.instructions) << 16));
+        for (uint8_t reg = g_r8; reg < 16; ++reg) {
+            if ((use.written & (1u << reg)) != 0) {
+                x86.store(uint8_t(reg - g_r8), reg);
+            }
+        }
+        for (uint8_t reg = 16; reg-- > 12;) {
+            if ((use.used & (1u << reg)) != 0) {
+                x86.pop(reg);
+            }
+        }
+        x86.ret();
+    }
+
+    static void emitFlags(X86Emitter &x86, RegisterUse &use, uint8_t computed, uint8_t set, uint8_t kept) {
+        x86.loadFlags();
+        if (computed != (g_flag_z | g_flag_h | g_flag_c)) {
+            x86.aluImmediate(AluOp::AND, g_rax, computed);
+        }
+        if (set != 0) {
+            x86.aluImmediate(AluOp::OR, g_rax, set);
+        }
+        uint8_t flags = use.write(Registers::FLAGS);
+        if (kept != 0) {
+            x86.aluImmediate(AluOp::AND, flags, kept);
+            x86.alu(AluOp::OR, flags, g_rax);
+        } else {
+            x86.move(flags, g_rax);
+        }
+    }
+
+    static AluOp getAluOp(InstructionType type) {
+        using enum InstructionType;
+        switch (type) {
+        case ADC: return AluOp::ADC;
+        case SUB: return AluOp::SUB;
+        case SBC: return AluOp::SBB;
+        case AND: return AluOp::AND;
+        case OR: return AluOp::OR;
+        case XOR: return AluOp::XOR;
+        case CP: return AluOp::CMP;
+        default: return AluOp::ADD;
+        }
+    }
+
+#if defined(__unix__)
+    static void *mapArena(size_t size) {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    static bool protectArena(void *memory, size_t size, bool writable) {
+        return mprotect(memory, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+    }
+
+    static void unmapArena(void *memory, size_t size) { munmap(memory, size); }
+#else
+    static void *mapArena(size_t) { return nullptr; }
+
+    static bool protectArena(void *, size_t, bool) { return false; }
+
+    static void unmapArena(void *, size_t) {}
+#endif
+} // namespace gb::cpu
@@ -0,0 +1,216 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_JIT_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_JIT_HDR_
+
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/block_ir.h"
+#include "gb/memory/basic_components.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace gb {
+    class Cartridge;
+}
+
+namespace gb::cpu {
+
+    struct ThreadedBlock;
+
+    // Compiled blocks are compiled out of builds configured with GB_JIT=OFF. Native code is only generated by builds
+    // for x86-64 Unix hosts, and only if isNativeJitAvailable(). Elsewhere blocks run as threaded code, see
+    // ThreadedBlock
+#ifndef GB_DISABLE_JIT
+    constexpr bool g_jit_enabled = true;
+#else
+    constexpr bool g_jit_enabled = false;
+#endif
+#if defined(__x86_64__) && defined(__unix__)
+    constexpr bool g_jit_supported = g_jit_enabled;
+#else
+    constexpr bool g_jit_supported = false;
+#endif
+
+    // a block is compiled once execution reached its first instruction this many times
+    constexpr uint32_t g_jit_threshold = 8;
+    // executable memory for compiled blocks, all of them are dropped when it's full
+    constexpr size_t g_jit_arena_size = size_t(1) << 20;
+    // direct-mapped table counting how often blocks are entered
+    constexpr size_t g_jit_slot_count = 4096;
+
+    // Registers compiled code works on. The offset of each 8-bit register in bytes is its Registers value
+    struct JitRegisters {
+        std::array<uint8_t, 8> bytes{};
+        uint16_t sp = 0;
+        // set by the block to the address of the first instruction it didn't run
+        uint16_t pc = 0;
+        // memory the block reads and writes, see AddressBus::getPages()
+        const MemoryPages *pages = nullptr;
+    };
+
+    // What a compiled block ran, nothing if its first instruction needs the interpreter. Returned in a register
+    struct JitExit {
+        // M-cycles up to and including the fetch of the opcode at JitRegisters::pc
+        uint16_t cycles = 0;
+        uint16_t instructions = 0;
+    };
+
+    using JitFunction = JitExit (*)(JitRegisters *registers);
+
+    // A run of at least two instructions starting at a ROM address, which ends at a jump, call or return or before
+    // the first instruction which can't be compiled: IO accesses, interrupt enables, HALT and prefixed opcodes.
+    // Memory is accessed through MemoryPages. The block leaves before an instruction which would access a page
+    // which isn't in the table, so the interpreter runs it and the bus, its observers and the block cache see the
+    // access. The CPU fetches the opcode the block stopped at itself
+    struct CompiledBlock {
+        // nullptr if less than two instructions at the address can be compiled, or if they run as threaded code
+        JitFunction function = nullptr;
+        // set instead of function where native code can't be generated, owned by Jit
+        const ThreadedBlock *threaded = nullptr;
+        // address after the last instruction of the block
+        uint16_t end = 0;
+        // the most M-cycles any exit of the block takes
+        uint16_t cycles = 0;
+        uint16_t instructions = 0;
+        // instructions whose flags aren't computed, a later one in the block overwrites them before they are read.
+        // Counted when the block runs to the end
+        uint16_t dead_flag_writes = 0;
+    };
+
+    // Block compiled to C++ by aot_compiler, key is (ROM bank << 16) | address
+    struct PrecompiledFunction {
+        uint32_t key = 0;
+        CompiledBlock block;
+    };
+
+    // Code of a single ROM, generated by aot_compiler
+    struct PrecompiledROM {
+        // gb::hashBytes() of the ROM
+        uint64_t rom_hash = 0;
+        // for BlockCache::setPrecompiled()
+        std::span<const PrecompiledBlock> blocks;
+        // for Jit::setPrecompiled()
+        std::span<const PrecompiledFunction> functions;
+    };
+
+    // Instructions starting at an address which make up a compiled block, and the block without its function. IrOp
+    // is filled in, flags are live before any instruction which might leave the block
+    struct CompiledRun {
+        std::vector<CachedOpcode> opcodes;
+        CompiledBlock block;
+    };
+
+    // M-cycles of an instruction of a run after its opcode is fetched, up to and including the fetch of the next one.
+    // taken is ignored by unconditional instructions
+    uint16_t getCompiledCycles(const CachedOpcode &opcode, bool taken);
+    // true if the instruction reads or writes memory other than its operands, compiled code checks the page first
+    bool accessesMemory(const DecodedInstruction &instruction);
+    // true for jumps, calls and returns, a run ends with them
+    bool isBranch(const DecodedInstruction &instruction);
+    // Where a branch goes if its condition holds, empty for returns and JP HL, which take the address from the stack
+    // or registers
+    std::optional<uint16_t> getBranchTarget(const CachedOpcode &opcode);
+
+    // opcodes is empty if less than two instructions at address can be compiled. read must return the ROM bank the
+    // run is compiled for
+    CompiledRun getCompiledRun(uint16_t address, const CodeReader &read);
+
+    struct JitStats {
+        uint64_t blocks_compiled = 0;
+        uint64_t blocks_run = 0;
+        uint64_t instructions_run = 0;
+        // instructions run without computing their flags, see IrOp::flags_live
+        uint64_t dead_flag_writes = 0;
+        // times the arena was full and every block was dropped
+        uint64_t flushes = 0;
+        // blocks compiled to threaded code instead of native code, and pairs of loads they run as one
+        uint64_t blocks_threaded = 0;
+        uint64_t fused_moves = 0;
+    };
+
+    // Native code is generated on x86-64 hosts only, which the build can't promise: an x86-64 binary might run under
+    // a translator, and some systems don't allow mapping executable memory. Checked once
+    bool isNativeJitAvailable();
+
+    // x86-64 translation of hot ROM code, a basic block at a time. Register loads, 8-bit arithmetic and logic, 16-bit
+    // increments, ADD HL,rr, loads and arithmetic on memory, PUSH, POP, jumps, calls and returns are compiled, with
+    // the SM83 registers kept in host registers while a block runs and flags no later instruction of the block reads
+    // left uncomputed. Everything else is left to the interpreter, see CompiledBlock.
+    //
+    // Blocks are keyed on (ROM bank, address), ROM can't change while they are cached. Executable memory is only
+    // mapped when the first block is compiled, it is writable while code is copied in and executable otherwise. If
+    // that fails, or if isNativeJitAvailable() is false, blocks are compiled to threaded code instead
+    class Jit {
+      public:
+        // out of line, ThreadedBlock is only complete in jit.cpp
+        Jit(const Cartridge &cartridge, CodeReader read);
+        ~Jit();
+        Jit(const Jit &) = delete;
+        Jit &operator=(const Jit &) = delete;
+
+        // Compiled block starting at address, nullptr until execution got there g_jit_threshold times or if the
+        // instructions at address can't be compiled. Precompiled blocks are returned right away
+        const CompiledBlock *lookup(uint16_t address);
+
+        // Blocks are looked up in functions before they are compiled at run time, they are kept by clear(). They
+        // must be for the current ROM and outlive the JIT
+        void setPrecompiled(std::span<const PrecompiledFunction> functions);
+
+        void clear();
+
+        // Runs a block returned by lookup()
+        JitExit run(const CompiledBlock &block, JitRegisters &registers) const;
+
+        // Blocks are compiled to threaded code if native code is disabled, drops the blocks compiled so far. Only
+        // has an effect where isNativeJitAvailable()
+        void setNativeEnabled(bool enabled) {
+            native_ = enabled && isNativeJitAvailable();
+            clear();
+        }
+
+        const JitStats &getStats() const { return stats_; }
+        // Called by the CPU, compiled code doesn't count what it runs itself
+        void onRun(const CompiledBlock &block, JitExit exit) {
+            ++stats_.blocks_run;
+            stats_.instructions_run += exit.instructions;
+            if (exit.instructions == block.instructions) {
+                stats_.dead_flag_writes += block.dead_flag_writes;
+            }
+        }
+
+      private:
+        // ROM addresses are below 0x8000, so this is never a valid key
+        static constexpr uint32_t g_no_key = 0xffffffff;
+
+        struct Slot {
+            uint32_t key = g_no_key;
+            uint32_t hits = 0;
+            const CompiledBlock *block = nullptr;
+        };
+
+        const CompiledBlock &compile(uint16_t address, uint32_t key);
+        // nullptr if the code can't be installed, the block runs as threaded code then
+        JitFunction compileNative(const CompiledRun &run);
+        // Copies code to the arena, nullptr if there's no room or the arena can't be mapped or protected
+        JitFunction install(const std::vector<uint8_t> &code);
+
+        const Cartridge &cartridge_;
+        CodeReader read_;
+        std::vector<Slot> slots_ = std::vector<Slot>(g_jit_slot_count);
+        std::unordered_map<uint32_t, CompiledBlock> blocks_;
+        std::unordered_map<uint32_t, std::unique_ptr<ThreadedBlock>> threaded_;
+        std::unordered_map<uint32_t, const CompiledBlock *> precompiled_;
+        uint8_t *arena_ = nullptr;
+        size_t arena_used_ = 0;
+        bool arena_failed_ = false;
+        bool native_ = isNativeJitAvailable();
+        JitStats stats_;
+    };
+} // namespace gb::cpu
+
+#endif
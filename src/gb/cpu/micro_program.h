@@ -0,0 +1,78 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_MICRO_PROGRAM_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_MICRO_PROGRAM_HDR_
+
+#include "gb/cpu/operation.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb::cpu {
+
+    // One M-cycle of an instruction. Addresses, data and target registers of memory accesses are set by the CPU
+    // when the cycles start
+    enum class MicroOp : uint8_t {
+        // internal cycle without a memory access
+        IDLE,
+        // immediate or indirect operand byte into the data buffer
+        READ,
+        // low and high byte of the target register
+        READ_LOW,
+        READ_HIGH,
+        // low byte of the data, the address is incremented and the data is shifted right after it
+        WRITE,
+        // high byte of the data to the decremented address, the data is shifted left after it
+        PUSH,
+        // the next opcode
+        FETCH,
+    };
+
+    constexpr size_t g_max_micro_ops = 5;
+
+    struct MicroSequence {
+        std::array<MicroOp, g_max_micro_ops> ops{};
+        uint8_t size = 0;
+
+        constexpr void add(MicroOp op) { ops[size++] = op; }
+    };
+
+    // M-cycles of an opcode after the one it is fetched in
+    struct MicroProgram {
+        // operand reads, the instruction is executed at the start of the cycle after them
+        MicroSequence operands;
+        // cycles starting with the one the instruction is executed in, the last one fetches the next opcode
+        MicroSequence execute;
+        // used instead of execute by conditional jumps, calls and returns if the condition doesn't hold
+        MicroSequence not_taken;
+        // operands are read from PC, which is advanced past them when the opcode is fetched,
+        // or from the address in indirect_operand
+        uint8_t immediate_size = 0;
+        Registers indirect_operand = Registers::NONE;
+    };
+
+    // Index of the program of a prefixed opcode is the opcode + this
+    constexpr uint16_t g_prefixed_programs = 0x100;
+    // Pushes PC and jumps to an interrupt vector instead of executing an instruction
+    constexpr uint16_t g_interrupt_program = 0x200;
+    constexpr uint16_t g_micro_program_count = g_interrupt_program + 1;
+
+    // Number of immediate bytes read after the opcode
+    constexpr uint16_t getImmediateSize(const DecodedInstruction &instruction) {
+        switch (instruction.src.src) {
+        case ArgumentSource::IMMEDIATE_S8:
+        case ArgumentSource::IMMEDIATE_U8: return 1;
+        case ArgumentSource::IMMEDIATE_U16: return 2;
+        case ArgumentSource::INDIRECT: return 0;
+        default: break;
+        }
+
+        if (instruction.dst.src == ArgumentSource::IMMEDIATE_U8) {
+            return 1;
+        } else if (instruction.dst.src == ArgumentSource::IMMEDIATE_U16) {
+            return 2;
+        }
+        return 0;
+    }
+} // namespace gb::cpu
+
+#endif
@@ -0,0 +1,447 @@
+#include "gb/cpu/threaded_code.h"
+#include "gb/cpu/block_cache.h"
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/jit.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/basic_components.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace gb::cpu {
+
+    constexpr uint8_t g_none = uint8_t(Registers::NONE);
+    constexpr uint8_t g_flags = uint8_t(Registers::FLAGS);
+    constexpr uint8_t g_a = uint8_t(Registers::A);
+    constexpr uint8_t g_hl = uint8_t(Registers::HL);
+    constexpr uint8_t g_flag_z = uint8_t(Flags::Z);
+    constexpr uint8_t g_flag_n = uint8_t(Flags::N);
+    constexpr uint8_t g_flag_h = uint8_t(Flags::H);
+    constexpr uint8_t g_flag_c = uint8_t(Flags::C);
+    // ThreadedOp::c of loads through (HL+) and (HL-)
+    constexpr uint8_t g_hl_increment = 1;
+    constexpr uint8_t g_hl_decrement = 2;
+
+    static uint16_t getPair(const JitRegisters &registers, uint8_t pair) {
+        return uint16_t((registers.bytes[pair >> 4] << 8) | registers.bytes[pair & 0x0f]);
+    }
+
+    static void setPair(JitRegisters &registers, uint8_t pair, uint16_t value) {
+        registers.bytes[pair & 0x0f] = uint8_t(value);
+        registers.bytes[pair >> 4] = uint8_t(value >> 8);
+    }
+
+    static const uint8_t *getReadPage(const JitRegisters &registers, uint16_t address) {
+        return registers.pages->read[address / g_memory_page_size];
+    }
+
+    static uint8_t *getWritePage(const JitRegisters &registers, uint16_t address) {
+        return registers.pages->write[address / g_memory_page_size];
+    }
+
+    // g_none stands for no condition
+    static bool holds(const JitRegisters &registers, uint8_t condition) {
+        uint8_t flags = registers.bytes[g_flags];
+        switch (Conditions(condition)) {
+        case Conditions::NOT_ZERO: return (flags & g_flag_z) == 0;
+        case Conditions::ZERO: return (flags & g_flag_z) != 0;
+        case Conditions::NOT_CARRY: return (flags & g_flag_c) == 0;
+        case Conditions::CARRY: return (flags & g_flag_c) != 0;
+        }
+        return true;
+    }
+
+    // the two bytes a push writes or a pop reads at address are in different pages, the interpreter handles them
+    static bool crossesPage(uint16_t address) { return address % g_memory_page_size == g_memory_page_size - 1; }
+
+    static void applyAlu(JitRegisters &registers, InstructionType type, uint8_t value, bool flags) {
+        uint8_t &a = registers.bytes[g_a];
+        uint8_t &f = registers.bytes[g_flags];
+        using enum InstructionType;
+        unsigned carry = (type == ADC || type == SBC) && (f & g_flag_c) != 0 ? 1 : 0;
+        unsigned result = 0;
+        uint8_t computed = 0;
+        switch (type) {
+        case ADD:
+        case ADC:
+            result = a + value + carry;
+            computed = uint8_t(((a & 0x0f) + (value & 0x0f) + carry > 0x0f ? g_flag_h : 0) |
+                               (result > 0xff ? g_flag_c : 0));
+            break;
+        case SUB:
+        case SBC:
+        case CP:
+            result = a - value - carry;
+            computed = uint8_t(g_flag_n | ((a & 0x0f) < (value & 0x0f) + carry ? g_flag_h : 0) |
+                               (a < value + carry ? g_flag_c : 0));
+            break;
+        case AND:
+            result = a & value;
+            computed = g_flag_h;
+            break;
+        case OR: result = a | value; break;
+        default: result = a ^ value; break;
+        }
+        if (type != CP) {
+            a = uint8_t(result);
+        }
+        if (flags) {
+            f = uint8_t(computed | (uint8_t(result) == 0 ? g_flag_z : 0));
+        }
+    }
+
+    // a = b, b is g_none for the low byte of the constant
+    static ThreadedResult move(JitRegisters &registers, const ThreadedOp &op) {
+        registers.bytes[op.a] = op.b == g_none ? uint8_t(op.constant) : registers.bytes[op.b];
+        return ThreadedResult::NEXT;
+    }
+
+    // a = b, then c = d, d is g_none for the high byte of the constant
+    static ThreadedResult moveTwo(JitRegisters &registers, const ThreadedOp &op) {
+        registers.bytes[op.a] = op.b == g_none ? uint8_t(op.constant) : registers.bytes[op.b];
+        registers.bytes[op.c] = op.d == g_none ? uint8_t(op.constant >> 8) : registers.bytes[op.d];
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult loadSP(JitRegisters &registers, const ThreadedOp &op) {
+        registers.sp = op.constant;
+        return ThreadedResult::NEXT;
+    }
+
+    static void updateHL(JitRegisters &registers, uint8_t update) {
+        if (update == g_hl_increment) {
+            setPair(registers, g_hl, uint16_t(getPair(registers, g_hl) + 1));
+        } else if (update == g_hl_decrement) {
+            setPair(registers, g_hl, uint16_t(getPair(registers, g_hl) - 1));
+        }
+    }
+
+    // a = memory at pair b, or at the constant if b is g_none
+    static ThreadedResult load(JitRegisters &registers, const ThreadedOp &op) {
+        uint16_t address = op.b == g_none ? op.constant : getPair(registers, op.b);
+        const uint8_t *page = getReadPage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        registers.bytes[op.a] = page[address % g_memory_page_size];
+        updateHL(registers, op.c);
+        return ThreadedResult::NEXT;
+    }
+
+    // memory at pair b, or at the constant if b is g_none = a, or the constant if a is g_none
+    static ThreadedResult store(JitRegisters &registers, const ThreadedOp &op) {
+        uint16_t address = op.b == g_none ? op.constant : getPair(registers, op.b);
+        uint8_t *page = getWritePage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        page[address % g_memory_page_size] = op.a == g_none ? uint8_t(op.constant) : registers.bytes[op.a];
+        updateHL(registers, op.c);
+        return ThreadedResult::NEXT;
+    }
+
+    // INC or DEC of the byte value, C is kept
+    static uint8_t incrementByte(JitRegisters &registers, uint8_t value, bool decrement, bool flags) {
+        uint8_t result = decrement ? uint8_t(value - 1) : uint8_t(value + 1);
+        if (flags) {
+            uint8_t half_carry = (value & 0x0f) == (decrement ? 0 : 0x0f) ? g_flag_h : 0;
+            uint8_t &f = registers.bytes[g_flags];
+            f = uint8_t((f & g_flag_c) | (result == 0 ? g_flag_z : 0) | (decrement ? g_flag_n : 0) | half_carry);
+        }
+        return result;
+    }
+
+    // INC or DEC (if b is set) of register a
+    static ThreadedResult incrementRegister(JitRegisters &registers, const ThreadedOp &op) {
+        registers.bytes[op.a] = incrementByte(registers, registers.bytes[op.a], op.b != 0, op.flags);
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult incrementMemory(JitRegisters &registers, const ThreadedOp &op) {
+        uint16_t address = getPair(registers, g_hl);
+        uint8_t *page = getWritePage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        uint8_t &value = page[address % g_memory_page_size];
+        value = incrementByte(registers, value, op.b != 0, op.flags);
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult incrementPair(JitRegisters &registers, const ThreadedOp &op) {
+        setPair(registers, op.a, uint16_t(getPair(registers, op.a) + (op.b != 0 ? -1 : 1)));
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult incrementSP(JitRegisters &registers, const ThreadedOp &op) {
+        registers.sp = uint16_t(registers.sp + (op.b != 0 ? -1 : 1));
+        return ThreadedResult::NEXT;
+    }
+
+    // ADD HL, pair a, Z is kept
+    static ThreadedResult addHL(JitRegisters &registers, const ThreadedOp &op) {
+        unsigned lhs = getPair(registers, g_hl);
+        unsigned rhs = getPair(registers, op.a);
+        unsigned result = lhs + rhs;
+        setPair(registers, g_hl, uint16_t(result));
+        if (op.flags) {
+            uint8_t &f = registers.bytes[g_flags];
+            f = uint8_t((f & g_flag_z) | ((lhs & 0x0fff) + (rhs & 0x0fff) > 0x0fff ? g_flag_h : 0) |
+                        (result > 0xffff ? g_flag_c : 0));
+        }
+        return ThreadedResult::NEXT;
+    }
+
+    // instruction type a on A and register b, or the constant if b is g_none
+    static ThreadedResult alu(JitRegisters &registers, const ThreadedOp &op) {
+        uint8_t value = op.b == g_none ? uint8_t(op.constant) : registers.bytes[op.b];
+        applyAlu(registers, InstructionType(op.a), value, op.flags);
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult aluMemory(JitRegisters &registers, const ThreadedOp &op) {
+        uint16_t address = getPair(registers, g_hl);
+        const uint8_t *page = getReadPage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        applyAlu(registers, InstructionType(op.a), page[address % g_memory_page_size], op.flags);
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult complement(JitRegisters &registers, const ThreadedOp &op) {
+        registers.bytes[g_a] = uint8_t(~registers.bytes[g_a]);
+        if (op.flags) {
+            registers.bytes[g_flags] |= g_flag_n | g_flag_h;
+        }
+        return ThreadedResult::NEXT;
+    }
+
+    // SCF, or CCF if a is set
+    static ThreadedResult setCarry(JitRegisters &registers, const ThreadedOp &op) {
+        if (op.flags) {
+            uint8_t &f = registers.bytes[g_flags];
+            f = op.a != 0 ? uint8_t((f & (g_flag_z | g_flag_c)) ^ g_flag_c) : uint8_t((f & g_flag_z) | g_flag_c);
+        }
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult push(JitRegisters &registers, const ThreadedOp &op) {
+        uint16_t address = uint16_t(registers.sp - 2);
+        uint8_t *page = crossesPage(address) ? nullptr : getWritePage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        page[address % g_memory_page_size] = registers.bytes[op.a & 0x0f];
+        page[address % g_memory_page_size + 1] = registers.bytes[op.a >> 4];
+        registers.sp = address;
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult pop(JitRegisters &registers, const ThreadedOp &op) {
+        const uint8_t *page = crossesPage(registers.sp) ? nullptr : getReadPage(registers, registers.sp);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        registers.bytes[op.a & 0x0f] = page[registers.sp % g_memory_page_size];
+        registers.bytes[op.a >> 4] = page[registers.sp % g_memory_page_size + 1];
+        if (op.a == uint8_t(Registers::AF)) {
+            // the low bits of F always read as 0
+            registers.bytes[g_flags] &= uint8_t(Flags::ALL);
+        }
+        registers.sp = uint16_t(registers.sp + 2);
+        return ThreadedResult::NEXT;
+    }
+
+    // JP or JR to the constant if condition c holds
+    static ThreadedResult jump(JitRegisters &registers, const ThreadedOp &op) {
+        if (!holds(registers, op.c)) {
+            return ThreadedResult::NOT_TAKEN;
+        }
+        registers.pc = op.constant;
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult jumpHL(JitRegisters &registers, const ThreadedOp &) {
+        registers.pc = getPair(registers, g_hl);
+        return ThreadedResult::NEXT;
+    }
+
+    // CALL or RST to the constant if condition c holds
+    static ThreadedResult call(JitRegisters &registers, const ThreadedOp &op) {
+        if (!holds(registers, op.c)) {
+            return ThreadedResult::NOT_TAKEN;
+        }
+        uint16_t address = uint16_t(registers.sp - 2);
+        uint8_t *page = crossesPage(address) ? nullptr : getWritePage(registers, address);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        page[address % g_memory_page_size] = uint8_t(op.next);
+        page[address % g_memory_page_size + 1] = uint8_t(op.next >> 8);
+        registers.sp = address;
+        registers.pc = op.constant;
+        return ThreadedResult::NEXT;
+    }
+
+    static ThreadedResult ret(JitRegisters &registers, const ThreadedOp &op) {
+        if (!holds(registers, op.c)) {
+            return ThreadedResult::NOT_TAKEN;
+        }
+        const uint8_t *page = crossesPage(registers.sp) ? nullptr : getReadPage(registers, registers.sp);
+        if (!page) {
+            return ThreadedResult::LEAVE;
+        }
+        size_t offset = registers.sp % g_memory_page_size;
+        registers.pc = uint16_t(page[offset] | (page[offset + 1] << 8));
+        registers.sp = uint16_t(registers.sp + 2);
+        return ThreadedResult::NEXT;
+    }
+
+    // op for an instruction getCompiledRun() accepts, without a handler for NOP
+    static ThreadedOp getThreadedOp(const CachedOpcode &opcode) {
+        const DecodedInstruction &instr = opcode.decoded;
+        uint16_t constant = opcode.ir.constant;
+        uint8_t src = uint8_t(instr.src.reg);
+        uint8_t dst = uint8_t(instr.dst.reg);
+        uint8_t condition = instr.condition ? uint8_t(*instr.condition) : g_none;
+        uint8_t decrement = instr.type == InstructionType::DEC ? 1 : 0;
+
+        using enum InstructionType;
+        using source = ArgumentSource;
+        switch (instr.type) {
+        case LD: {
+            uint8_t update = instr.ld_subtype == LoadSubtype::LD_INC   ? g_hl_increment
+                             : instr.ld_subtype == LoadSubtype::LD_DEC ? g_hl_decrement
+                                                                       : 0;
+            if (instr.dst.src == source::DOUBLE_REGISTER) {
+                if (instr.dst.reg == Registers::SP) {
+                    return ThreadedOp{.handler = loadSP, .constant = constant};
+                }
+                return ThreadedOp{
+                    .handler = moveTwo, .a = uint8_t(dst & 0x0f), .b = g_none, .c = uint8_t(dst >> 4), .d = g_none,
+                    .constant = constant};
+            }
+            if (instr.dst.src == source::REGISTER && instr.src.src == source::REGISTER) {
+                return ThreadedOp{.handler = move, .a = dst, .b = src};
+            }
+            if (instr.dst.src == source::REGISTER && instr.src.src == source::IMMEDIATE_U8) {
+                return ThreadedOp{.handler = move, .a = dst, .b = g_none, .constant = uint8_t(constant)};
+            }
+            if (instr.dst.src == source::REGISTER) {
+                // (rr) or (nn)
+                uint8_t pair = instr.src.src == source::INDIRECT ? src : g_none;
+                return ThreadedOp{.handler = load, .a = dst, .b = pair, .c = update, .constant = constant};
+            }
+            uint8_t pair = instr.dst.src == source::INDIRECT ? dst : g_none;
+            uint8_t value = instr.src.src == source::IMMEDIATE_U8 ? g_none : src;
+            return ThreadedOp{.handler = store, .a = value, .b = pair, .c = update, .constant = constant};
+        }
+        case INC:
+        case DEC:
+            if (instr.src.src == source::INDIRECT) {
+                return ThreadedOp{.handler = incrementMemory, .b = decrement};
+            }
+            if (instr.src.src == source::REGISTER) {
+                return ThreadedOp{.handler = incrementRegister, .a = src, .b = decrement};
+            }
+            return ThreadedOp{.handler = instr.src.reg == Registers::SP ? incrementSP : incrementPair, .a = src,
+                              .b = decrement};
+        case ADD:
+            if (instr.dst.reg == Registers::HL) {
+                return ThreadedOp{.handler = addHL, .a = src};
+            }
+            [[fallthrough]];
+        case ADC:
+        case SUB:
+        case SBC:
+        case AND:
+        case OR:
+        case XOR:
+        case CP:
+            if (instr.src.src == source::INDIRECT) {
+                return ThreadedOp{.handler = aluMemory, .a = uint8_t(instr.type)};
+            }
+            return ThreadedOp{.handler = alu,
+                              .a = uint8_t(instr.type),
+                              .b = instr.src.src == source::IMMEDIATE_U8 ? g_none : src,
+                              .constant = uint8_t(constant)};
+        case CPL: return ThreadedOp{.handler = complement};
+        case SCF: return ThreadedOp{.handler = setCarry};
+        case CCF: return ThreadedOp{.handler = setCarry, .a = 1};
+        case PUSH: return ThreadedOp{.handler = push, .a = src};
+        case POP: return ThreadedOp{.handler = pop, .a = dst};
+        case JP:
+            if (instr.src.src == source::DOUBLE_REGISTER) {
+                return ThreadedOp{.handler = jumpHL};
+            }
+            [[fallthrough]];
+        case JR: return ThreadedOp{.handler = jump, .c = condition, .constant = *getBranchTarget(opcode)};
+        case CALL:
+        case RST: return ThreadedOp{.handler = call, .c = condition, .constant = *getBranchTarget(opcode)};
+        case RET: return ThreadedOp{.handler = ret, .c = condition};
+        default: return ThreadedOp{};
+        }
+    }
+
+    ThreadedBlock translateThreaded(const CompiledRun &run) {
+        ThreadedBlock block{.ops = {},
+                            .end = run.block.end,
+                            .taken = {.cycles = run.block.cycles, .instructions = run.block.instructions}};
+        JitExit before;
+        for (const CachedOpcode &opcode : run.opcodes) {
+            ThreadedOp op = getThreadedOp(opcode);
+            op.flags = (opcode.ir.flags_written & opcode.ir.flags_live) != 0;
+            op.next = uint16_t(opcode.address + 1 + getImmediateSize(opcode.decoded));
+            op.address = opcode.address;
+            op.before = before;
+            before.cycles = uint16_t(before.cycles + getCompiledCycles(opcode, true));
+            ++before.instructions;
+
+            if (!op.handler) {
+                continue;
+            }
+            // neither of the loads leaves the block, so they can share the exit of the first one
+            if (op.handler == move && !block.ops.empty() && block.ops.back().handler == move) {
+                ThreadedOp &previous = block.ops.back();
+                previous.handler = moveTwo;
+                previous.c = op.a;
+                previous.d = op.b;
+                previous.constant = uint16_t(previous.constant | (op.constant << 8));
+                ++block.fused_moves;
+                continue;
+            }
+            block.ops.push_back(op);
+        }
+
+        if (!run.opcodes.empty()) {
+            const CachedOpcode &last = run.opcodes.back();
+            block.branches = isBranch(last.decoded);
+            uint16_t last_start = uint16_t(run.block.cycles - getCompiledCycles(last, true));
+            block.not_taken = JitExit{.cycles = uint16_t(last_start + getCompiledCycles(last, false)),
+                                      .instructions = run.block.instructions};
+        }
+        return block;
+    }
+
+    JitExit runThreaded(const ThreadedBlock &block, JitRegisters &registers) {
+        for (const ThreadedOp &op : block.ops) {
+            ThreadedResult result = op.handler(registers, op);
+            if (result == ThreadedResult::LEAVE) {
+                registers.pc = op.address;
+                return op.before;
+            }
+            if (result == ThreadedResult::NOT_TAKEN) {
+                registers.pc = block.end;
+                return block.not_taken;
+            }
+        }
+        if (!block.branches) {
+            registers.pc = block.end;
+        }
+        return block.taken;
+    }
+} // namespace gb::cpu
@@ -0,0 +1,62 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_THREADED_CODE_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_THREADED_CODE_HDR_
+
+#include "gb/cpu/jit.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace gb::cpu {
+
+    struct ThreadedOp;
+
+    enum class ThreadedResult : uint8_t {
+        NEXT,
+        // the interpreter runs the instruction, its memory isn't in the page table
+        LEAVE,
+        // the condition of the branch ending the block doesn't hold
+        NOT_TAKEN,
+    };
+
+    using ThreadedHandler = ThreadedResult (*)(JitRegisters &registers, const ThreadedOp &op);
+
+    // An instruction of a threaded block, or two fused loads
+    struct ThreadedOp {
+        ThreadedHandler handler = nullptr;
+        // registers, instruction type or condition, depending on the handler
+        uint8_t a = 0;
+        uint8_t b = 0;
+        uint8_t c = 0;
+        uint8_t d = 0;
+        // the flags the instruction writes are computed, see IrOp::flags_live
+        bool flags = true;
+        // immediate operand, memory address or branch target
+        uint16_t constant = 0;
+        // address after the instruction, returned to by calls
+        uint16_t next = 0;
+        // where the interpreter takes over when the handler leaves, and what ran before
+        uint16_t address = 0;
+        JitExit before{};
+    };
+
+    // Portable form of a compiled block: a handler per instruction, called one after another by runThreaded().
+    // Leaves the block where the x86-64 code would and reports the same JitExit, see CompiledBlock
+    struct ThreadedBlock {
+        std::vector<ThreadedOp> ops;
+        uint16_t end = 0;
+        // the last instruction is a branch, its handler sets PC when it's taken
+        bool branches = false;
+        JitExit taken{};
+        JitExit not_taken{};
+        // pairs of loads run by a single handler
+        uint16_t fused_moves = 0;
+    };
+
+    // Chooses a handler for each instruction of run. Register loads following each other are fused into one
+    // handler, and flags no later instruction reads aren't computed
+    ThreadedBlock translateThreaded(const CompiledRun &run);
+
+    JitExit runThreaded(const ThreadedBlock &block, JitRegisters &registers);
+} // namespace gb::cpu
+
+#endif
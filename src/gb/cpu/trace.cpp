@@ -0,0 +1,155 @@
+#include "gb/cpu/trace.h"
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/basic_components.h"
+
+#include <cstdint>
+
+namespace gb::cpu {
+
+    // Register for register and indirect arguments, data for immediate ones
+    static Instruction::Argument getArgument(ArgumentInfo info, uint8_t data);
+    static void disassembleLoad(Instruction &result, const DecodedInstruction &decoded, uint8_t byte, uint16_t word);
+
+    Instruction disassemble(const TraceRecord &record) {
+        Instruction result;
+        result.address = record.pc;
+        result.width = record.width();
+        if (isPrefix(record.bytes[0])) {
+            DecodedInstruction decoded = decodePrefixed(record.bytes[1]);
+            result.type = decoded.type;
+            result.arg() = decoded.arg().reg;
+            if (decoded.bit) {
+                result.bit() = *decoded.bit;
+            }
+            return result;
+        }
+
+        DecodedInstruction decoded = decodeUnprefixed(record.bytes[0]);
+        result.type = decoded.type;
+        result.load_subtype = decoded.ld_subtype;
+        result.condition = decoded.condition;
+        uint8_t byte = record.bytes[1];
+        uint16_t word = uint16_t(record.bytes[1]) | (uint16_t(record.bytes[2]) << 8);
+
+        using enum InstructionType;
+        switch (decoded.type) {
+        case LD: disassembleLoad(result, decoded, byte, word); break;
+        case INC:
+        case DEC: result.arg() = decoded.src.reg; break;
+        case ADD:
+            if (decoded.dst.reg == Registers::HL) {
+                result.dst = Registers::HL;
+                result.src = decoded.src.reg;
+            } else if (decoded.dst.reg == Registers::SP) {
+                result.dst = Registers::SP;
+                result.src = int8_t(byte);
+            } else {
+                result.arg() = getArgument(decoded.src, byte);
+            }
+            break;
+        case ADC:
+        case SUB:
+        case SBC:
+        case OR:
+        case AND:
+        case XOR:
+        case CP: result.arg() = getArgument(decoded.src, byte); break;
+        case JP:
+            if (decoded.src.src == ArgumentSource::DOUBLE_REGISTER) {
+                result.arg() = Registers::HL;
+            } else {
+                result.arg() = word;
+            }
+            break;
+        case JR: result.arg() = int8_t(byte); break;
+        case CALL: result.arg() = word; break;
+        case PUSH: result.arg() = decoded.src.reg; break;
+        case POP: result.arg() = decoded.dst.reg; break;
+        case RST: result.arg() = *decoded.reset_vector; break;
+        default: break;
+        }
+        return result;
+    }
+
+    RegisterFile getRegisters(const TraceRecord &record) {
+        RegisterFile registers;
+        registers.af(record.af);
+        registers.bc(record.bc);
+        registers.de(record.de);
+        registers.hl(record.hl);
+        registers.pc(record.pc);
+        return registers;
+    }
+
+    uint16_t getTraceBank(const Cartridge &cartridge, uint16_t address) {
+        if (address <= g_rom_bank0_max_address) {
+            return cartridge.getCurrentROMBanks().first;
+        } else if (address <= g_memory_rom.max_address) {
+            return cartridge.getCurrentROMBanks().second;
+        } else if (g_memory_cartridge_ram.isInRange(address)) {
+            return cartridge.getCurrentRAMBank();
+        }
+        return g_no_trace_bank;
+    }
+
+    static Instruction::Argument getArgument(ArgumentInfo info, uint8_t data) {
+        if (info.src == ArgumentSource::REGISTER || info.src == ArgumentSource::INDIRECT) {
+            return info.reg;
+        }
+        return data;
+    }
+
+    static void disassembleLoad(Instruction &result, const DecodedInstruction &decoded, uint8_t byte, uint16_t word) {
+        switch (*decoded.ld_subtype) {
+        case LoadSubtype::LD_IO:
+            if (decoded.src.reg == Registers::A) { // LDH [n], A, LDH [C], A
+                result.dst = getArgument(decoded.dst, byte);
+                result.src = Registers::A;
+            } else { // LDH A, [n], LDH A, [C]
+                result.src = getArgument(decoded.src, byte);
+                result.dst = Registers::A;
+            }
+            return;
+        case LoadSubtype::LD_OFFSET_SP:
+            result.dst = Registers::SP;
+            result.src = int8_t(byte);
+            return;
+        case LoadSubtype::LD_SP:
+            result.dst = Registers::SP;
+            result.src = word;
+            return;
+        default: break;
+        }
+
+        if (decoded.dst.src == ArgumentSource::DOUBLE_REGISTER) { // LD rr, nn, LD SP, HL
+            result.dst = decoded.dst.reg;
+            if (decoded.src.src == ArgumentSource::IMMEDIATE_U16) {
+                result.src = word;
+            } else {
+                result.src = Registers::HL;
+            }
+            return;
+        }
+
+        switch (decoded.src.src) {
+        case ArgumentSource::IMMEDIATE_U16: // LD A, [nn]
+            result.src = word;
+            result.dst = decoded.dst.reg;
+            break;
+        case ArgumentSource::IMMEDIATE_U8: // LD r, n, LD [HL], n
+            result.src = byte;
+            result.dst = decoded.dst.reg;
+            break;
+        default:
+            if (decoded.dst.src == ArgumentSource::IMMEDIATE_U16) { // LD [nn], A
+                result.dst = word;
+            } else { // LD r, r, LD r, [HL], LD [rr], A, LD A, [rr]
+                result.dst = decoded.dst.reg;
+            }
+            result.src = decoded.src.reg;
+            break;
+        }
+    }
+} // namespace gb::cpu
@@ -0,0 +1,79 @@
+#ifndef GB_EMULATOR_SRC_GB_CPU_TRACE_HDR_
+#define GB_EMULATOR_SRC_GB_CPU_TRACE_HDR_
+
+#include "gb/cpu/cpu_utils.h"
+#include "gb/cpu/operation.h"
+#include "gb/memory/basic_components.h"
+#include "util/util.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <variant>
+
+namespace gb::cpu {
+
+    // Instruction tracing is compiled out of builds configured with GB_TRACE=OFF
+#ifdef GB_DISABLE_TRACE
+    constexpr bool g_trace_enabled = false;
+#else
+    constexpr bool g_trace_enabled = true;
+#endif
+
+    // Bank of instructions which aren't in cartridge ROM or RAM
+    constexpr uint16_t g_no_trace_bank = uint16_t(-1);
+
+    // An executed instruction as it was fetched: its address and bytes and the registers before it was executed
+    struct TraceRecord {
+        uint16_t pc = 0;
+        // ROM or cartridge RAM bank pc was in
+        uint16_t bank = g_no_trace_bank;
+        // the opcode, after the 0xCB prefix if there is one, and immediate operands
+        std::array<uint8_t, 3> bytes{};
+        // width of the instruction in the low bits, IME in the highest one
+        uint8_t info = 0;
+        uint16_t af = 0;
+        uint16_t bc = 0;
+        uint16_t de = 0;
+        uint16_t hl = 0;
+
+        static constexpr uint8_t g_ime_bit = 0x80;
+
+        uint8_t width() const { return info & ~g_ime_bit; }
+        bool ime() const { return (info & g_ime_bit) != 0; }
+    };
+    static_assert(sizeof(TraceRecord) == 16, "trace records must stay packed");
+
+    constexpr inline bool operator==(const TraceRecord &lhs, const TraceRecord &rhs) {
+        return lhs.pc == rhs.pc && lhs.bank == rhs.bank && lhs.bytes == rhs.bytes && lhs.info == rhs.info &&
+               lhs.af == rhs.af && lhs.bc == rhs.bc && lhs.de == rhs.de && lhs.hl == rhs.hl;
+    }
+
+    // Disassembled trace record
+    struct Instruction {
+        using Argument = Variant<std::monostate, Registers, int8_t, uint8_t, uint16_t>;
+
+        InstructionType type = InstructionType::NONE;
+        std::optional<LoadSubtype> load_subtype;
+        std::optional<Conditions> condition;
+
+        Argument src;
+        Argument dst;
+
+        uint16_t address = 0;
+        uint8_t width = 1;
+
+        Argument &arg() { return src; }
+        Argument &bit() { return dst; }
+    };
+
+    Instruction disassemble(const TraceRecord &record);
+
+    // Registers of the record, SP isn't traced
+    RegisterFile getRegisters(const TraceRecord &record);
+
+    // ROM or RAM bank mapped at the address, g_no_trace_bank outside of cartridge memory
+    uint16_t getTraceBank(const Cartridge &cartridge, uint16_t address);
+} // namespace gb::cpu
+
+#endif
@@ -2,34 +2,75 @@
 #define GB_EMULATOR_SRC_GB_EMULATOR_HDR_
 
 #include "gb/address_bus.h"
+#include "gb/condition.h"
+#include "gb/config.h"
 #include "gb/cpu/cpu.h"
 #include "gb/cpu/cpu_utils.h"
 #include "gb/cpu/decoder.h"
+#include "gb/cpu/trace.h"
+#include "gb/fault.h"
 #include "gb/gb_input.h"
+#include "gb/idle_loop.h"
 #include "gb/interrupt_register.h"
 #include "gb/memory/basic_components.h"
 #include "gb/memory/memory_map.h"
+#include "gb/pc_breakpoints.h"
 #include "gb/ppu/ppu.h"
+#include "gb/save_state.h"
 #include "gb/timer.h"
 #include "util/util.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 
 namespace gb {
 
-    class Emulator {
+    // DMG master clock, all cycle counts are in T-cycles (4 T-cycles per Emulator::tick())
+    constexpr uint64_t g_cpu_frequency = 4194304;
+    constexpr uint64_t g_cycles_per_tick = 4;
+    constexpr uint64_t g_cycles_per_frame = 70224;
+
+    // Why runFrame() or runUntil() returned
+    enum class StopReason : uint8_t {
+        // the frame was finished or the cycle limit was reached
+        FINISHED,
+        // the next instruction is at a PC breakpoint, calling runFrame() or runUntil() again executes it
+        BREAKPOINT,
+        // a fault stopped the emulator, see BasicEmulator::getFault()
+        FAULT,
+        // the emulator was stopped or the CPU executed STOP
+        STOPPED,
+    };
+
+    // The CPU runs ahead of the PPU and the timer while they can't change anything it sees, their updates are
+    // applied in bulk when the CPU accesses their memory or right before the next event.
+    // Features disabled in CONFIG are compiled out of every component, see Emulator and HeadlessEmulator.
+    // Emulation doesn't throw: a fault stops the emulator and stays recorded until reset() or loadState()
+    template <EmulatorConfig CONFIG>
+    class BasicEmulator : private IPeripheralSync {
       public:
-        Emulator() = default;
+        BasicEmulator() { bus_.setPeripheralSync(this); }
+        BasicEmulator(const BasicEmulator &) = delete;
+        BasicEmulator &operator=(const BasicEmulator &) = delete;
 
-        void tick();
+        void tick() noexcept;
 
         bool terminated() const { return !is_running_; }
 
+        const FaultState &getFault() const { return fault_; }
+
+        // Everything except cartridge RAM is reset, so emulation after reset() only depends on the ROM,
+        // cartridge RAM and input
         void reset() {
+            fault_.clear();
+            *memory_ = Memory{};
+            input_.reset();
             cpu_.reset();
             bus_.reset();
             ppu_.reset();
@@ -37,52 +78,406 @@ namespace gb {
             cartridge_.reset();
             ie_.write(0);
             if_.setFlag(InterruptFlags::VBLANK);
+            cycles_ = 0;
+            lag_ = 0;
+            frame_interrupted_ = false;
+            idle_loop_.reset(cpu_);
         }
 
-        void start() { is_running_ = true; }
+        // A faulted emulator doesn't start
+        void start() { is_running_ = !fault_.isSet(); }
 
         void stop() { is_running_ = false; }
 
+        // number of emulated T-cycles since reset
+        uint64_t getCycleCount() const { return cycles_; }
+
+        // Runs until the PPU finishes a frame, but at most g_cycles_per_frame cycles (no frame is finished while
+        // the LCD is off). A frame interrupted by a breakpoint is finished by the next call
+        StopReason runFrame() noexcept;
+        // Runs until the cycle counter reaches cycles
+        StopReason runUntil(uint64_t cycles) noexcept {
+            StopReason reason = StopReason::FINISHED;
+            while (is_running_ && cycles_ < cycles) {
+                advance(peripheral_batching_);
+                if (atBreakpoint()) [[unlikely]] {
+                    reason = StopReason::BREAKPOINT;
+                    break;
+                }
+                runCompiled(cycles);
+                skipIdleLoop(cycles);
+                skipHalt(cycles);
+            }
+            syncPeripherals();
+            return getStopReason(reason);
+        }
+
+        // runFrame() and runUntil() stop right before an instruction at one of the breakpoints is executed. The
+        // breakpoints aren't copied, changes to them take effect right away
+        void setPCBreakpoints(const PCBreakpoints &breakpoints)
+            requires(CONFIG.breakpoints)
+        {
+            pc_breakpoints_ = &breakpoints;
+        }
+        void removePCBreakpoints() { pc_breakpoints_ = nullptr; }
+        // The CPU is between instructions and the next one is at a PC breakpoint whose condition holds
+        bool atBreakpoint() const {
+            return CONFIG.breakpoints && pc_breakpoints_ && cpu_.isFinished() &&
+                   pc_breakpoints_->isSet(cpu_.getInstructionAddress()) &&
+                   pc_breakpoints_->isHit(getConditionContext(cpu_.getInstructionAddress()));
+        }
+
+        // State breakpoint conditions are evaluated against, address and value are those of the access being checked
+        ConditionContext getConditionContext(uint16_t address, uint8_t value = 0) const {
+            return ConditionContext{.registers = cpu_.getRegisters(),
+                                    .cycles = cycles_,
+                                    .bank = cpu::getTraceBank(cartridge_, address),
+                                    .rom_bank = cartridge_.getCurrentROMBanks().second,
+                                    .ram_bank = cartridge_.getCurrentRAMBank(),
+                                    .instruction_address = cpu_.getInstructionAddress(),
+                                    .address = address,
+                                    .value = value,
+                                    .peek = [this](uint16_t peeked) { return bus_.peek(peeked); }};
+        }
+
+        // If the CPU is halted and no interrupt is pending, advances emulation straight to the next PPU event or
+        // timer interrupt, but not past limit. The result is exactly the same as running tick() for the skipped
+        // cycles. Returns the number of skipped cycles.
+        // runFrame() and runUntil() call this after every tick
+        uint64_t skipHalt(uint64_t limit) noexcept;
+        uint64_t getSkippedHaltCycles() const { return skipped_halt_cycles_; }
+
+        // If the CPU has just finished an iteration of an idle loop, advances emulation by whole iterations up to
+        // the next event which can change the loop's outcome, but not past limit. The result is exactly the same as
+        // running tick() for the skipped cycles. Returns the number of skipped cycles.
+        // runFrame() and runUntil() call this after every tick
+        uint64_t skipIdleLoop(uint64_t limit) noexcept;
+
+        // If the CPU has just fetched the first opcode of a compiled block which ends before the next PPU event or
+        // timer interrupt and before limit, runs the block. The result is exactly the same as running tick() for its
+        // cycles. Returns the number of cycles run.
+        // runFrame() and runUntil() call this after every tick
+        uint64_t runCompiled(uint64_t limit) noexcept;
+
+        // Hosts where cpu::isNativeJitAvailable() is false run blocks as threaded code
+        void setJitEnabled(bool enabled)
+            requires(CONFIG.jit)
+        {
+            jit_enabled_ = enabled;
+        }
+        bool isJitEnabled() const { return cpu::g_jit_enabled && CONFIG.jit && jit_enabled_; }
+        const cpu::JitStats &getJitStats() const { return cpu_.getJit().getStats(); }
+
+        void setIdleLoopSkipping(bool enabled) {
+            idle_loop_skipping_ = enabled;
+            idle_loop_.reset(cpu_);
+        }
+        bool isIdleLoopSkipping() const { return idle_loop_skipping_; }
+        const IdleLoopStats &getIdleLoopStats() const { return idle_loop_.getStats(); }
+
+        // Lets runFrame() and runUntil() defer PPU and timer updates, tick() never does
+        void setPeripheralBatching(bool enabled) { peripheral_batching_ = enabled; }
+        bool isPeripheralBatching() const { return peripheral_batching_; }
+        // number of T-cycles for which PPU and timer updates were deferred
+        uint64_t getBatchedCycles() const { return batched_cycles_; }
+
+        // Serializes everything except the ROM, observers and the renderer. Whether the emulator is running is not
+        // saved either. The buffer's capacity is reused, so saving into the same buffer again doesn't allocate
+        void saveState(std::vector<uint8_t> &buffer) const;
+        // Throws std::invalid_argument if the state is invalid or was made with a different ROM, the emulator is
+        // left unchanged then. Doesn't allocate after the first call
+        void loadState(std::span<const uint8_t> state);
+
         std::optional<uint8_t> peekMemory(uint16_t address) { return bus_.peek(address); }
 
-        cpu::SharpSM83 &getCPU() { return cpu_; }
-        AddressBus &getBus() { return bus_; }
+        cpu::SharpSM83<CONFIG> &getCPU() { return cpu_; }
+        AddressBus<CONFIG> &getBus() { return bus_; }
         Timer &getTimer() { return timer_; }
         Cartridge &getCartridge() { return cartridge_; }
-        PPU &getPPU() { return ppu_; }
+        PPU<CONFIG> &getPPU() { return ppu_; }
         InterruptRegister &getIE() { return ie_; }
         InterruptRegister &getIF() { return if_; }
         Input &getInput() { return input_; }
 
       private:
-        std::unique_ptr<Memory> memory_ = std::make_unique<Memory>();
-        Cartridge cartridge_;
+        // Runs one M-cycle, if defer_peripherals is true the PPU and the timer are only updated if an event is due
+        void advance(bool defer_peripherals) noexcept;
+
+        // Reads the whole state the way loadState() does and throws if any component would reject it, without
+        // changing anything
+        void checkState(std::span<const uint8_t> state) const;
+
+        // reason, unless the emulator isn't running anymore
+        StopReason getStopReason(StopReason reason) const {
+            if (is_running_) {
+                return reason;
+            }
+            return fault_.isSet() ? StopReason::FAULT : StopReason::STOPPED;
+        }
+
+        // Applies deferred PPU and timer updates
+        void syncPeripherals() noexcept override {
+            if (lag_ != 0) {
+                ppu_.skip(lag_);
+                timer_.skip(lag_);
+                lag_ = 0;
+            }
+        }
+
+        // Advances the PPU and the timer by cycles, which must not go past getNextEvent()
+        void skipCycles(uint64_t cycles) noexcept {
+            ppu_.skip(lag_ + cycles);
+            timer_.skip(lag_ + cycles);
+            lag_ = 0;
+            cycles_ += cycles;
+        }
+
+        // Cycle count at which the PPU or the timer can next change something the CPU sees
+        uint64_t getNextEvent() const {
+            // the PPU and the timer are lag_ cycles behind
+            uint64_t synced = cycles_ - lag_;
+            uint64_t cycles = std::min(ppu_.cyclesUntilEvent(), timer_.cyclesUntilInterrupt());
+            return cycles > std::numeric_limits<uint64_t>::max() - synced ? std::numeric_limits<uint64_t>::max()
+                                                                            : synced + cycles;
+        }
+
+        // State used on every M-cycle comes first and starts at a cache line, so a tick touches as few lines as
+        // possible. Each component only keeps references to the ones declared before it
+        alignas(g_cache_line_size) uint64_t cycles_ = 0;
+        // cycles the PPU and the timer are behind cycles_, always 0 outside of runFrame() and runUntil()
+        uint64_t lag_ = 0;
+        uint64_t batched_cycles_ = 0;
+        bool is_running_ = false;
+        bool peripheral_batching_ = true;
+        bool idle_loop_skipping_ = true;
+        bool jit_enabled_ = true;
+        FaultState fault_;
+        const PCBreakpoints *pc_breakpoints_ = nullptr;
+        // end of the frame runFrame() was running when it stopped at a breakpoint, the next call continues it
+        uint64_t frame_end_ = 0;
+        bool frame_interrupted_ = false;
         InterruptRegister ie_;
         InterruptRegister if_;
-        Input input_{if_};
         Timer timer_{if_};
-        PPU ppu_{if_, memory_->vram, memory_->oam};
-        AddressBus bus_{memory_->wram, memory_->unused_io, memory_->hram, cartridge_, ppu_, timer_, input_, ie_, if_};
-        cpu::SharpSM83 cpu_{bus_, ie_, if_};
+        // the bus and the PPU keep spans into memory, its contents are only reached through them
+        std::unique_ptr<Memory> memory_ = std::make_unique<Memory>();
+        PPU<CONFIG> ppu_{if_, memory_->vram, memory_->oam};
+        Cartridge cartridge_;
+        Input input_{if_};
+        AddressBus<CONFIG> bus_{memory_->wram, memory_->unused_io, memory_->hram, cartridge_, ppu_, timer_, input_,
+                                ie_, if_, fault_};
+        cpu::SharpSM83<CONFIG> cpu_{bus_, ie_, if_, fault_};
 
-        bool is_running_ = false;
+        IdleLoopDetector idle_loop_;
+        uint64_t skipped_halt_cycles_ = 0;
     };
 
-    inline void Emulator::tick() {
+    // Everything can be observed: memory accesses, executed instructions and rendered frames
+    using Emulator = BasicEmulator<g_full_config>;
+    // Only emulates, for runners which check the results of a ROM
+    using HeadlessEmulator = BasicEmulator<g_headless_config>;
+
+    // Large or rarely used state (memory, the block cache's maps, traces) is kept out of line or at the end of the
+    // components, so the whole core fits in a few dozen cache lines
+    static_assert(sizeof(Emulator) <= 32 * g_cache_line_size, "emulator state is too large to stay in cache");
+
+    template <EmulatorConfig CONFIG>
+    void BasicEmulator<CONFIG>::tick() noexcept { advance(false); }
+
+    template <EmulatorConfig CONFIG>
+    void BasicEmulator<CONFIG>::advance(bool defer_peripherals) noexcept {
         if (!is_running_) {
             return;
         }
 
-        try {
-            cpu_.tick();
+        // the CPU reads IF directly, but deferred updates never include an event, so it is up to date
+        cpu_.tick();
+        // the CPU might have just scheduled an event by writing to the PPU or the timer
+        if (defer_peripherals && cycles_ + g_cycles_per_tick <= getNextEvent()) {
+            lag_ += g_cycles_per_tick;
+            batched_cycles_ += g_cycles_per_tick;
+        } else {
+            syncPeripherals();
             for (int i = 0; i < 4; ++i) {
                 timer_.update();
                 ppu_.update();
             }
-            is_running_ = !cpu_.isStopped();
-        } catch (...) {
-            is_running_ = false;
-            throw;
+        }
+        cycles_ += g_cycles_per_tick;
+        // the M-cycle which faulted is finished, so the emulator is left in a consistent state
+        is_running_ = !cpu_.isStopped() && !fault_.isSet();
+        if (idle_loop_skipping_ && cpu_.isFinished()) {
+            idle_loop_.onInstruction(cpu_, cycles_);
+            if (idle_loop_.needsHorizon()) {
+                idle_loop_.setHorizon(getNextEvent());
+            }
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    StopReason BasicEmulator<CONFIG>::runFrame() noexcept {
+        if (!frame_interrupted_) {
+            frame_end_ = cycles_ + g_cycles_per_frame;
+        }
+        StopReason reason = StopReason::FINISHED;
+        while (is_running_ && !ppu_.frameFinished() && cycles_ < frame_end_) {
+            advance(peripheral_batching_);
+            if (atBreakpoint()) [[unlikely]] {
+                reason = StopReason::BREAKPOINT;
+                break;
+            }
+            // the tick might have finished the frame, compiled code would run on into the next one
+            if (!ppu_.frameFinished()) {
+                runCompiled(frame_end_);
+            }
+            skipIdleLoop(frame_end_);
+            skipHalt(frame_end_);
+        }
+        syncPeripherals();
+        // the frame might have been finished by the same cycle, the next call returns right away then
+        frame_interrupted_ = reason == StopReason::BREAKPOINT;
+        if (!frame_interrupted_) {
+            ppu_.resetFrameFinistedFlag();
+        }
+        return getStopReason(reason);
+    }
+
+    template <EmulatorConfig CONFIG>
+    uint64_t BasicEmulator<CONFIG>::skipIdleLoop(uint64_t limit) noexcept {
+        // the period is only valid right at the instruction boundary where the iteration ended,
+        // and a pending interrupt would be serviced instead of running the next iteration
+        uint64_t period = idle_loop_.getLoopPeriod();
+        if (period == 0 || !is_running_ || !cpu_.isFinished() || cpu_.isHalted() ||
+            (ie_.getFlags() & if_.getFlags()) != 0 || cycles_ >= limit) {
+            return 0;
+        }
+        // skipped iterations aren't checked for breakpoints, the loop's reads include every instruction it ran
+        if (CONFIG.breakpoints && pc_breakpoints_ && !pc_breakpoints_->empty() &&
+            std::ranges::any_of(idle_loop_.getLoopReads(),
+                                [this](uint16_t address) { return pc_breakpoints_->isSet(address); })) {
+            return 0;
+        }
+        // nor are their reads reported to observers
+        if (bus_.hasObserver() && std::ranges::any_of(idle_loop_.getLoopReads(), [this](uint16_t address) {
+                return bus_.isWatched(address);
+            })) {
+            return 0;
+        }
+
+        uint64_t skipped = (std::min(getNextEvent(), limit) - cycles_) / period * period;
+        if (skipped == 0) {
+            return 0;
+        }
+        skipCycles(skipped);
+        idle_loop_.onSkipped(skipped);
+        idle_loop_.setHorizon(getNextEvent());
+        return skipped;
+    }
+
+    template <EmulatorConfig CONFIG>
+    uint64_t BasicEmulator<CONFIG>::runCompiled(uint64_t limit) noexcept {
+        // breakpoints are only checked between interpreted instructions
+        if (!isJitEnabled() || !is_running_ || (pc_breakpoints_ && !pc_breakpoints_->empty()) ||
+            !cpu_.isFinished()) {
+            return 0;
+        }
+        uint64_t end = std::min(getNextEvent(), limit);
+        if (end <= cycles_) {
+            return 0;
+        }
+
+        // nothing the block does can change the PPU or the timer, so their updates can be deferred like in advance()
+        uint64_t cycles = cpu_.runCompiled((end - cycles_) / g_cycles_per_tick) * g_cycles_per_tick;
+        if (cycles == 0) {
+            return 0;
+        }
+        if (peripheral_batching_) {
+            lag_ += cycles;
+            batched_cycles_ += cycles;
+            cycles_ += cycles;
+        } else {
+            skipCycles(cycles);
+        }
+        if (idle_loop_skipping_) {
+            idle_loop_.onInstruction(cpu_, cycles_);
+            if (idle_loop_.needsHorizon()) {
+                idle_loop_.setHorizon(getNextEvent());
+            }
+        }
+        return cycles;
+    }
+
+    template <EmulatorConfig CONFIG>
+    uint64_t BasicEmulator<CONFIG>::skipHalt(uint64_t limit) noexcept {
+        // the CPU leaves HALT as soon as IE & IF is non-zero, whether IME is set or not
+        if (!is_running_ || !cpu_.isWaitingForInterrupt() || (ie_.getFlags() & if_.getFlags()) != 0 ||
+            cycles_ >= limit) {
+            return 0;
+        }
+
+        // only whole ticks are skipped, the tick with the event itself runs normally
+        uint64_t skipped = (std::min(getNextEvent(), limit) - cycles_) / g_cycles_per_tick * g_cycles_per_tick;
+        skipCycles(skipped);
+        skipped_halt_cycles_ += skipped;
+        return skipped;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void BasicEmulator<CONFIG>::saveState(std::vector<uint8_t> &buffer) const {
+        StateWriter writer(buffer);
+        writer.write(g_save_state_magic);
+        writer.write(g_save_state_version);
+        cartridge_.saveState(writer);
+        writer.write(cycles_);
+        writer.write(*memory_);
+        ie_.saveState(writer);
+        if_.saveState(writer);
+        input_.saveState(writer);
+        timer_.saveState(writer);
+        ppu_.saveState(writer);
+        bus_.saveState(writer);
+        cpu_.saveState(writer);
+    }
+
+    template <EmulatorConfig CONFIG>
+    void BasicEmulator<CONFIG>::loadState(std::span<const uint8_t> state) {
+        // components are only loaded once the whole state is known to be valid
+        checkState(state);
+        StateReader reader(state);
+        reader.skip(sizeof(g_save_state_magic) + sizeof(g_save_state_version));
+        cartridge_.loadState(reader);
+        reader.read(cycles_);
+        reader.read(*memory_);
+        ie_.loadState(reader);
+        if_.loadState(reader);
+        input_.loadState(reader);
+        timer_.loadState(reader);
+        ppu_.loadState(reader);
+        bus_.loadState(reader);
+        cpu_.loadState(reader);
+        fault_.clear();
+        lag_ = 0;
+        frame_interrupted_ = false;
+        idle_loop_.reset(cpu_);
+    }
+
+    template <EmulatorConfig CONFIG>
+    void BasicEmulator<CONFIG>::checkState(std::span<const uint8_t> state) const {
+        StateReader reader(state);
+        if (reader.read<uint32_t>() != g_save_state_magic || reader.read<uint32_t>() != g_save_state_version) {
+            throw std::invalid_argument("unsupported save state format");
+        }
+        cartridge_.checkState(reader);
+        reader.skip(sizeof(cycles_) + sizeof(Memory));
+        ie_.checkState(reader);
+        if_.checkState(reader);
+        input_.checkState(reader);
+        timer_.checkState(reader);
+        ppu_.checkState(reader);
+        bus_.checkState(reader);
+        cpu_.checkState(reader);
+        if (!reader.finished()) {
+            throw std::invalid_argument("save state is too long");
         }
     }
 } // namespace gb
@@ -0,0 +1,50 @@
+#ifndef GB_EMULATOR_SRC_GB_FAULT_HDR_
+#define GB_EMULATOR_SRC_GB_FAULT_HDR_
+
+#include <cstdint>
+#include <string_view>
+
+namespace gb {
+
+    // Conditions emulation can't continue after. They don't unwind: the first one is recorded and the emulator stops
+    // at the end of the M-cycle it happened in
+    enum class Fault : uint8_t {
+        NONE,
+        // an opcode the CPU doesn't have, the real one locks up
+        ILLEGAL_INSTRUCTION,
+        // a read from cartridge RAM of a cartridge without RAM
+        UNMAPPED_MEMORY,
+        // the emulator itself reached a state which should be impossible
+        INTERNAL_ERROR,
+    };
+
+    struct FaultState {
+        Fault fault = Fault::NONE;
+        // address of the instruction or of the memory access which caused the fault
+        uint16_t address = 0;
+
+        bool isSet() const noexcept { return fault != Fault::NONE; }
+
+        // Only the first fault is kept, later ones are likely caused by it
+        void raise(Fault new_fault, uint16_t fault_address) noexcept {
+            if (!isSet()) {
+                fault = new_fault;
+                address = fault_address;
+            }
+        }
+
+        void clear() noexcept { *this = FaultState{}; }
+    };
+
+    constexpr inline std::string_view getFaultName(Fault fault) {
+        switch (fault) {
+        case Fault::NONE: return "none";
+        case Fault::ILLEGAL_INSTRUCTION: return "illegal instruction";
+        case Fault::UNMAPPED_MEMORY: return "unmapped memory";
+        case Fault::INTERNAL_ERROR: return "internal error";
+        }
+        return "";
+    }
+} // namespace gb
+
+#endif
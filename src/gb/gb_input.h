@@ -2,6 +2,7 @@
 #define GB_EMULATOR_SRC_GB_GB_INPUT_HDR_
 
 #include "gb/interrupt_register.h"
+#include "gb/save_state.h"
 #include "util/util.h"
 #include <cstdint>
 
@@ -56,7 +57,30 @@ namespace gb {
             select_dpad_ = (data & g_input_select_dpad) != 0;
         }
 
+        void reset() {
+            state_ = 0;
+            select_dpad_ = false;
+            select_buttons_ = false;
+        }
+
         void setState(uint8_t state) { state_ = state; }
+        uint8_t getState() const { return state_; }
+
+        void saveState(StateWriter &writer) const {
+            writer.write(state_);
+            writer.write(select_dpad_);
+            writer.write(select_buttons_);
+        }
+
+        void loadState(StateReader &reader) {
+            reader.read(state_);
+            reader.read(select_dpad_);
+            reader.read(select_buttons_);
+        }
+
+        void checkState(StateReader &reader) const {
+            reader.skip(sizeof(state_) + sizeof(select_dpad_) + sizeof(select_buttons_));
+        }
 
       private:
         InterruptRegister &interrupt_flags_;
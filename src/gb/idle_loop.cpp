@@ -0,0 +1,113 @@
+#include "gb/idle_loop.h"
+#include "gb/config.h"
+#include "gb/cpu/cpu.h"
+#include "gb/memory/memory_map.h"
+#include "gb/save_state.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+    // Values read from these addresses can change without a PPU event or a timer interrupt,
+    // the joypad changes whenever the host sets new input
+    static bool isVolatileAddress(uint16_t address);
+
+    template <EmulatorConfig CONFIG>
+    void IdleLoopDetector::reset(cpu::SharpSM83<CONFIG> &cpu) {
+        cpu.setAccessLog(nullptr);
+        verifying_ = false;
+        confirmed_ = false;
+        needs_horizon_ = false;
+        counted_ = false;
+        last_pc_ = 0;
+        backoff_ = g_idle_loop_min_backoff;
+        backoff_left_ = 0;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void IdleLoopDetector::update(cpu::SharpSM83<CONFIG> &cpu, uint16_t pc, uint64_t cycles) {
+        if (!verifying_) {
+            startVerification(cpu, pc, cycles);
+            return;
+        }
+
+        if (cycles - iteration_start_ > g_max_idle_loop_period || log_.has_writes || log_.overflow) {
+            fail(cpu);
+            return;
+        }
+        if (pc != head_) {
+            return;
+        }
+        if (!hasStableReads()) {
+            fail(cpu);
+            return;
+        }
+
+        StateWriter writer(current_state_);
+        cpu.saveState(writer);
+        if (current_state_ != loop_state_) {
+            // still the same loop, but values it read have changed
+            if (++mismatches_ > g_idle_loop_max_mismatches) {
+                fail(cpu);
+                return;
+            }
+            loop_state_.swap(current_state_);
+        } else if (cycles <= horizon_) {
+            period_ = cycles - iteration_start_;
+            confirmed_ = true;
+            loop_reads_ = log_;
+            mismatches_ = 0;
+            backoff_ = g_idle_loop_min_backoff;
+            if (!counted_) {
+                ++stats_.loops_detected;
+                counted_ = true;
+            }
+        }
+        startIteration(cycles);
+    }
+
+    template <EmulatorConfig CONFIG>
+    void IdleLoopDetector::startVerification(cpu::SharpSM83<CONFIG> &cpu, uint16_t pc, uint64_t cycles) {
+        StateWriter writer(loop_state_);
+        cpu.saveState(writer);
+        head_ = pc;
+        cpu.setAccessLog(&log_);
+        verifying_ = true;
+        counted_ = false;
+        mismatches_ = 0;
+        startIteration(cycles);
+    }
+
+    void IdleLoopDetector::startIteration(uint64_t cycles) {
+        iteration_start_ = cycles;
+        needs_horizon_ = true;
+        log_.clear();
+    }
+
+    template <EmulatorConfig CONFIG>
+    void IdleLoopDetector::fail(cpu::SharpSM83<CONFIG> &cpu) {
+        cpu.setAccessLog(nullptr);
+        verifying_ = false;
+        needs_horizon_ = false;
+        backoff_left_ = backoff_;
+        backoff_ = std::min(backoff_ * 2, g_idle_loop_max_backoff);
+    }
+
+    bool IdleLoopDetector::hasStableReads() const {
+        return std::none_of(log_.reads.begin(), log_.reads.begin() + log_.read_count, isVolatileAddress);
+    }
+
+    static bool isVolatileAddress(uint16_t address) {
+        // OAM and the forbidden area after it, DMA isn't emulated, but OAM is still best left alone
+        bool oam = address >= 0xfe00 && address <= g_memory_forbidden.max_address;
+        return oam || g_memory_timer.isInRange(address) || address == uint16_t(IO::DMA_SRC) ||
+               address == uint16_t(IO::JOYPAD);
+    }
+
+    template void IdleLoopDetector::reset(cpu::SharpSM83<g_full_config> &cpu);
+    template void IdleLoopDetector::reset(cpu::SharpSM83<g_headless_config> &cpu);
+    template void IdleLoopDetector::update(cpu::SharpSM83<g_full_config> &cpu, uint16_t pc, uint64_t cycles);
+    template void IdleLoopDetector::update(cpu::SharpSM83<g_headless_config> &cpu, uint16_t pc, uint64_t cycles);
+} // namespace gb
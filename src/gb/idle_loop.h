@@ -0,0 +1,117 @@
+#ifndef GB_EMULATOR_SRC_GB_IDLE_LOOP_HDR_
+#define GB_EMULATOR_SRC_GB_IDLE_LOOP_HDR_
+
+#include "gb/config.h"
+#include "gb/cpu/cpu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace gb {
+
+    // loops with longer iterations aren't worth verifying
+    constexpr uint64_t g_max_idle_loop_period = 1024;
+    // after a failed verification, this many backward jumps are ignored (doubled on every failure in a row)
+    constexpr uint32_t g_idle_loop_min_backoff = 4;
+    constexpr uint32_t g_idle_loop_max_backoff = 1024;
+    // iterations in a row which ended with different CPU state before the loop is given up on,
+    // e.g. a loop polling LY gets a new value once per scanline, but a delay loop counting down never repeats
+    constexpr uint32_t g_idle_loop_max_mismatches = 2;
+
+    struct IdleLoopStats {
+        uint64_t loops_detected = 0;
+        uint64_t skips = 0;
+        uint64_t skipped_cycles = 0;
+    };
+
+    // Recognizes loops the CPU can't leave until something outside of it changes, e.g. JR -2 or polling LY,
+    // STAT or a RAM flag.
+    //
+    // A backward jump starts a candidate loop at its target. The next time the CPU gets back to the target, the
+    // iteration is accepted if the CPU state is exactly the same as at the start, the CPU didn't write anything and
+    // only read memory which can't change until the next PPU event or timer interrupt, and no such
+    // event happened during the iteration (see setHorizon()). Each following iteration is verified the same way,
+    // so a loop which starts doing something else is dropped right away.
+    //
+    // A confirmed loop will repeat every getLoopPeriod() cycles until the next event, so the emulator can advance
+    // peripherals by whole iterations instead of interpreting them
+    class IdleLoopDetector {
+      public:
+        // Must be called on every instruction boundary
+        template <EmulatorConfig CONFIG>
+        void onInstruction(cpu::SharpSM83<CONFIG> &cpu, uint64_t cycles) {
+            confirmed_ = false;
+            uint16_t pc = cpu.getProgramCounter();
+            bool backward_jump = pc < last_pc_;
+            last_pc_ = pc;
+            if (!verifying_ && (!backward_jump || (backoff_left_ != 0 && --backoff_left_ != 0))) {
+                return;
+            }
+            update(cpu, pc, cycles);
+        }
+
+        // Period in cycles if the CPU has just finished an iteration of an idle loop, 0 otherwise
+        uint64_t getLoopPeriod() const { return confirmed_ ? period_ : 0; }
+        // Addresses read by the last confirmed iteration, including every opcode and operand it fetched
+        std::span<const uint16_t> getLoopReads() const {
+            return std::span<const uint16_t>(loop_reads_.reads).first(loop_reads_.read_count);
+        }
+
+        // True when an iteration has just started, its horizon must be set before the next instruction
+        bool needsHorizon() const { return needs_horizon_; }
+        // Cycle count at which the next PPU event or timer interrupt happens, an iteration that reaches it
+        // might have read values which are already stale
+        void setHorizon(uint64_t cycles) {
+            horizon_ = cycles;
+            needs_horizon_ = false;
+        }
+
+        // The loop was advanced by cycles, which must be a multiple of the period
+        void onSkipped(uint64_t cycles) {
+            iteration_start_ += cycles;
+            needs_horizon_ = true;
+            ++stats_.skips;
+            stats_.skipped_cycles += cycles;
+        }
+
+        // Forgets the current loop, must be called when CPU state is changed from outside
+        template <EmulatorConfig CONFIG>
+        void reset(cpu::SharpSM83<CONFIG> &cpu);
+
+        const IdleLoopStats &getStats() const { return stats_; }
+
+      private:
+        template <EmulatorConfig CONFIG>
+        void update(cpu::SharpSM83<CONFIG> &cpu, uint16_t pc, uint64_t cycles);
+        template <EmulatorConfig CONFIG>
+        void startVerification(cpu::SharpSM83<CONFIG> &cpu, uint16_t pc, uint64_t cycles);
+        void startIteration(uint64_t cycles);
+        template <EmulatorConfig CONFIG>
+        void fail(cpu::SharpSM83<CONFIG> &cpu);
+        bool hasStableReads() const;
+
+        cpu::MemoryAccessLog log_;
+        cpu::MemoryAccessLog loop_reads_;
+        std::vector<uint8_t> loop_state_;
+        std::vector<uint8_t> current_state_;
+        uint64_t iteration_start_ = 0;
+        uint64_t horizon_ = 0;
+        uint64_t period_ = 0;
+        uint16_t head_ = 0;
+        uint16_t last_pc_ = 0;
+        uint32_t backoff_ = g_idle_loop_min_backoff;
+        uint32_t backoff_left_ = 0;
+        uint32_t mismatches_ = 0;
+        bool verifying_ = false;
+        bool needs_horizon_ = false;
+        bool confirmed_ = false;
+        // the current loop was already counted in stats
+        bool counted_ = false;
+
+        IdleLoopStats stats_;
+    };
+} // namespace gb
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef GB_EMULATOR_SRC_GB_INTERRUPT_REGISTER_HDR_
 #define GB_EMULATOR_SRC_GB_INTERRUPT_REGISTER_HDR_
 
+#include "gb/save_state.h"
+
 #include <cstdint>
 
 namespace gb {
@@ -32,6 +34,10 @@ namespace gb {
 
         inline uint8_t getFlags() const { return interrupts_ & (~g_unused_interrupt_bits); }
 
+        void saveState(StateWriter &writer) const { writer.write(interrupts_); }
+        void loadState(StateReader &reader) { reader.read(interrupts_); }
+        void checkState(StateReader &reader) const { reader.skip(sizeof(interrupts_)); }
+
       private:
         uint8_t interrupts_;
     };
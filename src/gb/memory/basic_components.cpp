@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <utility>
 #include <vector>
@@ -49,16 +50,14 @@ namespace gb {
         }
 
         rom_ = std::move(rom);
-        ram_.resize(ram_size);
+        rom_hash_ = hashBytes(rom_);
+        ram_.assign(ram_size, 0);
+        notifyMappingChanged();
 
         return true;
     }
 
-    uint8_t Cartridge::readROM(uint16_t address) const {
-        if (!g_memory_rom.isInRange(address)) [[unlikely]] {
-            throw std::invalid_argument("wrong ROM address");
-        }
-
+    uint8_t Cartridge::readROM(uint16_t address) const noexcept {
         if (mbc_) {
             size_t addr = mbc_->getEffectiveROMAddress(address);
             return rom_[addr];
@@ -73,11 +72,27 @@ namespace gb {
         // it seems that MBC chips' registers are always in ROM,
         // thus write to MBC and to cartridge RAM never occur on the same write
         mbc_->write(address, data);
+        notifyMappingChanged();
+    }
+
+    const uint8_t *Cartridge::getROMPage(uint16_t address) const noexcept {
+        if (rom_.empty()) {
+            return nullptr;
+        }
+        // banks are mapped whole, so the rest of the page follows the first byte
+        return rom_.data() + (mbc_ ? mbc_->getEffectiveROMAddress(address) : address);
+    }
+
+    uint8_t *Cartridge::getRAMPage(uint16_t address) noexcept {
+        if (ram_.empty() || !mbc_->ramEnabled()) {
+            return nullptr;
+        }
+        return ram_.data() + mbc_->getEffectiveRAMAddress(address);
     }
 
-    uint8_t Cartridge::readRAM(uint16_t address) const {
+    std::optional<uint8_t> Cartridge::readRAM(uint16_t address) const noexcept {
         if (ram_.empty()) {
-            throw std::invalid_argument("accessing unmapped cartridge RAM");
+            return {};
         }
 
         if (mbc_ && mbc_->ramEnabled()) {
@@ -94,6 +109,50 @@ namespace gb {
         ram_[mbc_->getEffectiveRAMAddress(address)] = data;
     }
 
+    void Cartridge::saveState(StateWriter &writer) const {
+        writer.write(rom_hash_);
+        writer.write(ram_.size());
+        writer.writeBytes(ram_);
+        if (mbc_) {
+            mbc_->saveState(writer);
+        }
+    }
+
+    void Cartridge::loadState(StateReader &reader) {
+        if (reader.read<uint64_t>() != rom_hash_ || reader.read<size_t>() != ram_.size()) {
+            throw std::invalid_argument("save state was made with a different cartridge");
+        }
+        reader.readBytes(ram_);
+        if (mbc_) {
+            mbc_->loadState(reader);
+        }
+        notifyMappingChanged();
+    }
+
+    void Cartridge::checkState(StateReader &reader) const {
+        if (reader.read<uint64_t>() != rom_hash_ || reader.read<size_t>() != ram_.size()) {
+            throw std::invalid_argument("save state was made with a different cartridge");
+        }
+        reader.skip(ram_.size());
+        if (mbc_) {
+            mbc_->checkState(reader);
+        }
+    }
+
+    void MBC1::saveState(StateWriter &writer) const {
+        writer.write(rom_bank_);
+        writer.write(ram_bank_);
+        writer.write(mode_);
+        writer.write(ram_enabled_);
+    }
+
+    void MBC1::loadState(StateReader &reader) {
+        reader.read(rom_bank_);
+        reader.read(ram_bank_);
+        reader.read(mode_);
+        reader.read(ram_enabled_);
+    }
+
     void MBC1::write(uint16_t address, uint8_t value) {
         if (address <= 0x1fff) {
             ram_enabled_ = (value & 0xf) == 0xa;
@@ -1,12 +1,15 @@
 #ifndef GB_EMULATOR_SRC_GB_MEMORY_BASIC_COMPONENTS_HDR_
 #define GB_EMULATOR_SRC_GB_MEMORY_BASIC_COMPONENTS_HDR_
 
+#include "gb/save_state.h"
+
 #include <array>
 #include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -26,6 +29,11 @@ namespace gb {
         virtual std::pair<uint16_t, uint16_t> getCurrentROMBanks() const = 0;
         virtual uint16_t getCurrentRAMBank() const = 0;
         virtual void reset() = 0;
+
+        virtual void saveState(StateWriter &writer) const = 0;
+        virtual void loadState(StateReader &reader) = 0;
+        // Reads what loadState() would and throws if it would reject it, without changing anything
+        virtual void checkState(StateReader &reader) const = 0;
     };
 
     constexpr size_t getAddressMask(size_t size) {
@@ -58,6 +66,12 @@ namespace gb {
             ram_enabled_ = false;
         }
 
+        void saveState(StateWriter &writer) const override;
+        void loadState(StateReader &reader) override;
+        void checkState(StateReader &reader) const override {
+            reader.skip(sizeof(rom_bank_) + sizeof(ram_bank_) + sizeof(mode_) + sizeof(ram_enabled_));
+        }
+
       private:
         size_t rom_address_mask_ = 0;
         size_t ram_address_mask_ = 0;
@@ -82,26 +96,60 @@ namespace gb {
     constexpr MemoryObjectInfo g_memory_rom = {.min_address = 0x0000, .max_address = 0x7FFF};
     constexpr MemoryObjectInfo g_memory_cartridge_ram = {.min_address = 0xa000, .max_address = 0xbfff};
     constexpr uint16_t g_rom_bank0_max_address = 0x3fff;
+    // granularity of Cartridge::getROMPage() and getRAMPage(), banks are multiples of it
+    constexpr uint16_t g_memory_page_size = 256;
+    constexpr size_t g_memory_page_count = 0x10000 / g_memory_page_size;
+
+    // Plain memory behind each page of the address space: ROM, cartridge RAM while it's enabled, WRAM and its
+    // mirror. Pages holding anything else, or an address watched by an observer, are nullptr and go through the
+    // bus's decoding instead. Writes to ROM never use the table, they switch banks. Filled in by AddressBus, compiled
+    // code reads and writes memory through it too
+    struct MemoryPages {
+        std::array<const uint8_t *, g_memory_page_count> read{};
+        std::array<uint8_t *, g_memory_page_count> write{};
+    };
+
+    // Notified when the memory behind the cartridge's address ranges may have moved: a bank switch, RAM being
+    // enabled or disabled, a new ROM, a reset or a loaded state
+    class ICartridgeMappingListener {
+      public:
+        virtual void onMappingChanged() noexcept = 0;
+
+      protected:
+        ~ICartridgeMappingListener() = default;
+    };
 
     class Cartridge {
       public:
         Cartridge() = default;
-        Cartridge(std::vector<uint8_t> rom) : rom_(std::move(rom)) {}
+        Cartridge(std::vector<uint8_t> rom) : rom_(std::move(rom)), rom_hash_(hashBytes(rom_)) {}
 
         bool setROM(std::vector<uint8_t> rom);
-        uint8_t readROM(uint16_t address) const;
+        // address must be in g_memory_rom
+        uint8_t readROM(uint16_t address) const noexcept;
         void writeROM(uint16_t address, uint8_t data);
 
-        uint8_t readRAM(uint16_t address) const;
+        // Empty if the cartridge has no RAM, address must be in g_memory_cartridge_ram
+        std::optional<uint8_t> readRAM(uint16_t address) const noexcept;
         void writeRAM(uint16_t address, uint8_t data);
 
         bool hasRAM() const { return !ram_.empty(); }
         bool hasROM() const { return !rom_.empty(); }
+        const std::vector<uint8_t> &getROM() const { return rom_; }
+
+        // Bytes currently mapped to the page starting at address, nullptr if there is no ROM. They stay valid
+        // until the listener is notified
+        const uint8_t *getROMPage(uint16_t address) const noexcept;
+        // Like getROMPage(), nullptr unless the cartridge has RAM and it is enabled
+        uint8_t *getRAMPage(uint16_t address) noexcept;
+        // At most one listener, nullptr removes it
+        void setMappingListener(ICartridgeMappingListener *listener) { listener_ = listener; }
 
         void reset() {
             if (mbc_) {
                 mbc_->reset();
             }
+            notifyMappingChanged();
         }
 
         std::pair<uint16_t, uint16_t> getCurrentROMBanks() const {
@@ -118,9 +166,23 @@ namespace gb {
             return 0;
         }
 
+        // ROM is not saved, only its hash, state can only be loaded into a cartridge with the same ROM
+        void saveState(StateWriter &writer) const;
+        void loadState(StateReader &reader);
+        void checkState(StateReader &reader) const;
+
       private:
+        void notifyMappingChanged() noexcept {
+            if (listener_) {
+                listener_->onMappingChanged();
+            }
+        }
+
         std::unique_ptr<MemoryBankController> mbc_;
+        ICartridgeMappingListener *listener_ = nullptr;
         std::vector<uint8_t> rom_;
+        // hashBytes() of rom_, computed once when the ROM is set
+        uint64_t rom_hash_ = hashBytes({});
         std::vector<uint8_t> ram_;
     };
 
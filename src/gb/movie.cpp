@@ -0,0 +1,352 @@
+#include "gb/movie.h"
+#include "gb/config.h"
+#include "gb/emulator.h"
+#include "util/util.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace gb {
+
+    // offset of the frame count in the header, it is only known when recording is finished
+    constexpr size_t g_movie_frame_count_offset = 16;
+
+    static void putInt(std::vector<uint8_t> &out, uint64_t value, size_t size);
+    static uint64_t getInt(std::span<const uint8_t> data, size_t &offset, size_t size);
+    static size_t getMovieVarint(std::span<const uint8_t> data, size_t &offset);
+
+    MovieRecorder::MovieRecorder(Emulator &emulator, MovieStart start, uint64_t keyframe_interval)
+        : emulator_(emulator), keyframe_interval_(keyframe_interval) {
+        putInt(data_, g_movie_magic, sizeof(uint32_t));
+        putInt(data_, g_movie_version, sizeof(uint32_t));
+        putInt(data_, hashBytes(emulator.getCartridge().getROM()), sizeof(uint64_t));
+        putInt(data_, 0, sizeof(uint64_t));
+        data_.push_back(uint8_t(start));
+
+        if (start == MovieStart::RESET) {
+            emulator.reset();
+            emulator.start();
+        } else {
+            emulator.saveState(state_);
+            putVarint(data_, state_.size());
+            data_.insert(data_.end(), state_.begin(), state_.end());
+        }
+    }
+
+    void MovieRecorder::addFrame(uint8_t input) {
+        if (keyframe_interval_ != 0 && frame_count_ != 0 && frame_count_ % keyframe_interval_ == 0) {
+            flushRun();
+            emulator_.saveState(state_);
+            data_.push_back(uint8_t(MovieRecord::KEYFRAME));
+            putVarint(data_, frame_count_);
+            putVarint(data_, state_.size());
+            data_.insert(data_.end(), state_.begin(), state_.end());
+        }
+
+        if (run_length_ != 0 && input != run_input_) {
+            flushRun();
+        }
+        run_input_ = input;
+        ++run_length_;
+        ++frame_count_;
+    }
+
+    void MovieRecorder::flushRun() {
+        if (run_length_ == 0) {
+            return;
+        }
+        data_.push_back(uint8_t(MovieRecord::RUN));
+        data_.push_back(run_input_);
+        putVarint(data_, run_length_);
+        run_length_ = 0;
+    }
+
+    std::vector<uint8_t> MovieRecorder::finish() {
+        flushRun();
+        data_.push_back(uint8_t(MovieRecord::END));
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            data_[g_movie_frame_count_offset + i] = uint8_t(frame_count_ >> (i * 8));
+        }
+        return std::move(data_);
+    }
+
+    MoviePlayer::MoviePlayer(std::vector<uint8_t> movie) : data_(std::move(movie)) {
+        size_t offset = 0;
+        if (getInt(data_, offset, sizeof(uint32_t)) != g_movie_magic) {
+            throw std::invalid_argument("not a movie file");
+        }
+        if (getInt(data_, offset, sizeof(uint32_t)) != g_movie_version) {
+            throw std::invalid_argument("unsupported movie version");
+        }
+        rom_hash_ = getInt(data_, offset, sizeof(uint64_t));
+        frame_count_ = getInt(data_, offset, sizeof(uint64_t));
+
+        start_ = MovieStart(getInt(data_, offset, sizeof(uint8_t)));
+        if (start_ == MovieStart::STATE) {
+            state_size_ = getMovieVarint(data_, offset);
+            state_offset_ = offset;
+            if (state_size_ > data_.size() - offset) {
+                throw std::invalid_argument("movie is truncated");
+            }
+            offset += state_size_;
+        } else if (start_ != MovieStart::RESET) {
+            throw std::invalid_argument("invalid movie start type");
+        }
+
+        records_offset_ = offset;
+        offset_ = offset;
+        indexed_offset_ = offset;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void MoviePlayer::checkROM(BasicEmulator<CONFIG> &emulator) const {
+        if (hashBytes(emulator.getCartridge().getROM()) != rom_hash_) {
+            throw std::invalid_argument("movie was recorded with a different ROM");
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void MoviePlayer::start(BasicEmulator<CONFIG> &emulator) {
+        checkROM(emulator);
+        if (start_ == MovieStart::RESET) {
+            emulator.reset();
+        } else {
+            emulator.loadState(std::span<const uint8_t>(data_).subspan(state_offset_, state_size_));
+        }
+        emulator.start();
+
+        offset_ = records_offset_;
+        current_frame_ = 0;
+        run_left_ = 0;
+    }
+
+    std::optional<uint8_t> MoviePlayer::nextFrame() {
+        while (run_left_ == 0) {
+            size_t record_offset = offset_;
+            Record record = readRecord(offset_);
+            indexRecord(record, record_offset, offset_);
+
+            if (record.type == MovieRecord::END) {
+                offset_ = record_offset;
+                return {};
+            } else if (record.type == MovieRecord::RUN) {
+                run_input_ = record.input;
+                run_left_ = record.value;
+            } else if (record.value != current_frame_) {
+                throw std::invalid_argument("movie keyframe is out of place");
+            }
+        }
+        --run_left_;
+        ++current_frame_;
+        return run_input_;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void MoviePlayer::seek(BasicEmulator<CONFIG> &emulator, uint64_t frame) {
+        if (frame > frame_count_) {
+            throw std::invalid_argument("seeking past the end of the movie");
+        }
+
+        extendIndex(frame);
+        auto it =
+            std::upper_bound(keyframes_.begin(), keyframes_.end(), frame,
+                             [](uint64_t frame, const MovieKeyframe &keyframe) { return frame < keyframe.frame; });
+        if (it == keyframes_.begin()) {
+            start(emulator);
+        } else {
+            --it;
+            checkROM(emulator);
+            size_t offset = it->offset;
+            Record keyframe = readRecord(offset);
+            emulator.loadState(std::span<const uint8_t>(data_).subspan(keyframe.state_offset, keyframe.state_size));
+            emulator.start();
+            offset_ = offset;
+            current_frame_ = keyframe.value;
+            run_left_ = 0;
+        }
+
+        while (current_frame_ < frame && !emulator.terminated()) {
+            std::optional<uint8_t> input = nextFrame();
+            if (!input) {
+                break;
+            }
+            emulator.getInput().setState(*input);
+            // replayed frames run through breakpoints
+            while (emulator.runFrame() == StopReason::BREAKPOINT) {
+            }
+        }
+    }
+
+    MoviePlayer::Record MoviePlayer::readRecord(size_t &offset) const {
+        Record record;
+        record.type = MovieRecord(getInt(data_, offset, sizeof(uint8_t)));
+        switch (record.type) {
+        case MovieRecord::END: break;
+        case MovieRecord::RUN:
+            record.input = uint8_t(getInt(data_, offset, sizeof(uint8_t)));
+            record.value = getMovieVarint(data_, offset);
+            if (record.value == 0) {
+                throw std::invalid_argument("empty run in movie");
+            }
+            break;
+        case MovieRecord::KEYFRAME:
+            record.value = getMovieVarint(data_, offset);
+            record.state_size = getMovieVarint(data_, offset);
+            record.state_offset = offset;
+            if (record.state_size > data_.size() - offset) {
+                throw std::invalid_argument("movie is truncated");
+            }
+            offset += record.state_size;
+            break;
+        default: throw std::invalid_argument("invalid movie record");
+        }
+        return record;
+    }
+
+    void MoviePlayer::indexRecord(const Record &record, size_t record_offset, size_t next_offset) {
+        // records are only indexed in order, the ones before indexed_offset_ are already in the index
+        if (record_offset != indexed_offset_ || index_complete_) {
+            return;
+        }
+
+        switch (record.type) {
+        case MovieRecord::END:
+            if (indexed_frames_ != frame_count_) {
+                throw std::invalid_argument("movie frame count doesn't match its records");
+            }
+            index_complete_ = true;
+            return;
+        case MovieRecord::RUN: indexed_frames_ += record.value; break;
+        case MovieRecord::KEYFRAME:
+            if (record.value != indexed_frames_) {
+                throw std::invalid_argument("movie keyframe is out of place");
+            }
+            keyframes_.push_back(MovieKeyframe{.frame = record.value, .offset = record_offset});
+            break;
+        }
+        indexed_offset_ = next_offset;
+    }
+
+    void MoviePlayer::extendIndex(uint64_t frame) {
+        // a keyframe for frame can be right after the run that ends at it
+        while (!index_complete_ && indexed_frames_ <= frame) {
+            size_t record_offset = indexed_offset_;
+            size_t offset = record_offset;
+            Record record = readRecord(offset);
+            indexRecord(record, record_offset, offset);
+        }
+    }
+
+    std::optional<std::vector<uint8_t>> MoviePlayer::saveIndex() const {
+        if (!index_complete_) {
+            return {};
+        }
+
+        std::vector<uint8_t> result;
+        putInt(result, g_movie_index_magic, sizeof(uint32_t));
+        putInt(result, hashBytes(data_), sizeof(uint64_t));
+        putVarint(result, indexed_offset_);
+        putVarint(result, keyframes_.size());
+        for (const MovieKeyframe &keyframe : keyframes_) {
+            putVarint(result, keyframe.frame);
+            putVarint(result, keyframe.offset);
+        }
+        return result;
+    }
+
+    bool MoviePlayer::loadIndex(std::span<const uint8_t> index) {
+        try {
+            size_t offset = 0;
+            if (getInt(index, offset, sizeof(uint32_t)) != g_movie_index_magic ||
+                getInt(index, offset, sizeof(uint64_t)) != hashBytes(data_)) {
+                return false;
+            }
+
+            size_t end_offset = getMovieVarint(index, offset);
+            size_t end = end_offset;
+            if (end_offset < records_offset_ || readRecord(end).type != MovieRecord::END) {
+                return false;
+            }
+
+            size_t count = getMovieVarint(index, offset);
+            std::vector<MovieKeyframe> keyframes;
+            uint64_t previous_frame = 0;
+            for (size_t i = 0; i < count; ++i) {
+                MovieKeyframe keyframe{.frame = getMovieVarint(index, offset), .offset = getMovieVarint(index, offset)};
+                size_t record_offset = keyframe.offset;
+                // the hash matches, but offsets are still checked in case the index itself is corrupted
+                if (keyframe.offset < records_offset_ || keyframe.offset >= end_offset ||
+                    keyframe.frame <= previous_frame || keyframe.frame > frame_count_) {
+                    return false;
+                }
+                Record record = readRecord(record_offset);
+                if (record.type != MovieRecord::KEYFRAME || record.value != keyframe.frame) {
+                    return false;
+                }
+                previous_frame = keyframe.frame;
+                keyframes.push_back(keyframe);
+            }
+
+            keyframes_ = std::move(keyframes);
+            indexed_offset_ = end_offset;
+            indexed_frames_ = frame_count_;
+            index_complete_ = true;
+            return true;
+        } catch (const std::invalid_argument &) {
+            return false;
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    uint64_t playMovie(BasicEmulator<CONFIG> &emulator, std::vector<uint8_t> movie) {
+        MoviePlayer player(std::move(movie));
+        player.start(emulator);
+        while (auto input = player.nextFrame()) {
+            emulator.getInput().setState(*input);
+            while (emulator.runFrame() == StopReason::BREAKPOINT) {
+            }
+            if (emulator.terminated()) {
+                break;
+            }
+        }
+        return player.getCurrentFrame();
+    }
+
+    static void putInt(std::vector<uint8_t> &out, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i, value >>= 8) {
+            out.push_back(uint8_t(value));
+        }
+    }
+
+    static uint64_t getInt(std::span<const uint8_t> data, size_t &offset, size_t size) {
+        if (offset > data.size() || size > data.size() - offset) {
+            throw std::invalid_argument("movie is truncated");
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value |= uint64_t(data[offset++]) << (i * 8);
+        }
+        return value;
+    }
+
+    static size_t getMovieVarint(std::span<const uint8_t> data, size_t &offset) {
+        std::optional<size_t> value = getVarint(data.data(), data.size(), offset);
+        if (!value) {
+            throw std::invalid_argument("movie is truncated");
+        }
+        return *value;
+    }
+
+    template void MoviePlayer::start(Emulator &emulator);
+    template void MoviePlayer::start(HeadlessEmulator &emulator);
+    template void MoviePlayer::seek(Emulator &emulator, uint64_t frame);
+    template void MoviePlayer::seek(HeadlessEmulator &emulator, uint64_t frame);
+    template uint64_t playMovie(Emulator &emulator, std::vector<uint8_t> movie);
+    template uint64_t playMovie(HeadlessEmulator &emulator, std::vector<uint8_t> movie);
+} // namespace gb
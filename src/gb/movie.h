@@ -0,0 +1,142 @@
+#ifndef GB_EMULATOR_SRC_GB_MOVIE_HDR_
+#define GB_EMULATOR_SRC_GB_MOVIE_HDR_
+
+#include "gb/config.h"
+#include "gb/emulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace gb {
+
+    constexpr uint32_t g_movie_magic = 0x564d4247;       // "GBMV"
+    constexpr uint32_t g_movie_index_magic = 0x494d4247; // "GBMI"
+    constexpr uint32_t g_movie_version = 2;
+
+    enum class MovieStart : uint8_t { RESET = 0, STATE = 1 };
+
+    enum class MovieRecord : uint8_t {
+        END = 0,
+        // joypad state followed by a varint count of frames it was held for
+        RUN = 1,
+        // varint frame number, varint size of the save state and the state itself.
+        // The state is taken right before the frame is run
+        KEYFRAME = 2
+    };
+
+    struct MovieKeyframe {
+        uint64_t frame = 0;
+        // offset of the KEYFRAME record in the movie
+        size_t offset = 0;
+    };
+
+    // Movie format (all integers are little-endian):
+    // magic (u32), version (u32), ROM hash (u64), frame count (u64), MovieStart (u8),
+    // for MovieStart::STATE: varint size of the initial save state followed by the state,
+    // records, each starting with MovieRecord tag, the last one is MovieRecord::END.
+    //
+    // A frame is one Emulator::runFrame() call, joypad state is set before each frame and doesn't change during it
+    class MovieRecorder {
+      public:
+        // Resets the emulator if start is MovieStart::RESET, otherwise saves its current state.
+        // If keyframe_interval isn't 0, a keyframe is embedded every keyframe_interval frames
+        MovieRecorder(Emulator &emulator, MovieStart start, uint64_t keyframe_interval = 0);
+
+        // Must be called right before the frame is run, keyframes are taken here
+        void addFrame(uint8_t input);
+        uint64_t getFrameCount() const { return frame_count_; }
+
+        // No more frames can be added after the movie is finished
+        std::vector<uint8_t> finish();
+
+      private:
+        void flushRun();
+
+        Emulator &emulator_;
+        std::vector<uint8_t> data_;
+        std::vector<uint8_t> state_;
+        uint64_t keyframe_interval_ = 0;
+        uint64_t frame_count_ = 0;
+        uint64_t run_length_ = 0;
+        uint8_t run_input_ = 0;
+    };
+
+    // Keyframes are indexed lazily as records are played (or skipped over by seek()). Once the whole movie was
+    // indexed, the index can be saved and loaded back the next time the movie is played
+    class MoviePlayer {
+      public:
+        // Throws std::invalid_argument if the header is malformed.
+        // Records are validated as they are read, so nextFrame() and seek() can throw too
+        MoviePlayer(std::vector<uint8_t> movie);
+
+        // Resets the emulator or loads the initial state and starts it, playback restarts from the first frame.
+        // Throws std::invalid_argument if the movie was recorded with a different ROM
+        template <EmulatorConfig CONFIG>
+        void start(BasicEmulator<CONFIG> &emulator);
+
+        // Joypad state for the next frame, empty once the movie has ended
+        std::optional<uint8_t> nextFrame();
+
+        // Loads the last keyframe at or before frame and re-simulates the rest,
+        // so the next call to nextFrame() returns input for frame
+        template <EmulatorConfig CONFIG>
+        void seek(BasicEmulator<CONFIG> &emulator, uint64_t frame);
+
+        uint64_t getFrameCount() const { return frame_count_; }
+        uint64_t getCurrentFrame() const { return current_frame_; }
+
+        const std::vector<MovieKeyframe> &getKeyframes() const { return keyframes_; }
+        bool isIndexComplete() const { return index_complete_; }
+
+        // Empty until the index is complete
+        std::optional<std::vector<uint8_t>> saveIndex() const;
+        // Returns false if the index is malformed or belongs to a different movie
+        bool loadIndex(std::span<const uint8_t> index);
+
+      private:
+        struct Record {
+            MovieRecord type = MovieRecord::END;
+            uint8_t input = 0;
+            // frame count for RUN, frame number for KEYFRAME
+            uint64_t value = 0;
+            size_t state_offset = 0;
+            size_t state_size = 0;
+        };
+
+        Record readRecord(size_t &offset) const;
+        void indexRecord(const Record &record, size_t record_offset, size_t next_offset);
+        // Reads records after the indexed part until frame is covered
+        void extendIndex(uint64_t frame);
+        template <EmulatorConfig CONFIG>
+        void checkROM(BasicEmulator<CONFIG> &emulator) const;
+
+        std::vector<uint8_t> data_;
+        uint64_t rom_hash_ = 0;
+        MovieStart start_ = MovieStart::RESET;
+        size_t state_offset_ = 0;
+        size_t state_size_ = 0;
+        size_t records_offset_ = 0;
+
+        uint64_t frame_count_ = 0;
+        uint64_t current_frame_ = 0;
+        size_t offset_ = 0;
+        uint64_t run_left_ = 0;
+        uint8_t run_input_ = 0;
+
+        std::vector<MovieKeyframe> keyframes_;
+        // records before indexed_offset_ are indexed, indexed_frames_ is the number of frames in them
+        size_t indexed_offset_ = 0;
+        uint64_t indexed_frames_ = 0;
+        bool index_complete_ = false;
+    };
+
+    // Plays the movie headlessly as fast as possible, returns the number of frames played.
+    // Playback stops early if the emulator terminates
+    template <EmulatorConfig CONFIG>
+    uint64_t playMovie(BasicEmulator<CONFIG> &emulator, std::vector<uint8_t> movie);
+} // namespace gb
+
+#endif
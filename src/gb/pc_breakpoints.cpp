@@ -0,0 +1,45 @@
+#include "gb/pc_breakpoints.h"
+#include "gb/condition.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace gb {
+
+    void PCBreakpoints::add(const PCBreakpoint &breakpoint) {
+        auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), breakpoint);
+        if (it != breakpoints_.end() && *it == breakpoint) {
+            return;
+        }
+        breakpoints_.insert(it, breakpoint);
+        addresses_.set(breakpoint.address);
+    }
+
+    void PCBreakpoints::remove(const PCBreakpoint &breakpoint) {
+        auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), breakpoint);
+        if (it == breakpoints_.end() || *it != breakpoint) {
+            return;
+        }
+        breakpoints_.erase(it);
+        bool address_used = std::ranges::any_of(
+            breakpoints_, [&breakpoint](const PCBreakpoint &other) { return other.address == breakpoint.address; });
+        addresses_.set(breakpoint.address, address_used);
+    }
+
+    void PCBreakpoints::clear() {
+        breakpoints_.clear();
+        addresses_.reset();
+    }
+
+    bool PCBreakpoints::isHit(const ConditionContext &context) const {
+        // breakpoints without a bank or a condition sort first
+        for (auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(),
+                                        PCBreakpoint{.address = context.address, .bank = {}, .condition = {}});
+             it != breakpoints_.end() && it->address == context.address; ++it) {
+            if ((!it->bank || *it->bank == context.bank) && (!it->condition || it->condition->evaluate(context))) {
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace gb
@@ -0,0 +1,48 @@
+#ifndef GB_EMULATOR_SRC_GB_PC_BREAKPOINTS_HDR_
+#define GB_EMULATOR_SRC_GB_PC_BREAKPOINTS_HDR_
+
+#include "gb/condition.h"
+
+#include <bitset>
+#include <compare>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace gb {
+
+    struct PCBreakpoint {
+        uint16_t address = 0;
+        // ROM or cartridge RAM bank the way cpu::TraceRecord reports it, any bank if empty
+        std::optional<uint16_t> bank = std::nullopt;
+        // checked after the address and the bank match, always true if empty
+        std::optional<BreakpointCondition> condition = std::nullopt;
+
+        auto operator<=>(const PCBreakpoint &) const = default;
+    };
+
+    // Breakpoints on the address of the next instruction, checked by the emulator's run loop at every instruction
+    // boundary. A bit per address tells whether any breakpoint is set there, so the check is a single bit test;
+    // banks and conditions are only checked at addresses which have a breakpoint
+    class PCBreakpoints {
+      public:
+        void add(const PCBreakpoint &breakpoint);
+        void remove(const PCBreakpoint &breakpoint);
+        void clear();
+
+        // Sorted by address
+        const std::vector<PCBreakpoint> &getBreakpoints() const { return breakpoints_; }
+        bool empty() const { return breakpoints_.empty(); }
+
+        // Any breakpoint is set at address
+        bool isSet(uint16_t address) const { return addresses_[address]; }
+        // A breakpoint at context.address matches context.bank and its condition holds
+        bool isHit(const ConditionContext &context) const;
+
+      private:
+        std::bitset<0x10000> addresses_;
+        std::vector<PCBreakpoint> breakpoints_;
+    };
+} // namespace gb
+
+#endif
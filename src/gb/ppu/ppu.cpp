@@ -1,17 +1,20 @@
 #include "gb/ppu/ppu.h"
+#include "gb/config.h"
 #include "gb/interrupt_register.h"
 #include "util/util.h"
 #include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cstring>
+#include <limits>
 #include <span>
 #include <stdexcept>
 #include <type_traits>
 
 namespace gb {
 
-    uint8_t PPU::readIO(uint16_t address) const {
+    template <EmulatorConfig CONFIG>
+    uint8_t PPU<CONFIG>::readIO(uint16_t address) const noexcept {
 
         switch (IO(address)) {
         case IO::LCDC: return lcd_control_;
@@ -26,11 +29,12 @@ namespace gb {
         case IO::OBJ1_PALETTE: return obj_palette1_;
         case IO::WINDOW_Y: return window_y_;
         case IO::WINDOW_X: return window_x_;
-        default: throw std::invalid_argument("unreachable"); return 0;
+        default: return 0xff;
         }
     }
 
-    void PPU::writeIO(uint16_t address, uint8_t data) {
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::writeIO(uint16_t address, uint8_t data) noexcept {
 
         switch (IO(address)) {
         case IO::LCDC: lcd_control_ = data; break;
@@ -50,84 +54,53 @@ namespace gb {
         case IO::OBJ1_PALETTE: obj_palette1_ = data; break;
         case IO::WINDOW_Y: window_y_ = data; break;
         case IO::WINDOW_X: window_x_ = data; break;
-        default: throw std::invalid_argument("unreachable");
+        default: break;
         }
     }
 
-    uint8_t PPU::readVRAM(uint16_t address) const {
-        if (!g_memory_vram.isInRange(address)) [[unlikely]] {
-            throw std::invalid_argument("wrong VRAM address");
-        }
-
+    template <EmulatorConfig CONFIG>
+    uint8_t PPU<CONFIG>::readVRAM(uint16_t address) const noexcept {
         return vram_[address - g_memory_vram.min_address];
     }
 
-    void PPU::writeVRAM(uint16_t address, uint8_t data) {
-        if (!g_memory_vram.isInRange(address)) [[unlikely]] {
-            throw std::invalid_argument("wrong VRAM address");
-        }
-
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::writeVRAM(uint16_t address, uint8_t data) noexcept {
         vram_[address - g_memory_vram.min_address] = data;
     }
 
-    uint8_t PPU::readOAM(uint16_t address) const {
-        if (!g_memory_oam.isInRange(address)) [[unlikely]] {
-            throw std::invalid_argument("wrong VRAM address");
-        }
-
+    template <EmulatorConfig CONFIG>
+    uint8_t PPU<CONFIG>::readOAM(uint16_t address) const noexcept {
         return oam_[address - g_memory_oam.min_address];
     }
-    void PPU::writeOAM(uint16_t address, uint8_t data) {
-        if (!g_memory_oam.isInRange(address)) [[unlikely]] {
-            throw std::invalid_argument("wrong VRAM address");
-        }
-
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::writeOAM(uint16_t address, uint8_t data) noexcept {
         oam_[address - g_memory_oam.min_address] = data;
     }
 
-    void PPU::update() {
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::update() {
         if (!(lcd_control_ & LCDControlFlags::ENABLE)) {
             return;
         }
 
         switch (mode_) {
-        case PPUMode::OAM_SCAN: {
-            // spend 80 clock cycles to check 40 y coordinates
-            if (cycles_to_finish_ % 2 == 0) {
-                // each OAM entry is 4 bytes long, y coordinate is the first byte in the entry
-                size_t idx = (g_oam_fetch_duration - cycles_to_finish_) * 4;
-                uint8_t y_coord = oam_[idx] - 16;
-                // height = 8 if OBJ_SIZE bit is not set, 16 otherwise
-                uint8_t height = 8 * (((lcd_control_ & LCDControlFlags::OBJ_SIZE) != 0) + 1);
-
-                if (current_y_ >= y_coord && current_y_ < y_coord + height) {
-                    ObjectAttributes attrs = decodeObjectAttributes(std::span<uint8_t, 4>{&oam_[idx], 4},
-                                                                    (lcd_control_ & LCDControlFlags::OBJ_SIZE) != 0);
-                    // discard objs that are not visible
-                    if (attrs.x == 0) {
-                        break;
-                    }
-                    auto it = std::upper_bound(objects_on_current_line_.begin(), objects_on_current_line_.end(), attrs,
-                                               [](auto lhs, auto rhs) { return lhs.x < rhs.x; });
-
-                    // if two objs have the same x coordinate, the obj with lower attributes address
-                    // is drawn
-                    if (it != objects_on_current_line_.begin() && (--it)->x == attrs.x) {
-                        break;
-                    }
-                    objects_on_current_line_.insert(it, attrs);
-                }
+        case PPUMode::OAM_SCAN:
+            // found objects are only used for rendering
+            if (isRendering()) {
+                scanOAM();
+            }
+            break;
+        case PPUMode::RENDER:
+            if (isRendering()) {
+                renderPixelRow();
             }
             break;
-        }
-        case PPUMode::RENDER: renderPixelRow(); break;
         case PPUMode::HBLANK: break;
         case PPUMode::VBLANK:
             if (cycles_to_finish_ % g_scanline_duration == 1) {
                 ++current_y_;
             }
             break;
-        default: throw std::runtime_error("unexpected PPU mode");
         }
 
         --cycles_to_finish_;
@@ -170,11 +143,10 @@ namespace gb {
                 cycles_to_finish_ = g_oam_fetch_duration;
                 current_y_ = 0;
                 frame_finished_ = true;
-                if (renderer_) {
+                if (isRendering()) {
                     renderer_->finishFrame();
                 }
                 break;
-            default: throw std::runtime_error("unexpected PPU mode");
             }
         }
         set_interrupt = set_interrupt || (current_y_ == y_compare_ && (status_ & PPUInterruptSelectFlags::Y_COMPARE));
@@ -183,7 +155,70 @@ namespace gb {
         }
     }
 
-    void PPU::renderPixelRow() {
+    template <EmulatorConfig CONFIG>
+    uint64_t PPU<CONFIG>::cyclesUntilEvent() const {
+        if (!(lcd_control_ & LCDControlFlags::ENABLE)) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        // update() sets the flag every cycle while LY == LYC, it only matters if the flag isn't set already
+        if (current_y_ == y_compare_ && (status_ & PPUInterruptSelectFlags::Y_COMPARE) &&
+            !(interrupt_flags_.getFlags() & uint8_t(InterruptFlags::LCD_STAT))) {
+            return 0;
+        }
+        // mode changes when the update starts with cycles_to_finish_ == 1,
+        // in VBLANK LY also changes when cycles_to_finish_ % g_scanline_duration == 1
+        if (mode_ == PPUMode::VBLANK) {
+            return (cycles_to_finish_ - 1) % g_scanline_duration;
+        }
+        return cycles_to_finish_ - 1;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::skip(uint64_t cycles) {
+        if (!(lcd_control_ & LCDControlFlags::ENABLE)) {
+            return;
+        }
+        if ((mode_ == PPUMode::OAM_SCAN || mode_ == PPUMode::RENDER) && isRendering()) {
+            for (uint64_t i = 0; i < cycles; ++i) {
+                update();
+            }
+            return;
+        }
+        cycles_to_finish_ -= cycles;
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::scanOAM() {
+        // spend 80 clock cycles to check 40 y coordinates
+        if (cycles_to_finish_ % 2 == 0) {
+            // each OAM entry is 4 bytes long, y coordinate is the first byte in the entry
+            size_t idx = (g_oam_fetch_duration - cycles_to_finish_) * 4;
+            uint8_t y_coord = oam_[idx] - 16;
+            // height = 8 if OBJ_SIZE bit is not set, 16 otherwise
+            uint8_t height = 8 * (((lcd_control_ & LCDControlFlags::OBJ_SIZE) != 0) + 1);
+
+            if (current_y_ >= y_coord && current_y_ < y_coord + height) {
+                ObjectAttributes attrs = decodeObjectAttributes(std::span<uint8_t, 4>{&oam_[idx], 4},
+                                                                (lcd_control_ & LCDControlFlags::OBJ_SIZE) != 0);
+                // discard objs that are not visible
+                if (attrs.x == 0) {
+                    return;
+                }
+                auto it = std::upper_bound(objects_on_current_line_.begin(), objects_on_current_line_.end(), attrs,
+                                           [](auto lhs, auto rhs) { return lhs.x < rhs.x; });
+
+                // if two objs have the same x coordinate, the obj with lower attributes address
+                // is drawn
+                if (it != objects_on_current_line_.begin() && (--it)->x == attrs.x) {
+                    return;
+                }
+                objects_on_current_line_.insert(it, attrs);
+            }
+        }
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::renderPixelRow() {
         if (current_x_ >= g_screen_width) {
             return;
         }
@@ -281,13 +316,16 @@ namespace gb {
                 pixels.push_back(PixelInfo{});
             }
         }
-        if (renderer_) {
-            renderer_->drawPixels(current_x_, current_y_, pixels);
+        if constexpr (CONFIG.renderer) {
+            if (renderer_) {
+                renderer_->drawPixels(current_x_, current_y_, pixels);
+            }
         }
         current_x_ += pixels.size();
     }
 
-    std::array<GBColor, 8> PPU::getTileRow(uint16_t tilemap_base, uint8_t x, uint8_t y) {
+    template <EmulatorConfig CONFIG>
+    std::array<GBColor, 8> PPU<CONFIG>::getTileRow(uint16_t tilemap_base, uint8_t x, uint8_t y) {
         uint16_t tile_y = y / 8;
         uint16_t tile_x = x / 8;
         uint8_t tile_id = vram_[(tilemap_base + (tile_y * 32 + tile_x)) - g_memory_vram.min_address];
@@ -304,16 +342,116 @@ namespace gb {
                              vram_[tile_address + 1 - g_memory_vram.min_address]);
     }
 
-    GBColor PPU ::getBGColor(GBColor color_idx) { return GBColor((bg_palette_ >> uint8_t(color_idx) * 2) & 0b11); }
+    template <EmulatorConfig CONFIG>
+    GBColor PPU<CONFIG>::getBGColor(GBColor color_idx) {
+        return GBColor((bg_palette_ >> uint8_t(color_idx) * 2) & 0b11);
+    }
 
-    GBColor PPU ::getSpriteColor(GBColor color_idx, bool use_obp1) {
+    template <EmulatorConfig CONFIG>
+    GBColor PPU<CONFIG>::getSpriteColor(GBColor color_idx, bool use_obp1) {
         if (use_obp1) {
             return GBColor((obj_palette1_ >> uint8_t(color_idx) * 2) & 0b11);
         }
         return GBColor((obj_palette0_ >> uint8_t(color_idx) * 2) & 0b11);
     }
 
-    void PPU::reset() {
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::saveState(StateWriter &writer) const {
+        writer.write(objects_on_current_line_.size());
+        writer.writeBytes(std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(objects_on_current_line_.data()),
+                                                   objects_on_current_line_.size() * sizeof(ObjectAttributes)));
+        // objects_to_draw_ points into objects_on_current_line_
+        size_t draw_offset = objects_to_draw_.empty() ? 0 : objects_to_draw_.data() - objects_on_current_line_.data();
+        writer.write(draw_offset);
+        writer.write(objects_to_draw_.size());
+
+        writer.write(cycles_to_finish_);
+        writer.write(current_x_);
+        writer.write(mode_);
+        writer.write(dma_running_);
+        writer.write(frame_finished_);
+        writer.write(current_dma_address_);
+
+        writer.write(lcd_control_);
+        writer.write(status_);
+        writer.write(scroll_x_);
+        writer.write(scroll_y_);
+        writer.write(current_y_);
+        writer.write(y_compare_);
+        writer.write(dma_src_);
+        writer.write(bg_palette_);
+        writer.write(obj_palette0_);
+        writer.write(obj_palette1_);
+        writer.write(window_x_);
+        writer.write(window_y_);
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::loadState(StateReader &reader) {
+        size_t object_count = reader.read<size_t>();
+        if (object_count > g_memory_oam.size / 4) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+        objects_on_current_line_.resize(object_count);
+        reader.readBytes(std::span<uint8_t>(reinterpret_cast<uint8_t *>(objects_on_current_line_.data()),
+                                            object_count * sizeof(ObjectAttributes)));
+        size_t draw_offset = reader.read<size_t>();
+        size_t draw_size = reader.read<size_t>();
+        if (draw_offset + draw_size > object_count) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+        objects_to_draw_ = std::span<ObjectAttributes>{objects_on_current_line_}.subspan(draw_offset, draw_size);
+
+        reader.read(cycles_to_finish_);
+        reader.read(current_x_);
+        reader.read(mode_);
+        if (uint8_t(mode_) > uint8_t(PPUMode::RENDER)) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+        reader.read(dma_running_);
+        reader.read(frame_finished_);
+        reader.read(current_dma_address_);
+
+        reader.read(lcd_control_);
+        reader.read(status_);
+        reader.read(scroll_x_);
+        reader.read(scroll_y_);
+        reader.read(current_y_);
+        reader.read(y_compare_);
+        reader.read(dma_src_);
+        reader.read(bg_palette_);
+        reader.read(obj_palette0_);
+        reader.read(obj_palette1_);
+        reader.read(window_x_);
+        reader.read(window_y_);
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::checkState(StateReader &reader) const {
+        size_t object_count = reader.read<size_t>();
+        if (object_count > g_memory_oam.size / 4) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+        reader.skip(object_count * sizeof(ObjectAttributes));
+        size_t draw_offset = reader.read<size_t>();
+        size_t draw_size = reader.read<size_t>();
+        if (draw_offset + draw_size > object_count) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+
+        reader.skip(sizeof(cycles_to_finish_) + sizeof(current_x_));
+        if (uint8_t(reader.read<PPUMode>()) > uint8_t(PPUMode::RENDER)) {
+            throw std::invalid_argument("invalid PPU state");
+        }
+        reader.skip(sizeof(dma_running_) + sizeof(frame_finished_) + sizeof(current_dma_address_));
+
+        reader.skip(sizeof(lcd_control_) + sizeof(status_) + sizeof(scroll_x_) + sizeof(scroll_y_) +
+                    sizeof(current_y_) + sizeof(y_compare_) + sizeof(dma_src_) + sizeof(bg_palette_) +
+                    sizeof(obj_palette0_) + sizeof(obj_palette1_) + sizeof(window_x_) + sizeof(window_y_));
+    }
+
+    template <EmulatorConfig CONFIG>
+    void PPU<CONFIG>::reset() {
         memset(vram_.data(), 0, vram_.size());
         current_y_ = 0;
         y_compare_ = 0;
@@ -325,5 +463,19 @@ namespace gb {
         cycles_to_finish_ = 1;
         bg_palette_ = 0xfc;
         lcd_control_ = 0x91;
+
+        objects_on_current_line_.clear();
+        objects_to_draw_ = std::span<ObjectAttributes>{};
+        current_x_ = 0;
+        dma_running_ = false;
+        frame_finished_ = false;
+        current_dma_address_ = 0;
+        status_ = 0;
+        dma_src_ = 0;
+        obj_palette0_ = 0;
+        obj_palette1_ = 0;
     }
+
+    template class PPU<g_full_config>;
+    template class PPU<g_headless_config>;
 } // namespace gb
@@ -1,9 +1,11 @@
 #ifndef GB_EMULATOR_SRC_GB_PPU_PPU_HDR_
 #define GB_EMULATOR_SRC_GB_PPU_PPU_HDR_
 
+#include "gb/config.h"
 #include "gb/interrupt_register.h"
 #include "gb/memory/basic_components.h"
 #include "gb/memory/memory_map.h"
+#include "gb/save_state.h"
 #include "util/util.h"
 #include <array>
 #include <cstddef>
@@ -98,6 +100,7 @@ namespace gb {
 
     struct PixelFIFO {};
 
+    template <EmulatorConfig CONFIG>
     class PPU {
       public:
         PPU(InterruptRegister &interrupt_flags, VRAM vram, OAM oam)
@@ -106,21 +109,37 @@ namespace gb {
             reset();
         }
 
-        uint8_t readIO(uint16_t address) const;
-        void writeIO(uint16_t address, uint8_t data);
+        // Addresses must be in the corresponding memory region, the bus never passes anything else
+        uint8_t readIO(uint16_t address) const noexcept;
+        void writeIO(uint16_t address, uint8_t data) noexcept;
 
-        uint8_t readVRAM(uint16_t address) const;
-        void writeVRAM(uint16_t address, uint8_t data);
+        uint8_t readVRAM(uint16_t address) const noexcept;
+        void writeVRAM(uint16_t address, uint8_t data) noexcept;
 
-        uint8_t readOAM(uint16_t address) const;
-        void writeOAM(uint16_t address, uint8_t data);
+        uint8_t readOAM(uint16_t address) const noexcept;
+        void writeOAM(uint16_t address, uint8_t data) noexcept;
 
         void update();
 
-        void setRenderer(IRenderer &renderer) { renderer_ = &renderer; }
+        // Number of update() calls that can be made before the PPU changes anything visible to the CPU
+        // (LY, STAT, interrupt flags) or finishes a frame, UINT64_MAX if the LCD is off
+        uint64_t cyclesUntilEvent() const;
+        // Same as calling update() cycles times, cycles must not exceed cyclesUntilEvent()
+        void skip(uint64_t cycles);
+
+        void setRenderer(IRenderer &renderer)
+            requires(CONFIG.renderer)
+        {
+            renderer_ = &renderer;
+        }
         void removeRenderer() { renderer_ = nullptr; }
         void renderPixelRow();
 
+        // Suppresses all rendering work (frames are still emulated), used for frame skipping.
+        // Should only be changed between frames
+        void skipRendering(bool skip) { rendering_skipped_ = skip; }
+        bool isRendering() const { return CONFIG.renderer && renderer_ && !rendering_skipped_; }
+
         PPUMode getMode() const { return mode_; }
 
         bool frameFinished() const { return frame_finished_; }
@@ -128,21 +147,26 @@ namespace gb {
 
         void reset();
 
+        // VRAM and OAM are not included, they are saved by the owner of the memory
+        void saveState(StateWriter &writer) const;
+        void loadState(StateReader &reader);
+        void checkState(StateReader &reader) const;
+
       private:
         std::array<GBColor, 8> getTileRow(uint16_t tilemap_base, uint8_t x, uint8_t y);
         GBColor getBGColor(GBColor color_idx);
         GBColor getSpriteColor(GBColor color_idx, bool use_obp1);
+        void scanOAM();
 
-        std::vector<ObjectAttributes> objects_on_current_line_;
-        std::span<ObjectAttributes> objects_to_draw_;
-        size_t cycles_to_finish_ = g_vblank_duration;
+        // State update() uses every cycle comes first, the objects of the current line and the renderer are only used
+        // while drawing, they are at the end
         InterruptRegister &interrupt_flags_;
-        IRenderer *renderer_ = nullptr;
-        uint8_t current_x_ = 0;
-
+        size_t cycles_to_finish_ = g_vblank_duration;
         PPUMode mode_ = PPUMode::VBLANK;
         bool dma_running_ = false;
         bool frame_finished_ = false;
+        bool rendering_skipped_ = false;
+        uint8_t current_x_ = 0;
         uint16_t current_dma_address_ = 0;
 
         // memory-mapped registers
@@ -163,8 +187,14 @@ namespace gb {
 
         VRAM vram_;
         OAM oam_;
+        std::vector<ObjectAttributes> objects_on_current_line_;
+        std::span<ObjectAttributes> objects_to_draw_;
+        IRenderer *renderer_ = nullptr;
     };
 
+    extern template class PPU<g_full_config>;
+    extern template class PPU<g_headless_config>;
+
     constexpr inline std::array<GBColor, 8> decodeTileRow(uint8_t low, uint8_t high) {
         std::array<GBColor, 8> result{};
         // bit 7 is the leftmost pixel of the line
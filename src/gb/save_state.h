@@ -0,0 +1,86 @@
+#ifndef GB_EMULATOR_SRC_GB_SAVE_STATE_HDR_
+#define GB_EMULATOR_SRC_GB_SAVE_STATE_HDR_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace gb {
+
+    constexpr uint32_t g_save_state_magic = 0x54534247; // "GBST"
+    constexpr uint32_t g_save_state_version = 6;
+
+    // FNV-1a, identifies the ROM a save state or a movie was made with
+    inline uint64_t hashBytes(std::span<const uint8_t> data) {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (uint8_t byte : data) {
+            hash ^= byte;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    // Appends raw emulator state to a buffer. The buffer is cleared first, but its capacity is kept,
+    // so repeatedly saving into the same buffer doesn't allocate
+    class StateWriter {
+      public:
+        StateWriter(std::vector<uint8_t> &buffer) : buffer_(buffer) { buffer_.clear(); }
+
+        template <typename T>
+        void write(const T &value) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be saved");
+            writeBytes(std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&value), sizeof(T)));
+        }
+
+        void writeBytes(std::span<const uint8_t> data) { buffer_.insert(buffer_.end(), data.begin(), data.end()); }
+
+      private:
+        std::vector<uint8_t> &buffer_;
+    };
+
+    // Reads state written by StateWriter, fields must be read in the same order they were written
+    class StateReader {
+      public:
+        StateReader(std::span<const uint8_t> data) : data_(data) {}
+
+        template <typename T>
+        void read(T &value) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be loaded");
+            readBytes(std::span<uint8_t>(reinterpret_cast<uint8_t *>(&value), sizeof(T)));
+        }
+
+        template <typename T>
+        T read() {
+            T value{};
+            read(value);
+            return value;
+        }
+
+        void readBytes(std::span<uint8_t> data) {
+            if (data.size() > data_.size() - offset_) {
+                throw std::invalid_argument("save state is truncated");
+            }
+            std::memcpy(data.data(), data_.data() + offset_, data.size());
+            offset_ += data.size();
+        }
+
+        void skip(size_t size) {
+            if (size > data_.size() - offset_) {
+                throw std::invalid_argument("save state is truncated");
+            }
+            offset_ += size;
+        }
+
+        bool finished() const { return offset_ == data_.size(); }
+
+      private:
+        std::span<const uint8_t> data_;
+        size_t offset_ = 0;
+    };
+} // namespace gb
+
+#endif
@@ -3,8 +3,6 @@
 
 #include <cstdint>
 #include <limits>
-#include <stdexcept>
-#include <string>
 
 namespace gb {
     void Timer::update() {
@@ -20,20 +18,49 @@ namespace gb {
         frequency_bit_was_set_ = current_freq_bit && TAC_.enable;
     }
 
-    uint8_t Timer::read(uint16_t address) const {
+    uint64_t Timer::cyclesUntilInterrupt() const {
+        uint64_t bit = g_frequency_bit_mask[TAC_.freqency];
+        if (frequency_bit_was_set_ != (TAC_.enable && (counter_ & bit) != 0)) {
+            // TAC or DIV was written since the last update, the next update may be a falling edge even if the
+            // timer was just disabled
+            return 0;
+        }
+        if (!TAC_.enable) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        // TIMA is incremented when the counter reaches a multiple of 2 * bit
+        uint64_t period = 2 * bit;
+        uint64_t first_increment = period - counter_ % period;
+        return first_increment + (0xff - TIMA_) * period - 1;
+    }
+
+    void Timer::skip(uint64_t cycles) {
+        if (cycles != 0 &&
+            frequency_bit_was_set_ != (TAC_.enable && (counter_ & g_frequency_bit_mask[TAC_.freqency]) != 0)) {
+            // the edge left by a write to TAC or DIV is only seen by the next update
+            update();
+            --cycles;
+        }
+        if (TAC_.enable) {
+            uint64_t bit = g_frequency_bit_mask[TAC_.freqency];
+            TIMA_ += uint8_t((counter_ % (2 * bit) + cycles) / (2 * bit));
+        }
+        // the period of the counter is 2^16, which is a multiple of any TIMA period
+        counter_ = uint16_t(counter_ + cycles);
+        frequency_bit_was_set_ = TAC_.enable && (counter_ & g_frequency_bit_mask[TAC_.freqency]) != 0;
+    }
+
+    uint8_t Timer::read(uint16_t address) const noexcept {
         switch (IO(address)) {
         case IO::DIV: return uint8_t((counter_ & 0xff00) >> 8);
         case IO::TIMA: return TIMA_;
         case IO::TMA: return TMA_;
         case IO::TAC: return 0xf8 | (uint8_t(TAC_.enable) << 2) | TAC_.freqency;
-        default:
-            throw std::invalid_argument("Attempting to read data from timer at invalid adress: " +
-                                        std::to_string(address));
-            return 0x00;
+        default: return 0xff;
         }
     }
 
-    void Timer::write(uint16_t address, uint8_t data) {
+    void Timer::write(uint16_t address, uint8_t data) noexcept {
         switch (IO(address)) {
         case IO::DIV: counter_ = 0; break;
         case IO::TIMA: TIMA_ = data; break;
@@ -42,12 +69,30 @@ namespace gb {
             TAC_.enable = (data & 0b00000100) != 0;
             TAC_.freqency = data & 0b00000011;
             break;
-        default:
-            throw std::invalid_argument("Attempting to write data to timer at invalid adress: " +
-                                        std::to_string(address) + ", data: " + std::to_string(+data));
+        default: break;
         }
     }
 
+    void Timer::saveState(StateWriter &writer) const {
+        writer.write(counter_);
+        writer.write(TIMA_);
+        writer.write(TMA_);
+        writer.write(TAC_);
+        writer.write(frequency_bit_was_set_);
+    }
+
+    void Timer::loadState(StateReader &reader) {
+        reader.read(counter_);
+        reader.read(TIMA_);
+        reader.read(TMA_);
+        reader.read(TAC_);
+        reader.read(frequency_bit_was_set_);
+    }
+
+    void Timer::checkState(StateReader &reader) const {
+        reader.skip(sizeof(counter_) + sizeof(TIMA_) + sizeof(TMA_) + sizeof(TAC_) + sizeof(frequency_bit_was_set_));
+    }
+
     void Timer::reset() {
         counter_ = 0xABCC;
         TIMA_ = 0;
@@ -2,6 +2,7 @@
 #define GB_EMULATOR_SRC_GB_TIMER_HDR_
 
 #include "gb/interrupt_register.h"
+#include "gb/save_state.h"
 
 #include <array>
 #include <cstdint>
@@ -18,11 +19,23 @@ namespace gb {
         Timer(InterruptRegister &interrupt_flags) : interrupt_flags_(interrupt_flags) { reset(); }
 
         void update();
-        uint8_t read(uint16_t address) const;
-        void write(uint16_t address, uint8_t data);
+
+        // Number of update() calls that can be made before TIMA overflows, UINT64_MAX if the timer is disabled. 0 if
+        // a write to TAC or DIV left a falling edge for the next update
+        uint64_t cyclesUntilInterrupt() const;
+        // Same as calling update() cycles times. Only the first of them may overflow TIMA, so cycles must not exceed
+        // cyclesUntilInterrupt() unless it is 0
+        void skip(uint64_t cycles);
+        // address must be in g_memory_timer
+        uint8_t read(uint16_t address) const noexcept;
+        void write(uint16_t address, uint8_t data) noexcept;
 
         void reset();
 
+        void saveState(StateWriter &writer) const;
+        void loadState(StateReader &reader);
+        void checkState(StateReader &reader) const;
+
       private:
         uint16_t counter_ = 0xABCC;
 
@@ -0,0 +1,230 @@
+#include "rewind.h"
+#include "gb/emulator.h"
+#include "util/util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace emulator {
+
+    // Delta format: pairs of (count of unchanged bytes, count of changed bytes) followed by changed bytes XORed
+    // with their previous values. Both counts are varints
+    static void encodeDelta(std::span<const uint8_t> previous, std::span<const uint8_t> current,
+                            std::vector<uint8_t> &out);
+    // Applying a delta is symmetric: it turns the previous state into the current one and vice versa
+    static void applyDelta(std::span<const uint8_t> delta, std::span<uint8_t> state);
+
+    RewindBuffer::RewindBuffer(size_t memory_budget, uint32_t capture_interval)
+        : arena_(memory_budget), capture_interval_(std::max(capture_interval, uint32_t(1))) {
+        pending_.reserve(capture_interval_);
+    }
+
+    void RewindBuffer::setMemoryBudget(size_t bytes) {
+        clear();
+        arena_.resize(bytes);
+        arena_.shrink_to_fit();
+    }
+
+    void RewindBuffer::setCaptureInterval(uint32_t frames) {
+        clear();
+        capture_interval_ = std::max(frames, uint32_t(1));
+        pending_.reserve(capture_interval_);
+    }
+
+    void RewindBuffer::clear() {
+        snapshots_.clear();
+        head_ = 0;
+        used_bytes_ = 0;
+        latest_.clear();
+        pending_.clear();
+    }
+
+    void RewindBuffer::onFrame(gb::Emulator &emulator) {
+        if (latest_.empty()) {
+            capture(emulator);
+            return;
+        }
+
+        pending_.push_back(FrameRecord{.end_cycle = emulator.getCycleCount(), .input = emulator.getInput().getState()});
+        if (pending_.size() >= capture_interval_) {
+            capture(emulator);
+        }
+    }
+
+    void RewindBuffer::capture(gb::Emulator &emulator) {
+        auto start = std::chrono::steady_clock::now();
+
+        emulator.saveState(current_);
+        if (current_.size() != latest_.size()) {
+            // first snapshot or the cartridge was changed, there is nothing to compute the delta against
+            clear();
+            delta_.clear();
+        } else {
+            encodeDelta(latest_, current_, delta_);
+        }
+
+        Snapshot snapshot{
+            .frame_count = pending_.size(), .delta_size = delta_.size(), .cycles = emulator.getCycleCount()};
+        if (snapshot.size() > arena_.size()) {
+            // frames before this snapshot can't be restored anyway, but it can still be rewound to
+            snapshots_.clear();
+            head_ = 0;
+            used_bytes_ = 0;
+            snapshot.frame_count = 0;
+            snapshot.delta_size = 0;
+        }
+        store(snapshot.size());
+        snapshot.offset = head_ - snapshot.size();
+
+        uint8_t *data = arena_.data() + snapshot.offset;
+        std::memcpy(data, pending_.data(), snapshot.frame_count * sizeof(FrameRecord));
+        std::memcpy(data + snapshot.frame_count * sizeof(FrameRecord), delta_.data(), snapshot.delta_size);
+        snapshots_.push_back(snapshot);
+
+        latest_.swap(current_);
+        pending_.clear();
+
+        ++captures_;
+        captured_bytes_ += snapshot.size();
+        capture_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                           .count();
+    }
+
+    void RewindBuffer::store(size_t size) {
+        bool wrap = head_ + size > arena_.size();
+        size_t start = wrap ? 0 : head_;
+        while (!snapshots_.empty()) {
+            // empty snapshots take no space, they are evicted together with the next snapshot
+            auto oldest = std::find_if(snapshots_.begin(), snapshots_.end(),
+                                       [](const Snapshot &snapshot) { return snapshot.size() != 0; });
+            if (oldest == snapshots_.end()) {
+                break;
+            }
+            // when wrapping around, snapshots after head_ are older than ones before it, so they are evicted too
+            bool evict = (wrap && oldest->offset >= head_) ||
+                         (oldest->offset < start + size && start < oldest->offset + oldest->size());
+            if (!evict) {
+                break;
+            }
+            used_bytes_ -= oldest->size();
+            snapshots_.erase(snapshots_.begin(), oldest + 1);
+        }
+
+        head_ = start + size;
+        used_bytes_ += size;
+    }
+
+    void RewindBuffer::dropNewest() {
+        Snapshot snapshot = snapshots_.back();
+        const uint8_t *data = arena_.data() + snapshot.offset;
+        size_t frames_size = snapshot.frame_count * sizeof(FrameRecord);
+
+        pending_.resize(snapshot.frame_count);
+        std::memcpy(pending_.data(), data, frames_size);
+        applyDelta(std::span<const uint8_t>(data + frames_size, snapshot.delta_size), latest_);
+
+        snapshots_.pop_back();
+        head_ = snapshot.offset;
+        used_bytes_ -= snapshot.size();
+    }
+
+    bool RewindBuffer::rewind(gb::Emulator &emulator, uint32_t frames) {
+        if (snapshots_.empty() || frames == 0) {
+            return false;
+        }
+
+        size_t to_rewind = frames;
+        while (to_rewind >= pending_.size()) {
+            if (snapshots_.size() == 1) {
+                // the oldest snapshot, its delta can't be applied since the previous snapshot is gone
+                bool moved = !pending_.empty();
+                restore(emulator, 0);
+                return moved;
+            }
+            // if the target is exactly the newest snapshot, it is still re-simulated from the one before it,
+            // so the target frame gets rendered
+            to_rewind -= pending_.size();
+            dropNewest();
+        }
+
+        restore(emulator, pending_.size() - to_rewind);
+        return true;
+    }
+
+    void RewindBuffer::restore(gb::Emulator &emulator, size_t frames_to_replay) {
+        emulator.loadState(latest_);
+        emulator.start();
+
+        auto &ppu = emulator.getPPU();
+        for (size_t i = 0; i < frames_to_replay; ++i) {
+            // only the target frame needs to be displayed
+            ppu.skipRendering(i + 1 < frames_to_replay);
+            emulator.getInput().setState(pending_[i].input);
+            // replayed frames run through breakpoints
+            while (emulator.runUntil(pending_[i].end_cycle) == gb::StopReason::BREAKPOINT) {
+            }
+        }
+        ppu.skipRendering(false);
+        ppu.resetFrameFinistedFlag();
+        pending_.resize(frames_to_replay);
+    }
+
+    RewindStats RewindBuffer::getStats(gb::Emulator &emulator) const {
+        RewindStats stats{.snapshots = snapshots_.size(), .used_bytes = used_bytes_, .budget_bytes = arena_.size()};
+        if (!snapshots_.empty() && emulator.getCycleCount() >= snapshots_.front().cycles) {
+            stats.buffered_seconds =
+                double(emulator.getCycleCount() - snapshots_.front().cycles) / double(gb::g_cpu_frequency);
+        }
+        if (captures_ != 0) {
+            stats.capture_us = double(capture_ns_) / double(captures_) / 1000.0;
+            stats.average_snapshot_bytes = double(captured_bytes_) / double(captures_);
+        }
+        return stats;
+    }
+
+    static void encodeDelta(std::span<const uint8_t> previous, std::span<const uint8_t> current,
+                            std::vector<uint8_t> &out) {
+        out.clear();
+        size_t size = current.size();
+        size_t i = 0;
+        while (i < size) {
+            size_t unchanged_start = i;
+            // most of the state doesn't change between snapshots, so unchanged bytes are skipped 8 at a time
+            while (i + sizeof(uint64_t) <= size &&
+                   std::memcmp(previous.data() + i, current.data() + i, sizeof(uint64_t)) == 0) {
+                i += sizeof(uint64_t);
+            }
+            while (i < size && previous[i] == current[i]) {
+                ++i;
+            }
+            size_t changed_start = i;
+            while (i < size && previous[i] != current[i]) {
+                ++i;
+            }
+
+            putVarint(out, changed_start - unchanged_start);
+            putVarint(out, i - changed_start);
+            for (size_t j = changed_start; j < i; ++j) {
+                out.push_back(previous[j] ^ current[j]);
+            }
+        }
+    }
+
+    static void applyDelta(std::span<const uint8_t> delta, std::span<uint8_t> state) {
+        size_t offset = 0;
+        size_t position = 0;
+        while (offset < delta.size()) {
+            // deltas are produced by encodeDelta, so they are always well-formed
+            position += getVarint(delta.data(), delta.size(), offset).value_or(0);
+            size_t changed = getVarint(delta.data(), delta.size(), offset).value_or(0);
+            for (size_t i = 0; i < changed; ++i) {
+                state[position++] ^= delta[offset++];
+            }
+        }
+    }
+} // namespace emulator
@@ -0,0 +1,100 @@
+#ifndef GB_EMULATOR_SRC_REWIND_HDR_
+#define GB_EMULATOR_SRC_REWIND_HDR_
+
+#include "gb/emulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace emulator {
+
+    constexpr size_t g_default_rewind_budget = 32 * 1024 * 1024;
+    constexpr uint32_t g_default_rewind_interval = 4;
+
+    struct RewindStats {
+        size_t snapshots = 0;
+        size_t used_bytes = 0;
+        size_t budget_bytes = 0;
+        // emulated time which can be rewound, in seconds
+        double buffered_seconds = 0;
+        // average host time spent on capturing a snapshot, in microseconds
+        double capture_us = 0;
+        double average_snapshot_bytes = 0;
+    };
+
+    // Records emulator state for rewinding.
+    //
+    // Every capture interval (counted in onFrame() calls) full emulator state is saved and stored as an XOR delta
+    // against the previous snapshot with runs of unchanged bytes run-length encoded. Only the newest snapshot is
+    // kept uncompressed, older ones are recovered by applying deltas backwards. Deltas are stored in a circular
+    // arena of fixed size, the oldest snapshots are evicted once it is full.
+    //
+    // Each snapshot also stores the cycle counter and joypad state at the end of every frame since the previous
+    // snapshot, so frames in between snapshots are restored by loading the preceding snapshot and re-simulating.
+    class RewindBuffer {
+      public:
+        RewindBuffer(size_t memory_budget = g_default_rewind_budget,
+                     uint32_t capture_interval = g_default_rewind_interval);
+
+        // both clear the buffer
+        void setMemoryBudget(size_t bytes);
+        void setCaptureInterval(uint32_t frames);
+
+        size_t getMemoryBudget() const { return arena_.size(); }
+        uint32_t getCaptureInterval() const { return capture_interval_; }
+
+        void clear();
+
+        // Must be called after every emulated frame. Any other advancement of emulation (e.g. stepping in the
+        // debugger) also counts as a frame, joypad state must not change in between the calls
+        void onFrame(gb::Emulator &emulator);
+
+        // Moves emulation back by at most frames frames, returns false if there is nothing left to rewind
+        bool rewind(gb::Emulator &emulator, uint32_t frames);
+
+        RewindStats getStats(gb::Emulator &emulator) const;
+
+      private:
+        struct FrameRecord {
+            uint64_t end_cycle = 0;
+            uint8_t input = 0;
+        };
+
+        struct Snapshot {
+            size_t offset = 0;
+            size_t frame_count = 0;
+            size_t delta_size = 0;
+            uint64_t cycles = 0;
+
+            size_t size() const { return frame_count * sizeof(FrameRecord) + delta_size; }
+        };
+
+        void capture(gb::Emulator &emulator);
+        void store(size_t size);
+        void dropNewest();
+        void restore(gb::Emulator &emulator, size_t frames_to_replay);
+
+        std::vector<uint8_t> arena_;
+        std::deque<Snapshot> snapshots_;
+        size_t head_ = 0;
+        size_t used_bytes_ = 0;
+        uint32_t capture_interval_ = g_default_rewind_interval;
+
+        // newest snapshot
+        std::vector<uint8_t> latest_;
+        // frames after the newest snapshot
+        std::vector<FrameRecord> pending_;
+
+        // buffers are reused between captures
+        std::vector<uint8_t> current_;
+        std::vector<uint8_t> delta_;
+
+        uint64_t captures_ = 0;
+        uint64_t capture_ns_ = 0;
+        uint64_t captured_bytes_ = 0;
+    };
+} // namespace emulator
+
+#endif
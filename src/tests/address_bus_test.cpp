@@ -0,0 +1,89 @@
+#include "gb/address_bus.h"
+#include "gb/emulator.h"
+#include "gb/memory/basic_components.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// MBC1 with 8 ROM banks and 8 KiB of RAM, every byte of a bank holds its number
+static std::vector<uint8_t> makeBankedROM() {
+    std::vector<uint8_t> rom(8 * 16 * 1024);
+    for (size_t i = 0; i < rom.size(); ++i) {
+        rom[i] = uint8_t(i / (16 * 1024));
+    }
+    rom[gb::g_mapper_type_address] = 3;
+    rom[gb::g_rom_size_address] = 2;
+    rom[gb::g_cartridge_ram_size_address] = 2;
+    return rom;
+}
+
+// Every mapped page must read what the bus decodes for its addresses
+static void requirePagesMatchPeek(gb::Emulator &emulator) {
+    const gb::MemoryPages &pages = emulator.getBus().getPages();
+    for (uint32_t address = 0; address <= 0xffff; ++address) {
+        if (const uint8_t *page = pages.read[address / gb::g_memory_page_size]) {
+            REQUIRE(page[address % gb::g_memory_page_size] == emulator.getBus().peek(uint16_t(address)));
+        }
+    }
+}
+
+TEST_CASE("page table follows the cartridge mapping") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeBankedROM()));
+    emulator.reset();
+    gb::AddressBus<gb::g_full_config> &bus = emulator.getBus();
+    const gb::MemoryPages &pages = bus.getPages();
+    requirePagesMatchPeek(emulator);
+
+    // ROM bank switches
+    REQUIRE(bus.read(0x4000) == 1);
+    bus.write(0x2000, 5);
+    REQUIRE(bus.read(0x4000) == 5);
+    REQUIRE(bus.read(0x7fff) == 5);
+    REQUIRE(bus.read(0x3fff) == 0);
+    requirePagesMatchPeek(emulator);
+
+    // cartridge RAM is only mapped while it's enabled
+    REQUIRE(pages.read[0xa0] == nullptr);
+    REQUIRE(bus.read(0xa010) == 0xff);
+    bus.write(0x0000, 0x0a);
+    REQUIRE(pages.write[0xa0] != nullptr);
+    bus.write(0xa010, 0x55);
+    REQUIRE(bus.read(0xa010) == 0x55);
+    requirePagesMatchPeek(emulator);
+    bus.write(0x0000, 0);
+    REQUIRE(pages.write[0xa0] == nullptr);
+    bus.write(0xa010, 0x66);
+    REQUIRE(bus.read(0xa010) == 0xff);
+    bus.write(0x0000, 0x0a);
+    REQUIRE(bus.read(0xa010) == 0x55);
+
+    // WRAM is read through its mirror, but the mirror is written through the bus's decoding
+    bus.write(0xc123, 0x12);
+    REQUIRE(bus.read(0xe123) == 0x12);
+    REQUIRE(pages.write[0xe1] == nullptr);
+    bus.write(0xe124, 0x34);
+    REQUIRE(bus.read(0xc124) == 0x34);
+
+    // a loaded state and a reset move the mapping back
+    std::vector<uint8_t> saved;
+    emulator.saveState(saved);
+    bus.write(0x2000, 7);
+    REQUIRE(bus.read(0x4000) == 7);
+    emulator.loadState(saved);
+    REQUIRE(bus.read(0x4000) == 5);
+    requirePagesMatchPeek(emulator);
+    emulator.reset();
+    REQUIRE(bus.read(0x4000) == 1);
+    REQUIRE(pages.read[0xa0] == nullptr);
+
+    // so does a new ROM, the old one is gone
+    std::vector<uint8_t> rom = makeBankedROM();
+    rom[0x4000] = 0x99;
+    REQUIRE(emulator.getCartridge().setROM(rom));
+    REQUIRE(bus.read(0x4000) == 0x99);
+    requirePagesMatchPeek(emulator);
+}
@@ -0,0 +1,194 @@
+#include "batch_runner.h"
+#include "gb/emulator.h"
+#include "gb/movie.h"
+#include "gb/save_state.h"
+#include "test_rom.h"
+#include "util/util.h"
+#include "work_stealing_pool.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ios>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("work stealing pool runs every task once") {
+    emulator::WorkStealingPool pool(4);
+    std::vector<std::atomic<int>> runs(100);
+    pool.run(runs.size(), [&](size_t worker, size_t index) {
+        // worker 0 is slow, so its tasks are stolen by the others
+        if (worker == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        ++runs[index];
+    });
+    for (const std::atomic<int> &count : runs) {
+        REQUIRE(count == 1);
+    }
+    REQUIRE(pool.getStolenCount() > 0);
+}
+
+TEST_CASE("batch runner reproduces sequential runs") {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "gb_batch_runner_test";
+    std::filesystem::create_directories(directory);
+    REQUIRE(writeFile(directory / "test.gb", makeTestROM()));
+
+    // the expected result of every job is computed with a single emulator
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    std::vector<uint64_t> expected;
+    std::vector<uint8_t> state;
+    std::stringstream job_list;
+    job_list << "# rom\tinput\tstate\thash\n";
+    for (size_t i = 0; i < 12; ++i) {
+        std::string movie_name = "movie" + std::to_string(i) + ".gbm";
+        gb::MovieRecorder recorder(emulator, gb::MovieStart::RESET);
+        for (size_t frame = 0; frame < 20 + i; ++frame) {
+            recorder.addFrame(uint8_t(frame * i));
+            emulator.getInput().setState(uint8_t(frame * i));
+            emulator.runFrame();
+        }
+        REQUIRE(writeFile(directory / movie_name, recorder.finish()));
+        emulator.saveState(state);
+        expected.push_back(gb::hashBytes(state));
+        job_list << "test.gb\t" << movie_name << '\n';
+    }
+    job_list << "test.gb\tframes:30\tframes.state\n";
+    emulator.reset();
+    emulator.start();
+    for (size_t frame = 0; frame < 30; ++frame) {
+        emulator.runFrame();
+    }
+    emulator.saveState(state);
+    expected.push_back(gb::hashBytes(state));
+    // a wrong expected hash fails the job, a missing ROM or movie is an error. A number without the prefix is a movie
+    job_list << "test.gb\tframes:30\t\t1234\n";
+    job_list << "missing.gb\tframes:30\n";
+    job_list << "test.gb\t30\n";
+
+    std::vector<emulator::BatchJob> jobs = emulator::parseJobList(job_list, directory);
+    REQUIRE(jobs.size() == 16);
+    REQUIRE(jobs[15].movie == directory / "30");
+    std::vector<emulator::BatchResult> results;
+    emulator::BatchSummary summary = emulator::runBatch(jobs, results, 4);
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(results[i].status == emulator::BatchStatus::PASSED);
+        REQUIRE(results[i].state_hash == expected[i]);
+    }
+    REQUIRE(gb::hashBytes(readFile(directory / "frames.state")) == expected.back());
+    REQUIRE(results[13].status == emulator::BatchStatus::FAILED);
+    REQUIRE(results[14].status == emulator::BatchStatus::ERROR);
+    REQUIRE(results[15].status == emulator::BatchStatus::ERROR);
+    REQUIRE(summary.passed == 13);
+    REQUIRE(summary.failed == 1);
+    REQUIRE(summary.errors == 2);
+
+    std::stringstream malformed("test.gb\n");
+    REQUIRE_THROWS(emulator::parseJobList(malformed, directory));
+    std::stringstream invalid_frames("test.gb\tframes:30x\n");
+    REQUIRE_THROWS(emulator::parseJobList(invalid_frames, directory));
+    std::filesystem::remove_all(directory);
+}
+
+template <typename T>
+concept Observable = requires(T &emulator, gb::IMemoryObserver &observer) { emulator.getBus().addObserver(observer); };
+template <typename T>
+concept Traceable = requires(T &emulator) { emulator.getCPU().setTraceEnabled(true); };
+
+TEST_CASE("headless emulator matches the full one") {
+    static_assert(Observable<gb::Emulator> && Traceable<gb::Emulator>);
+    static_assert(!Observable<gb::HeadlessEmulator> && !Traceable<gb::HeadlessEmulator>);
+
+    gb::Emulator full;
+    gb::HeadlessEmulator headless;
+    REQUIRE(full.getCartridge().setROM(makeTestROM()));
+    REQUIRE(headless.getCartridge().setROM(makeTestROM()));
+    full.getCPU().setTraceEnabled(true);
+    full.reset();
+    headless.reset();
+    full.start();
+    headless.start();
+    std::vector<uint8_t> full_state;
+    std::vector<uint8_t> headless_state;
+    for (uint8_t frame = 0; frame < 20; ++frame) {
+        full.getInput().setState(frame);
+        headless.getInput().setState(frame);
+        full.runFrame();
+        headless.runFrame();
+        full.saveState(full_state);
+        headless.saveState(headless_state);
+        REQUIRE(full_state == headless_state);
+    }
+    REQUIRE(!headless.getCPU().isTraceEnabled());
+
+    // states are interchangeable
+    headless.loadState(full_state);
+    full.loadState(headless_state);
+}
+
+TEST_CASE("faults stop emulation without unwinding") {
+    std::vector<uint8_t> rom = makeTestROM();
+    rom[0x100] = 0x00; // NOP
+    rom[0x101] = 0xd3; // illegal opcode
+    gb::HeadlessEmulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(rom));
+    emulator.reset();
+    emulator.start();
+    REQUIRE(emulator.runUntil(gb::g_cycles_per_frame) == gb::StopReason::FAULT);
+    REQUIRE(emulator.terminated());
+    REQUIRE(emulator.getFault().fault == gb::Fault::ILLEGAL_INSTRUCTION);
+    REQUIRE(emulator.getFault().address == 0x101);
+    // the first fault is kept until reset
+    emulator.start();
+    REQUIRE(emulator.terminated());
+    emulator.reset();
+    REQUIRE(!emulator.getFault().isSet());
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "gb_batch_fault_test";
+    std::filesystem::create_directories(directory);
+    REQUIRE(writeFile(directory / "fault.gb", rom));
+    REQUIRE(writeFile(directory / "test.gb", makeTestROM()));
+    std::stringstream job_list("fault.gb\tframes:10\ntest.gb\tframes:10\n");
+    std::vector<emulator::BatchResult> results;
+    // one thread, so the faulted emulator is reused by the next job
+    emulator::BatchSummary summary = emulator::runBatch(emulator::parseJobList(job_list, directory), results, 1);
+    REQUIRE(results[0].status == emulator::BatchStatus::FAULT);
+    REQUIRE(results[0].fault.fault == gb::Fault::ILLEGAL_INSTRUCTION);
+    REQUIRE(results[0].fault.address == 0x101);
+    REQUIRE(results[0].frames == 2);
+    REQUIRE(results[1].status == emulator::BatchStatus::PASSED);
+    REQUIRE(summary.faults == 1);
+    REQUIRE(summary.passed == 1);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("batch report quotes fields") {
+    std::vector<emulator::BatchJob> jobs(2);
+    jobs[0].rom = "roms/a,b.gb";
+    jobs[0].movie = "say \"hi\".gbm";
+    jobs[1].rom = "test.gb";
+    jobs[1].frames = 10;
+    std::vector<emulator::BatchResult> results(2);
+    results[0].error = "line 1\nline 2";
+    results[1].status = emulator::BatchStatus::PASSED;
+    results[1].state_hash = 0xab;
+
+    std::stringstream report;
+    std::ios_base::fmtflags flags = report.flags();
+    emulator::writeReport(report, jobs, results, emulator::BatchSummary{});
+    std::string text = report.str();
+    REQUIRE(text.find("0,\"roms/a,b.gb\",\"say \"\"hi\"\".gbm\",error,") != std::string::npos);
+    REQUIRE(text.find(",\"line 1\nline 2\"\n") != std::string::npos);
+    REQUIRE(text.find("1,test.gb,10 frames,passed,0,0,00000000000000ab,") != std::string::npos);
+    // the stream's formatting is left as it was
+    REQUIRE(report.flags() == flags);
+    REQUIRE(report.fill() == ' ');
+}
@@ -0,0 +1,120 @@
+#include "gb/cpu/code_walker.h"
+#include "gb/emulator.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Copies a routine into WRAM and calls it in a loop, flipping it between INC A and DEC A after every call
+std::vector<uint8_t> makeSelfModifyingROM() {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0x21, 0x00, 0xc0, // LD HL, 0xc000
+        0x36, 0x3c,       // LD (HL), 0x3c (INC A)
+        0x23,             // INC HL
+        0x36, 0xc9,       // LD (HL), 0xc9 (RET)
+        0xcd, 0x00, 0xc0, // loop: CALL 0xc000
+        0xea, 0x00, 0xc1, // LD (0xc100), A
+        0xfa, 0x00, 0xc0, // LD A, (0xc000)
+        0xee, 0x01,       // XOR 0x01
+        0xea, 0x00, 0xc0, // LD (0xc000), A
+        0xfa, 0x00, 0xc1, // LD A, (0xc100)
+        0x04,             // INC B
+        0xcb, 0x40,       // BIT 0, B
+        0x18, 0xea,       // JR loop
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    return rom;
+}
+
+TEST_CASE("block cache doesn't change emulation") {
+    gb::Emulator reference;
+    gb::Emulator cached;
+    for (gb::Emulator *emulator : {&reference, &cached}) {
+        REQUIRE(emulator->getCartridge().setROM(makeSelfModifyingROM()));
+        emulator->reset();
+        emulator->start();
+        // compiled ROM code isn't looked up in the cache
+        emulator->setJitEnabled(false);
+    }
+    reference.getCPU().getBlockCache().setEnabled(false);
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (int i = 0; i < 10; ++i) {
+        reference.runFrame();
+        cached.runFrame();
+        reference.saveState(expected);
+        cached.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+    // A starts at 1, without invalidation it would keep growing
+    REQUIRE(cached.getCPU().getRegisters().a() <= 2);
+
+    const gb::cpu::BlockCacheStats &stats = cached.getCPU().getBlockCache().getStats();
+    REQUIRE(stats.hits > stats.misses * 10);
+    REQUIRE(stats.invalidations > 0);
+    REQUIRE(reference.getCPU().getBlockCache().getStats().hits == 0);
+}
+
+TEST_CASE("block translation finds dead flags and constant operands") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0xaf,       // XOR A
+        0x3c,       // loop: INC A
+        0xfe, 0x05, // CP 0x05
+        0x20, 0xfb, // JR NZ, loop
+        0x76,       // HALT
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(rom));
+    emulator.reset();
+    emulator.start();
+    while (!emulator.getCPU().isHalted()) {
+        emulator.tick();
+    }
+    REQUIRE(emulator.getCPU().getRegisters().a() == 5);
+
+    // blocks at 0x100 and 0x101 (the loop) and 0x106 (HALT). Everything XOR A and INC A write is overwritten by CP
+    const gb::cpu::TranslationStats &stats = emulator.getCPU().getBlockCache().getStats().translation;
+    REQUIRE(stats.flag_writes == 4 + 3 + 4 + 3 + 4);
+    REQUIRE(stats.dead_flag_writes == 4 + 3 + 3);
+    REQUIRE(stats.constant_operands == 4);
+}
+
+TEST_CASE("precompiled blocks don't change emulation") {
+    std::vector<uint8_t> rom = makeSelfModifyingROM();
+    std::vector<gb::cpu::CodeBlock> code = gb::cpu::findReachableCode(rom);
+    // the loop after the WRAM routine is written and the RST and interrupt vectors
+    REQUIRE(code.size() > 2);
+    std::vector<gb::cpu::PrecompiledBlock> blocks = gb::cpu::getPrecompiledBlocks(code);
+
+    gb::Emulator reference;
+    gb::Emulator precompiled;
+    for (gb::Emulator *emulator : {&reference, &precompiled}) {
+        REQUIRE(emulator->getCartridge().setROM(rom));
+        emulator->reset();
+        emulator->start();
+    }
+    precompiled.getCPU().getBlockCache().setPrecompiled(blocks);
+    // reset() keeps precompiled blocks
+    precompiled.reset();
+    precompiled.start();
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (int i = 0; i < 5; ++i) {
+        reference.runFrame();
+        precompiled.runFrame();
+        reference.saveState(expected);
+        precompiled.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+    // only the routine in WRAM is decoded at run time
+    REQUIRE(precompiled.getCPU().getBlockCache().getStats().blocks_built <
+            reference.getCPU().getBlockCache().getStats().blocks_built);
+}
@@ -0,0 +1,149 @@
+#include "breakpoint.h"
+#include "gb/condition.h"
+#include "gb/emulator.h"
+#include "gb/pc_breakpoints.h"
+#include "test_rom.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the loop of makeTestROM() starts at 0x107, ADD A, B at 0x109 runs with B counting up
+constexpr uint16_t g_loop_add = 0x109;
+
+static bool evaluate(std::string_view expression, const gb::ConditionContext &context) {
+    return gb::BreakpointCondition::compile(expression).evaluate(context);
+}
+
+TEST_CASE("conditions evaluate expressions over emulator state") {
+    gb::ConditionContext context;
+    context.registers.a() = 0x3f;
+    context.registers.hl(0xc000);
+    context.registers.setFlag(gb::cpu::Flags::ZERO, true);
+    context.cycles = 1001 * gb::g_cycles_per_frame;
+    context.rom_bank = 3;
+    size_t reads = 0;
+    context.peek = [&reads](uint16_t address) -> std::optional<uint8_t> {
+        ++reads;
+        if (address == 0xc000) {
+            return 0x11;
+        }
+        return std::nullopt;
+    };
+
+    REQUIRE(evaluate("A == 0x3f && [HL] > 0x10 && frame > 1000", context));
+    REQUIRE(!evaluate("a == 0x3f && [hl] > 0x11", context));
+    REQUIRE(evaluate("zf && !cf && rom_bank == 3", context));
+    // bitwise operators bind tighter than comparisons, unmapped memory reads as 0xff
+    REQUIRE(evaluate("[hl] & 0x10 == 0x10 && [$d000] == 255", context));
+    REQUIRE(evaluate("hl + 1 - 2 == $bfff || 1 == 2", context));
+    REQUIRE(evaluate("cycles > 0x100000000 - 1 || cycles == 70294224", context));
+    REQUIRE(evaluate("~0 == 0xffffffffffffffff", context));
+
+    // the right side of && and || isn't evaluated if the left one decides
+    reads = 0;
+    REQUIRE(!evaluate("a == 0 && [hl] == 0x11", context));
+    REQUIRE(evaluate("a == 0x3f || [hl] == 0", context));
+    REQUIRE(reads == 0);
+
+    REQUIRE(gb::BreakpointCondition{}.evaluate(context));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile(""));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("a == "));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("[hl"));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("ix == 1"));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("0x1g"));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("a < b < c"));
+    REQUIRE_THROWS(gb::BreakpointCondition::compile("99999999999999999999"));
+    std::string nested = "1";
+    for (size_t i = 0; i < gb::BreakpointCondition::g_max_stack_depth; ++i) {
+        nested = "1 + (" + nested + ")";
+    }
+    REQUIRE_THROWS(gb::BreakpointCondition::compile(nested));
+}
+
+TEST_CASE("breakpoints only stop when their condition holds") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    gb::PCBreakpoints breakpoints;
+    breakpoints.add(gb::PCBreakpoint{
+        .address = g_loop_add, .bank = {}, .condition = gb::BreakpointCondition::compile("b == 0x10")});
+    emulator.setPCBreakpoints(breakpoints);
+    emulator.reset();
+    emulator.start();
+
+    REQUIRE(emulator.runUntil(gb::g_cycles_per_frame) == gb::StopReason::BREAKPOINT);
+    REQUIRE(emulator.getCPU().getRegisters().b() == 0x10);
+    // the loop runs 256 times before B is 0x10 again
+    uint64_t hit = emulator.getCycleCount();
+    REQUIRE(emulator.runUntil(hit + 2 * gb::g_cycles_per_frame) == gb::StopReason::BREAKPOINT);
+    REQUIRE(emulator.getCycleCount() - hit == 256 * 11 * gb::g_cycles_per_tick);
+
+    // the loop writes A to [HL], WRAM has no bank
+    using enum emulator::MemoryBreakpointData::BreakOn;
+    size_t writes = 0;
+    emulator::MemoryBreakpoints memory_breakpoints([&writes]() { ++writes; },
+                                                   [&emulator](uint16_t address, uint8_t value) {
+                                                       return emulator.getConditionContext(address, value);
+                                                   });
+    emulator.getBus().addObserver(memory_breakpoints);
+    emulator.removePCBreakpoints();
+    memory_breakpoints.addBreakpoint(emulator::MemoryBreakpointData{
+        .address = 0xc020,
+        .break_on = WRITE,
+        .value = {},
+        .condition = gb::BreakpointCondition::compile("value != a"),
+        .end_address = {}});
+    emulator.getBus().updateWatchedAddresses();
+    REQUIRE(emulator.runUntil(emulator.getCycleCount() + gb::g_cycles_per_frame) == gb::StopReason::FINISHED);
+    REQUIRE(writes == 0);
+
+    memory_breakpoints.addBreakpoint(emulator::MemoryBreakpointData{
+        .address = 0xc020,
+        .break_on = WRITE,
+        .value = {},
+        .condition = gb::BreakpointCondition::compile("value == a && address == hl && bank == 0xffff"),
+        .end_address = {}});
+    emulator.getBus().updateWatchedAddresses();
+    REQUIRE(emulator.runUntil(emulator.getCycleCount() + gb::g_cycles_per_frame) == gb::StopReason::FINISHED);
+    REQUIRE(writes > 0);
+}
+
+TEST_CASE("breakpoints in idle loops stop where they would without skipping") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0xf0, 0x44, // loop: LDH A, (LY)
+        0xfe, 0x40, // CP 0x40
+        0x18, 0xfa, // JR loop
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    std::array<uint64_t, 2> stops{};
+    for (bool skipping : {false, true}) {
+        gb::Emulator emulator;
+        REQUIRE(emulator.getCartridge().setROM(rom));
+        gb::PCBreakpoints breakpoints;
+        breakpoints.add(gb::PCBreakpoint{
+            .address = 0x100, .bank = {}, .condition = gb::BreakpointCondition::compile("cycles >= 30000")});
+        emulator.setPCBreakpoints(breakpoints);
+        emulator.reset();
+        emulator.start();
+        emulator.setIdleLoopSkipping(skipping);
+
+        REQUIRE(emulator.runUntil(gb::g_cycles_per_frame) == gb::StopReason::BREAKPOINT);
+        stops[skipping] = emulator.getCycleCount();
+        REQUIRE(emulator.getIdleLoopStats().skips == 0);
+
+        // a breakpoint outside of the loop doesn't keep it from being skipped
+        breakpoints.clear();
+        breakpoints.add(gb::PCBreakpoint{.address = 0x0000, .bank = {}, .condition = {}});
+        REQUIRE(emulator.runUntil(2 * gb::g_cycles_per_frame) == gb::StopReason::FINISHED);
+        REQUIRE((emulator.getIdleLoopStats().skips > 0) == skipping);
+    }
+    REQUIRE(stops[0] == stops[1]);
+}
@@ -0,0 +1,185 @@
+#include "gb/emulator.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Waits for LY == 0x40, then for a flag set by the VBLANK handler, while the timer interrupt counts in the
+// background. Both waits are idle loops
+std::vector<uint8_t> makeIdleLoopROM() {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> vblank_handler = {
+        0xf5,             // PUSH AF
+        0x3e, 0x01,       // LD A, 1
+        0xea, 0x01, 0xc0, // LD (0xc001), A
+        0xf1,             // POP AF
+        0xd9,             // RETI
+    };
+    const std::vector<uint8_t> timer_handler = {
+        0xe5,             // PUSH HL
+        0x21, 0x02, 0xc0, // LD HL, 0xc002
+        0x34,             // INC (HL)
+        0xe1,             // POP HL
+        0xd9,             // RETI
+    };
+    const std::vector<uint8_t> code = {
+        0xf3,             // DI
+        0x3e, 0x05,       // LD A, 0x05
+        0xe0, 0xff,       // LDH (IE), A
+        0x3e, 0x04,       // LD A, 0x04
+        0xe0, 0x07,       // LDH (TAC), A
+        0x3e, 0xf0,       // LD A, 0xf0
+        0xe0, 0x06,       // LDH (TMA), A
+        0xfb,             // EI
+        0xf0, 0x44,       // main: LDH A, (LY)
+        0xfe, 0x40,       // CP 0x40
+        0x20, 0xfa,       // JR NZ, main
+        0x21, 0x00, 0xc0, // LD HL, 0xc000
+        0x34,             // INC (HL)
+        0xfa, 0x01, 0xc0, // wait: LD A, (0xc001)
+        0xa7,             // AND A
+        0x28, 0xfa,       // JR Z, wait
+        0xaf,             // XOR A
+        0xea, 0x01, 0xc0, // LD (0xc001), A
+        0x18, 0xea,       // JR main
+    };
+    std::copy(vblank_handler.begin(), vblank_handler.end(), rom.begin() + 0x40);
+    std::copy(timer_handler.begin(), timer_handler.end(), rom.begin() + 0x50);
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    return rom;
+}
+
+// Counts VBLANK and timer interrupts in WRAM, sleeping in HALT between them
+std::vector<uint8_t> makeHaltROM() {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> handler = {
+        0xe5,             // PUSH HL
+        0x21, 0x00, 0xc0, // LD HL, 0xc000
+        0x34,             // INC (HL)
+        0xe1,             // POP HL
+        0xd9,             // RETI
+    };
+    const std::vector<uint8_t> code = {
+        0x3e, 0x05, // LD A, 0x05
+        0xe0, 0xff, // LDH (IE), A
+        0x3e, 0x07, // LD A, 0x07
+        0xe0, 0x07, // LDH (TAC), A
+        0xaf,       // XOR A
+        0xe0, 0x0f, // LDH (IF), A
+        0xfb,       // EI
+        0x76,       // loop: HALT
+        0x00,       // NOP
+        0x04,       // INC B
+        0x18, 0xfb, // JR loop
+    };
+    std::copy(handler.begin(), handler.end(), rom.begin() + 0x40);
+    std::copy(handler.begin(), handler.end(), rom.begin() + 0x50);
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    return rom;
+}
+
+TEST_CASE("idle loop skipping doesn't change emulation") {
+    gb::Emulator reference;
+    gb::Emulator skipping;
+    for (gb::Emulator *emulator : {&reference, &skipping}) {
+        REQUIRE(emulator->getCartridge().setROM(makeIdleLoopROM()));
+        emulator->reset();
+        emulator->start();
+    }
+    reference.setIdleLoopSkipping(false);
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (int i = 0; i < 30; ++i) {
+        reference.runFrame();
+        skipping.runFrame();
+        reference.saveState(expected);
+        skipping.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+    // limits which don't line up with loop iterations or events
+    for (int i = 0; i < 30; ++i) {
+        uint64_t target = reference.getCycleCount() + 12345 + i * 4;
+        reference.runUntil(target);
+        skipping.runUntil(target);
+        reference.saveState(expected);
+        skipping.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+
+    // both the frame counter and the timer interrupt counter advanced
+    REQUIRE(skipping.peekMemory(0xc000) > 10);
+    REQUIRE(skipping.peekMemory(0xc002) > 0);
+
+    const gb::IdleLoopStats &stats = skipping.getIdleLoopStats();
+    REQUIRE(stats.loops_detected > 0);
+    // most of the time is spent waiting
+    REQUIRE(stats.skipped_cycles > skipping.getCycleCount() / 2);
+    REQUIRE(reference.getIdleLoopStats().skipped_cycles == 0);
+}
+
+TEST_CASE("halted CPU is fast-forwarded to the next event") {
+    gb::Emulator reference;
+    gb::Emulator skipping;
+    for (gb::Emulator *emulator : {&reference, &skipping}) {
+        REQUIRE(emulator->getCartridge().setROM(makeHaltROM()));
+        emulator->reset();
+        emulator->start();
+    }
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (int i = 0; i < 50; ++i) {
+        // tick() never skips anything
+        uint64_t target = skipping.getCycleCount() + 20000 + i * 4;
+        while (reference.getCycleCount() < target) {
+            reference.tick();
+        }
+        skipping.runUntil(target);
+        reference.saveState(expected);
+        skipping.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+
+    REQUIRE(skipping.peekMemory(0xc000) > 10);
+    REQUIRE(skipping.getSkippedHaltCycles() > skipping.getCycleCount() / 2);
+    REQUIRE(reference.getSkippedHaltCycles() == 0);
+}
+
+TEST_CASE("deferred PPU and timer updates don't change emulation") {
+    gb::Emulator reference;
+    gb::Emulator batching;
+    for (gb::Emulator *emulator : {&reference, &batching}) {
+        REQUIRE(emulator->getCartridge().setROM(makeIdleLoopROM()));
+        emulator->reset();
+        emulator->start();
+        // the loops are run, not skipped, so the CPU keeps polling LY
+        emulator->setIdleLoopSkipping(false);
+    }
+    reference.setPeripheralBatching(false);
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (int i = 0; i < 20; ++i) {
+        reference.runFrame();
+        batching.runFrame();
+        reference.saveState(expected);
+        batching.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+    for (int i = 0; i < 20; ++i) {
+        uint64_t target = reference.getCycleCount() + 12345 + i * 4;
+        reference.runUntil(target);
+        batching.runUntil(target);
+        reference.saveState(expected);
+        batching.saveState(actual);
+        REQUIRE(actual == expected);
+    }
+
+    REQUIRE(batching.peekMemory(0xc002) > 0);
+    REQUIRE(batching.getBatchedCycles() > batching.getCycleCount() / 2);
+    REQUIRE(reference.getBatchedCycles() == 0);
+}
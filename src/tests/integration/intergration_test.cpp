@@ -1,79 +1,85 @@
-#include "gb/emulator.h"
-#include "util/util.h"
+#include "rom_harness.h"
 
 #include "catch2/catch_message.hpp"
 #include "catch2/catch_test_macros.hpp"
-#include "catch2/generators/catch_generators.hpp"
 
-#include <cstdint>
-#include <exception>
+#include <cstddef>
 #include <filesystem>
-#include <memory>
-#include <ostream>
-#include <sstream>
 #include <string>
-
-class TestOutputReader : public gb::IMemoryObserver {
-  public:
-    TestOutputReader(std::ostream &out) : out_(out) {}
-
-    void onWrite(uint16_t address, uint8_t data) noexcept override {
-        // Used to get output from blargg's test ROMs.
-        if (address == 0xFF01) {
-            symbol_ = data;
-        } else if (address == 0xFF02 && data == 0x81) {
-            out_ << symbol_;
-        }
-    }
-
-    uint16_t minAddress() const noexcept override { return 0xFF01; }
-    uint16_t maxAddress() const noexcept override { return 0xFF02; }
-
-  private:
-    std::ostream &out_;
-    uint8_t symbol_ = 0;
-};
+#include <vector>
 
 const std::string rom_dir = "blargg_test_roms/";
+const std::string mooneye_dir = "mooneye_test_suite/";
+
+// blargg's cpu_instrs, instr_timing and mem_timing
+const std::vector<std::string> cpu_test_roms = {"01-special.gb",
+                                               "02-interrupts.gb",
+                                               "03-op sp,hl.gb",
+                                               "04-op r,imm.gb",
+                                               "05-op rp.gb",
+                                               "06-ld r,r.gb",
+                                               "07-jr,jp,call,ret,rst.gb",
+                                               "08-misc instrs.gb",
+                                               "09-op r,r.gb",
+                                               "10-bit ops.gb",
+                                               "11-op a,(hl).gb",
+                                               "instr_timing.gb",
+                                               "01-read_timing.gb",
+                                               "02-write_timing.gb",
+                                               "03-modify_timing.gb"};
 
+// All ROMs run concurrently, so the suite takes about as long as the slowest ROM
 TEST_CASE("run cpu test roms") {
-    auto rom_name = GENERATE(as<std::string>{}, "01-special.gb", "02-interrupts.gb", "03-op sp,hl.gb", "04-op r,imm.gb",
-                             "05-op rp.gb", "06-ld r,r.gb", "07-jr,jp,call,ret,rst.gb", "08-misc instrs.gb",
-                             "09-op r,r.gb", "10-bit ops.gb", "11-op a,(hl).gb", "instr_timing.gb", "01-read_timing.gb",
-                             "02-write_timing.gb", "03-modify_timing.gb");
+    std::vector<RomTest> tests;
+    for (const std::string &name : cpu_test_roms) {
+        REQUIRE(std::filesystem::exists(rom_dir + name));
+        tests.push_back(RomTest{.rom = rom_dir + name});
+    }
 
-    std::stringstream out;
-    TestOutputReader test_out(out);
+    std::vector<RomTestResult> results = runRomTests(tests);
+    for (size_t i = 0; i < tests.size(); ++i) {
+        INFO(cpu_test_roms[i] << ": " << toString(results[i].status) << " (" << results[i].detector << ") in "
+                          << results[i].seconds << " s");
+        INFO(results[i].output);
+        CHECK(results[i].status == RomTestStatus::PASSED);
+    }
+}
 
-    gb::Emulator emulator;
-    REQUIRE(std::filesystem::exists(rom_dir + rom_name));
-    emulator.getCartridge().setROM(readFile(rom_dir + rom_name));
+// The same programs with hot code compiled, see cpu::Jit. The timing tests show compiled blocks take as many cycles
+// as the instructions they replace
+TEST_CASE("run cpu test roms with compiled code") {
+    std::vector<RomTest> tests;
+    for (const std::string &name : cpu_test_roms) {
+        REQUIRE(std::filesystem::exists(rom_dir + name));
+        tests.push_back(RomTest{.rom = rom_dir + name, .jit = true});
+    }
 
-    emulator.getBus().setObserver(test_out);
-    emulator.reset();
-    emulator.start();
-    uint16_t old_pc = 0xffff;
-    while (!emulator.terminated()) {
-        try {
-            emulator.tick();
-            if (emulator.getCPU().isFinished()) {
-                // tests jump to infinite loop after comletion
-                if (!emulator.getCPU().isHalted() && emulator.getCPU().getLastInstruction().registers.pc() == old_pc) {
-                    INFO("Test rom completion detected at address:");
-                    INFO(old_pc);
-                    break;
-                }
-                old_pc = emulator.getCPU().getLastInstruction().registers.pc();
-            }
+    std::vector<RomTestResult> results = runRomTests(tests);
+    for (size_t i = 0; i < tests.size(); ++i) {
+        INFO(cpu_test_roms[i] << ": " << toString(results[i].status) << " (" << results[i].detector << ") in "
+                          << results[i].seconds << " s");
+        INFO(results[i].output);
+        CHECK(results[i].status == RomTestStatus::PASSED);
+    }
+}
 
-        } catch (const std::exception &e) {
-            INFO(e.what());
-            break;
+// Not all of mooneye's tests pass yet, so this only reports conformance. Hidden, run with [mooneye] -s
+TEST_CASE("run mooneye test roms", "[.][mooneye]") {
+    std::vector<RomTest> tests;
+    if (std::filesystem::exists(mooneye_dir)) {
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(mooneye_dir)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".gb") {
+                tests.push_back(RomTest{.rom = entry.path()});
+            }
         }
     }
 
-    std::string output = out.str();
-
-    INFO(output);
-    REQUIRE(output.find("Passed") != std::string::npos);
+    std::vector<RomTestResult> results = runRomTests(tests);
+    size_t passed = 0;
+    for (size_t i = 0; i < tests.size(); ++i) {
+        UNSCOPED_INFO(tests[i].rom.string() << ": " << toString(results[i].status) << " (" << results[i].detector
+                                            << ")");
+        passed += results[i].status == RomTestStatus::PASSED;
+    }
+    WARN(passed << " of " << tests.size() << " mooneye tests passed");
 }
@@ -0,0 +1,205 @@
+#include "rom_harness.h"
+#include "gb/emulator.h"
+#include "gb/fault.h"
+#include "util/util.h"
+#include "work_stealing_pool.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// timeout is checked every this many instructions, so reading the clock doesn't slow emulation down
+constexpr uint32_t g_timeout_check_interval = 1 << 16;
+
+class SerialOutputReader : public gb::IMemoryObserver {
+  public:
+    SerialOutputReader(std::string &out) : out_(out) {}
+
+    void onWrite(uint16_t address, uint8_t data, [[maybe_unused]] uint8_t old_data) noexcept override {
+        if (address == 0xFF01) {
+            symbol_ = data;
+        } else if (address == 0xFF02 && data == 0x81) {
+            if (symbol_ != '\n') {
+                out_.push_back(char(symbol_));
+                return;
+            }
+            // the result is only known once its line is complete, failures are followed by details
+            std::string_view line = std::string_view(out_).substr(line_start_);
+            if (line.starts_with("Passed")) {
+                status_ = RomTestStatus::PASSED;
+                finished_ = true;
+            } else if (line.starts_with("Failed")) {
+                status_ = RomTestStatus::FAILED;
+                finished_ = true;
+            }
+            out_.push_back('\n');
+            line_start_ = out_.size();
+        }
+    }
+
+    std::span<const gb::MemoryObjectInfo> getWatchedRanges() const noexcept override { return g_serial_ranges; }
+
+    bool isFinished() const { return finished_; }
+    RomTestStatus getStatus() const { return status_; }
+
+  private:
+    // SB and SC
+    static constexpr std::array<gb::MemoryObjectInfo, 1> g_serial_ranges = {
+        gb::MemoryObjectInfo{.min_address = 0xFF01, .max_address = 0xFF02}};
+
+    std::string &out_;
+    uint8_t symbol_ = 0;
+    size_t line_start_ = 0;
+    bool finished_ = false;
+    RomTestStatus status_ = RomTestStatus::FAILED;
+};
+
+static bool hasRegisters(const gb::cpu::RegisterFile &registers, const uint8_t (&values)[6]);
+// Sets a TIMEOUT result once the test used up its cycle budget or host time
+static bool checkTimeout(const gb::Emulator &emulator, const RomTest &test,
+                         std::chrono::steady_clock::time_point start, RomTestResult &result);
+
+std::string_view toString(RomTestStatus status) {
+    switch (status) {
+    case RomTestStatus::PASSED: return "passed";
+    case RomTestStatus::FAILED: return "failed";
+    case RomTestStatus::TIMEOUT: return "timeout";
+    case RomTestStatus::ERROR: return "error";
+    }
+    return "";
+}
+
+RomTestResult runRomTest(gb::Emulator &emulator, const RomTest &test) {
+    constexpr uint8_t mooneye_passed[6] = {3, 5, 8, 13, 21, 34};
+    constexpr uint8_t mooneye_failed[6] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42};
+    constexpr uint8_t ld_b_b_opcode = 0x40;
+
+    RomTestResult result;
+    auto start = std::chrono::steady_clock::now();
+    SerialOutputReader serial(result.output);
+    try {
+        if (!emulator.getCartridge().setROM(readFile(test.rom))) {
+            result.detector = "failed to load ROM";
+            return result;
+        }
+        emulator.getBus().addObserver(serial);
+        emulator.reset();
+        emulator.start();
+
+        auto &cpu = emulator.getCPU();
+        // signatures are found in the instruction trace, builds without it rely on serial output. Compiled blocks
+        // don't run while tracing
+        cpu.setTraceEnabled(!test.jit);
+        uint16_t old_pc = 0xffff;
+        uint32_t instructions = 0;
+        while (test.jit && !emulator.terminated()) {
+            emulator.runUntil(emulator.getCycleCount() + gb::g_cycles_per_frame);
+            if (serial.isFinished()) {
+                result.status = serial.getStatus();
+                result.detector = "serial output";
+                break;
+            }
+            if (checkTimeout(emulator, test, start, result)) {
+                break;
+            }
+        }
+        while (!test.jit && !emulator.terminated()) {
+            emulator.tick();
+            if (!cpu.isFinished()) {
+                continue;
+            }
+
+            if (serial.isFinished()) {
+                result.status = serial.getStatus();
+                result.detector = "serial output";
+                break;
+            }
+
+            if constexpr (gb::cpu::g_trace_enabled) {
+                const gb::cpu::TraceRecord &trace = cpu.getLastTrace();
+                gb::cpu::InstructionType type = gb::cpu::disassemble(trace).type;
+                // other register loads can leave the same values behind, only LD B,B is the signature
+                if (type == gb::cpu::InstructionType::LD && trace.bytes[0] == ld_b_b_opcode) {
+                    gb::cpu::RegisterFile registers = gb::cpu::getRegisters(trace);
+                    if (hasRegisters(registers, mooneye_passed)) {
+                        result.status = RomTestStatus::PASSED;
+                        result.detector = "LD B,B signature";
+                        break;
+                    } else if (hasRegisters(registers, mooneye_failed)) {
+                        result.status = RomTestStatus::FAILED;
+                        result.detector = "LD B,B signature";
+                        break;
+                    }
+                } else if (type == gb::cpu::InstructionType::JR && !cpu.isHalted() && trace.pc == old_pc) {
+                    result.status = result.output.find("Passed") != std::string::npos ? RomTestStatus::PASSED
+                                                                                      : RomTestStatus::FAILED;
+                    result.detector = "infinite JR loop";
+                    break;
+                }
+                old_pc = trace.pc;
+            }
+
+            if (++instructions % g_timeout_check_interval == 0 && checkTimeout(emulator, test, start, result)) {
+                break;
+            }
+        }
+        if (emulator.getFault().isSet()) {
+            result.status = RomTestStatus::ERROR;
+            result.detector = gb::getFaultName(emulator.getFault().fault);
+        } else if (result.detector.empty()) {
+            result.detector = "emulation terminated";
+        }
+    } catch (const std::exception &e) {
+        result.status = RomTestStatus::ERROR;
+        result.detector = e.what();
+    }
+    emulator.getBus().removeObserver(serial);
+
+    result.cycles = emulator.getCycleCount();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+std::vector<RomTestResult> runRomTests(const std::vector<RomTest> &tests, size_t threads) {
+    emulator::WorkStealingPool pool(threads);
+    std::vector<std::unique_ptr<gb::Emulator>> emulators(pool.getThreadCount());
+    std::vector<RomTestResult> results(tests.size());
+    pool.run(tests.size(), [&](size_t worker, size_t index) {
+        if (!emulators[worker]) {
+            emulators[worker] = std::make_unique<gb::Emulator>();
+        }
+        results[index] = runRomTest(*emulators[worker], tests[index]);
+        if (results[index].status == RomTestStatus::ERROR) {
+            // the emulator may be left in an inconsistent state after an exception
+            emulators[worker].reset();
+        }
+    });
+    return results;
+}
+
+static bool hasRegisters(const gb::cpu::RegisterFile &registers, const uint8_t (&values)[6]) {
+    return registers.b() == values[0] && registers.c() == values[1] && registers.d() == values[2] &&
+           registers.e() == values[3] && registers.h() == values[4] && registers.l() == values[5];
+}
+
+static bool checkTimeout(const gb::Emulator &emulator, const RomTest &test,
+                         std::chrono::steady_clock::time_point start, RomTestResult &result) {
+    if (emulator.getCycleCount() >= test.cycle_budget) {
+        result.status = RomTestStatus::TIMEOUT;
+        result.detector = "cycle budget exceeded";
+        return true;
+    }
+    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= test.timeout) {
+        result.status = RomTestStatus::TIMEOUT;
+        result.detector = "timed out";
+        return true;
+    }
+    return false;
+}
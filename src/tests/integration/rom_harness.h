@@ -0,0 +1,51 @@
+#ifndef GB_EMULATOR_SRC_TESTS_INTEGRATION_ROM_HARNESS_HDR_
+#define GB_EMULATOR_SRC_TESTS_INTEGRATION_ROM_HARNESS_HDR_
+
+#include "gb/emulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 2 minutes of emulated time, the slowest blargg ROM needs about a minute
+constexpr uint64_t g_rom_test_cycle_budget = 120 * gb::g_cpu_frequency;
+constexpr double g_rom_test_timeout = 30; // in seconds
+
+enum class RomTestStatus : uint8_t { PASSED, FAILED, TIMEOUT, ERROR };
+
+struct RomTest {
+    std::filesystem::path rom;
+    uint64_t cycle_budget = g_rom_test_cycle_budget;
+    // host time limit, in seconds
+    double timeout = g_rom_test_timeout;
+    // runs with runUntil() so hot code is compiled, see cpu::Jit. Nothing is traced then, only serial output
+    // decides the result
+    bool jit = false;
+};
+
+struct RomTestResult {
+    RomTestStatus status = RomTestStatus::ERROR;
+    // what decided the result
+    std::string detector;
+    // text written to the serial port
+    std::string output;
+    uint64_t cycles = 0;
+    double seconds = 0;
+};
+
+std::string_view toString(RomTestStatus status);
+
+// Runs a test ROM until one of the completion detectors fires:
+// - blargg's tests print "Passed" or "Failed" to the serial port,
+// - mooneye's tests execute LD B,B with B, C, D, E, H, L set to 3, 5, 8, 13, 21, 34 on success or 0x42 on failure,
+// - a test that finished without any of the above spins in an infinite JR loop, then the serial output decides.
+// Detectors are only checked on instruction boundaries, or after every frame with RomTest::jit
+RomTestResult runRomTest(gb::Emulator &emulator, const RomTest &test);
+
+// Runs the tests on a work-stealing pool, one emulator instance per thread. results[i] is the result of tests[i]
+std::vector<RomTestResult> runRomTests(const std::vector<RomTest> &tests, size_t threads = 0);
+
+#endif
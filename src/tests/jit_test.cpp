@@ -0,0 +1,326 @@
+#include "gb/emulator.h"
+#include "gb/cpu/code_walker.h"
+#include "gb/pc_breakpoints.h"
+
+#include "catch2/catch_message.hpp"
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+// Random code the JIT compiles, broken up by instructions it leaves to the interpreter: IO reads, interrupt
+// enables, HALT and prefixed opcodes. Memory is accessed in WRAM, ROM and OAM, which isn't in the page table, the
+// stack sometimes straddles two pages and jumps, calls and returns go both ways. The timer and VBLANK interrupts
+// fire all the time and their handler pushes AF, so both the timing and the flags of compiled blocks are visible
+static std::vector<uint8_t> makeRandomROM(uint32_t seed) {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> setup = {
+        0x31, 0xf0, 0xdf, // LD SP, 0xdff0
+        0x3e, 0xf0,       // LD A, 0xf0
+        0xe0, 0x06,       // LDH (TMA), A
+        0x3e, 0x05,       // LD A, 0x05
+        0xe0, 0x07,       // LDH (TAC), A
+        0xe0, 0xff,       // LDH (IE), A
+        0xfb,             // EI
+        0xc3, 0x50, 0x01, // JP 0x150
+    };
+    std::copy(setup.begin(), setup.end(), rom.begin() + 0x100);
+    // PUSH AF, POP AF, RETI
+    for (uint16_t vector : {0x40, 0x50}) {
+        rom[vector] = 0xf5;
+        rom[vector + 1] = 0xf1;
+        rom[vector + 2] = 0xd9;
+    }
+    // RST 0x28: INC D, RET
+    rom[0x28] = 0x14;
+    rom[0x29] = 0xc9;
+    // subroutine at 0x70: INC E, RET NC, DEC E, RET
+    const std::vector<uint8_t> subroutine = {0x1c, 0xd0, 0x1d, 0xc9};
+    std::copy(subroutine.begin(), subroutine.end(), rom.begin() + 0x70);
+
+    std::mt19937 random(seed);
+    auto pick = [&random](uint32_t count) { return uint8_t(random() % count); };
+    // B, C, D, E, H, L or A, (HL) is left out
+    auto reg = [&pick]() {
+        uint8_t index = pick(7);
+        return uint8_t(index == 6 ? 7 : index);
+    };
+    std::vector<uint8_t> code;
+    // address of the instruction size bytes after the end of the code
+    auto next = [&code](size_t size) { return uint16_t(0x150 + code.size() + size); };
+    for (int i = 0; i < 400; ++i) {
+        switch (pick(24)) {
+        case 0: code.push_back(uint8_t(0x40 | (reg() << 3) | reg())); break;
+        case 1: code.insert(code.end(), {uint8_t(0x06 | (reg() << 3)), pick(256)}); break;
+        case 2: code.insert(code.end(), {uint8_t(0x01 | (pick(3) << 4)), pick(256), pick(256)}); break;
+        case 3: code.push_back(uint8_t((pick(2) == 0 ? 0x04 : 0x05) | (reg() << 3))); break;
+        case 4: code.push_back(uint8_t((pick(2) == 0 ? 0x03 : 0x0b) | (pick(4) << 4))); break;
+        case 5: code.push_back(uint8_t(0x09 | (pick(4) << 4))); break;
+        case 6:
+        case 7: code.push_back(uint8_t(0x80 | (pick(8) << 3) | reg())); break;
+        case 8: code.insert(code.end(), {uint8_t(0xc6 | (pick(8) << 3)), pick(256)}); break;
+        case 9: code.push_back(std::vector<uint8_t>{0x00, 0x2f, 0x37, 0x3f}[pick(4)]); break;
+        case 10: code.push_back(std::vector<uint8_t>{0x27, 0x17, 0x0f, 0x1f}[pick(4)]); break;
+        // PUSH AF, POP BC
+        case 11: code.insert(code.end(), {0xf5, 0xc1}); break;
+        // LDH A, (DIV) or LDH A, (STAT)
+        case 12: code.insert(code.end(), {0xf0, pick(2) == 0 ? uint8_t(0x04) : uint8_t(0x41)}); break;
+        // JR NZ, +0 or JR C, +0
+        case 13: code.insert(code.end(), {pick(2) == 0 ? uint8_t(0x20) : uint8_t(0x38), 0x00}); break;
+        // DI, EI or HALT followed by a NOP, which the HALT bug runs twice
+        case 14: code.insert(code.end(), {std::vector<uint8_t>{0xf3, 0xfb, 0x76}[pick(3)], 0x00}); break;
+        // SWAP B or BIT 7, A
+        case 15: code.insert(code.end(), {0xcb, pick(2) == 0 ? uint8_t(0x30) : uint8_t(0x7f)}); break;
+        // LD H, n followed by an access to (HL): LD r, (HL), LD (HL), r, INC (HL), DEC (HL), ALU A, (HL),
+        // LD (HL), n or a load through (HL+) or (HL-)
+        case 16: {
+            const std::vector<uint8_t> pages = {uint8_t(0xc0 + pick(32)), uint8_t(0x40 + pick(64)), 0xfe};
+            code.insert(code.end(), {0x26, pages[pick(3)]});
+            switch (pick(6)) {
+            case 0: code.push_back(uint8_t(0x46 | (reg() << 3))); break;
+            case 1: code.push_back(uint8_t(0x70 | reg())); break;
+            case 2: code.push_back(uint8_t(0x34 | pick(2))); break;
+            case 3: code.push_back(uint8_t(0x86 | (pick(8) << 3))); break;
+            case 4: code.insert(code.end(), {0x36, pick(256)}); break;
+            case 5: code.push_back(std::vector<uint8_t>{0x22, 0x2a, 0x32, 0x3a}[pick(4)]); break;
+            }
+            break;
+        }
+        // LD A, (nn) or LD (nn), A in WRAM
+        case 17: {
+            uint8_t opcode = pick(2) == 0 ? uint8_t(0xfa) : uint8_t(0xea);
+            code.insert(code.end(), {opcode, pick(256), uint8_t(0xc0 + pick(32))});
+            break;
+        }
+        // PUSH rr, POP rr
+        case 18: code.insert(code.end(), {uint8_t(0xc5 | (pick(4) << 4)), uint8_t(0xc1 | (pick(4) << 4))}); break;
+        // JR cc, +1 over INC B
+        case 19: code.insert(code.end(), {uint8_t(0x20 | (pick(4) << 3)), 0x01, 0x04}); break;
+        // JP cc, nn or JP nn over INC C
+        case 20: {
+            uint16_t target = next(4);
+            uint8_t condition = pick(5);
+            code.insert(code.end(), {condition == 4 ? uint8_t(0xc3) : uint8_t(0xc2 | (condition << 3)),
+                                     uint8_t(target), uint8_t(target >> 8), 0x0c});
+            break;
+        }
+        // CALL cc, 0x70 or CALL 0x70
+        case 21: {
+            uint8_t condition = pick(5);
+            code.insert(code.end(), {condition == 4 ? uint8_t(0xcd) : uint8_t(0xc4 | (condition << 3)), 0x70, 0x00});
+            break;
+        }
+        // RST 0x28
+        case 22: code.push_back(0xef); break;
+        // LD HL, nn and JP HL to the next instruction
+        case 23: {
+            uint16_t target = next(4);
+            code.insert(code.end(), {0x21, uint8_t(target), uint8_t(target >> 8), 0xe9});
+            break;
+        }
+        }
+        // LD SP, nn keeps the stack in WRAM
+        if (pick(32) == 0) {
+            code.insert(code.end(), {0x31, pick(256), uint8_t(0xd0 + pick(16))});
+        }
+    }
+    // JP 0x150
+    code.insert(code.end(), {0xc3, 0x50, 0x01});
+    std::copy(code.begin(), code.end(), rom.begin() + 0x150);
+    return rom;
+}
+
+// Runs random ROMs with and without compiled blocks, which are native code only if native is set. Returns the
+// number of fused moves in threaded blocks
+static uint64_t requireSameAsInterpreter(bool native) {
+    uint64_t fused_moves = 0;
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        INFO("seed " << seed);
+        gb::Emulator interpreted;
+        gb::Emulator compiled;
+        for (gb::Emulator *emulator : {&interpreted, &compiled}) {
+            REQUIRE(emulator->getCartridge().setROM(makeRandomROM(seed)));
+            emulator->reset();
+            emulator->start();
+        }
+        interpreted.setJitEnabled(false);
+        compiled.getCPU().getJit().setNativeEnabled(native);
+
+        std::vector<uint8_t> expected;
+        std::vector<uint8_t> actual;
+        for (int i = 0; i < 10; ++i) {
+            interpreted.runFrame();
+            compiled.runFrame();
+            interpreted.saveState(expected);
+            compiled.saveState(actual);
+            REQUIRE(actual == expected);
+        }
+        // stops at odd cycle counts too, so blocks are cut short by the limit as well as by events
+        std::mt19937 random(seed);
+        for (int i = 0; i < 200; ++i) {
+            uint64_t limit = interpreted.getCycleCount() + 4 * (1 + random() % 2000);
+            interpreted.runUntil(limit);
+            compiled.runUntil(limit);
+            REQUIRE(interpreted.getCycleCount() >= limit);
+            interpreted.saveState(expected);
+            compiled.saveState(actual);
+            REQUIRE(actual == expected);
+        }
+        REQUIRE(interpreted.getJitStats().blocks_run == 0);
+        if constexpr (gb::cpu::g_jit_enabled) {
+            const gb::cpu::JitStats &stats = compiled.getJitStats();
+            REQUIRE(stats.blocks_compiled > 0);
+            REQUIRE(stats.instructions_run > stats.blocks_run);
+            if (!native || !gb::cpu::isNativeJitAvailable()) {
+                REQUIRE(stats.blocks_threaded == stats.blocks_compiled);
+            } else {
+                REQUIRE(stats.blocks_threaded == 0);
+            }
+            fused_moves += stats.fused_moves;
+        }
+    }
+    return fused_moves;
+}
+
+TEST_CASE("compiled blocks give the same results as the interpreter") { requireSameAsInterpreter(true); }
+
+TEST_CASE("threaded code gives the same results as the interpreter") {
+    uint64_t fused_moves = requireSameAsInterpreter(false);
+    REQUIRE((fused_moves > 0) == gb::cpu::g_jit_enabled);
+}
+
+// Watches all of ROM, so it is told about every fetch
+class CodeObserver : public gb::IMemoryObserver {
+  public:
+    std::span<const gb::MemoryObjectInfo> getWatchedRanges() const noexcept override { return ranges_; }
+
+  private:
+    std::array<gb::MemoryObjectInfo, 1> ranges_ = {gb::g_memory_rom};
+};
+
+TEST_CASE("compiled blocks don't run while instructions are observed") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeRandomROM(1)));
+    emulator.reset();
+    emulator.start();
+
+    CodeObserver observer;
+    emulator.getBus().addObserver(observer);
+    emulator.runUntil(10 * gb::g_cycles_per_frame);
+    REQUIRE(emulator.getJitStats().blocks_run == 0);
+    emulator.getBus().removeObserver(observer);
+
+    // a breakpoint stops compiled code even if it's never hit, the forbidden area can't be executed
+    gb::PCBreakpoints breakpoints;
+    breakpoints.add(gb::PCBreakpoint{.address = 0xfeff, .bank = {}, .condition = {}});
+    emulator.setPCBreakpoints(breakpoints);
+    emulator.runUntil(20 * gb::g_cycles_per_frame);
+    REQUIRE(emulator.getJitStats().blocks_run == 0);
+    emulator.removePCBreakpoints();
+
+    if constexpr (gb::cpu::g_trace_enabled) {
+        emulator.getCPU().setTraceEnabled(true);
+        emulator.runUntil(30 * gb::g_cycles_per_frame);
+        REQUIRE(emulator.getJitStats().blocks_run == 0);
+        emulator.getCPU().setTraceEnabled(false);
+    }
+
+    // an empty set of breakpoints doesn't
+    breakpoints.clear();
+    emulator.setPCBreakpoints(breakpoints);
+    emulator.runUntil(40 * gb::g_cycles_per_frame);
+    REQUIRE((emulator.getJitStats().blocks_run > 0) == gb::cpu::g_jit_enabled);
+}
+
+TEST_CASE("compiled blocks leave out flags nothing reads") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0xaf,       // XOR A
+        0x3c,       // loop: INC A
+        0x47,       // LD B, A
+        0xfe, 0x80, // CP 0x80
+        0x4f,       // LD C, A
+        0x20, 0xf9, // JR NZ, loop
+        0x76,       // HALT
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    gb::Emulator interpreted;
+    gb::Emulator compiled;
+    for (gb::Emulator *emulator : {&interpreted, &compiled}) {
+        REQUIRE(emulator->getCartridge().setROM(rom));
+        emulator->reset();
+        emulator->start();
+    }
+    interpreted.setJitEnabled(false);
+    interpreted.runUntil(gb::g_cycles_per_frame);
+    compiled.runUntil(gb::g_cycles_per_frame);
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    interpreted.saveState(expected);
+    compiled.saveState(actual);
+    REQUIRE(actual == expected);
+    // Z and N of CP 0x80
+    REQUIRE(compiled.getCPU().getRegisters().getByteRegister(gb::cpu::Registers::FLAGS) == 0xc0);
+
+    // CP overwrites everything INC A writes. Blocks entered at LD B, A when an event got in the way have none
+    if constexpr (gb::cpu::g_jit_enabled) {
+        const gb::cpu::JitStats &stats = compiled.getJitStats();
+        REQUIRE(stats.blocks_run > 64);
+        REQUIRE(stats.dead_flag_writes > stats.blocks_run / 2);
+        REQUIRE(stats.dead_flag_writes <= stats.blocks_run);
+    }
+}
+
+TEST_CASE("precompiled blocks run without being compiled") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    // the opcode at the entry point is fetched by reset(), the block starts after the NOP
+    const std::vector<uint8_t> code = {
+        0x00,       // NOP
+        0x06, 0x12, // LD B, 0x12
+        0x04,       // INC B
+        0x48,       // LD C, B
+        0x76,       // HALT
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    // what aot_compiler generates for the run at 0x101 in bank 0, the CPU fetches HALT itself
+    gb::cpu::CompiledRun run =
+        gb::cpu::getCompiledRun(0x101, [&rom](uint16_t address) { return gb::cpu::readROM(rom, 0, address); });
+    REQUIRE(run.opcodes.size() == 3);
+    REQUIRE(run.block.end == 0x105);
+    REQUIRE(run.block.cycles == 4);
+    run.block.function = [](gb::cpu::JitRegisters *registers) {
+        registers->bytes[size_t(gb::cpu::Registers::B)] = 0x13;
+        registers->bytes[size_t(gb::cpu::Registers::C)] = 0x13;
+        registers->bytes[size_t(gb::cpu::Registers::FLAGS)] &= 0x10;
+        registers->pc = 0x105;
+        return gb::cpu::JitExit{.cycles = 4, .instructions = 3};
+    };
+    const std::vector<gb::cpu::PrecompiledFunction> functions = {{.key = 0x101, .block = run.block}};
+
+    gb::Emulator interpreted;
+    gb::Emulator compiled;
+    for (gb::Emulator *emulator : {&interpreted, &compiled}) {
+        REQUIRE(emulator->getCartridge().setROM(rom));
+        emulator->reset();
+        emulator->start();
+    }
+    interpreted.setJitEnabled(false);
+    compiled.getCPU().getJit().setPrecompiled(functions);
+    interpreted.runUntil(gb::g_cycles_per_frame);
+    compiled.runUntil(gb::g_cycles_per_frame);
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    interpreted.saveState(expected);
+    compiled.saveState(actual);
+    REQUIRE(actual == expected);
+
+    const gb::cpu::JitStats &stats = compiled.getJitStats();
+    REQUIRE(stats.blocks_compiled == 0);
+    REQUIRE(stats.blocks_run == (gb::cpu::g_jit_enabled ? 1 : 0));
+}
@@ -0,0 +1,190 @@
+#include "gb/emulator.h"
+
+#include "catch2/catch_message.hpp"
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+TEST_CASE("lazy flags are computed only when read") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0xaf,       // XOR A
+        0x3c,       // loop: INC A
+        0xfe, 0x05, // CP 0x05
+        0x20, 0xfb, // JR NZ, loop
+        0x76,       // HALT
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(rom));
+    emulator.reset();
+    emulator.start();
+    while (!emulator.getCPU().isHalted()) {
+        emulator.tick();
+    }
+    // Z and N of CP 0x05
+    REQUIRE(emulator.getCPU().getRegisters().f() == 0xc0);
+
+    // INC A keeps C of XOR A, then only JR NZ reads the flags
+    const gb::cpu::FlagStats &stats = emulator.getCPU().getFlagStats();
+    REQUIRE(stats.deferred == 1 + 5 + 5);
+    REQUIRE(stats.materialized == 1 + 5);
+}
+
+// Flags of ADC, SBC, INC and DEC computed right away, the way the CPU did before they were deferred
+static uint8_t getEagerFlags(uint8_t opcode, uint8_t a, uint8_t operand, uint8_t flags) {
+    auto flag = [](uint8_t mask, bool value) { return value ? mask : uint8_t(0); };
+    bool carry = (flags & 0x10) != 0;
+    switch (opcode) {
+    // ADC A, B
+    case 0x88: {
+        unsigned result = a + operand + carry;
+        return flag(0x80, uint8_t(result) == 0) | flag(0x20, (a & 0xf) + (operand & 0xf) + carry > 0xf) |
+               flag(0x10, result > 0xff);
+    }
+    // SBC A, B
+    case 0x98:
+        return flag(0x80, uint8_t(a - operand - carry) == 0) | 0x40 |
+               flag(0x20, (a & 0xf) < (operand & 0xf) + carry) | flag(0x10, a < operand + carry);
+    // INC A
+    case 0x3c: return flag(0x80, uint8_t(a + 1) == 0) | flag(0x20, (a & 0xf) == 0xf) | (flags & 0x10);
+    // DEC A
+    default: return flag(0x80, uint8_t(a - 1) == 0) | 0x40 | flag(0x20, (a & 0xf) == 0) | (flags & 0x10);
+    }
+}
+
+static uint8_t getResult(uint8_t opcode, uint8_t a, uint8_t operand, uint8_t flags) {
+    uint8_t carry = (flags & 0x10) != 0 ? 1 : 0;
+    switch (opcode) {
+    case 0x88: return uint8_t(a + operand + carry);
+    case 0x98: return uint8_t(a - operand - carry);
+    case 0x3c: return uint8_t(a + 1);
+    default: return uint8_t(a - 1);
+    }
+}
+
+struct LazyFlagsROM {
+    std::vector<uint8_t> rom;
+    // A, C and B stored by each case: the result, then F or whether the branches saw C and Z
+    std::vector<uint8_t> expected;
+};
+
+// Cases of ADC A, B, SBC A, B, INC A and DEC A, half of them after a CP whose flags are still deferred too, each
+// followed by an instruction reading the flags: PUSH AF, DAA, conditional jumps, ADD SP, e or LD HL, SP+e. The
+// results are stored at 0xc000 + 4 * case
+static LazyFlagsROM makeLazyFlagsROM(uint32_t seed, size_t case_count) {
+    LazyFlagsROM result{.rom = std::vector<uint8_t>(32 * 1024, 0), .expected = {}};
+    std::vector<uint8_t> &rom = result.rom;
+    std::mt19937 random(seed);
+    auto pick = [&random](uint32_t count) { return uint8_t(random() % count); };
+    size_t pc = 0x100;
+    auto emit = [&rom, &pc](std::initializer_list<uint8_t> bytes) {
+        for (uint8_t byte : bytes) {
+            rom[pc++] = byte;
+        }
+    };
+    // JP 0x150 past the header
+    emit({0xc3, 0x50, 0x01});
+    pc = 0x150;
+
+    for (size_t i = 0; i < case_count; ++i) {
+        uint8_t a = pick(256);
+        uint8_t flags = pick(16) << 4;
+        uint8_t operand = pick(256);
+        uint8_t opcode = std::array<uint8_t, 4>{0x88, 0x98, 0x3c, 0x3d}[pick(4)];
+        // SP low byte, the offsets of ADD SP, e and LD HL, SP+e carry out of bits 3 and 7 depending on it
+        uint8_t sp = pick(256);
+        uint8_t offset = pick(256);
+        auto address = uint16_t(0xc000 + 4 * i);
+
+        // LD SP, 0xd0xx, LD BC, a:flags, PUSH BC, POP AF, LD B, operand
+        emit({0x31, sp, 0xd0, 0x01, flags, a, 0xc5, 0xf1, 0x06, operand});
+        if (pick(2) == 0) {
+            // CP n
+            uint8_t compared = pick(256);
+            emit({0xfe, compared});
+            flags = uint8_t(0x40 | (a == compared ? 0x80 : 0) | ((a & 0xf) < (compared & 0xf) ? 0x20 : 0) |
+                            (a < compared ? 0x10 : 0));
+        }
+        emit({opcode});
+        uint8_t value = getResult(opcode, a, operand, flags);
+        flags = getEagerFlags(opcode, a, operand, flags);
+
+        // POP BC leaves A in B
+        std::array<uint8_t, 3> expected = {value, flags, value};
+        switch (pick(4)) {
+        // PUSH AF, POP BC
+        case 0: emit({0xf5, 0xc1}); break;
+        // DAA, PUSH AF, POP BC
+        case 1: {
+            bool carry = (flags & 0x10) != 0;
+            if ((flags & 0x40) == 0) {
+                if (carry || value > 0x99) {
+                    value = uint8_t(value + 0x60);
+                    carry = true;
+                }
+                if ((flags & 0x20) != 0 || (value & 0xf) > 0x9) {
+                    value = uint8_t(value + 0x06);
+                }
+            } else {
+                value = uint8_t(value - (carry ? 0x60 : 0) - ((flags & 0x20) != 0 ? 0x06 : 0));
+            }
+            expected = {value, uint8_t((value == 0 ? 0x80 : 0) | (flags & 0x40) | (carry ? 0x10 : 0)), value};
+            emit({0x27, 0xf5, 0xc1});
+            break;
+        }
+        // LD BC, 0, JR NC, +2, LD C, 1, JP NZ, +2, LD B, 1, each branch sets a register if it isn't taken
+        case 2: {
+            auto skip = uint16_t(pc + 12);
+            emit({0x01, 0x00, 0x00, 0x30, 0x02, 0x0e, 0x01, 0xc2, uint8_t(skip), uint8_t(skip >> 8), 0x06, 0x01});
+            expected = {value, uint8_t((flags & 0x10) != 0 ? 1 : 0), uint8_t((flags & 0x80) != 0 ? 1 : 0)};
+            break;
+        }
+        // ADD SP, e or LD HL, SP+e, then PUSH AF, POP BC
+        case 3: {
+            bool half = (sp & 0xf) + (offset & 0xf) > 0xf;
+            bool carry = sp + offset > 0xff;
+            expected = {value, uint8_t((half ? 0x20 : 0) | (carry ? 0x10 : 0)), value};
+            emit({pick(2) == 0 ? uint8_t(0xe8) : uint8_t(0xf8), offset, 0xf5, 0xc1});
+            break;
+        }
+        }
+        // LD (nn), A, LD A, C, LD (nn + 1), A, LD A, B, LD (nn + 2), A
+        emit({0xea, uint8_t(address), uint8_t(address >> 8), 0x79, 0xea, uint8_t(address + 1),
+              uint8_t((address + 1) >> 8), 0x78, 0xea, uint8_t(address + 2), uint8_t((address + 2) >> 8)});
+        result.expected.insert(result.expected.end(), expected.begin(), expected.end());
+    }
+    // HALT
+    emit({0x76});
+    return result;
+}
+
+TEST_CASE("lazy flags read by later instructions match eagerly computed flags") {
+    constexpr size_t g_case_count = 512;
+    for (uint32_t seed = 1; seed <= 4; ++seed) {
+        INFO("seed " << seed);
+        LazyFlagsROM rom = makeLazyFlagsROM(seed, g_case_count);
+        gb::Emulator emulator;
+        REQUIRE(emulator.getCartridge().setROM(rom.rom));
+        emulator.reset();
+        emulator.start();
+        while (!emulator.getCPU().isHalted()) {
+            emulator.tick();
+        }
+
+        for (size_t i = 0; i < g_case_count; ++i) {
+            INFO("case " << i);
+            for (size_t j = 0; j < 3; ++j) {
+                REQUIRE(int(emulator.getBus().read(uint16_t(0xc000 + 4 * i + j))) == int(rom.expected[3 * i + j]));
+            }
+        }
+        REQUIRE(emulator.getCPU().getFlagStats().materialized > 0);
+    }
+}
@@ -1,4 +1,6 @@
 #include "breakpoint.h"
+#include "gb/emulator.h"
+#include "test_rom.h"
 
 #include "catch2/catch_test_macros.hpp"
 #include <algorithm>
@@ -8,6 +10,9 @@
 #include <numeric>
 #include <random>
 #include <set>
+#include <span>
+#include <utility>
+#include <vector>
 
 using namespace emulator;
 using enum MemoryBreakpointData::BreakOn;
@@ -58,10 +63,79 @@ TEST_CASE_METHOD(InitTest, "addBreakpoint, ordering") {
     }
 }
 
-TEST_CASE("minAddress, maxAddress") {
-    MemoryBreakpoints br{[]() {}};
-    REQUIRE(br.minAddress() == 0);
-    REQUIRE(br.maxAddress() == uint16_t(-1));
+TEST_CASE_METHOD(InitTest, "watched ranges") {
+    // adjacent addresses are merged
+    std::vector<gb::MemoryObjectInfo> expected = {{0, 0}, {8, 8}, {10, 10}, {12, 12}, {14, 14}, {16, 16},
+                                                  {18, 18}, {20, 20}, {22, 22}, {24, 24}};
+    auto ranges = breakpoints_.getWatchedRanges();
+    REQUIRE(ranges.size() == expected.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        REQUIRE(ranges[i].min_address == expected[i].min_address);
+        REQUIRE(ranges[i].max_address == expected[i].max_address);
+    }
+
+    breakpoints_.addBreakpoint(MemoryBreakpointData{9});
+    breakpoints_.addBreakpoint(MemoryBreakpointData{11});
+    REQUIRE(breakpoints_.getWatchedRanges()[1].min_address == 8);
+    REQUIRE(breakpoints_.getWatchedRanges()[1].max_address == 12);
+}
+
+class AccessRecorder : public gb::IMemoryObserver {
+  public:
+    AccessRecorder(std::vector<gb::MemoryObjectInfo> ranges) : ranges_(std::move(ranges)) {}
+
+    void onRead(uint16_t address, [[maybe_unused]] uint8_t data) noexcept override {
+        reads.insert(address);
+        ++read_count;
+    }
+    void onWrite(uint16_t address, [[maybe_unused]] uint8_t data, [[maybe_unused]] uint8_t old_data) noexcept override {
+        writes.insert(address);
+    }
+    std::span<const gb::MemoryObjectInfo> getWatchedRanges() const noexcept override { return ranges_; }
+
+    std::set<uint16_t> reads;
+    std::set<uint16_t> writes;
+    size_t read_count = 0;
+
+  private:
+    std::vector<gb::MemoryObjectInfo> ranges_;
+};
+
+TEST_CASE("bus notifies observers only about watched addresses") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    // LDH A, (0x00) and the first bytes of WRAM written by the loop
+    AccessRecorder code({{0x107, 0x108}, {0xc000, 0xc001}});
+    AccessRecorder joypad({{0xff00, 0xff00}, {0xc001, 0xc002}});
+    emulator.getBus().addObserver(code);
+    emulator.getBus().addObserver(joypad);
+    emulator.reset();
+    emulator.start();
+    emulator.runUntil(gb::g_cycles_per_frame);
+
+    REQUIRE(code.reads == std::set<uint16_t>{0x107, 0x108});
+    REQUIRE(code.writes == std::set<uint16_t>{0xc000, 0xc001});
+    REQUIRE(joypad.reads == std::set<uint16_t>{0xff00});
+    REQUIRE(joypad.writes == std::set<uint16_t>{0xff00, 0xc001, 0xc002});
+
+    // muted observers miss accesses, but keep their watched addresses
+    code.reads.clear();
+    emulator.getBus().setObserversMuted(true);
+    REQUIRE(!emulator.getBus().hasObserver());
+    REQUIRE(!emulator.getBus().isWatched(0xc000));
+    emulator.runUntil(2 * gb::g_cycles_per_frame);
+    REQUIRE(code.reads.empty());
+    emulator.getBus().setObserversMuted(false);
+    REQUIRE(emulator.getBus().isWatched(0xc000));
+    emulator.runUntil(3 * gb::g_cycles_per_frame);
+    REQUIRE(code.reads == std::set<uint16_t>{0x107, 0x108});
+
+    emulator.getBus().removeObserver(code);
+    REQUIRE(emulator.getBus().isWatched(0xc001));
+    REQUIRE(!emulator.getBus().isWatched(0xc000));
+    emulator.getBus().removeObserver(joypad);
+    REQUIRE(!emulator.getBus().hasObserver());
+    REQUIRE(!emulator.getBus().isWatched(0xc001));
 }
 
 TEST_CASE_METHOD(InitTest, "onRead") {
@@ -93,26 +167,26 @@ TEST_CASE_METHOD(InitTest, "onRead") {
 
 TEST_CASE_METHOD(InitTest, "onWrite") {
     SECTION("simple") {
-        breakpoints_.onWrite(10, 0);
+        breakpoints_.onWrite(10, 0, 0);
         REQUIRE(callback_called_);
         callback_called_ = false;
     }
     SECTION("multiple breakpoints on same address") {
-        breakpoints_.onWrite(0, 0);
+        breakpoints_.onWrite(0, 0, 0);
         REQUIRE(callback_called_);
         callback_called_ = false;
     }
     SECTION("breakpoint with value set") {
-        breakpoints_.onWrite(8, 0);
+        breakpoints_.onWrite(8, 0, 0);
         REQUIRE_FALSE(callback_called_);
-        breakpoints_.onWrite(8, 10);
+        breakpoints_.onWrite(8, 10, 0);
         REQUIRE(callback_called_);
         callback_called_ = false;
     }
     SECTION("multiple breakpoints with value set") {
-        breakpoints_.onWrite(14, 0);
+        breakpoints_.onWrite(14, 0, 0);
         REQUIRE_FALSE(callback_called_);
-        breakpoints_.onWrite(14, 10);
+        breakpoints_.onWrite(14, 10, 0);
         REQUIRE(callback_called_);
         callback_called_ = false;
     }
@@ -134,3 +208,96 @@ TEST_CASE_METHOD(InitTest, "deletion") {
         }
     }
 }
+
+TEST_CASE("range watchpoints") {
+    bool stopped = false;
+    MemoryBreakpoints breakpoints([&stopped]() { stopped = true; });
+    breakpoints.addBreakpoint(MemoryBreakpointData{
+        .address = 0x10, .break_on = CHANGE, .value = {}, .condition = {}, .end_address = 0x1f, .stop = false});
+    breakpoints.addBreakpoint(MemoryBreakpointData{
+        .address = 0x18, .break_on = READ, .value = 0x80, .condition = {}, .end_address = 0x27, .mask = 0xf0});
+    // adjacent and overlapping ranges are merged for the bus
+    REQUIRE(breakpoints.getWatchedRanges().size() == 1);
+    REQUIRE(breakpoints.getWatchedRanges()[0].min_address == 0x10);
+    REQUIRE(breakpoints.getWatchedRanges()[0].max_address == 0x27);
+    REQUIRE_THROWS(breakpoints.addBreakpoint(MemoryBreakpointData{
+        .address = 0x10, .break_on = ALWAYS, .value = {}, .condition = {}, .end_address = 0xf}));
+
+    // writes of the same value aren't changes, and only logging breakpoints don't stop
+    breakpoints.onWrite(0x12, 5, 5);
+    breakpoints.onRead(0x12, 5);
+    REQUIRE(breakpoints.getHits().size() == 0);
+    breakpoints.onWrite(0x1f, 6, 5);
+    REQUIRE(!stopped);
+    REQUIRE(breakpoints.getHits().size() == 1);
+    REQUIRE(breakpoints.getHits()[0].address == 0x1f);
+    REQUIRE(breakpoints.getHits()[0].old_value == 5);
+    REQUIRE(breakpoints.getHits()[0].new_value == 6);
+    REQUIRE(breakpoints.getHits()[0].write);
+
+    // the value is compared after masking
+    breakpoints.onRead(0x20, 0x7f);
+    REQUIRE(!stopped);
+    breakpoints.onRead(0x27, 0x8f);
+    REQUIRE(stopped);
+    REQUIRE(breakpoints.getHits().size() == 2);
+    REQUIRE(!breakpoints.getHits()[1].write);
+    breakpoints.onRead(0x28, 0x80);
+    REQUIRE(breakpoints.getHits().size() == 2);
+}
+
+TEST_CASE("watchpoint hits record the instruction and the cycle") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    MemoryBreakpoints breakpoints([]() {}, [&emulator](uint16_t address, uint8_t value) {
+        return emulator.getConditionContext(address, value);
+    });
+    // the loop writes to the whole page, LD (HL), A is at 0x10b
+    breakpoints.addBreakpoint(MemoryBreakpointData{
+        .address = 0xc000, .break_on = CHANGE, .value = {}, .condition = {}, .end_address = 0xc0ff, .stop = false});
+    emulator.getBus().addObserver(breakpoints);
+    emulator.reset();
+    emulator.start();
+    emulator.runUntil(gb::g_cycles_per_frame);
+
+    auto &hits = breakpoints.getHits();
+    REQUIRE(hits.size() > 0);
+    for (size_t i = 0; i < hits.size(); ++i) {
+        REQUIRE(hits[i].pc == 0x10b);
+        REQUIRE(hits[i].old_value != hits[i].new_value);
+        REQUIRE(hits[i].cycle <= emulator.getCycleCount());
+        REQUIRE((i == 0 || hits[i - 1].cycle < hits[i].cycle));
+    }
+}
+
+TEST_CASE("observers see every read of a skipped idle loop") {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0xfa, 0x01, 0xc0, // loop: LD A, (0xc001)
+        0xa7,             // AND A
+        0x28, 0xfa,       // JR Z, loop
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+
+    std::array<size_t, 2> reads{};
+    for (bool skipping : {false, true}) {
+        gb::Emulator emulator;
+        REQUIRE(emulator.getCartridge().setROM(rom));
+        AccessRecorder flag({{0xc001, 0xc001}});
+        emulator.getBus().addObserver(flag);
+        emulator.reset();
+        emulator.start();
+        emulator.setIdleLoopSkipping(skipping);
+        for (int i = 0; i < 3; ++i) {
+            emulator.runFrame();
+        }
+        reads[skipping] = flag.read_count;
+
+        // the loop is still skipped once nothing it reads is watched
+        emulator.getBus().removeObserver(flag);
+        emulator.runFrame();
+        REQUIRE((emulator.getIdleLoopStats().skips > 0) == skipping);
+    }
+    REQUIRE(reads[0] > 0);
+    REQUIRE(reads[0] == reads[1]);
+}
@@ -0,0 +1,246 @@
+#include "gb/cpu/decoder.h"
+#include "gb/cpu/micro_program.h"
+#include "gb/cpu/operation.h"
+#include "gb/emulator.h"
+
+#include "catch2/catch_message.hpp"
+#include "catch2/catch_test_macros.hpp"
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <random>
+#include <vector>
+
+// M-cycles of unprefixed opcodes with the condition taken, 0 for illegal opcodes and the prefix
+constexpr std::array<uint8_t, 256> g_opcode_cycles = {
+    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1, // 0x00
+    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1, // 0x10
+    3, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1, // 0x20
+    3, 3, 2, 2, 3, 3, 3, 1, 3, 2, 2, 2, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x60
+    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xB0
+    5, 3, 4, 4, 6, 4, 2, 4, 5, 4, 4, 0, 6, 6, 2, 4, // 0xC0
+    5, 3, 4, 0, 6, 4, 2, 4, 5, 4, 4, 0, 6, 0, 2, 4, // 0xD0
+    3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4, // 0xE0
+    3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4, // 0xF0
+};
+
+TEST_CASE("micro-op programs take as many M-cycles as documented") {
+    using namespace gb::cpu;
+    // the opcode is fetched in the last cycle of the previous instruction
+    auto getCycles = [](const MicroProgram &program, const MicroSequence &execute) {
+        return 1 + program.operands.size + execute.size - 1;
+    };
+
+    for (uint16_t code = 0; code < 0x100; ++code) {
+        if (g_opcode_cycles[code] == 0) {
+            continue;
+        }
+        const MicroProgram &program = getMicroProgram(code);
+        INFO("opcode " << code);
+        REQUIRE(getCycles(program, program.execute) == g_opcode_cycles[code]);
+
+        std::optional<Conditions> condition = decodeUnprefixed(uint8_t(code)).condition;
+        if (!condition) {
+            REQUIRE(program.not_taken.size == program.execute.size);
+        } else if (code < 0x40) { // JR
+            REQUIRE(getCycles(program, program.not_taken) == 2);
+        } else if ((code & 0x07) == 0) { // RET
+            REQUIRE(getCycles(program, program.not_taken) == 2);
+        } else { // JP, CALL
+            REQUIRE(getCycles(program, program.not_taken) == 3);
+        }
+    }
+
+    // the prefix and the prefixed opcode are fetched in separate cycles
+    REQUIRE(getMicroProgram(0xcb).operands.size == 1);
+    for (uint16_t code = 0; code < 0x100; ++code) {
+        uint8_t cycles = (code & 0x07) != 6 ? 2 : ((code & 0xc0) == 0x40 ? 3 : 4);
+        INFO("prefixed opcode " << code);
+        REQUIRE(1 + getCycles(getMicroProgram(g_prefixed_programs + code),
+                              getMicroProgram(g_prefixed_programs + code).execute) == cycles);
+    }
+
+    // 5 cycles, the interrupt vector is fetched in the last one
+    REQUIRE(getMicroProgram(g_interrupt_program).execute.size == 5);
+}
+
+// Random code covering every shape of bus access: (HL), (rr), (nn) and IO operands, read-modify-write CB
+// instructions, the stack, taken and not taken conditional branches, calls, returns, RST, JP HL, interrupts and
+// HALT. HL, BC and DE only point into WRAM when they are used as addresses
+static std::vector<uint8_t> makeRandomROM(uint32_t seed) {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> setup = {
+        0x31, 0xf0, 0xdf, // LD SP, 0xdff0
+        0x3e, 0x05,       // LD A, 0x05
+        0xe0, 0x07,       // LDH (TAC), A
+        0x3e, 0x04,       // LD A, 0x04
+        0xe0, 0xff,       // LDH (IE), A
+        0xfb,             // EI
+        0xc3, 0x50, 0x01, // JP 0x150
+    };
+    std::copy(setup.begin(), setup.end(), rom.begin() + 0x100);
+    // RST vectors return, interrupt vectors return with RETI
+    for (uint16_t vector = 0; vector < 0x40; vector += 8) {
+        rom[vector] = 0xc9;
+    }
+    for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) {
+        rom[vector] = 0xd9;
+    }
+    // subroutines: RET NZ, RET, RET Z, RET, RET NC, RET, RETI
+    constexpr uint16_t g_subroutines = 0x7f80;
+    const std::vector<uint8_t> subroutines = {0xc0, 0xc9, 0xc8, 0xc9, 0xd0, 0xc9, 0xd9};
+    std::copy(subroutines.begin(), subroutines.end(), rom.begin() + g_subroutines);
+
+    std::mt19937 random(seed);
+    auto pick = [&random](uint32_t count) { return uint8_t(random() % count); };
+    // B, C, D, E, H, L or A, (HL) is left out
+    auto reg = [&pick]() {
+        uint8_t index = pick(7);
+        return uint8_t(index == 6 ? 7 : index);
+    };
+    // after the header
+    size_t pc = 0x150;
+    auto emit = [&rom, &pc](std::initializer_list<uint8_t> bytes) {
+        for (uint8_t byte : bytes) {
+            rom[pc++] = byte;
+        }
+    };
+    auto emitWord = [&emit](uint16_t word) { emit({uint8_t(word), uint8_t(word >> 8)}); };
+    auto emitWRAMAddress = [&emitWord, &random]() { emitWord(uint16_t(0xc000 + random() % 0x1000)); };
+    auto setHL = [&]() {
+        emit({0x21});
+        emitWRAMAddress();
+    };
+
+    while (pc < g_subroutines - 0x80) {
+        switch (pick(20)) {
+        // ALU A, r / ALU A, (HL) / ALU A, n
+        case 0: emit({uint8_t(0x80 | (pick(8) << 3) | reg())}); break;
+        case 1: setHL(); emit({uint8_t(0x86 | (pick(8) << 3))}); break;
+        case 2: emit({uint8_t(0xc6 | (pick(8) << 3)), pick(256)}); break;
+        // INC/DEC (HL), LD r, (HL), LD (HL), r, LD (HL), n
+        case 3: setHL(); emit({pick(2) == 0 ? uint8_t(0x34) : uint8_t(0x35)}); break;
+        case 4:
+            setHL();
+            emit({pick(2) == 0 ? uint8_t(0x46 | (reg() << 3)) : uint8_t(0x70 | reg())});
+            break;
+        case 5: setHL(); emit({0x36, pick(256)}); break;
+        // LD BC/DE, nn followed by LD (rr), A or LD A, (rr)
+        case 6: {
+            uint8_t pair = pick(2) << 4;
+            emit({uint8_t(0x01 | pair)});
+            emitWRAMAddress();
+            emit({uint8_t((pick(2) == 0 ? 0x02 : 0x0a) | pair)});
+            break;
+        }
+        // LD (HL+), A, LD (HL-), A, LD A, (HL+), LD A, (HL-)
+        case 7: setHL(); emit({uint8_t(0x22 + 8 * pick(4))}); break;
+        // LD (nn), A, LD A, (nn), LD (nn), SP
+        case 8: emit({std::array<uint8_t, 3>{0xea, 0xfa, 0x08}[pick(3)]}); emitWRAMAddress(); break;
+        // LDH A, (DIV/TIMA/TMA/IF/STAT/LY), LDH (n), A into HRAM, LD (C), A / LD A, (C)
+        case 9: emit({0xf0, std::array<uint8_t, 6>{0x04, 0x05, 0x06, 0x0f, 0x41, 0x44}[pick(6)]}); break;
+        case 10: emit({0xe0, uint8_t(0x80 + pick(0x70))}); break;
+        case 11: emit({0x0e, uint8_t(0x80 + pick(0x70)), pick(2) == 0 ? uint8_t(0xe2) : uint8_t(0xf2)}); break;
+        // LD HL, SP+e, ADD SP, e and back, ADD HL, rr
+        case 12: emit({0xf8, pick(256)}); break;
+        case 13: {
+            auto offset = int8_t(pick(255) - 127);
+            emit({0xe8, uint8_t(offset), 0xe8, uint8_t(-offset)});
+            break;
+        }
+        case 14: emit({uint8_t(0x09 | (pick(4) << 4))}); break;
+        // PUSH rr, POP rr
+        case 15: emit({uint8_t(0xc5 | (pick(4) << 4)), uint8_t(0xc1 | (pick(4) << 4))}); break;
+        // JR, JP, JP HL, CALL and RST, each to the next instruction or returning to it
+        case 16:
+            switch (pick(5)) {
+            case 0: emit({uint8_t(0x18 + 8 * pick(5)), 0x00}); break;
+            case 1:
+                emit({pick(2) == 0 ? uint8_t(0xc3) : uint8_t(0xc2 + 8 * pick(4))});
+                emitWord(uint16_t(pc + 2));
+                break;
+            case 2: emit({0x21}); emitWord(uint16_t(pc + 3)); emit({0xe9}); break;
+            case 3:
+                emit({pick(2) == 0 ? uint8_t(0xcd) : uint8_t(0xc4 + 8 * pick(4))});
+                emitWord(uint16_t(g_subroutines + 2 * pick(4)));
+                break;
+            case 4: emit({uint8_t(0xc7 + 8 * pick(8))}); break;
+            }
+            break;
+        // CB r, CB (HL)
+        case 17: emit({0xcb, uint8_t((random() & 0xf8) | reg())}); break;
+        case 18: setHL(); emit({0xcb, uint8_t((random() & 0xf8) | 6)}); break;
+        // DAA, CPL, SCF, CCF, rotates of A, DI, EI or EI, HALT, NOP
+        case 19:
+            if (pick(8) == 0) {
+                emit({0xfb, 0x76, 0x00});
+            } else {
+                emit({std::array<uint8_t, 10>{0x27, 0x2f, 0x37, 0x3f, 0x17, 0x1f, 0x07, 0x0f, 0xf3, 0xfb}[pick(10)]});
+            }
+            break;
+        }
+    }
+    // JR -2
+    emit({0x18, 0xfe});
+    return rom;
+}
+
+// Hashes every bus access with the M-cycle it happened in
+class BusTrace : public gb::IMemoryObserver {
+  public:
+    explicit BusTrace(const uint64_t &cycle) : cycle_(cycle) {}
+
+    void onRead(uint16_t address, uint8_t data) noexcept override { add(address, data, false); }
+    void onWrite(uint16_t address, uint8_t data, uint8_t old_data) noexcept override { add(address, data, true); }
+    std::span<const gb::MemoryObjectInfo> getWatchedRanges() const noexcept override { return ranges_; }
+
+    uint64_t getHash() const { return hash_; }
+    uint64_t getAccessCount() const { return count_; }
+
+  private:
+    void add(uint16_t address, uint8_t data, bool write) {
+        for (uint64_t value : {cycle_, uint64_t(address) | (uint64_t(data) << 16) | (uint64_t(write) << 24)}) {
+            hash_ = (hash_ ^ value) * 0x100000001b3;
+        }
+        ++count_;
+    }
+
+    const uint64_t &cycle_;
+    std::array<gb::MemoryObjectInfo, 1> ranges_ = {gb::MemoryObjectInfo{.min_address = 0, .max_address = 0xffff}};
+    uint64_t hash_ = 0xcbf29ce484222325;
+    uint64_t count_ = 0;
+};
+
+TEST_CASE("micro-op programs access the bus in the same M-cycles as the memory operation queue") {
+    // Recorded with the Queue<MemoryOp, 8> implementation the programs replaced. The ROMs take longer than
+    // g_cycles to run through, so every cycle is spent in random code
+    constexpr uint64_t g_cycles = 80000;
+    constexpr std::array<uint64_t, 4> g_expected = {0x961712d5b1f3a8a7, 0x09ea8667cb3a3fb9, 0x36af5778aa6c07f7,
+                                                    0xd61eff55a8f79bb6};
+    for (uint32_t seed = 1; seed <= g_expected.size(); ++seed) {
+        INFO("seed " << seed);
+        gb::Emulator emulator;
+        REQUIRE(emulator.getCartridge().setROM(makeRandomROM(seed)));
+        emulator.reset();
+        emulator.start();
+
+        uint64_t cycle = 0;
+        BusTrace trace(cycle);
+        emulator.getBus().addObserver(trace);
+        for (; cycle < g_cycles; ++cycle) {
+            emulator.tick();
+        }
+        emulator.getBus().removeObserver(trace);
+        REQUIRE(trace.getAccessCount() > g_cycles / 3);
+        REQUIRE(trace.getHash() == g_expected[seed - 1]);
+    }
+}
@@ -0,0 +1,131 @@
+#include "gb/emulator.h"
+#include "gb/movie.h"
+#include "test_rom.h"
+
+#include "catch2/catch_test_macros.hpp"
+#include "catch2/generators/catch_generators.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// runs of equal inputs of different lengths
+uint8_t inputForFrame(size_t frame) { return uint8_t((frame / 7) * 0x11); }
+
+TEST_CASE("movie playback reproduces recorded session") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    emulator.reset();
+    emulator.start();
+    // run for a while, so recording from reset actually resets state
+    for (size_t i = 0; i < 10; ++i) {
+        emulator.getInput().setState(0xff);
+        emulator.runFrame();
+    }
+
+    auto start = GENERATE(gb::MovieStart::RESET, gb::MovieStart::STATE);
+    gb::MovieRecorder recorder(emulator, start);
+    for (size_t i = 0; i < 200; ++i) {
+        recorder.addFrame(inputForFrame(i));
+        emulator.getInput().setState(inputForFrame(i));
+        emulator.runFrame();
+    }
+    REQUIRE(recorder.getFrameCount() == 200);
+    std::vector<uint8_t> movie = recorder.finish();
+    std::vector<uint8_t> expected;
+    emulator.saveState(expected);
+
+    gb::Emulator playback;
+    REQUIRE(playback.getCartridge().setROM(makeTestROM()));
+    if (start == gb::MovieStart::RESET) {
+        // 200 frames in runs of 7 frames, each run is 3 bytes
+        REQUIRE(movie.size() < 128);
+    }
+    REQUIRE(gb::playMovie(playback, movie) == 200);
+
+    std::vector<uint8_t> actual;
+    playback.saveState(actual);
+    REQUIRE(actual == expected);
+}
+
+TEST_CASE("invalid movies are rejected") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    gb::MovieRecorder recorder(emulator, gb::MovieStart::RESET);
+    recorder.addFrame(0);
+    std::vector<uint8_t> movie = recorder.finish();
+
+    // records are validated lazily, so truncation is only detected during playback
+    std::vector<uint8_t> truncated(movie.begin(), movie.end() - 1);
+    REQUIRE_THROWS(gb::playMovie(emulator, truncated));
+    std::vector<uint8_t> header(movie.begin(), movie.begin() + 10);
+    REQUIRE_THROWS(gb::MoviePlayer(header));
+
+    std::vector<uint8_t> other_rom = makeTestROM();
+    other_rom[0x200] = 1;
+    gb::Emulator other;
+    REQUIRE(other.getCartridge().setROM(other_rom));
+    REQUIRE_THROWS(gb::playMovie(other, movie));
+}
+
+TEST_CASE("movie seeking uses keyframes") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    constexpr uint64_t interval = 32;
+    gb::MovieRecorder recorder(emulator, gb::MovieStart::RESET, interval);
+    std::vector<std::vector<uint8_t>> states;
+    for (size_t i = 0; i < 200; ++i) {
+        emulator.saveState(states.emplace_back());
+        recorder.addFrame(inputForFrame(i));
+        emulator.getInput().setState(inputForFrame(i));
+        emulator.runFrame();
+    }
+    emulator.saveState(states.emplace_back());
+    std::vector<uint8_t> movie = recorder.finish();
+
+    gb::Emulator playback;
+    REQUIRE(playback.getCartridge().setROM(makeTestROM()));
+    gb::MoviePlayer player(movie);
+    player.start(playback);
+    std::vector<uint8_t> state;
+    auto check = [&](uint64_t frame) {
+        player.seek(playback, frame);
+        REQUIRE(player.getCurrentFrame() == frame);
+        playback.saveState(state);
+        REQUIRE(state == states[frame]);
+    };
+
+    // nothing is indexed yet, seeking scans records up to the target
+    check(150);
+    REQUIRE(player.getKeyframes().size() == 4);
+    REQUIRE_FALSE(player.isIndexComplete());
+    check(64);
+    check(20);
+    check(200);
+    REQUIRE(player.isIndexComplete());
+    REQUIRE(player.getKeyframes().size() == 6);
+
+    // playing after seeking continues from the target
+    check(100);
+    std::optional<uint8_t> input = player.nextFrame();
+    REQUIRE(input == inputForFrame(100));
+    playback.getInput().setState(*input);
+    playback.runFrame();
+    playback.saveState(state);
+    REQUIRE(state == states[101]);
+
+    std::optional<std::vector<uint8_t>> index = player.saveIndex();
+    REQUIRE(index);
+    gb::MoviePlayer indexed(movie);
+    REQUIRE(indexed.loadIndex(*index));
+    REQUIRE(indexed.isIndexComplete());
+    REQUIRE(indexed.getKeyframes().size() == 6);
+
+    // an index for a different movie is rejected
+    std::vector<uint8_t> other = movie;
+    other[other.size() - 2] ^= 1;
+    gb::MoviePlayer other_player(other);
+    REQUIRE_FALSE(other_player.loadIndex(*index));
+    REQUIRE_FALSE(other_player.isIndexComplete());
+}
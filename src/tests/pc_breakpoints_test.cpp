@@ -0,0 +1,73 @@
+#include "gb/emulator.h"
+#include "gb/pc_breakpoints.h"
+#include "test_rom.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// the loop of makeTestROM() starts at 0x107 and takes 11 M-cycles
+constexpr uint16_t g_loop_add = 0x109;
+constexpr uint64_t g_loop_cycles = 11 * gb::g_cycles_per_tick;
+
+TEST_CASE("PC breakpoints stop the run loop") {
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    gb::PCBreakpoints breakpoints;
+    emulator.setPCBreakpoints(breakpoints);
+    emulator.reset();
+    emulator.start();
+
+    // the ROM has no MBC, bank 1 is never mapped at 0x0000-0x3fff
+    breakpoints.add(gb::PCBreakpoint{.address = g_loop_add, .bank = 1});
+    REQUIRE(emulator.runUntil(gb::g_cycles_per_frame) == gb::StopReason::FINISHED);
+
+    uint64_t frame_end = emulator.getCycleCount() + gb::g_cycles_per_frame;
+    breakpoints.add(gb::PCBreakpoint{.address = g_loop_add, .bank = 0});
+    REQUIRE(emulator.runUntil(frame_end) == gb::StopReason::BREAKPOINT);
+    REQUIRE(emulator.atBreakpoint());
+    REQUIRE(emulator.getCPU().getInstructionAddress() == g_loop_add);
+    // the instruction at the breakpoint is executed by the next call
+    uint64_t hit = emulator.getCycleCount();
+    REQUIRE(emulator.runUntil(frame_end) == gb::StopReason::BREAKPOINT);
+    REQUIRE(emulator.getCycleCount() - hit == g_loop_cycles);
+
+    breakpoints.remove(gb::PCBreakpoint{.address = g_loop_add, .bank = 0});
+    REQUIRE(emulator.runUntil(frame_end) == gb::StopReason::FINISHED);
+    breakpoints.add(gb::PCBreakpoint{.address = g_loop_add});
+    REQUIRE(emulator.runUntil(emulator.getCycleCount() + gb::g_cycles_per_frame) == gb::StopReason::BREAKPOINT);
+
+    emulator.removePCBreakpoints();
+    REQUIRE(!emulator.atBreakpoint());
+    emulator.stop();
+    REQUIRE(emulator.runFrame() == gb::StopReason::STOPPED);
+}
+
+TEST_CASE("frames interrupted by breakpoints match uninterrupted ones") {
+    gb::Emulator reference;
+    gb::Emulator stopping;
+    REQUIRE(reference.getCartridge().setROM(makeTestROM()));
+    REQUIRE(stopping.getCartridge().setROM(makeTestROM()));
+    gb::PCBreakpoints breakpoints;
+    breakpoints.add(gb::PCBreakpoint{.address = g_loop_add});
+    stopping.setPCBreakpoints(breakpoints);
+    reference.reset();
+    stopping.reset();
+    reference.start();
+    stopping.start();
+
+    std::vector<uint8_t> reference_state;
+    std::vector<uint8_t> stopping_state;
+    uint64_t hits = 0;
+    for (int frame = 0; frame < 5; ++frame) {
+        REQUIRE(reference.runFrame() == gb::StopReason::FINISHED);
+        while (stopping.runFrame() == gb::StopReason::BREAKPOINT) {
+            ++hits;
+        }
+        reference.saveState(reference_state);
+        stopping.saveState(stopping_state);
+        REQUIRE(reference_state == stopping_state);
+    }
+    REQUIRE(hits > 0);
+}
@@ -0,0 +1,160 @@
+#include "gb/emulator.h"
+#include "rewind.h"
+#include "test_rom.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+void initEmulator(gb::Emulator &emulator) {
+    REQUIRE(emulator.getCartridge().setROM(makeTestROM()));
+    emulator.reset();
+    emulator.start();
+}
+
+TEST_CASE("save state round trip") {
+    gb::Emulator emulator;
+    initEmulator(emulator);
+    for (int i = 0; i < 10; ++i) {
+        emulator.runFrame();
+    }
+
+    std::vector<uint8_t> saved;
+    emulator.saveState(saved);
+    for (int i = 0; i < 5; ++i) {
+        emulator.getInput().setState(uint8_t(i * 3));
+        emulator.runFrame();
+    }
+    std::vector<uint8_t> expected;
+    emulator.saveState(expected);
+
+    emulator.loadState(saved);
+    for (int i = 0; i < 5; ++i) {
+        emulator.getInput().setState(uint8_t(i * 3));
+        emulator.runFrame();
+    }
+    std::vector<uint8_t> actual;
+    emulator.saveState(actual);
+    REQUIRE(actual == expected);
+
+    // saving into the same buffer again reuses its storage
+    const uint8_t *storage = actual.data();
+    emulator.saveState(actual);
+    REQUIRE(actual.data() == storage);
+
+    // a rejected state leaves the emulator as it was
+    saved.pop_back();
+    REQUIRE_THROWS(emulator.loadState(saved));
+    saved.resize(saved.size() + 2);
+    REQUIRE_THROWS(emulator.loadState(saved));
+    emulator.saveState(actual);
+    REQUIRE(actual == expected);
+
+    // so is a state made with a different ROM of the same size
+    gb::Emulator other;
+    std::vector<uint8_t> other_rom = makeTestROM();
+    other_rom.back() = 0xff;
+    REQUIRE(other.getCartridge().setROM(other_rom));
+    other.reset();
+    other.saveState(saved);
+    REQUIRE_THROWS(emulator.loadState(saved));
+    emulator.saveState(actual);
+    REQUIRE(actual == expected);
+}
+
+TEST_CASE("rejected save states leave the emulator unchanged") {
+    gb::Emulator emulator;
+    initEmulator(emulator);
+    emulator.runFrame();
+    std::vector<uint8_t> saved;
+    emulator.saveState(saved);
+    emulator.runFrame();
+    std::vector<uint8_t> expected;
+    emulator.saveState(expected);
+
+    // the CPU state is saved last and some of its values are rejected
+    size_t rejected = 0;
+    std::vector<uint8_t> actual;
+    for (size_t i = saved.size() - 256; i < saved.size(); ++i) {
+        std::vector<uint8_t> corrupted = saved;
+        corrupted[i] = 0xff;
+        try {
+            emulator.loadState(corrupted);
+            emulator.loadState(expected);
+        } catch (const std::exception &) {
+            ++rejected;
+            emulator.saveState(actual);
+            REQUIRE(actual == expected);
+        }
+    }
+    REQUIRE(rejected > 0);
+}
+
+TEST_CASE("rewind restores previous frames") {
+    gb::Emulator emulator;
+    initEmulator(emulator);
+    emulator::RewindBuffer rewind(1024 * 1024, 4);
+
+    std::vector<std::vector<uint8_t>> frames;
+    auto advance = [&](size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            emulator.getInput().setState(uint8_t(frames.size() * 7));
+            emulator.runFrame();
+            rewind.onFrame(emulator);
+            emulator.saveState(frames.emplace_back());
+        }
+    };
+    auto check = [&](uint32_t count) {
+        REQUIRE(rewind.rewind(emulator, count));
+        frames.resize(frames.size() - count);
+        std::vector<uint8_t> state;
+        emulator.saveState(state);
+        REQUIRE(state == frames.back());
+    };
+
+    advance(30);
+    // within the frames after the newest snapshot
+    check(1);
+    // exactly at a snapshot
+    check(1);
+    // across several snapshots
+    check(9);
+    advance(5);
+    check(6);
+    check(3);
+
+    std::vector<uint8_t> state;
+    while (rewind.rewind(emulator, 1)) {
+        frames.pop_back();
+        emulator.saveState(state);
+        REQUIRE(state == frames.back());
+    }
+    REQUIRE(frames.size() == 1);
+}
+
+TEST_CASE("rewind buffer stays within memory budget") {
+    gb::Emulator emulator;
+    initEmulator(emulator);
+    constexpr size_t budget = 16 * 1024;
+    emulator::RewindBuffer rewind(budget, 1);
+
+    for (int i = 0; i < 600; ++i) {
+        emulator.getInput().setState(uint8_t(i));
+        emulator.runFrame();
+        rewind.onFrame(emulator);
+        REQUIRE(rewind.getStats(emulator).used_bytes <= budget);
+    }
+
+    emulator::RewindStats stats = rewind.getStats(emulator);
+    REQUIRE(stats.snapshots > 1);
+    REQUIRE(stats.snapshots < 600);
+
+    size_t rewound = 0;
+    while (rewind.rewind(emulator, 1)) {
+        ++rewound;
+    }
+    REQUIRE(rewound == stats.snapshots - 1);
+}
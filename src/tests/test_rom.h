@@ -0,0 +1,26 @@
+#ifndef GB_EMULATOR_SRC_TESTS_TEST_ROM_HDR_
+#define GB_EMULATOR_SRC_TESTS_TEST_ROM_HDR_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Reads the joypad and fills WRAM with values derived from it, so both memory and input matter
+inline std::vector<uint8_t> makeTestROM() {
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0x3e, 0x30,       // LD A, 0x30
+        0xe0, 0x00,       // LDH (0x00), A
+        0x21, 0x00, 0xc0, // LD HL, 0xc000
+        0xf0, 0x00,       // LDH A, (0x00)
+        0x80,             // ADD A, B
+        0x04,             // INC B
+        0x77,             // LD (HL), A
+        0x2c,             // INC L
+        0x18, 0xf8,       // JR -8
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    return rom;
+}
+
+#endif
@@ -129,3 +129,42 @@ TEST_CASE("incrementing in emulator") {
 
     REQUIRE(emulator.getTimer().read(uint16_t(gb::IO::DIV)) == 1);
 }
+
+TEST_CASE("skipping matches updating after TAC and DIV writes") {
+    // the selected counter bit is high when TAC or DIV is written, so the next update sees a falling edge
+    auto prepare = [](gb::Timer &timer, uint8_t TAC, uint8_t DIV_or_TAC) {
+        timer.write(uint16_t(gb::IO::DIV), 0);
+        timer.write(uint16_t(gb::IO::TAC), 5);
+        timer.write(uint16_t(gb::IO::TIMA), 0xff);
+        for (int i = 0; i < 8; ++i) {
+            timer.update();
+        }
+        if (DIV_or_TAC == 0) {
+            timer.write(uint16_t(gb::IO::DIV), 0);
+        } else {
+            timer.write(uint16_t(gb::IO::TAC), TAC);
+        }
+    };
+
+    for (uint8_t TAC : {0, 1, 4, 6, 7}) {
+        for (uint8_t write : {0, 1}) {
+            for (uint64_t cycles = 1; cycles <= 64; ++cycles) {
+                gb::InterruptRegister updated_flags;
+                gb::Timer updated(updated_flags);
+                prepare(updated, TAC, write);
+                gb::InterruptRegister skipped_flags;
+                gb::Timer skipped(skipped_flags);
+                prepare(skipped, TAC, write);
+                REQUIRE(skipped.cyclesUntilInterrupt() == 0);
+
+                for (uint64_t i = 0; i < cycles; ++i) {
+                    updated.update();
+                }
+                skipped.skip(cycles);
+                REQUIRE(skipped.read(uint16_t(gb::IO::TIMA)) == updated.read(uint16_t(gb::IO::TIMA)));
+                REQUIRE(skipped.read(uint16_t(gb::IO::DIV)) == updated.read(uint16_t(gb::IO::DIV)));
+                REQUIRE(skipped_flags.getFlags() == updated_flags.getFlags());
+            }
+        }
+    }
+}
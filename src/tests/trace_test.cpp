@@ -0,0 +1,67 @@
+#include "gb/cpu/operation.h"
+#include "gb/cpu/trace.h"
+#include "gb/emulator.h"
+
+#include "catch2/catch_test_macros.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace gb::cpu;
+
+TEST_CASE("trace records disassemble to executed instructions") {
+    if constexpr (!g_trace_enabled) {
+        return;
+    }
+    std::vector<uint8_t> rom(32 * 1024, 0);
+    const std::vector<uint8_t> code = {
+        0x3e, 0x12,       // LD A, 0x12
+        0xcb, 0x37,       // SWAP A
+        0xea, 0x00, 0xc0, // LD (0xc000), A
+        0xc3, 0x00, 0x01, // JP 0x0100
+    };
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    gb::Emulator emulator;
+    REQUIRE(emulator.getCartridge().setROM(rom));
+    emulator.reset();
+    emulator.start();
+    // LD A, 0x12 is already fetched
+    emulator.getCPU().setTraceEnabled(true);
+
+    std::vector<TraceRecord> records;
+    while (records.size() < 4) {
+        emulator.tick();
+        if (emulator.getCPU().isFinished()) {
+            records.push_back(emulator.getCPU().getLastTrace());
+        }
+    }
+
+    REQUIRE(records[0].pc == 0x100);
+    REQUIRE(records[0].bank == 0);
+    REQUIRE(records[0].width() == 2);
+    REQUIRE(records[0].af == 0x01b0);
+    Instruction load = disassemble(records[0]);
+    REQUIRE(load.type == InstructionType::LD);
+    REQUIRE(load.dst.get<Registers>() == Registers::A);
+    REQUIRE(load.src.get<uint8_t>() == 0x12);
+
+    REQUIRE(records[1].pc == 0x102);
+    REQUIRE(records[1].width() == 2);
+    REQUIRE(records[1].af == 0x12b0);
+    Instruction swap = disassemble(records[1]);
+    REQUIRE(swap.type == InstructionType::SWAP);
+    REQUIRE(swap.arg().get<Registers>() == Registers::A);
+
+    REQUIRE(records[2].pc == 0x104);
+    REQUIRE(records[2].width() == 3);
+    REQUIRE(records[2].af == 0x2100);
+    Instruction store = disassemble(records[2]);
+    REQUIRE(store.dst.get<uint16_t>() == 0xc000);
+    REQUIRE(store.src.get<Registers>() == Registers::A);
+
+    Instruction jump = disassemble(records[3]);
+    REQUIRE(jump.type == InstructionType::JP);
+    REQUIRE(jump.arg().get<uint16_t>() == 0x100);
+    REQUIRE(jump.address == 0x107);
+}
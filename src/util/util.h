@@ -7,6 +7,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -29,6 +30,36 @@ inline std::vector<uint8_t> readFile(const std::filesystem::path &path) {
     return contents;
 }
 
+inline bool writeFile(const std::filesystem::path &path, const std::vector<uint8_t> &contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(contents.data()), std::streamsize(contents.size()));
+    return file.good();
+}
+
+// LEB128-style variable length integers: 7 bits per byte, the high bit is set if more bytes follow
+inline void putVarint(std::vector<uint8_t> &out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+inline std::optional<size_t> getVarint(const uint8_t *data, size_t size, size_t &offset) {
+    size_t value = 0;
+    for (size_t shift = 0; offset < size && shift < std::numeric_limits<size_t>::digits; shift += 7) {
+        uint8_t byte = data[offset++];
+        value |= size_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    return {};
+}
+
 template <typename T, typename std::enable_if<std::is_integral<T>{}, bool>::type = true>
 inline void toHexOutput(std::stringstream &stream, T value) {
     stream << "0x" << std::setfill('0') << std::setw(sizeof(T) * 2) << std::hex << +value;
@@ -138,56 +169,6 @@ class RingBuffer {
     bool full_ = false;
 };
 
-template <typename T, size_t CAPACITY>
-class Queue {
-  public:
-    static_assert(CAPACITY >= 0, "capacity must be non-zero");
-    static_assert(std::is_trivially_destructible<T>::value, "T must be trivially destructible");
-
-    Queue() = default;
-
-    bool empty() const { return size_ == 0; }
-    size_t size() const { return size_; }
-
-    void clear() {
-        begin_ = 0;
-        end_ = 0;
-        size_ = 0;
-    }
-
-    T front() const {
-        if (empty()) {
-            throw std::runtime_error("attempting to pop_front from empty queue");
-        }
-        return data_[begin_];
-    }
-
-    T pop_front() {
-        if (empty()) {
-            throw std::runtime_error("attempting to pop_front from empty queue");
-        }
-        T elem = data_[begin_];
-        begin_ = (begin_ + 1) % CAPACITY;
-        --size_;
-        return elem;
-    }
-
-    void push_back(T elem) {
-        if (size_ == CAPACITY) {
-            throw std::runtime_error("attempting to push_back to full queue");
-        }
-        data_[end_] = elem;
-        end_ = (end_ + 1) % CAPACITY;
-        ++size_;
-    }
-
-  private:
-    T data_[CAPACITY];
-    size_t begin_ = 0;
-    size_t end_ = 0;
-    size_t size_ = 0;
-};
-
 constexpr inline uint8_t setBit(uint8_t bit) { return uint8_t(1) << bit; }
 
 class StringBuffer {
@@ -0,0 +1,80 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emulator {
+
+    WorkStealingPool::WorkStealingPool(size_t threads) {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        queues_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+    }
+
+    void WorkStealingPool::run(size_t count, const std::function<void(size_t worker, size_t index)> &task) {
+        stolen_ = 0;
+        // consecutive tasks go to different workers, so similar neighbouring tasks (e.g. the same ROM)
+        // are spread evenly
+        for (size_t i = 0; i < count; ++i) {
+            queues_[i % queues_.size()]->tasks.push_front(i);
+        }
+
+        size_t threads = std::min(queues_.size(), count);
+        if (threads <= 1) {
+            work(0, task);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i, &task]() { work(i, task); });
+        }
+        work(0, task);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    void WorkStealingPool::work(size_t worker, const std::function<void(size_t worker, size_t index)> &task) {
+        size_t index = 0;
+        while (pop(worker, index) || steal(worker, index)) {
+            task(worker, index);
+        }
+    }
+
+    bool WorkStealingPool::pop(size_t worker, size_t &index) {
+        Queue &queue = *queues_[worker];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        index = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool WorkStealingPool::steal(size_t worker, size_t &index) {
+        // no tasks are added during run(), so once every deque was seen empty the worker is done
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            Queue &victim = *queues_[(worker + i) % queues_.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                index = victim.tasks.front();
+                victim.tasks.pop_front();
+                ++stolen_;
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace emulator
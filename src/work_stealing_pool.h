@@ -0,0 +1,50 @@
+#ifndef GB_EMULATOR_SRC_WORK_STEALING_POOL_HDR_
+#define GB_EMULATOR_SRC_WORK_STEALING_POOL_HDR_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace emulator {
+
+    // Runs a batch of independent tasks on a fixed number of threads.
+    //
+    // Tasks are dealt out to per-worker deques up front. A worker takes tasks from the back of its own deque and,
+    // once it is empty, steals from the front of the others, so a few long tasks don't leave the other threads idle.
+    // Tasks are expected to be coarse (whole emulation runs), so deques are guarded by plain mutexes.
+    class WorkStealingPool {
+      public:
+        // 0 means one thread per hardware thread
+        explicit WorkStealingPool(size_t threads = 0);
+
+        size_t getThreadCount() const { return queues_.size(); }
+
+        // Calls task(worker, index) for every index in [0, count) and blocks until all calls return.
+        // worker is in [0, getThreadCount()), calls with the same worker never run concurrently, so it can be
+        // used to index per-thread state. task must not throw
+        void run(size_t count, const std::function<void(size_t worker, size_t index)> &task);
+
+        // number of tasks taken from another worker's deque during the last run()
+        uint64_t getStolenCount() const { return stolen_; }
+
+      private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        void work(size_t worker, const std::function<void(size_t worker, size_t index)> &task);
+        bool pop(size_t worker, size_t &index);
+        bool steal(size_t worker, size_t &index);
+
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::atomic<uint64_t> stolen_ = 0;
+    };
+} // namespace emulator
+
+#endif